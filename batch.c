@@ -0,0 +1,112 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <assert.h> /* for assert */
+
+/* \brief state shared by every model of mmd_load_batch */
+typedef struct mmd_batch {
+   mmd_string_pool *pool;
+   unsigned int flags;
+
+   /* completed models are handed out one at a time */
+   mmd_batch_fn callback;
+   void *user;
+   mmd_mutex *lock;
+} mmd_batch;
+
+/* \brief single model of batch */
+typedef struct mmd_batch_task {
+   mmd_batch *batch;
+   mmd_batch_item *item;
+   unsigned int index;
+} mmd_batch_task;
+
+/* \brief load model of task and report it */
+static void mmd_batch_task_run(void *arg)
+{
+   mmd_batch_task *task = arg;
+   mmd_batch *batch = task->batch;
+   mmd_batch_item *item = task->item;
+   mmd_data *mmd = NULL;
+
+   if (item->path) {
+      mmd = mmd_new_from_path_mmap(item->path);
+   } else if (item->data) {
+      mmd = mmd_new_from_memory(item->data, item->size);
+   }
+
+   if (mmd) {
+      mmd_set_string_pool(mmd, batch->pool);
+
+      if (mmd_load(mmd, batch->flags) == RETURN_OK) {
+         item->mmd = mmd;
+         item->status = RETURN_OK;
+      } else {
+         mmd_free(mmd);
+      }
+   }
+
+   if (!batch->callback)
+      return;
+
+   mmd_mutex_lock(batch->lock);
+   batch->callback(batch->user, task->index, item);
+   mmd_mutex_unlock(batch->lock);
+}
+
+/* \brief load many models concurrently */
+int mmd_load_batch(mmd_batch_item *items, unsigned int count, unsigned int flags, mmd_string_pool *pool,
+                   mmd_batch_fn callback, void *user, const mmd_executor *executor)
+{
+   mmd_batch_task *tasks = NULL;
+   void **args = NULL;
+   unsigned int i, threads;
+   mmd_batch batch;
+   int ret = RETURN_FAIL;
+   assert(items || !count);
+
+   for (i = 0; i < count; ++i) {
+      items[i].mmd = NULL;
+      items[i].status = RETURN_FAIL;
+   }
+
+   memset(&batch, 0, sizeof(batch));
+   batch.flags = flags;
+   batch.callback = callback;
+   batch.user = user;
+
+   if (!(batch.pool = (pool ? mmd_string_pool_ref(pool) : mmd_string_pool_new())))
+      goto out;
+
+   if (!(tasks = calloc(count + 1, sizeof(mmd_batch_task))) ||
+       !(args = calloc(count + 1, sizeof(void*))))
+      goto out;
+
+   for (i = 0; i < count; ++i) {
+      tasks[i].batch = &batch;
+      tasks[i].item = &items[i];
+      tasks[i].index = i;
+      args[i] = &tasks[i];
+   }
+
+   threads = mmd_cpu_count();
+   if ((executor || threads > 1) && !(batch.lock = mmd_mutex_new()))
+      goto out;
+
+   if (executor) {
+      executor->run(executor->user, mmd_batch_task_run, args, count);
+   } else {
+      mmd_run_tasks(mmd_batch_task_run, args, count, threads);
+   }
+
+   for (i = 0; i < count && items[i].status == RETURN_OK; ++i);
+   ret = (i == count ? RETURN_OK : RETURN_FAIL);
+
+out:
+   if (batch.lock) mmd_mutex_free(batch.lock);
+   if (batch.pool) mmd_string_pool_free(batch.pool);
+   if (tasks) free(tasks);
+   if (args) free(args);
+   return ret;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
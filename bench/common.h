@@ -0,0 +1,102 @@
+#ifndef __mmd_bench_common_h__
+#define __mmd_bench_common_h__
+
+#include "../mmd.h"
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+/* helpers shared by the benchmarks, all of them deterministic
+ * so that runs of one benchmark can be compared */
+
+/* first state of the random sequence */
+#define BENCH_SEED 0x9e3779b9
+
+/* \brief monotonic time in seconds, as mmd_time of internal.h
+ * for benches that only see the public API */
+static inline double bench_now(void)
+{
+#if defined(CLOCK_MONOTONIC)
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+   return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/* \brief state of the benchmark's random sequence, can be reset to repeat it */
+static inline unsigned int* bench_seed(void)
+{
+   static unsigned int seed = BENCH_SEED;
+   return &seed;
+}
+
+/* \brief next 24 bits of the benchmark's random sequence */
+static inline unsigned int bench_rand(void)
+{
+   unsigned int *seed = bench_seed();
+   *seed = *seed * 1664525 + 1013904223;
+   return *seed >> 8;
+}
+
+/* \brief deterministic random float in 0 - 1 */
+static inline float bench_rnd_unit(void)
+{
+   return (float)bench_rand() / (float)(1 << 24);
+}
+
+/* \brief deterministic random float in -1 - 1 */
+static inline float bench_rnd(void)
+{
+   return (float)bench_rand() / (float)(1 << 23) - 1.0f;
+}
+
+/* \brief bumpy grid of size * size vertices, its triangles
+ * in row order split evenly to materials.
+ * returns 0 when allocation fails, the arrays allocated
+ * so far are left in mmd */
+static inline int bench_grid(mmd_data *mmd, unsigned int size, unsigned int materials)
+{
+   const unsigned int quads = (size - 1) * (size - 1);
+   unsigned int x, y, i, m;
+
+   mmd->num_vertices = size * size;
+   mmd->num_indices = quads * 6;
+   mmd->num_materials = materials;
+
+   if (!(mmd->vertices = calloc(mmd->num_vertices * 3, sizeof(float))) ||
+       !(mmd->normals = calloc(mmd->num_vertices * 3, sizeof(float))) ||
+       !(mmd->coords = calloc(mmd->num_vertices * 2, sizeof(float))) ||
+       !(mmd->weights = calloc(mmd->num_vertices, sizeof(mmd_weight))) ||
+       !(mmd->indices = calloc(mmd->num_indices, sizeof(unsigned short))) ||
+       !(mmd->materials = calloc(materials, sizeof(mmd_material))))
+      return 0;
+
+   for (i = 0; i < mmd->num_vertices; ++i) {
+      mmd->vertices[i * 3 + 0] = (float)(i % size);
+      mmd->vertices[i * 3 + 1] = sinf((float)(i % size) * 0.05f) * cosf((float)(i / size) * 0.07f) * 4.0f;
+      mmd->vertices[i * 3 + 2] = (float)(i / size);
+      mmd->weights[i].bone_index[0] = (unsigned short)(i % 7);
+   }
+
+   for (y = 0, i = 0; y < size - 1; ++y) {
+      for (x = 0; x < size - 1; ++x, i += 6) {
+         mmd->indices[i + 0] = (unsigned short)(y * size + x);
+         mmd->indices[i + 1] = (unsigned short)((y + 1) * size + x);
+         mmd->indices[i + 2] = (unsigned short)(y * size + x + 1);
+         mmd->indices[i + 3] = (unsigned short)(y * size + x + 1);
+         mmd->indices[i + 4] = (unsigned short)((y + 1) * size + x);
+         mmd->indices[i + 5] = (unsigned short)((y + 1) * size + x + 1);
+      }
+   }
+
+   for (m = 0; m < materials; ++m)
+      mmd->materials[m].face = (quads * 2 * (m + 1) / materials - quads * 2 * m / materials) * 3;
+
+   return 1;
+}
+
+#endif /* __mmd_bench_common_h__ */
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,256 @@
+#include "../internal.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* microbenchmark for keyframe sampling,
+ * checks every curve kernel supported by this cpu against
+ * double precision reference and then samples a synthetic
+ * dance motion for many characters.
+ *
+ * usage: mmd_curve_bench [characters] [frames] */
+
+enum {
+   CURVES = 4096,
+   BONES = 100,
+   KEYS = 300
+};
+
+static double bezier(double s, double p1, double p2)
+{
+   return 3 * (1 - s) * (1 - s) * s * p1 + 3 * (1 - s) * s * s * p2 + s * s * s;
+}
+
+/* \brief reference bezier: bisection to double precision */
+static double bezier_reference(double x, double x1, double y1, double x2, double y2)
+{
+   double lo = 0, hi = 1, s;
+   int i;
+
+   for (i = 0; i < 60; ++i) {
+      s = (lo + hi) / 2;
+      if (bezier(s, x1, x2) < x) {
+         lo = s;
+      } else {
+         hi = s;
+      }
+   }
+
+   return bezier((lo + hi) / 2, y1, y2);
+}
+
+/* \brief reference slerp with libm */
+static void slerp_reference(const double *a, const double *b, double t, double *out)
+{
+   double d = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3], sign = 1, wa, wb, theta;
+   int c;
+
+   if (d < 0) {
+      d = -d;
+      sign = -1;
+   }
+
+   if (d > 0.9999999) {
+      wa = 1 - t;
+      wb = t;
+   } else {
+      theta = acos(d);
+      wa = sin((1 - t) * theta) / sin(theta);
+      wb = sin(t * theta) / sin(theta);
+   }
+
+   for (c = 0; c < 4; ++c)
+      out[c] = wa * a[c] + wb * sign * b[c];
+}
+
+/* \brief random unit quaternion */
+static void quaternion(float *q, size_t stride)
+{
+   float len = 0;
+   int c;
+
+   for (c = 0; c < 4; ++c) {
+      q[c * stride] = bench_rnd_unit() * 2 - 1;
+      len += q[c * stride] * q[c * stride];
+   }
+
+   for (c = 0, len = 1 / sqrtf(len); c < 4; ++c)
+      q[c * stride] *= len;
+}
+
+/* \brief check kernel precision and speed */
+static int check_kernel(const mmd_curve_kernel *kernel, unsigned int rounds)
+{
+   static float x[CURVES], x1[CURVES], y1[CURVES], x2[CURVES], y2[CURVES], y[CURVES];
+   static float qa[CURVES * 4], qb[CURVES * 4], qo[CURVES * 4];
+   double ref[4], a[4], b[4], err_bezier = 0, err_slerp = 0, start, elapsed_bezier, elapsed_slerp;
+   unsigned int i, c, r;
+
+   *bench_seed() = BENCH_SEED;
+   for (i = 0; i < CURVES; ++i) {
+      x[i] = bench_rnd_unit();
+      x1[i] = (float)(int)(bench_rnd_unit() * 127) / 127;
+      y1[i] = (float)(int)(bench_rnd_unit() * 127) / 127;
+      x2[i] = (float)(int)(bench_rnd_unit() * 127) / 127;
+      y2[i] = (float)(int)(bench_rnd_unit() * 127) / 127;
+      quaternion(&qa[i], CURVES);
+      quaternion(&qb[i], CURVES);
+   }
+
+   kernel->bezier(x, x1, y1, x2, y2, y, CURVES);
+   kernel->slerp(qa, qb, x, qo, CURVES, CURVES);
+
+   for (i = 0; i < CURVES; ++i) {
+      err_bezier = fmax(err_bezier, fabs(y[i] - bezier_reference(x[i], x1[i], y1[i], x2[i], y2[i])));
+
+      for (c = 0; c < 4; ++c) {
+         a[c] = qa[c * CURVES + i];
+         b[c] = qb[c * CURVES + i];
+      }
+
+      slerp_reference(a, b, x[i], ref);
+      for (c = 0; c < 4; ++c)
+         err_slerp = fmax(err_slerp, fabs(qo[c * CURVES + i] - ref[c]));
+   }
+
+   start = mmd_time();
+   for (r = 0; r < rounds; ++r)
+      kernel->bezier(x, x1, y1, x2, y2, y, CURVES);
+   elapsed_bezier = mmd_time() - start;
+
+   start = mmd_time();
+   for (r = 0; r < rounds; ++r)
+      kernel->slerp(qa, qb, x, qo, CURVES, CURVES);
+   elapsed_slerp = mmd_time() - start;
+
+   printf("%-10s %12.0f curves/sec %12.0f slerps/sec  max error %.2g, %.2g\n", kernel->name,
+         (elapsed_bezier > 0 ? (double)CURVES * rounds / elapsed_bezier : 0),
+         (elapsed_slerp > 0 ? (double)CURVES * rounds / elapsed_slerp : 0), err_bezier, err_slerp);
+
+   /* the bezier x -> s solve is good to about 1e-5 */
+   return (err_bezier < 1e-4 && err_slerp < 1e-5);
+}
+
+/* \brief put little endian uint32_t */
+static unsigned char* put_u32(unsigned char *p, uint32_t v)
+{
+   p[0] = v & 0xff; p[1] = (v >> 8) & 0xff; p[2] = (v >> 16) & 0xff; p[3] = v >> 24;
+   return p + 4;
+}
+
+/* \brief put little endian float */
+static unsigned char* put_f32(unsigned char *p, float v)
+{
+   uint32_t u;
+   memcpy(&u, &v, sizeof(u));
+   return put_u32(p, u);
+}
+
+/* \brief synthetic VMD with BONES tracks of KEYS keys */
+static unsigned char* generate(size_t *out_size)
+{
+   const size_t size = 30 + 20 + 4 + (size_t)BONES * KEYS * 111 + 4 + 4;
+   unsigned char *data, *p;
+   float q[4];
+   unsigned int b, k, c;
+
+   if (!(data = calloc(1, size)))
+      return NULL;
+
+   memcpy(data, "Vocaloid Motion Data 0002", 25);
+   p = put_u32(data + 50, BONES * KEYS);
+
+   for (k = 0; k < KEYS; ++k) {
+      for (b = 0; b < BONES; ++b) {
+         snprintf((char*)p, 15, "bone%u", b);
+         p = put_u32(p + 15, k * 3);
+
+         for (c = 0; c < 3; ++c)
+            p = put_f32(p, bench_rnd_unit() * 2 - 1);
+
+         quaternion(q, 1);
+         for (c = 0; c < 4; ++c)
+            p = put_f32(p, q[c]);
+
+         for (c = 0; c < 64; ++c)
+            *p++ = (unsigned char)(20 + (c % 16 < 8 ? c % 4 : 80 + c % 4));
+      }
+   }
+
+   *out_size = size;
+   return data;
+}
+
+int main(int argc, char **argv)
+{
+   unsigned int characters = (argc > 1 ? strtoul(argv[1], NULL, 10) : 300);
+   unsigned int frames = (argc > 2 ? strtoul(argv[2], NULL, 10) : 600);
+   const mmd_curve_kernel *kernel;
+   mmd_sampler **samplers;
+   mmd_motion *motion;
+   mmd_bone bones[BONES];
+   char names[BONES][16];
+   mmd_data mmd;
+   mmd_pose *pose;
+   unsigned char *data;
+   unsigned int i, f;
+   double start, elapsed;
+   size_t size;
+   int ret = EXIT_SUCCESS;
+
+   for (kernel = mmd_curve_kernels(); kernel->name; ++kernel) {
+      if (!kernel->supported())
+         continue;
+
+      if (!check_kernel(kernel, 200)) {
+         fprintf(stderr, "%s: error over tolerance\n", kernel->name);
+         ret = EXIT_FAILURE;
+      }
+   }
+
+   memset(&mmd, 0, sizeof(mmd));
+   memset(bones, 0, sizeof(bones));
+   for (i = 0; i < BONES; ++i) {
+      snprintf(names[i], sizeof(names[i]), "bone%u", i);
+      bones[i].name = names[i];
+   }
+   mmd.bones = bones;
+   mmd.num_bones = BONES;
+
+   if (!(data = generate(&size)) || !(motion = mmd_motion_new_from_memory(data, size)))
+      return EXIT_FAILURE;
+
+   if (mmd_motion_load(motion) != 0 || mmd_motion_bind(motion, &mmd) != 0)
+      return EXIT_FAILURE;
+
+   if (!(samplers = calloc(characters, sizeof(mmd_sampler*))) || !(pose = mmd_pose_new(&mmd)))
+      return EXIT_FAILURE;
+
+   for (i = 0; i < characters; ++i)
+      if (!(samplers[i] = mmd_sampler_new(motion)))
+         return EXIT_FAILURE;
+
+   /* 30 fps motion played back at 60 Hz, characters out of phase */
+   start = mmd_time();
+   for (f = 0; f < frames; ++f)
+      for (i = 0; i < characters; ++i)
+         mmd_sampler_sample(samplers[i], (float)((f + i * 7) % (KEYS * 6)) * 0.5f, pose);
+   elapsed = mmd_time() - start;
+
+   printf("%u characters of %u bones, %u frames: %.3f ms per frame, %.0f bones/sec\n",
+         characters, BONES, frames, (frames ? elapsed * 1000 / frames : 0),
+         (elapsed > 0 ? (double)characters * frames * BONES / elapsed : 0));
+
+   for (i = 0; i < characters; ++i)
+      mmd_sampler_free(samplers[i]);
+
+   free(samplers);
+   mmd_pose_free(pose);
+   mmd_motion_free(motion);
+   free(data);
+   return ret;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,155 @@
+#include "../internal.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* microbenchmark for CPU skinning,
+ * checks every deform kernel supported by this cpu
+ * against the scalar one and then measures mmd_deform
+ * on all cpus.
+ *
+ * usage: mmd_deform_bench [vertices] [rounds] */
+
+enum {
+   BONES = 120
+};
+
+/* \brief random mesh bound to BONES bones */
+static int generate(mmd_data *mmd, float *palette, unsigned int count)
+{
+   unsigned int i, c;
+
+   memset(mmd, 0, sizeof(mmd_data));
+   mmd->num_vertices = count;
+   mmd->num_bones = BONES;
+
+   if (!(mmd->vertices = malloc(count * 3 * sizeof(float))) ||
+       !(mmd->normals = malloc(count * 3 * sizeof(float))) ||
+       !(mmd->weights = malloc(count * sizeof(mmd_weight))))
+      return 0;
+
+   for (i = 0; i < count * 3; ++i) {
+      mmd->vertices[i] = bench_rnd() * 10.0f;
+      mmd->normals[i] = bench_rnd();
+   }
+
+   for (i = 0; i < count; ++i) {
+      mmd->weights[i].bone_index[0] = (unsigned short)(i / 64 % BONES);
+      mmd->weights[i].bone_index[1] = (unsigned short)((i / 64 + 1) % BONES);
+      mmd->weights[i].weight = (unsigned char)(i % 101);
+      mmd->weights[i].edge_flag = 0;
+   }
+
+   for (i = 0; i < BONES * 16; ++i)
+      palette[i] = bench_rnd();
+
+   for (i = 0; i < BONES; ++i) {
+      for (c = 0; c < 3; ++c)
+         palette[i * 16 + c * 4 + 3] = 0.0f;
+      palette[i * 16 + 15] = 1.0f;
+   }
+
+   return 1;
+}
+
+static double run(const char *name, mmd_deform_fn deform, const mmd_data *mmd, const float *palette, unsigned int rounds, float *out_vertices, float *out_normals)
+{
+   unsigned int r;
+   double start, elapsed, rate;
+
+   /* warm up */
+   deform(mmd->vertices, mmd->normals, mmd->weights, palette, mmd->num_bones, out_vertices, out_normals, mmd->num_vertices);
+
+   start = mmd_time();
+   for (r = 0; r < rounds; ++r)
+      deform(mmd->vertices, mmd->normals, mmd->weights, palette, mmd->num_bones, out_vertices, out_normals, mmd->num_vertices);
+   elapsed = mmd_time() - start;
+
+   rate = (elapsed > 0 ? (double)mmd->num_vertices * rounds / elapsed / 1000 : 0);
+   printf("%-10s %12.0f vertices/ms\n", name, rate);
+   return rate;
+}
+
+static float max_error(const float *a, const float *b, size_t count)
+{
+   float err = 0.0f;
+   size_t i;
+
+   for (i = 0; i < count; ++i)
+      err = fmaxf(err, fabsf(a[i] - b[i]) / fmaxf(1.0f, fabsf(a[i])));
+
+   return err;
+}
+
+int main(int argc, char **argv)
+{
+   unsigned int count = (argc > 1 ? strtoul(argv[1], NULL, 10) : 100000);
+   unsigned int rounds = (argc > 2 ? strtoul(argv[2], NULL, 10) : 100);
+   const mmd_deform_kernel *kernel;
+   float palette[BONES * 16], *reference[2], *out[2];
+   double start, elapsed;
+   unsigned int r;
+   mmd_data mmd;
+   int ret = EXIT_SUCCESS;
+
+   if (!generate(&mmd, palette, count))
+      return EXIT_FAILURE;
+
+   for (r = 0; r < 2; ++r) {
+      if (!(reference[r] = calloc(count * 3, sizeof(float))) || !(out[r] = calloc(count * 3, sizeof(float))))
+         return EXIT_FAILURE;
+   }
+
+   printf("%u vertices, %u bones, %u rounds\n", count, BONES, rounds);
+
+   for (kernel = mmd_deform_kernels(); kernel->name; ++kernel) {
+      if (!kernel->supported())
+         continue;
+
+      /* scalar kernel is last and becomes the reference */
+      if (!kernel[1].name) {
+         run(kernel->name, kernel->deform, &mmd, palette, rounds, reference[0], reference[1]);
+      } else {
+         run(kernel->name, kernel->deform, &mmd, palette, rounds, out[0], out[1]);
+      }
+   }
+
+   for (kernel = mmd_deform_kernels(); kernel[1].name; ++kernel) {
+      if (!kernel->supported())
+         continue;
+
+      kernel->deform(mmd.vertices, mmd.normals, mmd.weights, palette, mmd.num_bones, out[0], out[1], count);
+      if (max_error(reference[0], out[0], count * 3) > 1e-5f || max_error(reference[1], out[1], count * 3) > 1e-5f) {
+         fprintf(stderr, "%s: output differs from scalar kernel\n", kernel->name);
+         ret = EXIT_FAILURE;
+      }
+   }
+
+   mmd_deform(&mmd, palette, out[0], out[1], NULL);
+   start = mmd_time();
+   for (r = 0; r < rounds; ++r)
+      mmd_deform(&mmd, palette, out[0], out[1], NULL);
+   elapsed = mmd_time() - start;
+
+   printf("%-10s %12.0f vertices/ms on %u cpus\n", "threaded",
+         (elapsed > 0 ? (double)count * rounds / elapsed / 1000 : 0), mmd_cpu_count());
+
+   if (max_error(reference[0], out[0], count * 3) > 1e-5f || max_error(reference[1], out[1], count * 3) > 1e-5f) {
+      fprintf(stderr, "threaded: output differs from scalar kernel\n");
+      ret = EXIT_FAILURE;
+   }
+
+   for (r = 0; r < 2; ++r) {
+      free(reference[r]);
+      free(out[r]);
+   }
+
+   free(mmd.vertices);
+   free(mmd.normals);
+   free(mmd.weights);
+   return ret;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,160 @@
+#include "../mmd.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* microbenchmark for interleaved vertex export,
+ * writes full float layout and quantized layout
+ * and checks them against the source arrays.
+ *
+ * usage: mmd_export_bench [vertices] [rounds] */
+
+/* \brief random mesh */
+static int generate(mmd_data *mmd, unsigned int count)
+{
+   unsigned int i;
+   float len;
+
+   memset(mmd, 0, sizeof(mmd_data));
+   mmd->num_vertices = count;
+
+   if (!(mmd->vertices = malloc(count * 3 * sizeof(float))) ||
+       !(mmd->normals = malloc(count * 3 * sizeof(float))) ||
+       !(mmd->coords = malloc(count * 2 * sizeof(float))) ||
+       !(mmd->weights = malloc(count * sizeof(mmd_weight))))
+      return 0;
+
+   for (i = 0; i < count; ++i) {
+      mmd->vertices[i * 3 + 0] = bench_rnd() * 10.0f;
+      mmd->vertices[i * 3 + 1] = bench_rnd() * 20.0f;
+      mmd->vertices[i * 3 + 2] = bench_rnd() * 10.0f;
+      mmd->normals[i * 3 + 0] = bench_rnd();
+      mmd->normals[i * 3 + 1] = bench_rnd();
+      mmd->normals[i * 3 + 2] = bench_rnd();
+      len = sqrtf(mmd->normals[i * 3] * mmd->normals[i * 3] + mmd->normals[i * 3 + 1] * mmd->normals[i * 3 + 1] +
+                  mmd->normals[i * 3 + 2] * mmd->normals[i * 3 + 2]) + 1e-6f;
+      mmd->normals[i * 3 + 0] /= len;
+      mmd->normals[i * 3 + 1] /= len;
+      mmd->normals[i * 3 + 2] /= len;
+      mmd->coords[i * 2 + 0] = bench_rnd() * 0.5f + 0.5f;
+      mmd->coords[i * 2 + 1] = bench_rnd() * 0.5f + 0.5f;
+      mmd->weights[i].bone_index[0] = (unsigned short)(i / 64 % 120);
+      mmd->weights[i].bone_index[1] = (unsigned short)((i / 64 + 1) % 120);
+      mmd->weights[i].weight = (unsigned char)(i % 101);
+      mmd->weights[i].edge_flag = (unsigned char)(i & 1);
+   }
+
+   return 1;
+}
+
+/* \brief half float to float */
+static float unhalf(unsigned short h)
+{
+   const int e = (h >> 10) & 31, m = h & 1023;
+   const float v = (e ? ldexpf((float)(m | 1024), e - 25) : ldexpf((float)m, -24));
+   return (h & 0x8000 ? -v : v);
+}
+
+static double run(const char *name, const mmd_data *mmd, const mmd_vertex_layout *layout, void *out, unsigned int rounds)
+{
+   unsigned int r;
+   double start, elapsed;
+
+   mmd_export_vertices(mmd, layout, 0, mmd->num_vertices, out);
+
+   start = bench_now();
+   for (r = 0; r < rounds; ++r)
+      mmd_export_vertices(mmd, layout, 0, mmd->num_vertices, out);
+   elapsed = bench_now() - start;
+
+   printf("%-10s %3u bytes %12.0f vertices/ms\n", name, layout->stride, (elapsed > 0 ? (double)mmd->num_vertices * rounds / elapsed / 1000 : 0));
+   return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+   unsigned int count = (argc > 1 ? strtoul(argv[1], NULL, 10) : 100000);
+   unsigned int rounds = (argc > 2 ? strtoul(argv[2], NULL, 10) : 100);
+   mmd_vertex_layout full, quantized;
+   const unsigned char *v;
+   unsigned char *out;
+   float err = 0.0f, f;
+   unsigned int i, c;
+   short s;
+   unsigned short u;
+   mmd_data mmd;
+   int ret = EXIT_SUCCESS;
+
+   if (!generate(&mmd, count))
+      return EXIT_FAILURE;
+
+   memset(&full, 0, sizeof(full));
+   full.num_attribs = 6;
+   full.attribs[0].attrib = MMD_ATTRIB_POSITION;
+   full.attribs[1].attrib = MMD_ATTRIB_NORMAL;
+   full.attribs[2].attrib = MMD_ATTRIB_COORD;
+   full.attribs[3].attrib = MMD_ATTRIB_BONES;
+   full.attribs[4].attrib = MMD_ATTRIB_WEIGHTS;
+   full.attribs[5].attrib = MMD_ATTRIB_EDGE;
+   quantized = full;
+
+   quantized.attribs[0].format = MMD_FORMAT_FLOAT16;
+   quantized.attribs[1].format = MMD_FORMAT_SNORM16;
+   quantized.attribs[2].format = MMD_FORMAT_UNORM16;
+   quantized.attribs[3].format = MMD_FORMAT_UINT8;
+   quantized.attribs[4].format = MMD_FORMAT_UNORM8;
+   quantized.attribs[5].format = MMD_FORMAT_UINT8;
+
+   mmd_vertex_layout_pack(&full);
+   mmd_vertex_layout_pack(&quantized);
+
+   if (!(out = malloc((size_t)count * full.stride)))
+      return EXIT_FAILURE;
+
+   printf("%u vertices, %u rounds\n", count, rounds);
+   run("float32", &mmd, &full, out, rounds);
+
+   for (i = 0; i < count; ++i) {
+      if (memcmp(out + i * full.stride, &mmd.vertices[i * 3], 12) || memcmp(out + i * full.stride + 12, &mmd.normals[i * 3], 12) ||
+          memcmp(out + i * full.stride + 24, &mmd.coords[i * 2], 8)) {
+         fprintf(stderr, "float32: vertex %u differs from source\n", i);
+         ret = EXIT_FAILURE;
+         break;
+      }
+   }
+
+   run("quantized", &mmd, &quantized, out, rounds);
+
+   for (i = 0; i < count; ++i) {
+      v = out + i * quantized.stride;
+
+      for (c = 0; c < 3; ++c) {
+         memcpy(&u, v + c * 2, 2);
+         f = unhalf(u);
+         err = fmaxf(err, fabsf(f - mmd.vertices[i * 3 + c]) / fmaxf(1.0f, fabsf(mmd.vertices[i * 3 + c])) * 0.25f);
+
+         memcpy(&s, v + quantized.attribs[1].offset + c * 2, 2);
+         err = fmaxf(err, fabsf(s / 32767.0f - mmd.normals[i * 3 + c]));
+      }
+
+      if (v[quantized.attribs[3].offset] != mmd.weights[i].bone_index[0] ||
+          abs(v[quantized.attribs[4].offset] - (int)(mmd.weights[i].weight * 2.55f + 0.5f)) > 1)
+         err = 1.0f;
+   }
+
+   if (err > 1e-3f) {
+      fprintf(stderr, "quantized: error %g\n", err);
+      ret = EXIT_FAILURE;
+   }
+
+   free(out);
+   free(mmd.vertices);
+   free(mmd.normals);
+   free(mmd.coords);
+   free(mmd.weights);
+   return ret;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,111 @@
+#include "../mmd.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* microbenchmark for CCD IK,
+ * solves both legs of many characters one pose
+ * per call and then in batches.
+ *
+ * usage: mmd_ik_bench [characters] [frames] */
+
+enum {
+   BONES = 9
+};
+
+/* \brief move ik bones of characters for frame */
+static void animate(mmd_pose **poses, unsigned int characters, unsigned int frame)
+{
+   unsigned int i;
+
+   for (i = 0; i < characters; ++i) {
+      mmd_pose_reset(poses[i]);
+      poses[i]->translations[4 * 3 + 1] = 1.0f + (float)((frame + i) % 7) * 0.5f;
+      poses[i]->translations[4 * 3 + 2] = -1.0f + (float)((frame + i) % 5) * 0.5f;
+      poses[i]->translations[8 * 3 + 1] = 2.0f + (float)((frame + i) % 3) * 0.5f;
+   }
+}
+
+/* \brief solve frames, batch poses per call */
+static double run(mmd_ik_solver *solver, mmd_pose **poses, unsigned int characters, unsigned int frames, unsigned int batch)
+{
+   unsigned int f, i;
+   double start, elapsed;
+
+   start = bench_now();
+   for (f = 0; f < frames; ++f) {
+      animate(poses, characters, f);
+      for (i = 0; i < characters; i += batch)
+         mmd_ik_solve(solver, poses + i, (characters - i < batch ? characters - i : batch));
+   }
+   elapsed = bench_now() - start;
+
+   printf("batch %-4u %12.0f poses/sec\n", batch, (elapsed > 0 ? (double)characters * frames / elapsed : 0));
+   return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+   /* root, two legs of hip, knee, ankle and ik bone */
+   static const float heads[BONES][3] = {
+      { 0, 0, 0 }, { 1, 10, 0 }, { 1, 5, 0 }, { 1, 0, 0 }, { 1, 0, 0 },
+      { -1, 10, 0 }, { -1, 5, 0 }, { -1, 0, 0 }, { -1, 0, 0 }
+   };
+   static const unsigned short parents[BONES] = { 0xFFFF, 0, 1, 2, 0, 0, 5, 6, 0 };
+   static const char *names[BONES] = { "センター", "左足", "左ひざ", "左足首", "左足ＩＫ", "右足", "右ひざ", "右足首", "右足ＩＫ" };
+   static unsigned short links[2][2] = { { 2, 1 }, { 6, 5 } };
+   unsigned int characters = (argc > 1 ? strtoul(argv[1], NULL, 10) : 1000);
+   unsigned int frames = (argc > 2 ? strtoul(argv[2], NULL, 10) : 100);
+   mmd_bone bones[BONES];
+   mmd_ik ik[2];
+   mmd_data mmd;
+   mmd_pose **poses;
+   mmd_ik_solver *solver;
+   unsigned int i;
+
+   memset(&mmd, 0, sizeof(mmd));
+   memset(bones, 0, sizeof(bones));
+   memset(ik, 0, sizeof(ik));
+
+   for (i = 0; i < BONES; ++i) {
+      bones[i].name = names[i];
+      bones[i].parent_bone_index = parents[i];
+      memcpy(bones[i].head_pos, heads[i], sizeof(bones[i].head_pos));
+   }
+
+   for (i = 0; i < 2; ++i) {
+      ik[i].bone_index = (unsigned short)(4 + i * 4);
+      ik[i].target_bone_index = (unsigned short)(3 + i * 4);
+      ik[i].chain_length = 2;
+      ik[i].iterations = 40;
+      ik[i].cotrol_weight = 0.5f;
+      ik[i].child_bone_index = links[i];
+   }
+
+   mmd.bones = bones;
+   mmd.num_bones = BONES;
+   mmd.ik = ik;
+   mmd.num_ik = 2;
+
+   if (!(poses = calloc(characters + 1, sizeof(mmd_pose*))) || !(solver = mmd_ik_solver_new(&mmd, 64)))
+      return EXIT_FAILURE;
+
+   for (i = 0; i < characters; ++i)
+      if (!(poses[i] = mmd_pose_new(&mmd)))
+         return EXIT_FAILURE;
+
+   printf("%u characters, %u frames\n", characters, frames);
+   run(solver, poses, characters, frames, 1);
+   run(solver, poses, characters, frames, 16);
+   run(solver, poses, characters, frames, 64);
+
+   for (i = 0; i < characters; ++i)
+      mmd_pose_free(poses[i]);
+
+   free(poses);
+   mmd_ik_solver_free(solver);
+   return EXIT_SUCCESS;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,429 @@
+#include "../internal.h"
+#include "pmdgen.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#  include <sys/resource.h>
+#endif
+
+/* benchmark for model loading, on synthetic models of
+ * several sizes. every mmd_read_* section is timed on its own,
+ * then whole loads with each loader, and mmd_load once more
+ * with mmd_enable_stats to show what measuring costs, and with
+ * mmd_set_sections for header only and for the mesh, and into
+ * mmd_blob_store holding the same model already. reports throughput,
+ * allocations and peak resident memory as JSON on stdout.
+ *
+ * allocations are counted by wrapping malloc of glibc, they are
+ * null elsewhere and under sanitizers, which wrap malloc themselves.
+ * peak RSS is reset before every measurement on linux, elsewhere
+ * it is the peak of the process so far.
+ *
+ * usage: mmd_bench [rounds=N] [batch=N] [write=path] [pmdgen key=value...]
+ * any generator key replaces the presets with single custom model,
+ * write stores the model to path instead of benchmarking it. */
+
+#if defined(__has_feature)
+#  if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer) || __has_feature(memory_sanitizer)
+#     define BENCH_SANITIZED
+#  endif
+#endif
+
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#  define BENCH_SANITIZED
+#endif
+
+#if defined(__GLIBC__) && !defined(BENCH_SANITIZED)
+#  define BENCH_COUNT_ALLOCATIONS
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void *ptr, size_t size);
+
+static unsigned long allocations;
+
+void* malloc(size_t size)
+{
+   __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+   return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+   __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+   return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void *ptr, size_t size)
+{
+   __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+   return __libc_realloc(ptr, size);
+}
+#endif
+
+/* sections of mmd_load, in file order */
+static const struct {
+   const char *name;
+   int (*read)(mmd_data*);
+} sections[PMDGEN_SECTIONS] = {
+   { "header", mmd_read_header },
+   { "vertex", mmd_read_vertex_data },
+   { "index", mmd_read_index_data },
+   { "material", mmd_read_material_data },
+   { "bone", mmd_read_bone_data },
+   { "ik", mmd_read_ik_data },
+   { "skin", mmd_read_skin_data },
+   { "skin_display", mmd_read_skin_display_data },
+   { "bone_name", mmd_read_bone_name_data },
+};
+
+enum {
+   LOAD,
+   LOAD_STATS,
+   LOAD_HEADER,
+   LOAD_MESH,
+   LOAD_SHARED,
+   LOAD_ARENA,
+   LOAD_PARALLEL,
+   LOAD_PARALLEL_ARENA,
+   LOAD_BATCH,
+   LOADERS
+};
+
+static const char *loaders[LOADERS] = {
+   "mmd_load",
+   "mmd_load_stats",
+   "mmd_load_header",
+   "mmd_load_mesh",
+   "mmd_load_shared",
+   "mmd_load_arena",
+   "mmd_load_parallel",
+   "mmd_load_parallel_arena",
+   "mmd_load_batch",
+};
+
+/* \brief what one measurement collected */
+typedef struct measure {
+   double seconds, best;
+   unsigned long allocations;
+   long peak_rss_kb;
+   unsigned int count;
+} measure;
+
+/* \brief allocations so far */
+static unsigned long allocations_now(void)
+{
+#if defined(BENCH_COUNT_ALLOCATIONS)
+   return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+#else
+   return 0;
+#endif
+}
+
+/* \brief start new peak RSS period, when the system has one */
+static void peak_rss_reset(void)
+{
+#if defined(__linux__)
+   FILE *f;
+
+   if ((f = fopen("/proc/self/clear_refs", "w"))) {
+      fputs("5", f);
+      fclose(f);
+   }
+#endif
+}
+
+/* \brief peak RSS in kilobytes, -1 when unknown */
+static long peak_rss_kb(void)
+{
+#if defined(__linux__)
+   char line[128];
+   long kb = -1;
+   FILE *f;
+
+   if ((f = fopen("/proc/self/status", "r"))) {
+      while (fgets(line, sizeof(line), f))
+         if (!strncmp(line, "VmHWM:", 6))
+            kb = strtol(line + 6, NULL, 10);
+      fclose(f);
+   }
+
+   return kb;
+#elif defined(__unix__) || defined(__APPLE__)
+   struct rusage usage;
+
+   if (getrusage(RUSAGE_SELF, &usage))
+      return -1;
+
+#  if defined(__APPLE__)
+   return usage.ru_maxrss / 1024;
+#  else
+   return usage.ru_maxrss;
+#  endif
+#else
+   return -1;
+#endif
+}
+
+static void measure_begin(double *start, unsigned long *allocs)
+{
+   peak_rss_reset();
+   *allocs = allocations_now();
+   *start = mmd_time();
+}
+
+static void measure_end(measure *m, double start, unsigned long allocs)
+{
+   const double elapsed = mmd_time() - start;
+   const unsigned long count = allocations_now() - allocs;
+   const long rss = peak_rss_kb();
+
+   m->allocations += count;
+   m->seconds += elapsed;
+   m->best = (!m->count || elapsed < m->best ? elapsed : m->best);
+   m->peak_rss_kb = (rss > m->peak_rss_kb ? rss : m->peak_rss_kb);
+   m->count++;
+}
+
+/* \brief time every section of rounds loads */
+static int bench_sections(const pmdgen_model *model, unsigned int rounds, measure *out)
+{
+   unsigned long allocs;
+   unsigned int r, s;
+   mmd_data *mmd;
+   double start;
+
+   for (r = 0; r <= rounds; ++r) {
+      if (!(mmd = mmd_new_from_memory(model->data, model->size)))
+         return 0;
+
+      for (s = 0; s < PMDGEN_SECTIONS; ++s) {
+         measure_begin(&start, &allocs);
+
+         if (sections[s].read(mmd) != 0) {
+            mmd_free(mmd);
+            return 0;
+         }
+
+         /* first round warms up */
+         if (r)
+            measure_end(&out[s], start, allocs);
+      }
+
+      mmd_free(mmd);
+   }
+
+   return 1;
+}
+
+/* \brief time whole loads of rounds models, batch loads take batch models per round */
+static int bench_loads(const pmdgen_model *model, unsigned int rounds, unsigned int batch, measure *out)
+{
+   mmd_batch_item *items;
+   mmd_blob_store *store = NULL;
+   mmd_data *mmd = NULL, *resident = NULL;
+   measure warmup, *m;
+   unsigned long allocs;
+   unsigned int r, l, i;
+   double start;
+   int ok = 1;
+
+   if (!(items = calloc(batch, sizeof(mmd_batch_item))))
+      return 0;
+
+   /* shared loads find every array in store, as repeated loads of one model would */
+   if (!(store = mmd_blob_store_new()) || !(resident = mmd_new_from_memory(model->data, model->size))) {
+      ok = 0;
+   } else {
+      mmd_set_blob_store(resident, store);
+      ok = (mmd_load(resident, 0) == 0);
+   }
+
+   for (l = 0; l < LOADERS && ok; ++l) {
+      for (r = 0; r <= rounds && ok; ++r) {
+         /* first round warms up */
+         memset(&warmup, 0, sizeof(warmup));
+         m = (r ? &out[l] : &warmup);
+
+         if (l == LOAD_BATCH) {
+            memset(items, 0, batch * sizeof(mmd_batch_item));
+            for (i = 0; i < batch; ++i) {
+               items[i].data = model->data;
+               items[i].size = model->size;
+            }
+
+            measure_begin(&start, &allocs);
+            ok = (mmd_load_batch(items, batch, MMD_LOAD_ARENA, NULL, NULL, NULL, NULL) == 0);
+            measure_end(m, start, allocs);
+
+            for (i = 0; i < batch; ++i)
+               if (items[i].mmd) mmd_free(items[i].mmd);
+            continue;
+         }
+
+         measure_begin(&start, &allocs);
+
+         if (!(mmd = mmd_new_from_memory(model->data, model->size))) {
+            ok = 0;
+         } else if (l == LOAD_STATS) {
+            ok = (mmd_enable_stats(mmd, NULL) == 0 && mmd_load(mmd, 0) == 0);
+         } else if (l == LOAD_HEADER || l == LOAD_MESH) {
+            mmd_set_sections(mmd, (l == LOAD_HEADER ? 1 << MMD_SECTION_HEADER :
+                                   (1 << MMD_SECTION_VERTEX) | (1 << MMD_SECTION_INDEX) | (1 << MMD_SECTION_MATERIAL)));
+            ok = (mmd_load(mmd, 0) == 0);
+         } else if (l == LOAD_SHARED) {
+            mmd_set_blob_store(mmd, store);
+            ok = (mmd_load(mmd, 0) == 0);
+         } else if (l == LOAD || l == LOAD_ARENA) {
+            ok = (mmd_load(mmd, (l == LOAD_ARENA ? MMD_LOAD_ARENA : 0)) == 0);
+         } else {
+            ok = (mmd_load_parallel(mmd, (l == LOAD_PARALLEL_ARENA ? MMD_LOAD_ARENA : 0), NULL) == 0);
+         }
+
+         measure_end(m, start, allocs);
+         if (mmd) mmd_free(mmd);
+      }
+   }
+
+   if (resident) mmd_free(resident);
+   if (store) mmd_blob_store_free(store);
+   free(items);
+   return ok;
+}
+
+/* \brief print measurement of bytes per round and models per round */
+static void print_measure(const char *name, const measure *m, size_t bytes, unsigned int models, int last)
+{
+   const double mean = (m->count ? m->seconds / m->count : 0);
+
+   printf("        { \"name\": \"%s\", \"mean_ms\": %.4f, \"best_ms\": %.4f, \"mb_per_s\": %.2f, \"models_per_s\": %.2f, ",
+          name, mean * 1e3, m->best * 1e3, (mean > 0 ? bytes / mean / 1e6 : 0), (mean > 0 ? models / mean : 0));
+
+#if defined(BENCH_COUNT_ALLOCATIONS)
+   printf("\"allocations\": %.1f, ", (m->count ? (double)m->allocations / m->count : 0));
+#else
+   printf("\"allocations\": null, ");
+#endif
+
+   if (m->peak_rss_kb >= 0)
+      printf("\"peak_rss_kb\": %ld }%s\n", m->peak_rss_kb, (last ? "" : ","));
+   else
+      printf("\"peak_rss_kb\": null }%s\n", (last ? "" : ","));
+}
+
+/* \brief benchmark one model and print its JSON object */
+static int bench_model(const char *name, const pmdgen_params *params, unsigned int rounds, unsigned int batch, int last)
+{
+   measure section[PMDGEN_SECTIONS], load[LOADERS];
+   pmdgen_model model;
+   unsigned int s, l;
+
+   memset(section, 0, sizeof(section));
+   memset(load, 0, sizeof(load));
+
+   for (s = 0; s < PMDGEN_SECTIONS; ++s)
+      section[s].peak_rss_kb = -1;
+
+   for (l = 0; l < LOADERS; ++l)
+      load[l].peak_rss_kb = -1;
+
+   if (!pmdgen(params, &model)) {
+      fprintf(stderr, "%s: parameters do not fit PMD\n", name);
+      return 0;
+   }
+
+   if (!bench_sections(&model, rounds, section) || !bench_loads(&model, rounds, batch, load)) {
+      fprintf(stderr, "%s: model did not load\n", name);
+      pmdgen_free(&model);
+      return 0;
+   }
+
+   printf("    {\n");
+   printf("      \"name\": \"%s\", \"bytes\": %lu,\n", name, (unsigned long)model.size);
+   printf("      \"params\": { \"vertices\": %u, \"triangles\": %u, \"materials\": %u, \"textures\": %u, \"bones\": %u, "
+          "\"ik\": %u, \"chain\": %u, \"morphs\": %u, \"morph_vertices\": %u, \"names\": %u, \"seed\": %u },\n",
+          params->vertices, params->triangles, params->materials, params->textures, params->bones,
+          params->ik, params->chain, params->morphs, params->morph_vertices, params->names, params->seed);
+
+   printf("      \"sections\": [\n");
+   for (s = 0; s < PMDGEN_SECTIONS; ++s)
+      print_measure(sections[s].name, &section[s], model.sections[s], 1, s + 1 == PMDGEN_SECTIONS);
+
+   printf("      ],\n      \"loads\": [\n");
+   for (l = 0; l < LOADERS; ++l)
+      print_measure(loaders[l], &load[l], model.size * (l == LOAD_BATCH ? batch : 1), (l == LOAD_BATCH ? batch : 1), l + 1 == LOADERS);
+
+   printf("      ]\n    }%s\n", (last ? "" : ","));
+   pmdgen_free(&model);
+   return 1;
+}
+
+/* \brief store generated model */
+static int write_model(const char *path, const pmdgen_params *params)
+{
+   pmdgen_model model;
+   FILE *f;
+   int ok;
+
+   if (!pmdgen(params, &model))
+      return 0;
+
+   ok = ((f = fopen(path, "wb")) && fwrite(model.data, 1, model.size, f) == model.size);
+   if (f && fclose(f)) ok = 0;
+
+   pmdgen_free(&model);
+   return ok;
+}
+
+int main(int argc, char **argv)
+{
+   unsigned int rounds = 20, batch = 8, i, count = 0;
+   const char *name, *write = NULL;
+   pmdgen_params params, custom;
+   int custom_set = 0, ret = EXIT_SUCCESS;
+
+   pmdgen_preset(1, &name, &custom);
+
+   for (i = 1; i < (unsigned int)argc; ++i) {
+      if (!strncmp(argv[i], "rounds=", 7)) {
+         rounds = strtoul(argv[i] + 7, NULL, 10);
+      } else if (!strncmp(argv[i], "batch=", 6)) {
+         batch = strtoul(argv[i] + 6, NULL, 10);
+      } else if (!strncmp(argv[i], "write=", 6)) {
+         write = argv[i] + 6;
+      } else if (pmdgen_parse(&custom, argv[i])) {
+         custom_set = 1;
+      } else {
+         fprintf(stderr, "unknown argument: %s\n", argv[i]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   if (write)
+      return (write_model(write, &custom) ? EXIT_SUCCESS : EXIT_FAILURE);
+
+   if (!rounds || !batch)
+      return EXIT_FAILURE;
+
+   while (!custom_set && pmdgen_preset(count, &name, &params))
+      ++count;
+
+   printf("{\n  \"rounds\": %u, \"batch\": %u, \"cpus\": %u,\n  \"models\": [\n", rounds, batch, mmd_cpu_count());
+
+   if (custom_set) {
+      if (!bench_model("custom", &custom, rounds, batch, 1))
+         ret = EXIT_FAILURE;
+   } else {
+      for (i = 0; i < count && pmdgen_preset(i, &name, &params); ++i)
+         if (!bench_model(name, &params, rounds, batch, i + 1 == count))
+            ret = EXIT_FAILURE;
+   }
+
+   printf("  ]\n}\n");
+   return ret;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,60 @@
+#include "../mmd.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* benchmark for level of detail generation,
+ * simplifies bumpy grid split to materials in strips
+ * and checks levels against the source vertices.
+ *
+ * usage: mmd_lod_bench [grid size] [materials] */
+
+int main(int argc, char **argv)
+{
+   static const float ratios[] = { 0.5f, 0.25f, 0.1f };
+   const unsigned int num_levels = sizeof(ratios) / sizeof(ratios[0]);
+   unsigned int size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 200);
+   unsigned int materials = (argc > 2 ? strtoul(argv[2], NULL, 10) : 8);
+   unsigned int l, i, previous;
+   mmd_lod_chain *chain;
+   mmd_data *mmd;
+   double start, elapsed;
+   int ret = EXIT_SUCCESS;
+
+   if (size < 2 || size * size > 0x10000 || materials < 1 || materials > size - 1)
+      return EXIT_FAILURE;
+
+   if (!(mmd = mmd_new(NULL)) || !bench_grid(mmd, size, materials))
+      return EXIT_FAILURE;
+
+   start = bench_now();
+   if (!(chain = mmd_lod_chain_new(mmd, ratios, num_levels, 0, NULL)))
+      return EXIT_FAILURE;
+   elapsed = bench_now() - start;
+
+   printf("%u vertices, %u triangles, %u materials in %.2f ms\n", mmd->num_vertices, mmd->num_indices / 3, materials, elapsed * 1000);
+
+   for (l = 0, previous = mmd->num_indices; l < chain->num_levels; ++l) {
+      printf("level %u: %7u triangles (%.3f) error %g\n", l, chain->levels[l].num_indices / 3,
+             (double)chain->levels[l].num_indices / mmd->num_indices, chain->levels[l].error);
+
+      for (i = 0; i < chain->levels[l].num_indices; ++i)
+         if (chain->levels[l].indices[i] >= mmd->num_vertices)
+            ret = EXIT_FAILURE;
+
+      if (chain->levels[l].num_indices > previous)
+         ret = EXIT_FAILURE;
+
+      previous = chain->levels[l].num_indices;
+   }
+
+   if (ret != EXIT_SUCCESS)
+      fprintf(stderr, "lod: levels are not valid\n");
+
+   mmd_lod_chain_free(chain);
+   mmd_free(mmd);
+   return ret;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,69 @@
+#include "../mmd.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* benchmark for vertex cache optimization,
+ * reorders grid mesh with shuffled triangles and
+ * reports cache misses per triangle before and after.
+ *
+ * usage: mmd_optimize_bench [grid size] [materials] */
+
+/* \brief grid of size * size vertices, triangles shuffled inside every material */
+static int generate(mmd_data *mmd, unsigned int size, unsigned int materials)
+{
+   unsigned int i, j, m, t, tri[3], first, end;
+
+   if (!bench_grid(mmd, size, materials))
+      return 0;
+
+   for (m = 0, first = 0; m < materials; ++m, first = end) {
+      end = first + mmd->materials[m].face / 3;
+
+      for (i = end - 1; i > first; --i) {
+         j = first + bench_rand() % (i - first + 1);
+         for (t = 0; t < 3; ++t) {
+            tri[t] = mmd->indices[i * 3 + t];
+            mmd->indices[i * 3 + t] = mmd->indices[j * 3 + t];
+            mmd->indices[j * 3 + t] = (unsigned short)tri[t];
+         }
+      }
+   }
+
+   return 1;
+}
+
+int main(int argc, char **argv)
+{
+   unsigned int size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 200);
+   unsigned int materials = (argc > 2 ? strtoul(argv[2], NULL, 10) : 8);
+   mmd_optimize_stats stats;
+   mmd_data *mmd;
+   double start, elapsed;
+
+   if (size < 2 || size * size > 0x10000 || materials < 1)
+      return EXIT_FAILURE;
+
+   if (!(mmd = mmd_new(NULL)) || !generate(mmd, size, materials))
+      return EXIT_FAILURE;
+
+   start = bench_now();
+   if (mmd_optimize_vertex_cache(mmd, 0, NULL, &stats) != 0)
+      return EXIT_FAILURE;
+   elapsed = bench_now() - start;
+
+   printf("%u vertices, %u triangles, %u materials\n", mmd->num_vertices, mmd->num_indices / 3, materials);
+   printf("cache %u: acmr %.3f -> %.3f in %.2f ms\n", stats.cache_size, stats.acmr_before, stats.acmr_after, elapsed * 1000);
+
+   mmd_free(mmd);
+
+   if (stats.acmr_after > stats.acmr_before) {
+      fprintf(stderr, "optimize: acmr got worse\n");
+      return EXIT_FAILURE;
+   }
+
+   return EXIT_SUCCESS;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
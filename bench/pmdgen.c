@@ -0,0 +1,329 @@
+#include "pmdgen.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/* synthetic PMD writer.
+ *
+ * records are laid out as mmd_read_* expects them, little endian.
+ * triangles walk the vertex array with small jitter, so index
+ * locality is close to real meshes instead of uniformly random.
+ * skins index base skin, as in files from the editor. */
+
+enum {
+   HEADER_SIZE = 3 + sizeof(float) + 20 + 256,
+   VERTEX_SIZE = sizeof(float) * 8 + sizeof(uint16_t) * 2 + 2,
+   MATERIAL_SIZE = sizeof(float) * 11 + 2 + sizeof(uint32_t) + 20,
+   BONE_SIZE = 20 + sizeof(uint16_t) * 2 + 1 + sizeof(uint16_t) + sizeof(float) * 3,
+   IK_SIZE = sizeof(uint16_t) * 2 + 1 + sizeof(uint16_t) + sizeof(float),
+   SKIN_SIZE = 20 + sizeof(uint32_t) + 1,
+   SKIN_VERTEX_SIZE = sizeof(uint32_t) + sizeof(float) * 3,
+   BONE_NAME_SIZE = 50,
+   BONE_DISPLAY_SIZE = sizeof(uint16_t) + 1
+};
+
+typedef struct writer {
+   unsigned char *p;
+   uint32_t seed;
+} writer;
+
+static const struct {
+   const char *name;
+   pmdgen_params params;
+} presets[] = {
+   { "small", { 2000, 3000, 8, 4, 60, 4, 3, 20, 40, 8, 1 } },
+   { "medium", { 20000, 32000, 24, 12, 160, 8, 4, 60, 300, 16, 2 } },
+   { "large", { 65000, 120000, 64, 32, 400, 16, 6, 120, 800, 32, 3 } },
+};
+
+/* \brief next pseudo random number */
+static uint32_t next(writer *w)
+{
+   w->seed = w->seed * 1664525 + 1013904223;
+   return w->seed >> 8;
+}
+
+/* \brief pseudo random float in [lo, hi) */
+static float uniform(writer *w, float lo, float hi)
+{
+   return lo + (float)next(w) / (float)(1 << 24) * (hi - lo);
+}
+
+static void put_u8(writer *w, unsigned int v)
+{
+   *w->p++ = (unsigned char)v;
+}
+
+static void put_u16(writer *w, unsigned int v)
+{
+   put_u8(w, v & 0xFF);
+   put_u8(w, (v >> 8) & 0xFF);
+}
+
+static void put_u32(writer *w, uint32_t v)
+{
+   put_u16(w, v & 0xFFFF);
+   put_u16(w, v >> 16);
+}
+
+static void put_f32(writer *w, float v)
+{
+   uint32_t u;
+   memcpy(&u, &v, sizeof(u));
+   put_u32(w, u);
+}
+
+/* \brief NUL padded fixed size name */
+static void put_name(writer *w, size_t size, const char *name)
+{
+   memset(w->p, 0, size);
+   memcpy(w->p, name, (strlen(name) < size ? strlen(name) : size - 1));
+   w->p += size;
+}
+
+/* \brief name numbered by index */
+static void put_numbered(writer *w, size_t size, const char *prefix, unsigned int index, const char *suffix)
+{
+   char name[64];
+   snprintf(name, sizeof(name), "%s%u%s", prefix, index, suffix);
+   put_name(w, size, name);
+}
+
+/* \brief get preset */
+int pmdgen_preset(unsigned int index, const char **name, pmdgen_params *params)
+{
+   if (index >= sizeof(presets) / sizeof(presets[0]))
+      return 0;
+
+   *name = presets[index].name;
+   *params = presets[index].params;
+   return 1;
+}
+
+/* \brief parse key=value */
+int pmdgen_parse(pmdgen_params *params, const char *arg)
+{
+   static const struct {
+      const char *key;
+      size_t offset;
+   } keys[] = {
+      { "vertices", offsetof(pmdgen_params, vertices) },
+      { "triangles", offsetof(pmdgen_params, triangles) },
+      { "materials", offsetof(pmdgen_params, materials) },
+      { "textures", offsetof(pmdgen_params, textures) },
+      { "bones", offsetof(pmdgen_params, bones) },
+      { "ik", offsetof(pmdgen_params, ik) },
+      { "chain", offsetof(pmdgen_params, chain) },
+      { "morphs", offsetof(pmdgen_params, morphs) },
+      { "morph_vertices", offsetof(pmdgen_params, morph_vertices) },
+      { "names", offsetof(pmdgen_params, names) },
+      { "seed", offsetof(pmdgen_params, seed) },
+   };
+   const char *value;
+   unsigned int k;
+
+   if (!(value = strchr(arg, '=')))
+      return 0;
+
+   for (k = 0; k < sizeof(keys) / sizeof(keys[0]); ++k) {
+      if (strlen(keys[k].key) != (size_t)(value - arg) || strncmp(keys[k].key, arg, value - arg))
+         continue;
+
+      *(unsigned int*)((char*)params + keys[k].offset) = strtoul(value + 1, NULL, 10);
+      return 1;
+   }
+
+   return 0;
+}
+
+/* \brief bytes of every section */
+static int layout(const pmdgen_params *p, size_t *sections)
+{
+   /* counts have to fit their PMD fields */
+   if (p->vertices > 0x10000 || (p->vertices && !p->bones) || (p->triangles && !p->vertices) ||
+       p->triangles > 0x7FFFFFFF / 3 || (p->triangles && !p->materials) ||
+       p->bones > 0xFFFF || p->ik > 0xFFFF || p->chain > 0xFF || (p->ik && p->bones < p->chain + 2) ||
+       p->morphs >= 0xFFFF || (p->morphs && !p->vertices) || p->names > 0xFF)
+      return 0;
+
+   sections[PMDGEN_HEADER] = HEADER_SIZE;
+   sections[PMDGEN_VERTEX] = sizeof(uint32_t) + (size_t)p->vertices * VERTEX_SIZE;
+   sections[PMDGEN_INDEX] = sizeof(uint32_t) + (size_t)p->triangles * 3 * sizeof(uint16_t);
+   sections[PMDGEN_MATERIAL] = sizeof(uint32_t) + (size_t)p->materials * MATERIAL_SIZE;
+   sections[PMDGEN_BONE] = sizeof(uint16_t) + (size_t)p->bones * BONE_SIZE;
+   sections[PMDGEN_IK] = sizeof(uint16_t) + (size_t)p->ik * (IK_SIZE + p->chain * sizeof(uint16_t));
+   sections[PMDGEN_SKIN] = sizeof(uint16_t) + (p->morphs ? (size_t)(p->morphs + 1) * SKIN_SIZE +
+                           ((size_t)p->morphs + 1) * p->morph_vertices * SKIN_VERTEX_SIZE : 0);
+   sections[PMDGEN_SKIN_DISPLAY] = 1 + (p->morphs < 0xFF ? p->morphs : 0xFF) * sizeof(uint16_t);
+   sections[PMDGEN_BONE_NAME] = 1 + (size_t)p->names * BONE_NAME_SIZE;
+   return 1;
+}
+
+/* \brief write mesh sections */
+static void write_mesh(writer *w, const pmdgen_params *p)
+{
+   unsigned int i, c, m, first, faces;
+   float x, y, z;
+
+   put_u32(w, p->vertices);
+   for (i = 0; i < p->vertices; ++i) {
+      /* points on a lumpy cylinder, roughly the shape of a figure */
+      x = uniform(w, -1.0f, 1.0f);
+      z = uniform(w, -1.0f, 1.0f);
+      y = (float)i / (float)p->vertices * 20.0f;
+      put_f32(w, x * 4.0f);
+      put_f32(w, y);
+      put_f32(w, z * 4.0f);
+      put_f32(w, x);
+      put_f32(w, 0.0f);
+      put_f32(w, z);
+      put_f32(w, uniform(w, 0.0f, 1.0f));
+      put_f32(w, uniform(w, 0.0f, 1.0f));
+      put_u16(w, next(w) % p->bones);
+      put_u16(w, next(w) % p->bones);
+      put_u8(w, next(w) % 101);
+      put_u8(w, next(w) & 1);
+   }
+
+   put_u32(w, p->triangles * 3);
+   for (i = 0; i < p->triangles; ++i) {
+      first = (unsigned int)((unsigned long long)i * p->vertices / p->triangles);
+      for (c = 0; c < 3; ++c)
+         put_u16(w, (first + next(w) % 16) % p->vertices);
+   }
+
+   put_u32(w, p->materials);
+   for (m = 0, first = 0; m < p->materials; ++m) {
+      faces = (unsigned int)((unsigned long long)p->triangles * (m + 1) / p->materials) - first;
+      first += faces;
+
+      /* diffuse, alpha, power, specular, ambient */
+      for (c = 0; c < 11; ++c)
+         put_f32(w, uniform(w, 0.0f, 1.0f));
+
+      put_u8(w, m % 10);
+      put_u8(w, m & 1);
+      put_u32(w, faces * 3);
+
+      if (p->textures)
+         put_numbered(w, 20, "tex", m % p->textures, ".png");
+      else
+         put_name(w, 20, "");
+   }
+}
+
+/* \brief write skeleton sections */
+static void write_skeleton(writer *w, const pmdgen_params *p)
+{
+   static const unsigned char types[] = { 0, 1, 0, 0, 4, 5, 7, 8 };
+   unsigned int b, k, l;
+
+   put_u16(w, p->bones);
+   for (b = 0; b < p->bones; ++b) {
+      put_numbered(w, 20, "bone", b, "");
+      put_u16(w, (b ? next(w) % b : 0xFFFF));
+      put_u16(w, (b + 1 < p->bones ? b + 1 : 0));
+      put_u8(w, types[b % sizeof(types)]);
+      put_u16(w, 0);
+      put_f32(w, uniform(w, -2.0f, 2.0f));
+      put_f32(w, (float)b / (float)p->bones * 20.0f);
+      put_f32(w, uniform(w, -2.0f, 2.0f));
+   }
+
+   /* chains climb from target towards the root */
+   put_u16(w, p->ik);
+   for (k = 0; k < p->ik; ++k) {
+      b = p->chain + 1 + next(w) % (p->bones - p->chain - 1);
+      put_u16(w, b);
+      put_u16(w, b - 1);
+      put_u8(w, p->chain);
+      put_u16(w, 15 + k % 30);
+      put_f32(w, 0.5f);
+
+      for (l = 0; l < p->chain; ++l)
+         put_u16(w, b - 2 - l);
+   }
+}
+
+/* \brief write skin and name sections */
+static void write_names(writer *w, const pmdgen_params *p)
+{
+   const unsigned int displays = (p->morphs < 0xFF ? p->morphs : 0xFF);
+   const unsigned int stride = (p->morph_vertices ? p->vertices / p->morph_vertices : 0);
+   unsigned int s, v, c;
+
+   /* base skin lists the vertices the other skins move */
+   put_u16(w, (p->morphs ? p->morphs + 1 : 0));
+   for (s = 0; p->morphs && s <= p->morphs; ++s) {
+      put_numbered(w, 20, "skin", s, "");
+      put_u32(w, p->morph_vertices);
+      put_u8(w, (s ? 1 + s % 4 : 0));
+
+      for (v = 0; v < p->morph_vertices; ++v) {
+         put_u32(w, (s ? next(w) % p->morph_vertices : (v * (stride ? stride : 1)) % p->vertices));
+         for (c = 0; c < 3; ++c)
+            put_f32(w, (s ? uniform(w, -0.1f, 0.1f) : 0.0f));
+      }
+   }
+
+   put_u8(w, displays);
+   for (s = 0; s < displays; ++s)
+      put_u16(w, s + 1);
+
+   put_u8(w, p->names);
+   for (s = 0; s < p->names; ++s)
+      put_numbered(w, BONE_NAME_SIZE, "group", s, "");
+}
+
+/* \brief generate model */
+int pmdgen(const pmdgen_params *params, pmdgen_model *model)
+{
+   const unsigned int groups = (params->names && params->bones ? params->bones - 1 : 0);
+   writer w;
+   unsigned int s, b;
+
+   memset(model, 0, sizeof(pmdgen_model));
+
+   if (!layout(params, model->sections))
+      return 0;
+
+   for (s = 0; s < PMDGEN_SECTIONS; ++s)
+      model->size += model->sections[s];
+
+   /* bone display follows bone names, mmd_load stops before it */
+   model->size += sizeof(uint32_t) + (size_t)groups * BONE_DISPLAY_SIZE;
+
+   if (!(model->data = malloc(model->size)))
+      return 0;
+
+   w.p = model->data;
+   w.seed = params->seed * 0x9e3779b9u + 1;
+
+   memcpy(w.p, "Pmd", 3);
+   w.p += 3;
+   put_f32(&w, 1.0f);
+   put_numbered(&w, 20, "synthetic", params->seed, "");
+   put_name(&w, 256, "pmdgen");
+
+   write_mesh(&w, params);
+   write_skeleton(&w, params);
+   write_names(&w, params);
+
+   put_u32(&w, groups);
+   for (b = 1; b <= groups; ++b) {
+      put_u16(&w, b);
+      put_u8(&w, 1 + b % params->names);
+   }
+
+   return (w.p == model->data + model->size);
+}
+
+/* \brief free model */
+void pmdgen_free(pmdgen_model *model)
+{
+   if (model->data) free(model->data);
+   memset(model, 0, sizeof(pmdgen_model));
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,64 @@
+#ifndef __mmd_pmdgen_h__
+#define __mmd_pmdgen_h__
+
+#include <stddef.h>
+
+/* deterministic synthetic PMD models for the benchmarks,
+ * same parameters and seed always give the same bytes */
+
+/* sections in file order, same as mmd_read_* functions */
+enum {
+   PMDGEN_HEADER,
+   PMDGEN_VERTEX,
+   PMDGEN_INDEX,
+   PMDGEN_MATERIAL,
+   PMDGEN_BONE,
+   PMDGEN_IK,
+   PMDGEN_SKIN,
+   PMDGEN_SKIN_DISPLAY,
+   PMDGEN_BONE_NAME,
+   PMDGEN_SECTIONS
+};
+
+typedef struct pmdgen_params {
+   /* mesh, vertices fit 16-bit indices */
+   unsigned int vertices, triangles, materials;
+
+   /* distinct texture names shared by the materials, 0 leaves them empty */
+   unsigned int textures;
+
+   /* skeleton, chain is length of every IK chain */
+   unsigned int bones, ik, chain;
+
+   /* morphs besides the base skin, and vertices of each */
+   unsigned int morphs, morph_vertices;
+
+   /* bone group names */
+   unsigned int names;
+
+   unsigned int seed;
+} pmdgen_params;
+
+typedef struct pmdgen_model {
+   unsigned char *data;
+   size_t size;
+
+   /* bytes of every section, PMDGEN_* */
+   size_t sections[PMDGEN_SECTIONS];
+} pmdgen_model;
+
+/* small, medium and large presets, index past them returns 0 */
+int pmdgen_preset(unsigned int index, const char **name, pmdgen_params *params);
+
+/* set parameter from key=value argument, returns 0 for unknown keys */
+int pmdgen_parse(pmdgen_params *params, const char *arg);
+
+/* generate model, returns 0 when parameters do not fit PMD */
+int pmdgen(const pmdgen_params *params, pmdgen_model *model);
+
+/* free generated model */
+void pmdgen_free(pmdgen_model *model);
+
+#endif /* __mmd_pmdgen_h__ */
+
+/* vim: set ts=8 sw=3 tw=0 :*/
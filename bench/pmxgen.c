@@ -0,0 +1,597 @@
+#include "pmxgen.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/* synthetic PMX writer.
+ *
+ * records are variable length, so the model is written twice:
+ * the first pass only measures every section, the second one
+ * writes the bytes. both passes draw the same random sequence.
+ * names are kept as UTF8 here and written in the encoding of
+ * the model, some of them outside the BMP. */
+
+enum {
+   /* globals in header, no additional ones */
+   GLOBALS = 8,
+
+   /* morphs added besides the vertex morphs: group, bone, uv and material */
+   EXTRA_MORPHS = 4,
+
+   /* UTF16 units of longest name */
+   MAX_UNITS = 128
+};
+
+/* bone flags */
+enum {
+   TAIL_INDEX = 0x0001,
+   ROTATABLE = 0x0002,
+   MOVABLE = 0x0004,
+   VISIBLE = 0x0008,
+   IK = 0x0020,
+   INHERIT_ROTATION = 0x0100,
+   INHERIT_TRANSLATION = 0x0200,
+   FIXED_AXIS = 0x0400,
+   LOCAL_AXIS = 0x0800,
+   EXTERNAL_PARENT = 0x2000
+};
+
+typedef struct writer {
+   /* NULL while measuring */
+   unsigned char *data;
+   size_t size;
+
+   uint32_t seed;
+   unsigned int utf8;
+
+   /* bytes of index fields */
+   unsigned int vertex, texture, material, bone, morph, rigid;
+} writer;
+
+/* bone flags cycled through, IK is added to the ik bones */
+static const unsigned int bone_flags[] = {
+   TAIL_INDEX | ROTATABLE | MOVABLE | VISIBLE,
+   ROTATABLE | VISIBLE,
+   TAIL_INDEX | ROTATABLE | INHERIT_ROTATION,
+   VISIBLE | INHERIT_TRANSLATION | FIXED_AXIS,
+   TAIL_INDEX | ROTATABLE | VISIBLE | LOCAL_AXIS,
+   ROTATABLE | EXTERNAL_PARENT
+};
+
+/* \brief next pseudo random number */
+static uint32_t next(writer *w)
+{
+   w->seed = w->seed * 1664525 + 1013904223;
+   return w->seed >> 8;
+}
+
+/* \brief pseudo random float in [lo, hi) */
+static float uniform(writer *w, float lo, float hi)
+{
+   return lo + (float)next(w) / (float)(1 << 24) * (hi - lo);
+}
+
+static void put(writer *w, const void *bytes, size_t size)
+{
+   if (w->data)
+      memcpy(w->data + w->size, bytes, size);
+
+   w->size += size;
+}
+
+static void put_u8(writer *w, unsigned int v)
+{
+   unsigned char b = (unsigned char)v;
+   put(w, &b, 1);
+}
+
+static void put_u16(writer *w, unsigned int v)
+{
+   put_u8(w, v & 0xFF);
+   put_u8(w, (v >> 8) & 0xFF);
+}
+
+static void put_u32(writer *w, uint32_t v)
+{
+   put_u16(w, v & 0xFFFF);
+   put_u16(w, v >> 16);
+}
+
+static void put_f32(writer *w, float v)
+{
+   uint32_t u;
+   memcpy(&u, &v, sizeof(u));
+   put_u32(w, u);
+}
+
+/* \brief index of width bytes, -1 is none */
+static void put_index(writer *w, unsigned int width, int32_t v)
+{
+   if (width == 1)
+      put_u8(w, (uint8_t)v);
+   else if (width == 2)
+      put_u16(w, (uint16_t)v);
+   else
+      put_u32(w, (uint32_t)v);
+}
+
+/* \brief text from UTF8, converted to UTF16LE unless the model is UTF8 */
+static void put_text(writer *w, const char *utf8)
+{
+   const unsigned char *s = (const unsigned char*)utf8;
+   uint16_t units[MAX_UNITS];
+   unsigned int n = 0, c, i;
+
+   if (w->utf8) {
+      put_u32(w, (uint32_t)strlen(utf8));
+      put(w, utf8, strlen(utf8));
+      return;
+   }
+
+   /* names are written by us, so the UTF8 is valid */
+   while (*s && n + 2 <= MAX_UNITS) {
+      if (*s < 0x80) {
+         c = *s++;
+      } else if (*s < 0xE0) {
+         c = (s[0] & 0x1F) << 6 | (s[1] & 0x3F);
+         s += 2;
+      } else if (*s < 0xF0) {
+         c = (s[0] & 0x0F) << 12 | (s[1] & 0x3F) << 6 | (s[2] & 0x3F);
+         s += 3;
+      } else {
+         c = (s[0] & 0x07) << 18 | (s[1] & 0x3F) << 12 | (s[2] & 0x3F) << 6 | (s[3] & 0x3F);
+         s += 4;
+      }
+
+      if (c >= 0x10000) {
+         units[n++] = (uint16_t)(0xD800 + ((c - 0x10000) >> 10));
+         units[n++] = (uint16_t)(0xDC00 + ((c - 0x10000) & 0x3FF));
+      } else {
+         units[n++] = (uint16_t)c;
+      }
+   }
+
+   put_u32(w, n * 2);
+   for (i = 0; i < n; ++i)
+      put_u16(w, units[i]);
+}
+
+/* \brief text numbered by index */
+static void put_numbered(writer *w, const char *prefix, unsigned int index, const char *suffix)
+{
+   char name[64];
+   snprintf(name, sizeof(name), "%s%u%s", prefix, index, suffix);
+   put_text(w, name);
+}
+
+/* \brief bytes of signed index that fits count */
+static unsigned int index_width(unsigned int count, unsigned int least)
+{
+   const unsigned int width = (count < 0x80 ? 1 : (count < 0x8000 ? 2 : 4));
+   return (width > least ? width : least);
+}
+
+/* \brief bytes of vertex index, unsigned below 4 bytes */
+static unsigned int vertex_width(unsigned int count, unsigned int least)
+{
+   const unsigned int width = (count <= 0x100 ? 1 : (count <= 0x10000 ? 2 : 4));
+   return (width > least ? width : least);
+}
+
+/* \brief write header */
+static void write_header(writer *w, const pmxgen_params *p)
+{
+   char name[64];
+
+   put(w, "PMX ", 4);
+   put_f32(w, 2.0f);
+   put_u8(w, GLOBALS);
+   put_u8(w, p->utf8);
+   put_u8(w, p->uvs);
+   put_u8(w, w->vertex);
+   put_u8(w, w->texture);
+   put_u8(w, w->material);
+   put_u8(w, w->bone);
+   put_u8(w, w->morph);
+   put_u8(w, w->rigid);
+
+   /* local name has a character outside the BMP */
+   snprintf(name, sizeof(name), "合成%u \xF0\x9F\x98\x80", p->seed);
+   put_text(w, name);
+   put_numbered(w, "synthetic", p->seed, "");
+   put_text(w, "pmxgen コメント");
+   put_text(w, "pmxgen");
+}
+
+/* \brief write vertices */
+static void write_vertices(writer *w, const pmxgen_params *p)
+{
+   unsigned int i, c;
+   float x, z;
+
+   put_u32(w, p->vertices);
+   for (i = 0; i < p->vertices; ++i) {
+      /* points on a lumpy cylinder, as pmdgen */
+      x = uniform(w, -1.0f, 1.0f);
+      z = uniform(w, -1.0f, 1.0f);
+      put_f32(w, x * 4.0f);
+      put_f32(w, (float)i / (float)p->vertices * 20.0f);
+      put_f32(w, z * 4.0f);
+      put_f32(w, x);
+      put_f32(w, 0.0f);
+      put_f32(w, z);
+      put_f32(w, uniform(w, 0.0f, 1.0f));
+      put_f32(w, uniform(w, 0.0f, 1.0f));
+
+      for (c = 0; c < p->uvs * 4; ++c)
+         put_f32(w, uniform(w, -1.0f, 1.0f));
+
+      /* BDEF1, BDEF2, BDEF4, SDEF and QDEF in turn */
+      put_u8(w, i % 5);
+      switch (i % 5) {
+         case 0:
+            put_index(w, w->bone, next(w) % p->bones);
+            break;
+         case 1:
+         case 3:
+            put_index(w, w->bone, next(w) % p->bones);
+            put_index(w, w->bone, next(w) % p->bones);
+            put_f32(w, uniform(w, 0.0f, 1.0f));
+
+            /* SDEF C, R0 and R1 */
+            for (c = 0; i % 5 == 3 && c < 9; ++c)
+               put_f32(w, uniform(w, -1.0f, 1.0f));
+            break;
+         default:
+            /* last bone is unused */
+            put_index(w, w->bone, next(w) % p->bones);
+            put_index(w, w->bone, next(w) % p->bones);
+            put_index(w, w->bone, next(w) % p->bones);
+            put_index(w, w->bone, -1);
+            put_f32(w, 0.5f);
+            put_f32(w, 0.3f);
+            put_f32(w, 0.2f);
+            put_f32(w, 0.0f);
+            break;
+      }
+
+      put_f32(w, (i & 1 ? 1.0f : 0.5f));
+   }
+}
+
+/* \brief write indices, triangles walk the vertices as in pmdgen */
+static void write_indices(writer *w, const pmxgen_params *p)
+{
+   unsigned int i, c, first;
+
+   put_u32(w, p->triangles * 3);
+   for (i = 0; i < p->triangles; ++i) {
+      first = (unsigned int)((unsigned long long)i * p->vertices / p->triangles);
+      for (c = 0; c < 3; ++c)
+         put_index(w, w->vertex, (first + next(w) % 16) % p->vertices);
+   }
+}
+
+/* \brief write textures, every other one with non-ASCII name */
+static void write_textures(writer *w, const pmxgen_params *p)
+{
+   unsigned int t;
+
+   put_u32(w, p->textures);
+   for (t = 0; t < p->textures; ++t)
+      put_numbered(w, (t & 1 ? "テクスチャ" : "tex"), t, (t & 1 ? ".bmp" : ".png"));
+}
+
+/* \brief write materials */
+static void write_materials(writer *w, const pmxgen_params *p)
+{
+   unsigned int m, c, first, faces;
+
+   put_u32(w, p->materials);
+   for (m = 0, first = 0; m < p->materials; ++m) {
+      faces = (unsigned int)((unsigned long long)p->triangles * (m + 1) / p->materials) - first;
+      first += faces;
+
+      put_numbered(w, "材質", m, "");
+      put_numbered(w, "material", m, "");
+
+      /* diffuse, specular, power and ambient */
+      for (c = 0; c < 11; ++c)
+         put_f32(w, uniform(w, 0.0f, 1.0f));
+
+      /* flags, edge color and size */
+      put_u8(w, m & 0x1F);
+      for (c = 0; c < 5; ++c)
+         put_f32(w, uniform(w, 0.0f, 1.0f));
+
+      /* texture, no sphere */
+      put_index(w, w->texture, (p->textures ? (int32_t)(m % p->textures) : -1));
+      put_index(w, w->texture, -1);
+      put_u8(w, 0);
+
+      /* shared toon or toon texture */
+      put_u8(w, m & 1);
+      if (m & 1)
+         put_u8(w, m % 10);
+      else
+         put_index(w, w->texture, (p->textures ? (int32_t)((m + 1) % p->textures) : -1));
+
+      put_text(w, "");
+      put_u32(w, faces * 3);
+   }
+}
+
+/* \brief write bones, the last ik of them with chains climbing towards the root */
+static void write_bones(writer *w, const pmxgen_params *p)
+{
+   unsigned int b, l, c, flags;
+
+   put_u32(w, p->bones);
+   for (b = 0; b < p->bones; ++b) {
+      flags = bone_flags[b % (sizeof(bone_flags) / sizeof(bone_flags[0]))] | (b + p->ik >= p->bones ? IK : 0);
+
+      put_numbered(w, "ボーン", b, "");
+      put_numbered(w, "bone", b, "");
+      put_f32(w, uniform(w, -2.0f, 2.0f));
+      put_f32(w, (float)b / (float)p->bones * 20.0f);
+      put_f32(w, uniform(w, -2.0f, 2.0f));
+      put_index(w, w->bone, (b ? (int32_t)(next(w) % b) : -1));
+      put_u32(w, 0);
+      put_u16(w, flags);
+
+      if (flags & TAIL_INDEX) {
+         put_index(w, w->bone, (b + 1 < p->bones ? (int32_t)b + 1 : -1));
+      } else {
+         for (c = 0; c < 3; ++c)
+            put_f32(w, uniform(w, -1.0f, 1.0f));
+      }
+
+      if (flags & (INHERIT_ROTATION | INHERIT_TRANSLATION)) {
+         put_index(w, w->bone, (b ? (int32_t)b - 1 : -1));
+         put_f32(w, 0.5f);
+      }
+
+      for (c = 0; (flags & FIXED_AXIS) && c < 3; ++c)
+         put_f32(w, (c == 0 ? 1.0f : 0.0f));
+
+      for (c = 0; (flags & LOCAL_AXIS) && c < 6; ++c)
+         put_f32(w, (c == 0 || c == 4 ? 1.0f : 0.0f));
+
+      if (flags & EXTERNAL_PARENT)
+         put_u32(w, b);
+
+      if (!(flags & IK))
+         continue;
+
+      /* target, loop count, limit angle and links */
+      put_index(w, w->bone, b - 1);
+      put_u32(w, 15 + b % 30);
+      put_f32(w, 0.5f);
+      put_u32(w, p->chain);
+
+      for (l = 0; l < p->chain; ++l) {
+         put_index(w, w->bone, b - 2 - l);
+         put_u8(w, l & 1);
+         for (c = 0; (l & 1) && c < 6; ++c)
+            put_f32(w, (c < 3 ? -1.0f : 1.0f));
+      }
+   }
+}
+
+/* \brief write vertex morphs and the extra morphs */
+static void write_morphs(writer *w, const pmxgen_params *p)
+{
+   const unsigned int group = (p->morphs < 4 ? p->morphs : 4);
+   unsigned int m, v, c;
+
+   put_u32(w, (p->morphs ? p->morphs + EXTRA_MORPHS : 0));
+   if (!p->morphs)
+      return;
+
+   for (m = 0; m < p->morphs; ++m) {
+      put_numbered(w, "モーフ", m, "");
+      put_numbered(w, "morph", m, "");
+      put_u8(w, 1 + m % 4);
+      put_u8(w, 1);
+      put_u32(w, p->morph_vertices);
+
+      for (v = 0; v < p->morph_vertices; ++v) {
+         put_index(w, w->vertex, next(w) % p->vertices);
+         for (c = 0; c < 3; ++c)
+            put_f32(w, uniform(w, -0.1f, 0.1f));
+      }
+   }
+
+   /* group of the first vertex morphs and the bone morph */
+   put_text(w, "グループ");
+   put_text(w, "group");
+   put_u8(w, 4);
+   put_u8(w, 0);
+   put_u32(w, group + 1);
+   for (m = 0; m < group; ++m) {
+      put_index(w, w->morph, m);
+      put_f32(w, 0.5f + m);
+   }
+   put_index(w, w->morph, p->morphs + 1);
+   put_f32(w, 1.0f);
+
+   put_text(w, "bone");
+   put_text(w, "bone");
+   put_u8(w, 4);
+   put_u8(w, 2);
+   put_u32(w, 1);
+   put_index(w, w->bone, 0);
+   for (c = 0; c < 7; ++c)
+      put_f32(w, (c == 6 ? 1.0f : 0.0f));
+
+   put_text(w, "uv");
+   put_text(w, "uv");
+   put_u8(w, 4);
+   put_u8(w, 3);
+   put_u32(w, 1);
+   put_index(w, w->vertex, 0);
+   for (c = 0; c < 4; ++c)
+      put_f32(w, 0.1f);
+
+   /* every material */
+   put_text(w, "material");
+   put_text(w, "material");
+   put_u8(w, 4);
+   put_u8(w, 8);
+   put_u32(w, 1);
+   put_index(w, w->material, -1);
+   put_u8(w, 0);
+   for (c = 0; c < 28; ++c)
+      put_f32(w, 0.0f);
+}
+
+/* \brief write root, expression and bone frames */
+static void write_frames(writer *w, const pmxgen_params *p)
+{
+   const unsigned int morphs = (p->morphs ? p->morphs + EXTRA_MORPHS : 0);
+   unsigned int f, e, first, count;
+
+   put_u32(w, 2 + p->frames);
+
+   put_text(w, "Root");
+   put_text(w, "Root");
+   put_u8(w, 1);
+   put_u32(w, (p->bones ? 1 : 0));
+   if (p->bones) {
+      put_u8(w, 0);
+      put_index(w, w->bone, 0);
+   }
+
+   put_text(w, "表情");
+   put_text(w, "Exp");
+   put_u8(w, 1);
+   put_u32(w, morphs);
+   for (e = 0; e < morphs; ++e) {
+      put_u8(w, 1);
+      put_index(w, w->morph, e);
+   }
+
+   /* bones past root split evenly between the frames */
+   for (f = 0, first = 1; f < p->frames; ++f) {
+      count = (p->bones > 1 ? (unsigned int)((unsigned long long)(p->bones - 1) * (f + 1) / p->frames) + 1 - first : 0);
+      put_numbered(w, "枠", f, "");
+      put_numbered(w, "frame", f, "");
+      put_u8(w, 0);
+      put_u32(w, count);
+
+      for (e = 0; e < count; ++e) {
+         put_u8(w, 0);
+         put_index(w, w->bone, first + e);
+      }
+
+      first += count;
+   }
+}
+
+/* \brief write rigid bodies, they are not loaded */
+static void write_rigids(writer *w, const pmxgen_params *p)
+{
+   unsigned int r, c;
+
+   put_u32(w, p->rigids);
+   for (r = 0; r < p->rigids; ++r) {
+      put_numbered(w, "剛体", r, "");
+      put_numbered(w, "rigid", r, "");
+      put_index(w, w->bone, (p->bones ? (int32_t)(r % p->bones) : -1));
+      put_u8(w, r % 16);
+      put_u16(w, 0xFFFF);
+      put_u8(w, r % 3);
+
+      /* size, position, rotation, mass, dampings, restitution and friction */
+      for (c = 0; c < 14; ++c)
+         put_f32(w, uniform(w, 0.0f, 1.0f));
+
+      put_u8(w, r % 3);
+   }
+
+}
+
+/* \brief write joints linking each rigid body to the next, they are not loaded */
+static void write_joints(writer *w, const pmxgen_params *p)
+{
+   unsigned int r, c;
+
+   put_u32(w, (p->rigids > 1 ? p->rigids - 1 : 0));
+   for (r = 0; r + 1 < p->rigids; ++r) {
+      put_numbered(w, "ジョイント", r, "");
+      put_numbered(w, "joint", r, "");
+      put_u8(w, 0);
+      put_index(w, w->rigid, r);
+      put_index(w, w->rigid, r + 1);
+
+      /* position, rotation, limits and springs */
+      for (c = 0; c < 24; ++c)
+         put_f32(w, uniform(w, -1.0f, 1.0f));
+   }
+}
+
+/* \brief write whole model, sections are measured when set */
+static void write_model(writer *w, const pmxgen_params *p, size_t *sections)
+{
+   static void (*const writers[PMXGEN_SECTIONS])(writer*, const pmxgen_params*) = {
+      write_header, write_vertices, write_indices, write_textures, write_materials,
+      write_bones, write_morphs, write_frames, write_rigids, write_joints
+   };
+   size_t start;
+   unsigned int s;
+
+   w->size = 0;
+   w->seed = p->seed * 0x9e3779b9u + 1;
+
+   for (s = 0; s < PMXGEN_SECTIONS; ++s) {
+      start = w->size;
+      writers[s](w, p);
+
+      if (sections)
+         sections[s] = w->size - start;
+   }
+}
+
+/* \brief generate model */
+int pmxgen(const pmxgen_params *params, pmxgen_model *model)
+{
+   const pmxgen_params *p = params;
+   writer w;
+
+   memset(model, 0, sizeof(pmxgen_model));
+
+   /* counts have to fit their fields and refer to something */
+   if ((p->vertices && !p->bones) || (p->triangles && (!p->vertices || !p->materials)) ||
+       p->triangles > 0x7FFFFFFF / 3 || p->vertices > 0x7FFFFFFF || p->bones > 0x7FFF ||
+       (p->ik && p->bones < p->ik + p->chain + 1) || (p->morphs && !p->vertices) ||
+       p->uvs > 4 || (p->width != 0 && p->width != 1 && p->width != 2 && p->width != 4) || p->utf8 > 1)
+      return 0;
+
+   memset(&w, 0, sizeof(w));
+   w.utf8 = p->utf8;
+   w.vertex = vertex_width(p->vertices, p->width);
+   w.texture = index_width(p->textures, p->width);
+   w.material = index_width(p->materials, p->width);
+   w.bone = index_width(p->bones, p->width);
+   w.morph = index_width((p->morphs ? p->morphs + EXTRA_MORPHS : 0), p->width);
+   w.rigid = index_width(p->rigids, p->width);
+
+   write_model(&w, p, NULL);
+
+   if (!(model->data = w.data = malloc(w.size)))
+      return 0;
+
+   model->size = w.size;
+   write_model(&w, p, model->sections);
+   return (w.size == model->size);
+}
+
+/* \brief free model */
+void pmxgen_free(pmxgen_model *model)
+{
+   if (model->data) free(model->data);
+   memset(model, 0, sizeof(pmxgen_model));
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,72 @@
+#ifndef __mmd_pmxgen_h__
+#define __mmd_pmxgen_h__
+
+#include <stddef.h>
+
+/* deterministic synthetic PMX 2.0 models for the tests,
+ * same parameters and seed always give the same bytes */
+
+/* sections in file order */
+enum {
+   PMXGEN_HEADER,
+   PMXGEN_VERTEX,
+   PMXGEN_INDEX,
+   PMXGEN_TEXTURE,
+   PMXGEN_MATERIAL,
+   PMXGEN_BONE,
+   PMXGEN_MORPH,
+   PMXGEN_FRAME,
+   PMXGEN_RIGID,
+   PMXGEN_JOINT,
+   PMXGEN_SECTIONS
+};
+
+typedef struct pmxgen_params {
+   /* mesh, vertex weights cycle through every weight type */
+   unsigned int vertices, triangles, materials;
+
+   /* distinct texture names shared by the materials */
+   unsigned int textures;
+
+   /* skeleton, ik bones are the last ones, chain is length of every IK chain */
+   unsigned int bones, ik, chain;
+
+   /* vertex morphs, and vertices of each. a group, bone,
+    * uv and material morph are added when there are any */
+   unsigned int morphs, morph_vertices;
+
+   /* bone display frames besides the root and expression frames */
+   unsigned int frames;
+
+   /* rigid bodies, joints link each to the next */
+   unsigned int rigids;
+
+   /* 0 for UTF16LE text, 1 for UTF8 */
+   unsigned int utf8;
+
+   /* additional uvs, 0 - 4 */
+   unsigned int uvs;
+
+   /* least bytes of index fields, 1, 2 or 4. wider when count needs it */
+   unsigned int width;
+
+   unsigned int seed;
+} pmxgen_params;
+
+typedef struct pmxgen_model {
+   unsigned char *data;
+   size_t size;
+
+   /* bytes of every section, PMXGEN_* */
+   size_t sections[PMXGEN_SECTIONS];
+} pmxgen_model;
+
+/* generate model, returns 0 when parameters do not fit PMX */
+int pmxgen(const pmxgen_params *params, pmxgen_model *model);
+
+/* free generated model */
+void pmxgen_free(pmxgen_model *model);
+
+#endif /* __mmd_pmxgen_h__ */
+
+/* vim: set ts=8 sw=3 tw=0 :*/
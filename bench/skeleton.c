@@ -0,0 +1,178 @@
+#include "../mmd.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* microbenchmark for world transform propagation,
+ * compares recursive walk over mmd_bone parents in file order
+ * with mmd_skeleton on shuffled bone hierarchy, for many characters.
+ *
+ * usage: mmd_skeleton_bench [bones] [characters] [frames] */
+
+/* \brief random tree of count bones, stored in shuffled order */
+static int generate(mmd_data *mmd, unsigned int count)
+{
+   unsigned int *slot, i, j, t;
+
+   memset(mmd, 0, sizeof(mmd_data));
+   mmd->num_bones = (unsigned short)count;
+
+   if (!(mmd->bones = calloc(count, sizeof(mmd_bone))) || !(slot = malloc(count * sizeof(unsigned int))))
+      return 0;
+
+   for (i = 0; i < count; ++i)
+      slot[i] = i;
+
+   for (i = count - 1; i > 0; --i) {
+      j = bench_rand() % (i + 1);
+      t = slot[i]; slot[i] = slot[j]; slot[j] = t;
+   }
+
+   /* tree bone i hangs from one of the few bones before it */
+   for (i = 0; i < count; ++i) {
+      mmd->bones[slot[i]].parent_bone_index = (unsigned short)(i ? slot[i - 1 - bench_rand() % (i < 4 ? i : 4)] : 0xFFFF);
+      mmd->bones[slot[i]].head_pos[0] = bench_rnd() * 10.0f;
+      mmd->bones[slot[i]].head_pos[1] = bench_rnd() * 10.0f;
+      mmd->bones[slot[i]].head_pos[2] = bench_rnd() * 10.0f;
+   }
+
+   free(slot);
+   return 1;
+}
+
+/* \brief random rotations and translations */
+static void animate(mmd_pose *pose)
+{
+   unsigned int b;
+   float len;
+
+   for (b = 0; b < pose->num_bones; ++b) {
+      pose->rotations[b * 4 + 0] = bench_rnd();
+      pose->rotations[b * 4 + 1] = bench_rnd();
+      pose->rotations[b * 4 + 2] = bench_rnd();
+      pose->rotations[b * 4 + 3] = 2.0f;
+      len = sqrtf(pose->rotations[b * 4] * pose->rotations[b * 4] + pose->rotations[b * 4 + 1] * pose->rotations[b * 4 + 1] +
+                  pose->rotations[b * 4 + 2] * pose->rotations[b * 4 + 2] + 4.0f);
+      pose->rotations[b * 4 + 0] /= len;
+      pose->rotations[b * 4 + 1] /= len;
+      pose->rotations[b * 4 + 2] /= len;
+      pose->rotations[b * 4 + 3] /= len;
+      pose->translations[b * 3 + 1] = bench_rnd() * 0.1f;
+   }
+}
+
+/* \brief world transform of bone by walking to its parent first */
+static void walk(const mmd_data *mmd, const mmd_pose *pose, unsigned int b, float *wp, float *wq, unsigned char *done)
+{
+   const float *q = &pose->rotations[b * 4];
+   float t[3], tx, ty, tz, *p, *r;
+   unsigned int c, parent = mmd->bones[b].parent_bone_index;
+
+   if (done[b])
+      return;
+
+   for (c = 0; c < 3; ++c)
+      t[c] = mmd->bones[b].head_pos[c] + pose->translations[b * 3 + c] - (parent < mmd->num_bones ? mmd->bones[parent].head_pos[c] : 0.0f);
+
+   if (parent >= mmd->num_bones) {
+      memcpy(&wp[b * 3], t, sizeof(t));
+      memcpy(&wq[b * 4], q, 4 * sizeof(float));
+      done[b] = 1;
+      return;
+   }
+
+   walk(mmd, pose, parent, wp, wq, done);
+   p = &wp[parent * 3];
+   r = &wq[parent * 4];
+
+   tx = 2.0f * (r[1] * t[2] - r[2] * t[1]);
+   ty = 2.0f * (r[2] * t[0] - r[0] * t[2]);
+   tz = 2.0f * (r[0] * t[1] - r[1] * t[0]);
+   wp[b * 3 + 0] = p[0] + t[0] + r[3] * tx + (r[1] * tz - r[2] * ty);
+   wp[b * 3 + 1] = p[1] + t[1] + r[3] * ty + (r[2] * tx - r[0] * tz);
+   wp[b * 3 + 2] = p[2] + t[2] + r[3] * tz + (r[0] * ty - r[1] * tx);
+
+   wq[b * 4 + 0] = r[3] * q[0] + r[0] * q[3] + r[1] * q[2] - r[2] * q[1];
+   wq[b * 4 + 1] = r[3] * q[1] - r[0] * q[2] + r[1] * q[3] + r[2] * q[0];
+   wq[b * 4 + 2] = r[3] * q[2] + r[0] * q[1] - r[1] * q[0] + r[2] * q[3];
+   wq[b * 4 + 3] = r[3] * q[3] - r[0] * q[0] - r[1] * q[1] - r[2] * q[2];
+   done[b] = 1;
+}
+
+int main(int argc, char **argv)
+{
+   unsigned int count = (argc > 1 ? strtoul(argv[1], NULL, 10) : 200);
+   unsigned int characters = (argc > 2 ? strtoul(argv[2], NULL, 10) : 100);
+   unsigned int frames = (argc > 3 ? strtoul(argv[3], NULL, 10) : 100);
+   float *wp, *wq, position[3], rotation[4], err = 0.0f;
+   unsigned char *done;
+   mmd_pose **poses;
+   mmd_skeleton *skeleton;
+   mmd_data mmd;
+   unsigned int f, i, b, c;
+   double start, walked, swept;
+
+   if (count < 1 || count > 0xFFFE)
+      return EXIT_FAILURE;
+
+   if (!generate(&mmd, count) || !(skeleton = mmd_skeleton_new(&mmd)) ||
+       !(poses = calloc(characters + 1, sizeof(mmd_pose*))) ||
+       !(wp = calloc(count * 3, sizeof(float))) || !(wq = calloc(count * 4, sizeof(float))) ||
+       !(done = calloc(count, 1)))
+      return EXIT_FAILURE;
+
+   for (i = 0; i < characters; ++i) {
+      if (!(poses[i] = mmd_pose_new(&mmd)))
+         return EXIT_FAILURE;
+      animate(poses[i]);
+   }
+
+   start = bench_now();
+   for (f = 0; f < frames; ++f) {
+      for (i = 0; i < characters; ++i) {
+         memset(done, 0, count);
+         for (b = 0; b < count; ++b)
+            walk(&mmd, poses[i], b, wp, wq, done);
+      }
+   }
+   walked = bench_now() - start;
+
+   start = bench_now();
+   for (f = 0; f < frames; ++f)
+      for (i = 0; i < characters; ++i)
+         mmd_skeleton_update(skeleton, poses[i]);
+   swept = bench_now() - start;
+
+   for (b = 0; b < count; ++b) {
+      mmd_skeleton_world(skeleton, b, position, rotation);
+      for (c = 0; c < 3; ++c)
+         err = fmaxf(err, fabsf(position[c] - wp[b * 3 + c]) / fmaxf(1.0f, fabsf(wp[b * 3 + c])));
+      for (c = 0; c < 4; ++c)
+         err = fmaxf(err, fabsf(rotation[c] - wq[b * 4 + c]));
+   }
+
+   printf("%u bones, %u characters, %u frames\n", count, characters, frames);
+   printf("%-10s %12.0f bones/ms\n", "walk", (walked > 0 ? (double)count * characters * frames / walked / 1000 : 0));
+   printf("%-10s %12.0f bones/ms\n", "skeleton", (swept > 0 ? (double)count * characters * frames / swept / 1000 : 0));
+
+   for (i = 0; i < characters; ++i)
+      mmd_pose_free(poses[i]);
+
+   free(poses);
+   free(wp);
+   free(wq);
+   free(done);
+   free(mmd.bones);
+   mmd_skeleton_free(skeleton);
+
+   if (err > 1e-4f) {
+      fprintf(stderr, "skeleton: world transforms differ from walk (%g)\n", err);
+      return EXIT_FAILURE;
+   }
+
+   return EXIT_SUCCESS;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,186 @@
+#include "../internal.h"
+#include "buffer.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* microbenchmark for PMD vertex decoding,
+ * compares the old per-field chckBuffer loop against
+ * every bulk kernel supported by this cpu,
+ * and the best one with model bounds.
+ *
+ * usage: mmd_vertex_bench [vertices] [rounds] */
+
+enum {
+   VERTEX_SIZE = sizeof(uint32_t) * 9 + 2
+};
+
+typedef struct output {
+   float *vertices, *normals, *coords;
+   mmd_weight *weights;
+} output;
+
+/* \brief the per-field loop mmd_read_vertex_data used to have */
+static void decode_per_field(const unsigned char *data, size_t count, float *vertices, float *normals, float *coords, mmd_weight *weights)
+{
+   chckBuffer *buf;
+   size_t i;
+
+   if (!(buf = chckBufferNew(count * VERTEX_SIZE, CHCK_BUFFER_ENDIAN_LITTLE)))
+      return;
+
+   memcpy(chckBufferGetPointer(buf), data, count * VERTEX_SIZE);
+
+   for (i = 0; i < count; ++i) {
+      chckBufferRead(&vertices[i*3], sizeof(uint32_t), 3, buf);
+      if (!chckBufferIsNativeEndian(buf))
+         chckBufferSwap(&vertices[i*3], sizeof(uint32_t), 3);
+
+      chckBufferRead(&normals[i*3], sizeof(uint32_t), 3, buf);
+      if (!chckBufferIsNativeEndian(buf))
+         chckBufferSwap(&normals[i*3], sizeof(uint32_t), 3);
+
+      chckBufferRead(&coords[i*2], sizeof(uint32_t), 2, buf);
+      if (!chckBufferIsNativeEndian(buf))
+         chckBufferSwap(&coords[i*2], sizeof(uint32_t), 2);
+
+      chckBufferReadUInt16(buf, &weights[i].bone_index[0]);
+      chckBufferReadUInt16(buf, &weights[i].bone_index[1]);
+      chckBufferReadUInt8(buf, &weights[i].weight);
+      chckBufferReadUInt8(buf, &weights[i].edge_flag);
+   }
+
+   chckBufferFree(buf);
+}
+
+/* \brief deterministic vertex records */
+static unsigned char* generate(size_t count)
+{
+   unsigned char *data, *p;
+   uint32_t bits;
+   size_t i, f;
+   float v;
+
+   if (!(data = malloc(count * VERTEX_SIZE)))
+      return NULL;
+
+   for (i = 0, p = data; i < count; ++i) {
+      for (f = 0; f < 8; ++f, p += sizeof(float)) {
+         v = bench_rnd() * 10.0f;
+         memcpy(p, &v, sizeof(float));
+      }
+
+      bits = bench_rand();
+      memcpy(p, &bits, sizeof(uint32_t));
+      p += sizeof(uint32_t);
+      *p++ = (unsigned char)(bits % 101);
+      *p++ = (unsigned char)(bits & 1);
+   }
+
+   return data;
+}
+
+static int output_alloc(output *out, size_t count)
+{
+   out->vertices = calloc(count, 3 * sizeof(float));
+   out->normals = calloc(count, 3 * sizeof(float));
+   out->coords = calloc(count, 2 * sizeof(float));
+   out->weights = calloc(count, sizeof(mmd_weight));
+   return (out->vertices && out->normals && out->coords && out->weights);
+}
+
+static void output_free(output *out)
+{
+   free(out->vertices);
+   free(out->normals);
+   free(out->coords);
+   free(out->weights);
+}
+
+static int output_equal(const output *a, const output *b, size_t count)
+{
+   size_t i;
+
+   for (i = 0; i < count; ++i) {
+      if (a->weights[i].bone_index[0] != b->weights[i].bone_index[0] ||
+          a->weights[i].bone_index[1] != b->weights[i].bone_index[1] ||
+          a->weights[i].weight != b->weights[i].weight ||
+          a->weights[i].edge_flag != b->weights[i].edge_flag)
+         return 0;
+   }
+
+   return (!memcmp(a->vertices, b->vertices, count * 3 * sizeof(float)) &&
+           !memcmp(a->normals, b->normals, count * 3 * sizeof(float)) &&
+           !memcmp(a->coords, b->coords, count * 2 * sizeof(float)));
+}
+
+/* \brief best kernel with model bounds taken after every chunk */
+static void decode_bounded(const unsigned char *data, size_t count, float *vertices, float *normals, float *coords, mmd_weight *weights)
+{
+   mmd_bounds bounds;
+   mmd_bounds_reset(&bounds);
+   mmd_decode_vertices_bounded(data, count, vertices, normals, coords, weights, &bounds);
+}
+
+static double run(const char *name, mmd_vertex_decode_fn decode, const unsigned char *data, size_t count, unsigned int rounds, output *out)
+{
+   unsigned int r;
+   double start, elapsed, rate;
+
+   /* warm up */
+   decode(data, count, out->vertices, out->normals, out->coords, out->weights);
+
+   start = mmd_time();
+   for (r = 0; r < rounds; ++r)
+      decode(data, count, out->vertices, out->normals, out->coords, out->weights);
+   elapsed = mmd_time() - start;
+
+   rate = (elapsed > 0 ? (double)count * rounds / elapsed : 0);
+   printf("%-10s %12.0f vertices/sec\n", name, rate);
+   return rate;
+}
+
+int main(int argc, char **argv)
+{
+   size_t count = (argc > 1 ? strtoul(argv[1], NULL, 10) : 100000);
+   unsigned int rounds = (argc > 2 ? strtoul(argv[2], NULL, 10) : 50);
+   const mmd_vertex_kernel *kernel;
+   unsigned char *data;
+   output reference, out;
+   int ret = EXIT_SUCCESS;
+
+   if (!(data = generate(count)) || !output_alloc(&reference, count) || !output_alloc(&out, count))
+      return EXIT_FAILURE;
+
+   printf("%lu vertices, %u rounds\n", (unsigned long)count, rounds);
+   run("per-field", decode_per_field, data, count, rounds, &reference);
+
+   for (kernel = mmd_vertex_kernels(); kernel->name; ++kernel) {
+      if (!kernel->supported())
+         continue;
+
+      memset(out.vertices, 0, count * 3 * sizeof(float));
+      run(kernel->name, kernel->decode, data, count, rounds, &out);
+
+      if (!output_equal(&reference, &out, count)) {
+         fprintf(stderr, "%s: output differs from per-field loop\n", kernel->name);
+         ret = EXIT_FAILURE;
+      }
+   }
+
+   memset(out.vertices, 0, count * 3 * sizeof(float));
+   run("bounded", decode_bounded, data, count, rounds, &out);
+
+   if (!output_equal(&reference, &out, count)) {
+      fprintf(stderr, "bounded: output differs from per-field loop\n");
+      ret = EXIT_FAILURE;
+   }
+
+   output_free(&reference);
+   output_free(&out);
+   free(data);
+   return ret;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
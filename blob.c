@@ -0,0 +1,240 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h> /* for memcmp, memcpy */
+#include <assert.h> /* for assert */
+
+/* bytes before blob data, keeps the data aligned as arena arrays */
+#define MMD_BLOB_HEADER MMD_ARENA_ALIGN_SIZE(sizeof(mmd_blob))
+
+/* \brief immutable array, data follows after MMD_BLOB_HEADER */
+typedef struct mmd_blob {
+   /* next blob of same bucket */
+   struct mmd_blob *next;
+
+   unsigned long long hash;
+   size_t size;
+
+   /* arrays of mmd_data pointing to it */
+   unsigned int refs;
+} mmd_blob;
+
+struct mmd_blob_store {
+   /* guards everything below, many loaders may share the store */
+   mmd_mutex *lock;
+
+   /* references from mmd_data and users */
+   unsigned int refs;
+
+   /* chained hash table of blobs */
+   mmd_blob **buckets;
+   unsigned int num_buckets, num_blobs;
+
+   /* data bytes of all blobs */
+   size_t bytes;
+};
+
+/* \brief blob of data returned by mmd_blob_store_intern */
+static mmd_blob* mmd_blob_of(const void *data)
+{
+   return (mmd_blob*)((unsigned char*)data - MMD_BLOB_HEADER);
+}
+
+/* \brief data of blob */
+static void* mmd_blob_data(mmd_blob *blob)
+{
+   return (unsigned char*)blob + MMD_BLOB_HEADER;
+}
+
+/* \brief blob with same bytes, store is locked */
+static mmd_blob* mmd_blob_find(mmd_blob_store *store, const void *data, size_t size, unsigned long long hash)
+{
+   mmd_blob *blob;
+
+   if (!store->num_buckets)
+      return NULL;
+
+   for (blob = store->buckets[hash & (store->num_buckets - 1)]; blob; blob = blob->next)
+      if (blob->hash == hash && blob->size == size && !memcmp(mmd_blob_data(blob), data, size))
+         return blob;
+
+   return NULL;
+}
+
+/* \brief grow the hash table, store is locked */
+static int mmd_blob_rehash(mmd_blob_store *store)
+{
+   unsigned int i, b, num_buckets = (store->num_buckets ? store->num_buckets * 2 : 64);
+   mmd_blob **buckets, *blob, *next;
+
+   if (!(buckets = calloc(num_buckets, sizeof(mmd_blob*))))
+      return RETURN_FAIL;
+
+   for (i = 0; i < store->num_buckets; ++i) {
+      for (blob = store->buckets[i]; blob; blob = next) {
+         next = blob->next;
+         b = blob->hash & (num_buckets - 1);
+         blob->next = buckets[b];
+         buckets[b] = blob;
+      }
+   }
+
+   if (store->buckets) free(store->buckets);
+   store->buckets = buckets;
+   store->num_buckets = num_buckets;
+   return RETURN_OK;
+}
+
+/* \brief create blob store */
+mmd_blob_store* mmd_blob_store_new(void)
+{
+   mmd_blob_store *store;
+
+   if (!(store = calloc(1, sizeof(mmd_blob_store))))
+      return NULL;
+
+   if (!(store->lock = mmd_mutex_new())) {
+      free(store);
+      return NULL;
+   }
+
+   store->refs = 1;
+   return store;
+}
+
+/* \brief add reference to blob store */
+mmd_blob_store* mmd_blob_store_ref(mmd_blob_store *store)
+{
+   assert(store);
+   mmd_mutex_lock(store->lock);
+   store->refs++;
+   mmd_mutex_unlock(store->lock);
+   return store;
+}
+
+/* \brief drop reference to blob store */
+void mmd_blob_store_free(mmd_blob_store *store)
+{
+   mmd_blob *blob, *next;
+   unsigned int i, refs;
+   assert(store && store->refs);
+
+   mmd_mutex_lock(store->lock);
+   refs = --store->refs;
+   mmd_mutex_unlock(store->lock);
+
+   if (refs)
+      return;
+
+   /* every mmd_data holds a reference, so blobs are released already */
+   for (i = 0; i < store->num_buckets; ++i) {
+      for (blob = store->buckets[i]; blob; blob = next) {
+         next = blob->next;
+         free(blob);
+      }
+   }
+
+   if (store->buckets) free(store->buckets);
+   mmd_mutex_free(store->lock);
+   free(store);
+}
+
+/* \brief shared copy of size bytes of data, with reference for caller */
+const void* mmd_blob_store_intern(mmd_blob_store *store, const void *data, size_t size)
+{
+   unsigned long long hash;
+   mmd_blob *blob, *copy;
+   unsigned int b;
+   assert(store && (data || !size));
+
+   /* hash outside the lock, it is most of the work */
+   hash = mmd_cache_hash(data, size);
+
+   mmd_mutex_lock(store->lock);
+   if ((blob = mmd_blob_find(store, data, size, hash)))
+      blob->refs++;
+   mmd_mutex_unlock(store->lock);
+
+   if (blob)
+      return mmd_blob_data(blob);
+
+   /* first of its kind, copied without holding the lock */
+   if (size > (size_t)~0 - MMD_BLOB_HEADER || !(copy = malloc(MMD_BLOB_HEADER + size)))
+      return NULL;
+
+   copy->hash = hash;
+   copy->size = size;
+   copy->refs = 1;
+   memcpy(mmd_blob_data(copy), data, size);
+
+   mmd_mutex_lock(store->lock);
+
+   /* another loader may have stored it meanwhile */
+   if ((blob = mmd_blob_find(store, data, size, hash))) {
+      blob->refs++;
+      mmd_mutex_unlock(store->lock);
+      free(copy);
+      return mmd_blob_data(blob);
+   }
+
+   /* keep load factor under 1 */
+   if (store->num_blobs + 1 > store->num_buckets && mmd_blob_rehash(store) != RETURN_OK) {
+      mmd_mutex_unlock(store->lock);
+      free(copy);
+      return NULL;
+   }
+
+   b = hash & (store->num_buckets - 1);
+   copy->next = store->buckets[b];
+   store->buckets[b] = copy;
+   store->num_blobs++;
+   store->bytes += size;
+   mmd_mutex_unlock(store->lock);
+   return mmd_blob_data(copy);
+}
+
+/* \brief drop reference of mmd_blob_store_intern, frees blob with the last one */
+void mmd_blob_store_release(mmd_blob_store *store, const void *data)
+{
+   mmd_blob *blob = mmd_blob_of(data), **link;
+   assert(store && data && blob->refs);
+
+   mmd_mutex_lock(store->lock);
+
+   if (--blob->refs) {
+      mmd_mutex_unlock(store->lock);
+      return;
+   }
+
+   for (link = &store->buckets[blob->hash & (store->num_buckets - 1)]; *link != blob; link = &(*link)->next);
+   *link = blob->next;
+   store->num_blobs--;
+   store->bytes -= blob->size;
+   mmd_mutex_unlock(store->lock);
+   free(blob);
+}
+
+/* \brief number of distinct arrays stored */
+unsigned int mmd_blob_store_count(const mmd_blob_store *store)
+{
+   unsigned int count;
+   assert(store);
+
+   mmd_mutex_lock(store->lock);
+   count = store->num_blobs;
+   mmd_mutex_unlock(store->lock);
+   return count;
+}
+
+/* \brief bytes of stored arrays */
+size_t mmd_blob_store_size(const mmd_blob_store *store)
+{
+   size_t bytes;
+   assert(store);
+
+   mmd_mutex_lock(store->lock);
+   bytes = store->bytes;
+   mmd_mutex_unlock(store->lock);
+   return bytes;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,362 @@
+#include "internal.h"
+#include <float.h> /* for FLT_MAX */
+#include <math.h> /* for sqrtf, fabsf */
+#include <string.h> /* for memcpy */
+#include <assert.h> /* for assert */
+
+#if defined(MMD_HAS_SSE2)
+#  include <emmintrin.h>
+#endif
+
+#if defined(MMD_HAS_NEON)
+#  include <arm_neon.h>
+#endif
+
+enum {
+   /* positions whose box is tested against the sphere at once */
+   MMD_BOUNDS_BLOCK = 64
+};
+
+/* bounding volumes.
+ *
+ * boxes are exact, spheres grow point by point to contain
+ * every point seen so far (Ritter), and fall back to the sphere
+ * around the box whenever that one is smaller. both take single
+ * pass, so the model bounds can follow vertex decoding.
+ * the box sphere is only tried once all points are in,
+ * trying it earlier would make the result depend on how
+ * the points were split into mmd_bounds_add calls.
+ * blocks of positions whose box is inside the sphere are not
+ * visited point by point, which is nearly all of them. */
+
+/* \brief empty bounds */
+void mmd_bounds_reset(mmd_bounds *bounds)
+{
+   unsigned int c;
+   assert(bounds);
+
+   for (c = 0; c < 3; ++c) {
+      bounds->min[c] = FLT_MAX;
+      bounds->max[c] = -FLT_MAX;
+      bounds->center[c] = 0.0f;
+   }
+
+   bounds->radius = -1.0f;
+}
+
+/* \brief grow sphere to contain p */
+static inline void mmd_sphere_add(float *center, float *radius, const float *p)
+{
+   const float d[3] = { p[0] - center[0], p[1] - center[1], p[2] - center[2] };
+   float len2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2], len, grown, t;
+
+   if (*radius < 0.0f) {
+      memcpy(center, p, 3 * sizeof(float));
+      *radius = 0.0f;
+      return;
+   }
+
+   if (len2 <= *radius * *radius)
+      return;
+
+   /* new sphere touches the old one on the far side */
+   len = sqrtf(len2);
+   grown = (*radius + len) * 0.5f;
+   t = (grown - *radius) / len;
+   center[0] += d[0] * t;
+   center[1] += d[1] * t;
+   center[2] += d[2] * t;
+   *radius = grown;
+}
+
+/* \brief use sphere around the box when it is tighter */
+void mmd_bounds_tighten(mmd_bounds *bounds)
+{
+   float half[3], radius;
+   unsigned int c;
+
+   if (bounds->radius < 0.0f)
+      return;
+
+   for (c = 0; c < 3; ++c)
+      half[c] = (bounds->max[c] - bounds->min[c]) * 0.5f;
+
+   radius = sqrtf(half[0] * half[0] + half[1] * half[1] + half[2] * half[2]);
+
+   if (radius >= bounds->radius)
+      return;
+
+   for (c = 0; c < 3; ++c)
+      bounds->center[c] = bounds->min[c] + half[c];
+
+   bounds->radius = radius;
+}
+
+/* \brief add single point, box and sphere */
+static inline void mmd_bounds_add_point(mmd_bounds *bounds, const float *p)
+{
+   unsigned int c;
+
+   for (c = 0; c < 3; ++c) {
+      bounds->min[c] = (p[c] < bounds->min[c] ? p[c] : bounds->min[c]);
+      bounds->max[c] = (p[c] > bounds->max[c] ? p[c] : bounds->max[c]);
+   }
+
+   mmd_sphere_add(bounds->center, &bounds->radius, p);
+}
+
+/* \brief box of count positions */
+static void mmd_box(const float *positions, size_t count, float *lo, float *hi)
+{
+   size_t i = 0;
+   unsigned int c;
+
+   memcpy(lo, positions, 3 * sizeof(float));
+   memcpy(hi, positions, 3 * sizeof(float));
+
+#if defined(MMD_HAS_SSE2)
+   {
+      /* 4th lane is x of next position, it is never stored */
+      __m128 vlo = _mm_setr_ps(lo[0], lo[1], lo[2], lo[2]), vhi = vlo, p;
+      float l[4], h[4];
+
+      for (; i + 1 < count; ++i) {
+         p = _mm_loadu_ps(&positions[i * 3]);
+         vlo = _mm_min_ps(vlo, p);
+         vhi = _mm_max_ps(vhi, p);
+      }
+
+      _mm_storeu_ps(l, vlo);
+      _mm_storeu_ps(h, vhi);
+      memcpy(lo, l, 3 * sizeof(float));
+      memcpy(hi, h, 3 * sizeof(float));
+   }
+#elif defined(MMD_HAS_NEON)
+   {
+      const float first[4] = { lo[0], lo[1], lo[2], lo[2] };
+      float32x4_t vlo = vld1q_f32(first), vhi = vlo, p;
+      float l[4], h[4];
+
+      for (; i + 1 < count; ++i) {
+         p = vld1q_f32(&positions[i * 3]);
+         vlo = vminq_f32(vlo, p);
+         vhi = vmaxq_f32(vhi, p);
+      }
+
+      vst1q_f32(l, vlo);
+      vst1q_f32(h, vhi);
+      memcpy(lo, l, 3 * sizeof(float));
+      memcpy(hi, h, 3 * sizeof(float));
+   }
+#endif
+
+   for (; i < count; ++i) {
+      for (c = 0; c < 3; ++c) {
+         lo[c] = (positions[i * 3 + c] < lo[c] ? positions[i * 3 + c] : lo[c]);
+         hi[c] = (positions[i * 3 + c] > hi[c] ? positions[i * 3 + c] : hi[c]);
+      }
+   }
+}
+
+/* \brief is box inside sphere of bounds? */
+static int mmd_sphere_contains_box(const mmd_bounds *bounds, const float *lo, const float *hi)
+{
+   float d, far2 = 0.0f;
+   unsigned int c;
+
+   if (bounds->radius < 0.0f)
+      return 0;
+
+   /* farthest corner from center */
+   for (c = 0; c < 3; ++c) {
+      d = (bounds->center[c] - lo[c] > hi[c] - bounds->center[c] ? bounds->center[c] - lo[c] : hi[c] - bounds->center[c]);
+      far2 += d * d;
+   }
+
+   return far2 <= bounds->radius * bounds->radius;
+}
+
+/* \brief grow bounds by count positions */
+void mmd_bounds_add(mmd_bounds *bounds, const float *positions, size_t count)
+{
+   float lo[3], hi[3];
+   size_t i, j, n;
+   unsigned int c;
+   assert(bounds && (positions || !count));
+
+   for (i = 0; i < count; i += n) {
+      n = (count - i < MMD_BOUNDS_BLOCK ? count - i : MMD_BOUNDS_BLOCK);
+      mmd_box(&positions[i * 3], n, lo, hi);
+
+      for (c = 0; c < 3; ++c) {
+         bounds->min[c] = (lo[c] < bounds->min[c] ? lo[c] : bounds->min[c]);
+         bounds->max[c] = (hi[c] > bounds->max[c] ? hi[c] : bounds->max[c]);
+      }
+
+      if (mmd_sphere_contains_box(bounds, lo, hi))
+         continue;
+
+      for (j = i; j < i + n; ++j)
+         mmd_sphere_add(bounds->center, &bounds->radius, &positions[j * 3]);
+   }
+}
+
+/* \brief merge b into a */
+static void mmd_bounds_merge(mmd_bounds *a, const mmd_bounds *b)
+{
+   float d[3], len, radius, t;
+   unsigned int c;
+
+   if (b->radius < 0.0f)
+      return;
+
+   if (a->radius < 0.0f) {
+      *a = *b;
+      return;
+   }
+
+   for (c = 0; c < 3; ++c) {
+      a->min[c] = (b->min[c] < a->min[c] ? b->min[c] : a->min[c]);
+      a->max[c] = (b->max[c] > a->max[c] ? b->max[c] : a->max[c]);
+      d[c] = b->center[c] - a->center[c];
+   }
+
+   len = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+
+   /* one sphere inside the other */
+   if (len + b->radius <= a->radius) {
+      mmd_bounds_tighten(a);
+      return;
+   }
+
+   if (len + a->radius <= b->radius) {
+      memcpy(a->center, b->center, sizeof(a->center));
+      a->radius = b->radius;
+      mmd_bounds_tighten(a);
+      return;
+   }
+
+   radius = (len + a->radius + b->radius) * 0.5f;
+   t = (radius - a->radius) / len;
+
+   for (c = 0; c < 3; ++c)
+      a->center[c] += d[c] * t;
+
+   a->radius = radius;
+   mmd_bounds_tighten(a);
+}
+
+/* \brief bounds of faces of every material */
+void mmd_material_bounds(mmd_data *mmd)
+{
+   unsigned int m, i, first = 0, count, index, num_indices;
+   assert(mmd);
+
+   /* mesh skipped by mmd_set_sections leaves bounds empty */
+   num_indices = ((mmd->indices || mmd->indices32) && mmd->vertices ? mmd->num_indices : 0);
+
+   for (m = 0; mmd->materials && m < mmd->num_materials; ++m) {
+      mmd_bounds_reset(&mmd->materials[m].bounds);
+
+      count = (mmd->materials[m].face < num_indices - first ? mmd->materials[m].face : num_indices - first);
+      for (i = first; i < first + count; ++i) {
+         index = (mmd->indices32 ? mmd->indices32[i] : mmd->indices[i]);
+         if (index < mmd->num_vertices)
+            mmd_bounds_add_point(&mmd->materials[m].bounds, &mmd->vertices[(size_t)index * 3]);
+      }
+
+      mmd_bounds_tighten(&mmd->materials[m].bounds);
+      first += count;
+   }
+}
+
+/* \brief bounds of vertices weighted to every bone */
+void mmd_bone_bounds(mmd_data *mmd)
+{
+   const mmd_weight *weight;
+   unsigned int b, i, b0, b1;
+   assert(mmd);
+
+   if (!mmd->bones || !mmd->num_bones)
+      return;
+
+   for (b = 0; b < mmd->num_bones; ++b)
+      mmd_bounds_reset(&mmd->bones[b].bounds);
+
+   /* bone 0 has weight% of vertex, bone 1 the rest.
+    * bones out of range count as the first one, as in mmd_deform */
+   for (i = 0; mmd->weights && mmd->vertices && i < mmd->num_vertices; ++i) {
+      weight = &mmd->weights[i];
+      b0 = (weight->bone_index[0] < mmd->num_bones ? weight->bone_index[0] : 0);
+      b1 = (weight->bone_index[1] < mmd->num_bones ? weight->bone_index[1] : 0);
+
+      if (weight->weight > 0)
+         mmd_bounds_add_point(&mmd->bones[b0].bounds, &mmd->vertices[i * 3]);
+
+      if (weight->weight < 100)
+         mmd_bounds_add_point(&mmd->bones[b1].bounds, &mmd->vertices[i * 3]);
+   }
+
+   for (b = 0; b < mmd->num_bones; ++b)
+      mmd_bounds_tighten(&mmd->bones[b].bounds);
+}
+
+/* \brief recompute every bounds of mmd */
+void mmd_update_bounds(mmd_data *mmd)
+{
+   assert(mmd);
+
+   mmd_bounds_reset(&mmd->bounds);
+   mmd_bounds_add(&mmd->bounds, mmd->vertices, mmd->num_vertices);
+   mmd_bounds_tighten(&mmd->bounds);
+
+   if (mmd->materials && (mmd->indices || mmd->indices32 || !mmd->num_indices))
+      mmd_material_bounds(mmd);
+
+   if (mmd->bones && (mmd->weights || !mmd->num_vertices))
+      mmd_bone_bounds(mmd);
+}
+
+/* \brief bounds of skinned mesh from bone bounds and palette */
+void mmd_skinned_bounds(const mmd_data *mmd, const float *palette, mmd_bounds *out)
+{
+   const mmd_bounds *in;
+   const float *m;
+   mmd_bounds moved;
+   float center[3], half[3], mid, extent, scale, column;
+   unsigned int b, r, c;
+   assert(mmd && (palette || !mmd->num_bones) && out);
+
+   mmd_bounds_reset(out);
+
+   /* blended vertex lies between its two bone transforms,
+    * so union of every moved bone bounds contains it */
+   for (b = 0; b < mmd->num_bones; ++b) {
+      in = &mmd->bones[b].bounds;
+      m = &palette[b * 16];
+
+      if (in->radius < 0.0f)
+         continue;
+
+      for (c = 0; c < 3; ++c) {
+         center[c] = (in->min[c] + in->max[c]) * 0.5f;
+         half[c] = (in->max[c] - in->min[c]) * 0.5f;
+      }
+
+      for (r = 0, scale = 0.0f; r < 3; ++r) {
+         moved.center[r] = m[12 + r] + m[r] * in->center[0] + m[4 + r] * in->center[1] + m[8 + r] * in->center[2];
+         mid = m[12 + r] + m[r] * center[0] + m[4 + r] * center[1] + m[8 + r] * center[2];
+         extent = fabsf(m[r]) * half[0] + fabsf(m[4 + r]) * half[1] + fabsf(m[8 + r]) * half[2];
+         moved.min[r] = mid - extent;
+         moved.max[r] = mid + extent;
+
+         column = sqrtf(m[r * 4] * m[r * 4] + m[r * 4 + 1] * m[r * 4 + 1] + m[r * 4 + 2] * m[r * 4 + 2]);
+         scale = (column > scale ? column : scale);
+      }
+
+      moved.radius = in->radius * scale;
+      mmd_bounds_merge(out, &moved);
+   }
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
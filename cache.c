@@ -0,0 +1,568 @@
+#include "internal.h"
+#include <stdio.h>  /* for FILE, rename */
+#include <stdlib.h>
+#include <stdint.h> /* for standard integers */
+#include <string.h> /* for memcpy, memchr */
+#include <assert.h> /* for assert */
+
+/* precompiled model cache.
+ *
+ * the file is image of decoded mmd_data: header, then arrays
+ * and UTF8 strings of every section laid out like the arena,
+ * then the mmd_data itself. pointers are stored as offsets
+ * from the start of file, 0 is NULL.
+ *
+ * loading maps the file copy on write and turns offsets back
+ * to pointers, large arrays are never touched and stay shared
+ * with the page cache. structs are stored in host layout,
+ * so the header carries abi tag and caches from other hosts
+ * are treated as stale. */
+
+#define MMD_CACHE_MAGIC "MMDCACHE"
+#define MMD_CACHE_VERSION 3
+
+/* alignment of arrays in cache, same as arena */
+#define MMD_CACHE_ALIGN 16
+
+/* \brief cache file header */
+typedef struct mmd_cache_header {
+   char magic[8];
+   uint32_t version, abi;
+
+   /* hash of PMD the cache was made from, see mmd_cache_hash */
+   uint64_t source_hash;
+
+   /* size of whole cache file and offset of mmd_data image */
+   uint64_t file_size, data;
+
+   /* bytes of every MMD_SECTION_* */
+   struct {
+      uint64_t offset, size;
+   } sections[MMD_SECTION_LAST];
+} mmd_cache_header;
+
+/* \brief growing buffer the cache is built in */
+typedef struct mmd_cache_writer {
+   unsigned char *data;
+   size_t size, capacity;
+   int failed;
+} mmd_cache_writer;
+
+/* \brief mapped cache being relocated */
+typedef struct mmd_cache {
+   unsigned char *base;
+   const mmd_cache_header *header;
+   int ok;
+} mmd_cache;
+
+/* \brief tag of host layout of stored structs */
+static uint32_t mmd_cache_abi(void)
+{
+   const uint32_t sizes[] = {
+      sizeof(void*), mmd_is_little_endian(), sizeof(mmd_data), sizeof(mmd_weight), sizeof(mmd_bone),
+      sizeof(mmd_ik), sizeof(mmd_bone_name), sizeof(mmd_skin), sizeof(mmd_skin_vertex), sizeof(mmd_material)
+   };
+   uint32_t abi = 2166136261u;
+   unsigned int i;
+
+   for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+      abi = (abi ^ sizes[i]) * 16777619u;
+
+   return abi;
+}
+
+/* \brief little endian 64 bit word */
+static inline uint64_t mmd_cache_u64(const unsigned char *data)
+{
+   uint64_t w;
+
+   if (mmd_is_little_endian()) {
+      memcpy(&w, data, sizeof(w));
+      return w;
+   }
+
+   return (uint64_t)mmd_u32(data) | (uint64_t)mmd_u32(data + 4) << 32;
+}
+
+/* \brief mix word into hash lane */
+static inline uint64_t mmd_cache_mix(uint64_t h, uint64_t w)
+{
+   h = (h ^ w) * 0xff51afd7ed558ccdull;
+   return h ^ (h >> 32);
+}
+
+/* \brief hash of PMD file contents */
+unsigned long long mmd_cache_hash(const void *data, size_t size)
+{
+   const unsigned char *bytes = data;
+   unsigned char tail[32];
+   uint64_t h[4], r;
+   size_t i;
+   unsigned int l;
+   assert(data || !size);
+
+   for (l = 0; l < 4; ++l)
+      h[l] = (0x9e3779b97f4a7c15ull * (l + 1)) ^ size;
+
+   /* 4 independent lanes, so the multiplies overlap */
+   for (i = 0; i + 32 <= size; i += 32) {
+      h[0] = mmd_cache_mix(h[0], mmd_cache_u64(bytes + i));
+      h[1] = mmd_cache_mix(h[1], mmd_cache_u64(bytes + i + 8));
+      h[2] = mmd_cache_mix(h[2], mmd_cache_u64(bytes + i + 16));
+      h[3] = mmd_cache_mix(h[3], mmd_cache_u64(bytes + i + 24));
+   }
+
+   if (i < size) {
+      memset(tail, 0, sizeof(tail));
+      memcpy(tail, bytes + i, size - i);
+
+      for (l = 0; l < 4; ++l)
+         h[l] = mmd_cache_mix(h[l], mmd_cache_u64(tail + l * 8));
+   }
+
+   for (r = 0, l = 0; l < 4; ++l)
+      r = mmd_cache_mix(r, h[l]);
+
+   r ^= r >> 33;
+   r *= 0xc4ceb9fe1a85ec53ull;
+   r ^= r >> 33;
+   return r;
+}
+
+/* \brief append size bytes at align, returns offset, 0 for nothing stored */
+static size_t mmd_cache_put(mmd_cache_writer *writer, const void *src, size_t size, size_t align)
+{
+   size_t offset, capacity;
+   unsigned char *data;
+
+   if (!src || !size || writer->failed)
+      return 0;
+
+   offset = (writer->size + align - 1) & ~(align - 1);
+
+   if (offset < writer->size || size > (size_t)~0 - offset)
+      goto fail;
+
+   if (offset + size > writer->capacity) {
+      for (capacity = (writer->capacity ? writer->capacity : 4096); capacity < offset + size; capacity *= 2)
+         if (capacity > (size_t)~0 / 2)
+            goto fail;
+
+      if (!(data = realloc(writer->data, capacity)))
+         goto fail;
+
+      memset(data + writer->capacity, 0, capacity - writer->capacity);
+      writer->data = data;
+      writer->capacity = capacity;
+   }
+
+   memcpy(writer->data + offset, src, size);
+   writer->size = offset + size;
+   return offset;
+
+fail:
+   writer->failed = 1;
+   return 0;
+}
+
+/* \brief append array of memb elements */
+static size_t mmd_cache_put_array(mmd_cache_writer *writer, const void *src, size_t memb, size_t size)
+{
+   if (size && memb > (size_t)~0 / size) {
+      writer->failed = 1;
+      return 0;
+   }
+
+   return mmd_cache_put(writer, src, memb * size, MMD_CACHE_ALIGN);
+}
+
+/* \brief append UTF8 string of name, resolving handles of string pool */
+static size_t mmd_cache_put_string(mmd_cache_writer *writer, mmd_data *mmd, const char *name, mmd_string id)
+{
+   if (!name && id)
+      name = mmd_get_string(mmd, id);
+
+   return (name ? mmd_cache_put(writer, name, strlen(name) + 1, 1) : 0);
+}
+
+/* \brief stored offset as pointer field */
+static void* mmd_cache_ptr(size_t offset)
+{
+   return (void*)(uintptr_t)offset;
+}
+
+/* \brief element of struct array already in writer */
+#define MMD_CACHE_AT(writer, type, offset, i) (&((type*)((writer)->data + (offset)))[i])
+
+/* \brief append arrays and strings of section, recording its range */
+static void mmd_cache_put_section(mmd_cache_writer *writer, mmd_data *mmd, mmd_data *image, mmd_cache_header *header, unsigned int section)
+{
+   size_t start, offset, name, child;
+   unsigned int i;
+
+   start = writer->size;
+
+   switch (section) {
+      case MMD_SECTION_HEADER:
+         image->header.name = mmd_cache_ptr(mmd_cache_put_string(writer, mmd, mmd->header.name, mmd->header.name_id));
+         image->header.comment = mmd_cache_ptr(mmd_cache_put_string(writer, mmd, mmd->header.comment, mmd->header.comment_id));
+         image->header.name_id = image->header.comment_id = 0;
+         break;
+
+      case MMD_SECTION_VERTEX:
+         image->vertices = mmd_cache_ptr(mmd_cache_put_array(writer, mmd->vertices, mmd->num_vertices, 3 * sizeof(float)));
+         image->normals = mmd_cache_ptr(mmd_cache_put_array(writer, mmd->normals, mmd->num_vertices, 3 * sizeof(float)));
+         image->coords = mmd_cache_ptr(mmd_cache_put_array(writer, mmd->coords, mmd->num_vertices, 2 * sizeof(float)));
+         image->weights = mmd_cache_ptr(mmd_cache_put_array(writer, mmd->weights, mmd->num_vertices, sizeof(mmd_weight)));
+         break;
+
+      case MMD_SECTION_INDEX:
+         if (mmd->indices32) {
+            image->indices32 = mmd_cache_ptr(mmd_cache_put_array(writer, mmd->indices32, mmd->num_indices, sizeof(uint32_t)));
+         } else {
+            image->indices = mmd_cache_ptr(mmd_cache_put_array(writer, mmd->indices, mmd->num_indices, sizeof(uint16_t)));
+         }
+         break;
+
+      case MMD_SECTION_MATERIAL:
+         offset = mmd_cache_put_array(writer, mmd->materials, mmd->num_materials, sizeof(mmd_material));
+         image->materials = mmd_cache_ptr(offset);
+
+         for (i = 0; offset && i < mmd->num_materials; ++i) {
+            name = mmd_cache_put_string(writer, mmd, mmd->materials[i].texture, mmd->materials[i].texture_id);
+            if (writer->failed)
+               break;
+
+            MMD_CACHE_AT(writer, mmd_material, offset, i)->texture = mmd_cache_ptr(name);
+            MMD_CACHE_AT(writer, mmd_material, offset, i)->texture_id = 0;
+         }
+         break;
+
+      case MMD_SECTION_BONE:
+         offset = mmd_cache_put_array(writer, mmd->bones, mmd->num_bones, sizeof(mmd_bone));
+         image->bones = mmd_cache_ptr(offset);
+
+         for (i = 0; offset && i < mmd->num_bones; ++i) {
+            name = mmd_cache_put_string(writer, mmd, mmd->bones[i].name, mmd->bones[i].name_id);
+            if (writer->failed)
+               break;
+
+            MMD_CACHE_AT(writer, mmd_bone, offset, i)->name = mmd_cache_ptr(name);
+            MMD_CACHE_AT(writer, mmd_bone, offset, i)->name_id = 0;
+         }
+         break;
+
+      case MMD_SECTION_IK:
+         offset = mmd_cache_put_array(writer, mmd->ik, mmd->num_ik, sizeof(mmd_ik));
+         image->ik = mmd_cache_ptr(offset);
+
+         for (i = 0; offset && i < mmd->num_ik; ++i) {
+            child = mmd_cache_put_array(writer, mmd->ik[i].child_bone_index, mmd->ik[i].chain_length, sizeof(unsigned short));
+            if (writer->failed)
+               break;
+
+            MMD_CACHE_AT(writer, mmd_ik, offset, i)->child_bone_index = mmd_cache_ptr(child);
+         }
+         break;
+
+      case MMD_SECTION_SKIN:
+         offset = mmd_cache_put_array(writer, mmd->skin, mmd->num_skins, sizeof(mmd_skin));
+         image->skin = mmd_cache_ptr(offset);
+
+         for (i = 0; offset && i < mmd->num_skins; ++i) {
+            name = mmd_cache_put_string(writer, mmd, mmd->skin[i].name, mmd->skin[i].name_id);
+            child = mmd_cache_put_array(writer, mmd->skin[i].vertices, mmd->skin[i].num_vertices, sizeof(mmd_skin_vertex));
+            if (writer->failed)
+               break;
+
+            MMD_CACHE_AT(writer, mmd_skin, offset, i)->name = mmd_cache_ptr(name);
+            MMD_CACHE_AT(writer, mmd_skin, offset, i)->name_id = 0;
+            MMD_CACHE_AT(writer, mmd_skin, offset, i)->vertices = mmd_cache_ptr(child);
+         }
+         break;
+
+      case MMD_SECTION_SKIN_DISPLAY:
+         image->skin_display = mmd_cache_ptr(mmd_cache_put_array(writer, mmd->skin_display, mmd->num_skin_displays, sizeof(unsigned int)));
+         break;
+
+      case MMD_SECTION_BONE_NAME:
+         offset = mmd_cache_put_array(writer, mmd->bone_name, mmd->num_bone_names, sizeof(mmd_bone_name));
+         image->bone_name = mmd_cache_ptr(offset);
+
+         for (i = 0; offset && i < mmd->num_bone_names; ++i) {
+            name = mmd_cache_put_string(writer, mmd, mmd->bone_name[i].name, mmd->bone_name[i].name_id);
+            if (writer->failed)
+               break;
+
+            MMD_CACHE_AT(writer, mmd_bone_name, offset, i)->name = mmd_cache_ptr(name);
+            MMD_CACHE_AT(writer, mmd_bone_name, offset, i)->name_id = 0;
+         }
+         break;
+
+      default:
+         break;
+   }
+
+   header->sections[section].offset = start;
+   header->sections[section].size = (writer->size > start ? writer->size - start : 0);
+}
+
+/* \brief write decoded mmd to cache file */
+int mmd_cache_write(mmd_data *mmd, const char *path, unsigned long long source_hash)
+{
+   mmd_cache_writer writer;
+   mmd_cache_header header;
+   mmd_data image;
+   char *tmp = NULL;
+   FILE *f = NULL;
+   size_t data;
+   unsigned int s;
+   int ret = RETURN_FAIL;
+   assert(mmd && path);
+
+   memset(&writer, 0, sizeof(writer));
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, MMD_CACHE_MAGIC, sizeof(header.magic));
+   header.version = MMD_CACHE_VERSION;
+   header.abi = mmd_cache_abi();
+   header.source_hash = source_hash;
+
+   /* counts and plain fields come as is, pointers are replaced below */
+   image = *mmd;
+   image.f = NULL;
+
+   /* header is rewritten once offsets are known */
+   mmd_cache_put(&writer, &header, sizeof(header), MMD_CACHE_ALIGN);
+
+   for (s = 0; s < MMD_SECTION_LAST; ++s)
+      mmd_cache_put_section(&writer, mmd, &image, &header, s);
+
+   data = mmd_cache_put(&writer, &image, sizeof(image), MMD_CACHE_ALIGN);
+
+   if (writer.failed || !data)
+      goto out;
+
+   header.data = data;
+   header.file_size = writer.size;
+   memcpy(writer.data, &header, sizeof(header));
+
+   /* readers never see partial cache, it is renamed over the old one */
+   if (!(tmp = malloc(strlen(path) + sizeof(".tmp"))))
+      goto out;
+
+   strcpy(tmp, path);
+   strcat(tmp, ".tmp");
+
+   if (!(f = fopen(tmp, "wb")))
+      goto out;
+
+   if (fwrite(writer.data, 1, writer.size, f) != writer.size) {
+      fclose(f);
+      remove(tmp);
+      goto out;
+   }
+
+   if (fclose(f) != 0) {
+      remove(tmp);
+      goto out;
+   }
+
+#if defined(_WIN32)
+   remove(path);
+#endif
+
+   if (rename(tmp, path) != 0) {
+      remove(tmp);
+      goto out;
+   }
+
+   ret = RETURN_OK;
+
+out:
+   if (tmp) free(tmp);
+   if (writer.data) free(writer.data);
+   return ret;
+}
+
+/* \brief pointer for stored offset of memb * size bytes inside section,
+ * clears ok when it does not fit */
+static void* mmd_cache_locate(mmd_cache *cache, unsigned int section, const void *stored, size_t memb, size_t size)
+{
+   const uint64_t offset = (uintptr_t)stored;
+   const uint64_t start = cache->header->sections[section].offset;
+   const uint64_t end = start + cache->header->sections[section].size;
+
+   if (!offset) {
+      cache->ok &= (!memb || !size);
+      return NULL;
+   }
+
+   if (offset % MMD_CACHE_ALIGN || offset < start || offset > end ||
+       (size && memb > (end - offset) / size)) {
+      cache->ok = 0;
+      return NULL;
+   }
+
+   return cache->base + offset;
+}
+
+/* \brief pointer for stored offset of string inside section */
+static char* mmd_cache_locate_string(mmd_cache *cache, unsigned int section, const void *stored)
+{
+   const uint64_t offset = (uintptr_t)stored;
+   const uint64_t start = cache->header->sections[section].offset;
+   const uint64_t end = start + cache->header->sections[section].size;
+
+   if (!offset)
+      return NULL;
+
+   if (offset < start || offset >= end || !memchr(cache->base + offset, 0, (size_t)(end - offset))) {
+      cache->ok = 0;
+      return NULL;
+   }
+
+   return (char*)cache->base + offset;
+}
+
+/* \brief turn stored offsets of image back to pointers */
+static int mmd_cache_relocate(mmd_cache *cache, mmd_data *mmd)
+{
+   unsigned int i;
+
+   mmd->header.name = mmd_cache_locate_string(cache, MMD_SECTION_HEADER, mmd->header.name);
+   mmd->header.comment = mmd_cache_locate_string(cache, MMD_SECTION_HEADER, mmd->header.comment);
+
+   mmd->vertices = mmd_cache_locate(cache, MMD_SECTION_VERTEX, mmd->vertices, mmd->num_vertices, 3 * sizeof(float));
+   mmd->normals = mmd_cache_locate(cache, MMD_SECTION_VERTEX, mmd->normals, mmd->num_vertices, 3 * sizeof(float));
+   mmd->coords = mmd_cache_locate(cache, MMD_SECTION_VERTEX, mmd->coords, mmd->num_vertices, 2 * sizeof(float));
+   mmd->weights = mmd_cache_locate(cache, MMD_SECTION_VERTEX, mmd->weights, mmd->num_vertices, sizeof(mmd_weight));
+   if (mmd->indices32) {
+      mmd->indices32 = mmd_cache_locate(cache, MMD_SECTION_INDEX, mmd->indices32, mmd->num_indices, sizeof(uint32_t));
+   } else {
+      mmd->indices = mmd_cache_locate(cache, MMD_SECTION_INDEX, mmd->indices, mmd->num_indices, sizeof(uint16_t));
+   }
+   mmd->skin_display = mmd_cache_locate(cache, MMD_SECTION_SKIN_DISPLAY, mmd->skin_display, mmd->num_skin_displays, sizeof(unsigned int));
+
+   if ((mmd->materials = mmd_cache_locate(cache, MMD_SECTION_MATERIAL, mmd->materials, mmd->num_materials, sizeof(mmd_material)))) {
+      for (i = 0; i < mmd->num_materials; ++i)
+         mmd->materials[i].texture = mmd_cache_locate_string(cache, MMD_SECTION_MATERIAL, mmd->materials[i].texture);
+   }
+
+   if ((mmd->bones = mmd_cache_locate(cache, MMD_SECTION_BONE, mmd->bones, mmd->num_bones, sizeof(mmd_bone)))) {
+      for (i = 0; i < mmd->num_bones; ++i)
+         mmd->bones[i].name = mmd_cache_locate_string(cache, MMD_SECTION_BONE, mmd->bones[i].name);
+   }
+
+   if ((mmd->ik = mmd_cache_locate(cache, MMD_SECTION_IK, mmd->ik, mmd->num_ik, sizeof(mmd_ik)))) {
+      for (i = 0; i < mmd->num_ik; ++i)
+         mmd->ik[i].child_bone_index = mmd_cache_locate(cache, MMD_SECTION_IK, mmd->ik[i].child_bone_index, mmd->ik[i].chain_length, sizeof(unsigned short));
+   }
+
+   if ((mmd->skin = mmd_cache_locate(cache, MMD_SECTION_SKIN, mmd->skin, mmd->num_skins, sizeof(mmd_skin)))) {
+      for (i = 0; i < mmd->num_skins; ++i) {
+         mmd->skin[i].name = mmd_cache_locate_string(cache, MMD_SECTION_SKIN, mmd->skin[i].name);
+         mmd->skin[i].vertices = mmd_cache_locate(cache, MMD_SECTION_SKIN, mmd->skin[i].vertices, mmd->skin[i].num_vertices, sizeof(mmd_skin_vertex));
+      }
+   }
+
+   if ((mmd->bone_name = mmd_cache_locate(cache, MMD_SECTION_BONE_NAME, mmd->bone_name, mmd->num_bone_names, sizeof(mmd_bone_name)))) {
+      for (i = 0; i < mmd->num_bone_names; ++i)
+         mmd->bone_name[i].name = mmd_cache_locate_string(cache, MMD_SECTION_BONE_NAME, mmd->bone_name[i].name);
+   }
+
+   return (cache->ok ? RETURN_OK : RETURN_FAIL);
+}
+
+/* \brief is mapped cache of this host, version and source? */
+static int mmd_cache_valid(const unsigned char *map, size_t size, unsigned long long source_hash)
+{
+   const mmd_cache_header *header = (const mmd_cache_header*)map;
+   unsigned int s;
+
+   if (size < sizeof(mmd_cache_header) + sizeof(mmd_data) || memcmp(header->magic, MMD_CACHE_MAGIC, sizeof(header->magic)) ||
+       header->version != MMD_CACHE_VERSION || header->abi != mmd_cache_abi() ||
+       header->source_hash != source_hash || header->file_size != size)
+      return 0;
+
+   if (header->data < sizeof(mmd_cache_header) || header->data % MMD_CACHE_ALIGN || header->data > size - sizeof(mmd_data))
+      return 0;
+
+   for (s = 0; s < MMD_SECTION_LAST; ++s) {
+      if (header->sections[s].offset > size || header->sections[s].size > size - header->sections[s].offset)
+         return 0;
+   }
+
+   return 1;
+}
+
+/* \brief map cache file made from source with source_hash */
+mmd_data* mmd_new_from_cache(const char *path, unsigned long long source_hash)
+{
+   mmd_data image, *mmd;
+   mmd_cache cache;
+   void *map;
+   size_t size;
+   assert(path);
+
+   if (!(map = mmd_map_file(path, 1, &size)))
+      return NULL;
+
+   if (!mmd_cache_valid(map, size, source_hash))
+      goto fail;
+
+   cache.base = map;
+   cache.header = map;
+   cache.ok = 1;
+
+   memcpy(&image, cache.base + cache.header->data, sizeof(image));
+
+   if (mmd_cache_relocate(&cache, &image) != RETURN_OK)
+      goto fail;
+
+   if (!(mmd = mmd_new_from_map(map, size)))
+      goto fail;
+
+   *mmd = image;
+   return mmd;
+
+fail:
+   mmd_unmap_file(map, size);
+   return NULL;
+}
+
+/* \brief load PMD through cache, rebuilding stale cache */
+mmd_data* mmd_new_from_path_cached(const char *path, const char *cache_path, unsigned int flags)
+{
+   unsigned long long hash;
+   mmd_data *mmd;
+   void *map;
+   size_t size;
+   assert(path && cache_path);
+
+   /* copy on write, the model may view it */
+   if (!(map = mmd_map_file(path, 1, &size)))
+      return NULL;
+
+   hash = mmd_cache_hash(map, size);
+
+   if ((mmd = mmd_new_from_cache(cache_path, hash))) {
+      mmd_unmap_file(map, size);
+      return mmd;
+   }
+
+   if (!(mmd = mmd_new_from_map(map, size))) {
+      mmd_unmap_file(map, size);
+      return NULL;
+   }
+
+   if (mmd_load(mmd, flags) != RETURN_OK) {
+      mmd_free(mmd);
+      return NULL;
+   }
+
+   /* model is usable even if the cache can not be written */
+   mmd_cache_write(mmd, cache_path, hash);
+   return mmd;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,54 @@
+#include "internal.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#  include <intrin.h> /* for __cpuid, _xgetbv */
+#endif
+
+#if defined(_WIN32)
+#  define WIN32_LEAN_AND_MEAN
+#  include <windows.h> /* for GetSystemInfo */
+#elif defined(__unix__) || defined(__APPLE__)
+#  include <unistd.h> /* for sysconf */
+#endif
+
+/* \brief does the cpu we run on support AVX2? */
+int mmd_cpu_has_avx2(void)
+{
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+   __builtin_cpu_init();
+   return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+   int info[4];
+
+   __cpuid(info, 0);
+   if (info[0] < 7)
+      return 0;
+
+   /* OSXSAVE and AVX, then OS saves YMM state */
+   __cpuid(info, 1);
+   if ((info[2] & (1 << 27 | 1 << 28)) != (1 << 27 | 1 << 28) || (_xgetbv(0) & 6) != 6)
+      return 0;
+
+   __cpuidex(info, 7, 0);
+   return (info[1] & (1 << 5)) != 0;
+#else
+   return 0;
+#endif
+}
+
+/* \brief number of online cpus, at least 1 */
+unsigned int mmd_cpu_count(void)
+{
+#if defined(_WIN32)
+   SYSTEM_INFO info;
+   GetSystemInfo(&info);
+   return (info.dwNumberOfProcessors > 0 ? (unsigned int)info.dwNumberOfProcessors : 1);
+#elif defined(_SC_NPROCESSORS_ONLN)
+   long count = sysconf(_SC_NPROCESSORS_ONLN);
+   return (count > 0 ? (unsigned int)count : 1);
+#else
+   return 1;
+#endif
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,274 @@
+#include "internal.h"
+#include <math.h>   /* for sqrtf */
+#include <assert.h> /* for assert */
+
+#if defined(MMD_HAS_SSE2) || defined(MMD_HAS_AVX2)
+#  include <immintrin.h>
+#endif
+
+#if defined(MMD_HAS_NEON)
+#  include <arm_neon.h>
+#endif
+
+/* every kernel runs the same fixed sequence of operations,
+ * so results only differ by rounding between instruction sets.
+ *
+ * bezier: x -> s is solved by bisection, the final bracket is
+ * refined with one linear step, then s -> y is evaluated.
+ *
+ * slerp: acos and sin are polynomials accurate to float precision
+ * on the ranges we need (Abramowitz & Stegun 4.4.46, Taylor to x^11),
+ * nearly parallel rotations fall back to normalized lerp. */
+
+enum {
+   MMD_BEZIER_STEPS = 16
+};
+
+#define MMD_SLERP_LERP 0.9995f
+
+/* acos(x) = sqrt(1 - x) * poly(x) for 0 <= x <= 1 */
+#define MMD_ACOS_0  1.5707963050f
+#define MMD_ACOS_1 -0.2145988016f
+#define MMD_ACOS_2  0.0889789874f
+#define MMD_ACOS_3 -0.0501743046f
+#define MMD_ACOS_4  0.0308918810f
+#define MMD_ACOS_5 -0.0170881256f
+#define MMD_ACOS_6  0.0066700901f
+#define MMD_ACOS_7 -0.0012624911f
+
+/* sin(x) = x * (1 - x^2 / (2 * 3) * (1 - x^2 / (4 * 5) * ...)) */
+#define MMD_SIN_3  (1.0f / 6.0f)
+#define MMD_SIN_5  (1.0f / 20.0f)
+#define MMD_SIN_7  (1.0f / 42.0f)
+#define MMD_SIN_9  (1.0f / 72.0f)
+#define MMD_SIN_11 (1.0f / 110.0f)
+
+/* \brief 1D cubic bezier from 0 to 1 with control points p1 and p2 */
+static inline float mmd_bezier(float s, float p1, float p2)
+{
+   const float r = 1.0f - s;
+   return s * (3.0f * r * (r * p1 + s * p2) + s * s);
+}
+
+/* \brief solve single curve */
+static inline float mmd_bezier_solve(float x, float x1, float y1, float x2, float y2)
+{
+   float lo = 0.0f, hi = 1.0f, flo = 0.0f, fhi = 1.0f, s, f;
+   unsigned int i;
+
+   for (i = 0; i < MMD_BEZIER_STEPS; ++i) {
+      s = (lo + hi) * 0.5f;
+      f = mmd_bezier(s, x1, x2);
+      if (f < x) {
+         lo = s;
+         flo = f;
+      } else {
+         hi = s;
+         fhi = f;
+      }
+   }
+
+   s = (fhi > flo ? lo + (hi - lo) * (x - flo) / (fhi - flo) : lo);
+   return mmd_bezier(s, y1, y2);
+}
+
+/* \brief sin(x) for 0 <= x <= pi/2 */
+static inline float mmd_sin(float x)
+{
+   const float x2 = x * x;
+   return x * (1.0f - x2 * MMD_SIN_3 * (1.0f - x2 * MMD_SIN_5 * (1.0f - x2 * MMD_SIN_7 * (1.0f - x2 * MMD_SIN_9 * (1.0f - x2 * MMD_SIN_11)))));
+}
+
+/* \brief acos(x) for 0 <= x <= 1 */
+static inline float mmd_acos(float x)
+{
+   return sqrtf(1.0f - x) * (MMD_ACOS_0 + x * (MMD_ACOS_1 + x * (MMD_ACOS_2 + x * (MMD_ACOS_3 +
+          x * (MMD_ACOS_4 + x * (MMD_ACOS_5 + x * (MMD_ACOS_6 + x * MMD_ACOS_7)))))));
+}
+
+/* \brief portable bezier solver */
+static void mmd_bezier_scalar(const float *x, const float *x1, const float *y1, const float *x2, const float *y2, float *y, size_t count)
+{
+   size_t i;
+
+   for (i = 0; i < count; ++i)
+      y[i] = mmd_bezier_solve(x[i], x1[i], y1[i], x2[i], y2[i]);
+}
+
+/* \brief portable slerp */
+static void mmd_slerp_scalar(const float *a, const float *b, const float *t, float *out, size_t count, size_t stride)
+{
+   float d, sign, wa, wb, theta, sin_theta, len;
+   size_t i, c;
+
+   for (i = 0; i < count; ++i) {
+      for (d = 0.0f, c = 0; c < 4; ++c)
+         d += a[c * stride + i] * b[c * stride + i];
+
+      /* shortest path */
+      sign = (d < 0.0f ? -1.0f : 1.0f);
+      d *= sign;
+
+      if (d > MMD_SLERP_LERP) {
+         wa = 1.0f - t[i];
+         wb = t[i];
+      } else {
+         theta = mmd_acos(d);
+         sin_theta = sqrtf(1.0f - d * d);
+         wa = mmd_sin((1.0f - t[i]) * theta) / sin_theta;
+         wb = mmd_sin(t[i] * theta) / sin_theta;
+      }
+
+      for (len = 0.0f, c = 0; c < 4; ++c) {
+         out[c * stride + i] = wa * a[c * stride + i] + wb * sign * b[c * stride + i];
+         len += out[c * stride + i] * out[c * stride + i];
+      }
+
+      len = (len > 0.0f ? 1.0f / sqrtf(len) : 0.0f);
+      for (c = 0; c < 4; ++c)
+         out[c * stride + i] *= len;
+   }
+}
+
+#if defined(MMD_HAS_SSE2)
+#define MMD_V __m128
+#define MMD_V_WIDTH 4
+#define MMD_V_ATTR
+#define MMD_V_SET1(x) _mm_set1_ps(x)
+#define MMD_V_LOAD(p) _mm_loadu_ps(p)
+#define MMD_V_STORE(p, v) _mm_storeu_ps(p, v)
+#define MMD_V_ADD(a, b) _mm_add_ps(a, b)
+#define MMD_V_SUB(a, b) _mm_sub_ps(a, b)
+#define MMD_V_MUL(a, b) _mm_mul_ps(a, b)
+#define MMD_V_DIV(a, b) _mm_div_ps(a, b)
+#define MMD_V_MAX(a, b) _mm_max_ps(a, b)
+#define MMD_V_SQRT(a) _mm_sqrt_ps(a)
+#define MMD_V_XOR(a, b) _mm_xor_ps(a, b)
+#define MMD_V_AND(a, b) _mm_and_ps(a, b)
+#define MMD_V_LT(a, b) _mm_cmplt_ps(a, b)
+#define MMD_V_GT(a, b) _mm_cmpgt_ps(a, b)
+#define MMD_V_SELECT(m, a, b) _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+#define MMD_V_SUFFIX sse2
+#include "curve_simd.h"
+#endif
+
+#if defined(MMD_HAS_AVX2)
+#define MMD_V __m256
+#define MMD_V_WIDTH 8
+#define MMD_V_ATTR MMD_TARGET_AVX2
+#define MMD_V_SET1(x) _mm256_set1_ps(x)
+#define MMD_V_LOAD(p) _mm256_loadu_ps(p)
+#define MMD_V_STORE(p, v) _mm256_storeu_ps(p, v)
+#define MMD_V_ADD(a, b) _mm256_add_ps(a, b)
+#define MMD_V_SUB(a, b) _mm256_sub_ps(a, b)
+#define MMD_V_MUL(a, b) _mm256_mul_ps(a, b)
+#define MMD_V_DIV(a, b) _mm256_div_ps(a, b)
+#define MMD_V_MAX(a, b) _mm256_max_ps(a, b)
+#define MMD_V_SQRT(a) _mm256_sqrt_ps(a)
+#define MMD_V_XOR(a, b) _mm256_xor_ps(a, b)
+#define MMD_V_AND(a, b) _mm256_and_ps(a, b)
+#define MMD_V_LT(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define MMD_V_GT(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define MMD_V_SELECT(m, a, b) _mm256_blendv_ps(b, a, m)
+#define MMD_V_SUFFIX avx2
+#include "curve_simd.h"
+#endif
+
+#if defined(MMD_HAS_NEON)
+#define MMD_V float32x4_t
+#define MMD_V_WIDTH 4
+#define MMD_V_ATTR
+#define MMD_V_SET1(x) vdupq_n_f32(x)
+#define MMD_V_LOAD(p) vld1q_f32(p)
+#define MMD_V_STORE(p, v) vst1q_f32(p, v)
+#define MMD_V_ADD(a, b) vaddq_f32(a, b)
+#define MMD_V_SUB(a, b) vsubq_f32(a, b)
+#define MMD_V_MUL(a, b) vmulq_f32(a, b)
+#define MMD_V_DIV(a, b) mmd_neon_div(a, b)
+#define MMD_V_MAX(a, b) vmaxq_f32(a, b)
+#define MMD_V_SQRT(a) mmd_neon_sqrt(a)
+#define MMD_V_XOR(a, b) vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b)))
+#define MMD_V_AND(a, b) vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b)))
+#define MMD_V_LT(a, b) vreinterpretq_f32_u32(vcltq_f32(a, b))
+#define MMD_V_GT(a, b) vreinterpretq_f32_u32(vcgtq_f32(a, b))
+#define MMD_V_SELECT(m, a, b) vbslq_f32(vreinterpretq_u32_f32(m), a, b)
+#define MMD_V_SUFFIX neon
+
+/* \brief a / b, armv7 has only reciprocal estimate */
+static inline float32x4_t mmd_neon_div(float32x4_t a, float32x4_t b)
+{
+#if defined(__aarch64__)
+   return vdivq_f32(a, b);
+#else
+   float32x4_t r = vrecpeq_f32(b);
+   r = vmulq_f32(vrecpsq_f32(b, r), r);
+   r = vmulq_f32(vrecpsq_f32(b, r), r);
+   return vmulq_f32(a, r);
+#endif
+}
+
+/* \brief sqrt(a), armv7 has only reciprocal estimate */
+static inline float32x4_t mmd_neon_sqrt(float32x4_t a)
+{
+#if defined(__aarch64__)
+   return vsqrtq_f32(a);
+#else
+   float32x4_t r = vrsqrteq_f32(vmaxq_f32(a, vdupq_n_f32(1e-30f)));
+   r = vmulq_f32(vrsqrtsq_f32(vmulq_f32(a, r), r), r);
+   r = vmulq_f32(vrsqrtsq_f32(vmulq_f32(a, r), r), r);
+   return vmulq_f32(a, r);
+#endif
+}
+
+#include "curve_simd.h"
+#endif
+
+/* \brief can we run the AVX2 kernel? */
+#if defined(MMD_HAS_AVX2)
+static int mmd_curve_avx2_supported(void)
+{
+   return mmd_cpu_has_avx2();
+}
+#endif
+
+/* \brief SSE2 and NEON are baseline when compiled in */
+static int mmd_curve_baseline_supported(void)
+{
+   return 1;
+}
+
+/* \brief kernels compiled in, best first */
+const mmd_curve_kernel* mmd_curve_kernels(void)
+{
+   static const mmd_curve_kernel kernels[] = {
+#if defined(MMD_HAS_AVX2)
+      { "avx2", mmd_bezier_avx2, mmd_slerp_avx2, mmd_curve_avx2_supported },
+#endif
+#if defined(MMD_HAS_SSE2)
+      { "sse2", mmd_bezier_sse2, mmd_slerp_sse2, mmd_curve_baseline_supported },
+#endif
+#if defined(MMD_HAS_NEON)
+      { "neon", mmd_bezier_neon, mmd_slerp_neon, mmd_curve_baseline_supported },
+#endif
+      { "scalar", mmd_bezier_scalar, mmd_slerp_scalar, mmd_curve_baseline_supported },
+      { NULL, NULL, NULL, NULL }
+   };
+
+   return kernels;
+}
+
+/* \brief best kernel for this cpu */
+const mmd_curve_kernel* mmd_curve_kernel_best(void)
+{
+   static const mmd_curve_kernel *best;
+   const mmd_curve_kernel *kernel;
+
+   if (!(kernel = MMD_ATOMIC_LOAD(best))) {
+      for (kernel = mmd_curve_kernels(); !kernel->supported(); ++kernel);
+      MMD_ATOMIC_STORE(best, kernel);
+   }
+
+   return kernel;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,146 @@
+/* SIMD bezier and slerp kernels, included by curve.c
+ * once per instruction set with the MMD_V_* macros defined */
+
+#define MMD_V_CAT2(a, b) a##_##b
+#define MMD_V_CAT(a, b) MMD_V_CAT2(a, b)
+#define MMD_V_FN(name) MMD_V_CAT(name, MMD_V_SUFFIX)
+
+/* \brief 1D cubic bezier from 0 to 1 with control points p1 and p2 */
+MMD_V_ATTR static inline MMD_V MMD_V_FN(mmd_bezier_v)(MMD_V s, MMD_V p1, MMD_V p2)
+{
+   const MMD_V r = MMD_V_SUB(MMD_V_SET1(1.0f), s);
+   MMD_V v = MMD_V_ADD(MMD_V_MUL(r, p1), MMD_V_MUL(s, p2));
+   v = MMD_V_MUL(MMD_V_MUL(MMD_V_SET1(3.0f), r), v);
+   return MMD_V_MUL(s, MMD_V_ADD(v, MMD_V_MUL(s, s)));
+}
+
+/* \brief sin(x) for 0 <= x <= pi/2 */
+MMD_V_ATTR static inline MMD_V MMD_V_FN(mmd_sin_v)(MMD_V x)
+{
+   const MMD_V one = MMD_V_SET1(1.0f), x2 = MMD_V_MUL(x, x);
+   MMD_V v = MMD_V_SUB(one, MMD_V_MUL(x2, MMD_V_SET1(MMD_SIN_11)));
+   v = MMD_V_SUB(one, MMD_V_MUL(MMD_V_MUL(x2, MMD_V_SET1(MMD_SIN_9)), v));
+   v = MMD_V_SUB(one, MMD_V_MUL(MMD_V_MUL(x2, MMD_V_SET1(MMD_SIN_7)), v));
+   v = MMD_V_SUB(one, MMD_V_MUL(MMD_V_MUL(x2, MMD_V_SET1(MMD_SIN_5)), v));
+   v = MMD_V_SUB(one, MMD_V_MUL(MMD_V_MUL(x2, MMD_V_SET1(MMD_SIN_3)), v));
+   return MMD_V_MUL(x, v);
+}
+
+/* \brief acos(x) for 0 <= x <= 1 */
+MMD_V_ATTR static inline MMD_V MMD_V_FN(mmd_acos_v)(MMD_V x)
+{
+   MMD_V v = MMD_V_ADD(MMD_V_SET1(MMD_ACOS_6), MMD_V_MUL(x, MMD_V_SET1(MMD_ACOS_7)));
+   v = MMD_V_ADD(MMD_V_SET1(MMD_ACOS_5), MMD_V_MUL(x, v));
+   v = MMD_V_ADD(MMD_V_SET1(MMD_ACOS_4), MMD_V_MUL(x, v));
+   v = MMD_V_ADD(MMD_V_SET1(MMD_ACOS_3), MMD_V_MUL(x, v));
+   v = MMD_V_ADD(MMD_V_SET1(MMD_ACOS_2), MMD_V_MUL(x, v));
+   v = MMD_V_ADD(MMD_V_SET1(MMD_ACOS_1), MMD_V_MUL(x, v));
+   v = MMD_V_ADD(MMD_V_SET1(MMD_ACOS_0), MMD_V_MUL(x, v));
+   return MMD_V_MUL(MMD_V_SQRT(MMD_V_SUB(MMD_V_SET1(1.0f), x)), v);
+}
+
+/* \brief solve MMD_V_WIDTH curves at a time */
+MMD_V_ATTR static void MMD_V_FN(mmd_bezier)(const float *x, const float *x1, const float *y1, const float *x2, const float *y2, float *y, size_t count)
+{
+   size_t i;
+   unsigned int step;
+   MMD_V vx, vx1, vx2, lo, hi, flo, fhi, s, f, m;
+
+   for (i = 0; i + MMD_V_WIDTH <= count; i += MMD_V_WIDTH) {
+      vx = MMD_V_LOAD(x + i);
+      vx1 = MMD_V_LOAD(x1 + i);
+      vx2 = MMD_V_LOAD(x2 + i);
+      lo = flo = MMD_V_SET1(0.0f);
+      hi = fhi = MMD_V_SET1(1.0f);
+
+      for (step = 0; step < MMD_BEZIER_STEPS; ++step) {
+         s = MMD_V_MUL(MMD_V_ADD(lo, hi), MMD_V_SET1(0.5f));
+         f = MMD_V_FN(mmd_bezier_v)(s, vx1, vx2);
+         m = MMD_V_LT(f, vx);
+         lo = MMD_V_SELECT(m, s, lo);
+         flo = MMD_V_SELECT(m, f, flo);
+         hi = MMD_V_SELECT(m, hi, s);
+         fhi = MMD_V_SELECT(m, fhi, f);
+      }
+
+      /* linear step inside the final bracket */
+      f = MMD_V_SUB(fhi, flo);
+      m = MMD_V_GT(fhi, flo);
+      s = MMD_V_DIV(MMD_V_MUL(MMD_V_SUB(hi, lo), MMD_V_SUB(vx, flo)), MMD_V_MAX(f, MMD_V_SET1(1e-30f)));
+      s = MMD_V_SELECT(m, MMD_V_ADD(lo, s), lo);
+
+      MMD_V_STORE(y + i, MMD_V_FN(mmd_bezier_v)(s, MMD_V_LOAD(y1 + i), MMD_V_LOAD(y2 + i)));
+   }
+
+   mmd_bezier_scalar(x + i, x1 + i, y1 + i, x2 + i, y2 + i, y + i, count - i);
+}
+
+/* \brief slerp MMD_V_WIDTH rotations at a time */
+MMD_V_ATTR static void MMD_V_FN(mmd_slerp)(const float *a, const float *b, const float *t, float *out, size_t count, size_t stride)
+{
+   size_t i, c;
+   MMD_V va[4], vb[4], vo[4], vt, d, sign, m, theta, sin_theta, wa, wb, len;
+   const MMD_V one = MMD_V_SET1(1.0f), zero = MMD_V_SET1(0.0f);
+
+   for (i = 0; i + MMD_V_WIDTH <= count; i += MMD_V_WIDTH) {
+      for (c = 0; c < 4; ++c) {
+         va[c] = MMD_V_LOAD(a + c * stride + i);
+         vb[c] = MMD_V_LOAD(b + c * stride + i);
+      }
+
+      vt = MMD_V_LOAD(t + i);
+      d = MMD_V_MUL(va[0], vb[0]);
+      for (c = 1; c < 4; ++c)
+         d = MMD_V_ADD(d, MMD_V_MUL(va[c], vb[c]));
+
+      /* shortest path */
+      sign = MMD_V_AND(MMD_V_LT(d, zero), MMD_V_SET1(-0.0f));
+      d = MMD_V_XOR(d, sign);
+
+      theta = MMD_V_FN(mmd_acos_v)(d);
+      sin_theta = MMD_V_SQRT(MMD_V_MAX(MMD_V_SUB(one, MMD_V_MUL(d, d)), MMD_V_SET1(1e-30f)));
+      wa = MMD_V_DIV(MMD_V_FN(mmd_sin_v)(MMD_V_MUL(MMD_V_SUB(one, vt), theta)), sin_theta);
+      wb = MMD_V_DIV(MMD_V_FN(mmd_sin_v)(MMD_V_MUL(vt, theta)), sin_theta);
+
+      m = MMD_V_GT(d, MMD_V_SET1(MMD_SLERP_LERP));
+      wa = MMD_V_SELECT(m, MMD_V_SUB(one, vt), wa);
+      wb = MMD_V_XOR(MMD_V_SELECT(m, vt, wb), sign);
+
+      len = zero;
+      for (c = 0; c < 4; ++c) {
+         vo[c] = MMD_V_ADD(MMD_V_MUL(wa, va[c]), MMD_V_MUL(wb, vb[c]));
+         len = MMD_V_ADD(len, MMD_V_MUL(vo[c], vo[c]));
+      }
+
+      m = MMD_V_GT(len, zero);
+      len = MMD_V_AND(m, MMD_V_DIV(one, MMD_V_SQRT(MMD_V_MAX(len, MMD_V_SET1(1e-30f)))));
+      for (c = 0; c < 4; ++c)
+         MMD_V_STORE(out + c * stride + i, MMD_V_MUL(vo[c], len));
+   }
+
+   mmd_slerp_scalar(a + i, b + i, t + i, out + i, count - i, stride);
+}
+
+#undef MMD_V_FN
+#undef MMD_V_CAT
+#undef MMD_V_CAT2
+#undef MMD_V
+#undef MMD_V_WIDTH
+#undef MMD_V_ATTR
+#undef MMD_V_SET1
+#undef MMD_V_LOAD
+#undef MMD_V_STORE
+#undef MMD_V_ADD
+#undef MMD_V_SUB
+#undef MMD_V_MUL
+#undef MMD_V_DIV
+#undef MMD_V_MAX
+#undef MMD_V_SQRT
+#undef MMD_V_XOR
+#undef MMD_V_AND
+#undef MMD_V_LT
+#undef MMD_V_GT
+#undef MMD_V_SELECT
+#undef MMD_V_SUFFIX
+
+/* vim: set ts=8 sw=3 tw=0 :*/
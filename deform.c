@@ -0,0 +1,286 @@
+#include "internal.h"
+#include <assert.h> /* for assert */
+
+#if defined(MMD_HAS_SSE2) || defined(MMD_HAS_AVX2)
+#  include <immintrin.h>
+#endif
+
+#if defined(MMD_HAS_NEON)
+#  include <arm_neon.h>
+#endif
+
+/* every kernel blends the four columns of the two bone matrices
+ * first and then transforms position and normal with the blend,
+ * which is cheaper than transforming twice and blending results. */
+
+enum {
+   /* floats per palette matrix */
+   MMD_DEFORM_MATRIX = 16,
+
+   /* smallest vertex range worth its own task */
+   MMD_DEFORM_MIN_RANGE = 2048
+};
+
+/* \brief deform task of mmd_deform */
+typedef struct mmd_deform_task {
+   const mmd_data *mmd;
+   const float *palette;
+   float *out_vertices, *out_normals;
+   unsigned int first, count;
+   int ret;
+} mmd_deform_task;
+
+/* \brief palette matrix of bone, bones out of range use first matrix */
+static inline const float* mmd_deform_matrix(const float *palette, unsigned int num_bones, unsigned short bone)
+{
+   return palette + (bone < num_bones ? bone : 0) * MMD_DEFORM_MATRIX;
+}
+
+/* \brief amount of first bone */
+static inline float mmd_deform_amount(const mmd_weight *weight)
+{
+   return (weight->weight < 100 ? weight->weight : 100) * 0.01f;
+}
+
+/* \brief portable kernel */
+static void mmd_deform_scalar(const float *vertices, const float *normals, const mmd_weight *weights, const float *palette, unsigned int num_bones, float *out_vertices, float *out_normals, size_t count)
+{
+   const float *m0, *m1, *v, *n;
+   float a, b, c[MMD_DEFORM_MATRIX];
+   size_t i, r;
+
+   for (i = 0; i < count; ++i) {
+      m0 = mmd_deform_matrix(palette, num_bones, weights[i].bone_index[0]);
+      m1 = mmd_deform_matrix(palette, num_bones, weights[i].bone_index[1]);
+      a = mmd_deform_amount(&weights[i]);
+      b = 1.0f - a;
+
+      /* bottom row is not needed */
+      for (r = 0; r < 15; ++r)
+         c[r] = m0[r] * a + m1[r] * b;
+
+      v = &vertices[i*3];
+      n = &normals[i*3];
+      for (r = 0; r < 3; ++r) {
+         out_vertices[i*3 + r] = c[r] * v[0] + c[4 + r] * v[1] + c[8 + r] * v[2] + c[12 + r];
+         out_normals[i*3 + r] = c[r] * n[0] + c[4 + r] * n[1] + c[8 + r] * n[2];
+      }
+   }
+}
+
+#if defined(MMD_HAS_SSE2)
+/* \brief SSE2 kernel, matrix column per register
+ * 3 float results are written with 4 float stores,
+ * the extra lane is overwritten by the next vertex */
+static void mmd_deform_sse2(const float *vertices, const float *normals, const mmd_weight *weights, const float *palette, unsigned int num_bones, float *out_vertices, float *out_normals, size_t count)
+{
+   const float *m0, *m1;
+   __m128 a, b, c0, c1, c2, c3, v, n;
+   size_t i;
+
+   for (i = 0; i + 1 < count; ++i) {
+      m0 = mmd_deform_matrix(palette, num_bones, weights[i].bone_index[0]);
+      m1 = mmd_deform_matrix(palette, num_bones, weights[i].bone_index[1]);
+      a = _mm_set1_ps(mmd_deform_amount(&weights[i]));
+      b = _mm_sub_ps(_mm_set1_ps(1.0f), a);
+
+      c0 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(m0), a), _mm_mul_ps(_mm_loadu_ps(m1), b));
+      c1 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(m0 + 4), a), _mm_mul_ps(_mm_loadu_ps(m1 + 4), b));
+      c2 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(m0 + 8), a), _mm_mul_ps(_mm_loadu_ps(m1 + 8), b));
+      c3 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(m0 + 12), a), _mm_mul_ps(_mm_loadu_ps(m1 + 12), b));
+
+      v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(vertices[i*3])), _mm_mul_ps(c1, _mm_set1_ps(vertices[i*3 + 1]))),
+                     _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(vertices[i*3 + 2])), c3));
+      n = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(normals[i*3])), _mm_mul_ps(c1, _mm_set1_ps(normals[i*3 + 1]))),
+                     _mm_mul_ps(c2, _mm_set1_ps(normals[i*3 + 2])));
+
+      _mm_storeu_ps(&out_vertices[i*3], v);
+      _mm_storeu_ps(&out_normals[i*3], n);
+   }
+
+   mmd_deform_scalar(&vertices[i*3], &normals[i*3], &weights[i], palette, num_bones, &out_vertices[i*3], &out_normals[i*3], count - i);
+}
+#endif
+
+#if defined(MMD_HAS_AVX2)
+/* \brief AVX2 kernel, two matrix columns per register
+ * columns 0 | 1 and 2 | 3 are blended and multiplied with x | y and z | 1,
+ * the two halves are then summed. 3 float results are written with
+ * 4 float stores, the extra lane is overwritten by the next vertex */
+MMD_TARGET_AVX2 static void mmd_deform_avx2(const float *vertices, const float *normals, const mmd_weight *weights, const float *palette, unsigned int num_bones, float *out_vertices, float *out_normals, size_t count)
+{
+   const float *m0, *m1;
+   __m256 a, b, c01, c23, v, n;
+   const __m256i xy = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+   const __m256i zz = _mm256_set1_epi32(2);
+   const __m256 ones = _mm256_set1_ps(1.0f);
+   const __m256 zeros = _mm256_setzero_ps();
+   size_t i;
+
+   for (i = 0; i + 1 < count; ++i) {
+      m0 = mmd_deform_matrix(palette, num_bones, weights[i].bone_index[0]);
+      m1 = mmd_deform_matrix(palette, num_bones, weights[i].bone_index[1]);
+      a = _mm256_set1_ps(mmd_deform_amount(&weights[i]));
+      b = _mm256_sub_ps(ones, a);
+
+      c01 = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(m0), a), _mm256_mul_ps(_mm256_loadu_ps(m1), b));
+      c23 = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(m0 + 8), a), _mm256_mul_ps(_mm256_loadu_ps(m1 + 8), b));
+
+      /* x y z and the next x, which is ignored */
+      v = _mm256_castps128_ps256(_mm_loadu_ps(&vertices[i*3]));
+      n = _mm256_castps128_ps256(_mm_loadu_ps(&normals[i*3]));
+
+      v = _mm256_add_ps(_mm256_mul_ps(c01, _mm256_permutevar8x32_ps(v, xy)),
+                        _mm256_mul_ps(c23, _mm256_blend_ps(_mm256_permutevar8x32_ps(v, zz), ones, 0xf0)));
+      n = _mm256_add_ps(_mm256_mul_ps(c01, _mm256_permutevar8x32_ps(n, xy)),
+                        _mm256_mul_ps(c23, _mm256_blend_ps(_mm256_permutevar8x32_ps(n, zz), zeros, 0xf0)));
+
+      _mm_storeu_ps(&out_vertices[i*3], _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+      _mm_storeu_ps(&out_normals[i*3], _mm_add_ps(_mm256_castps256_ps128(n), _mm256_extractf128_ps(n, 1)));
+   }
+
+   mmd_deform_scalar(&vertices[i*3], &normals[i*3], &weights[i], palette, num_bones, &out_vertices[i*3], &out_normals[i*3], count - i);
+}
+#endif
+
+#if defined(MMD_HAS_NEON)
+/* \brief NEON kernel, matrix column per register
+ * 3 float results are written with 4 float stores,
+ * the extra lane is overwritten by the next vertex */
+static void mmd_deform_neon(const float *vertices, const float *normals, const mmd_weight *weights, const float *palette, unsigned int num_bones, float *out_vertices, float *out_normals, size_t count)
+{
+   const float *m0, *m1;
+   float32x4_t c0, c1, c2, c3, v, n;
+   float a, b;
+   size_t i;
+
+   for (i = 0; i + 1 < count; ++i) {
+      m0 = mmd_deform_matrix(palette, num_bones, weights[i].bone_index[0]);
+      m1 = mmd_deform_matrix(palette, num_bones, weights[i].bone_index[1]);
+      a = mmd_deform_amount(&weights[i]);
+      b = 1.0f - a;
+
+      c0 = vmlaq_n_f32(vmulq_n_f32(vld1q_f32(m0), a), vld1q_f32(m1), b);
+      c1 = vmlaq_n_f32(vmulq_n_f32(vld1q_f32(m0 + 4), a), vld1q_f32(m1 + 4), b);
+      c2 = vmlaq_n_f32(vmulq_n_f32(vld1q_f32(m0 + 8), a), vld1q_f32(m1 + 8), b);
+      c3 = vmlaq_n_f32(vmulq_n_f32(vld1q_f32(m0 + 12), a), vld1q_f32(m1 + 12), b);
+
+      v = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(c3, c0, vertices[i*3]), c1, vertices[i*3 + 1]), c2, vertices[i*3 + 2]);
+      n = vmlaq_n_f32(vmlaq_n_f32(vmulq_n_f32(c0, normals[i*3]), c1, normals[i*3 + 1]), c2, normals[i*3 + 2]);
+
+      vst1q_f32(&out_vertices[i*3], v);
+      vst1q_f32(&out_normals[i*3], n);
+   }
+
+   mmd_deform_scalar(&vertices[i*3], &normals[i*3], &weights[i], palette, num_bones, &out_vertices[i*3], &out_normals[i*3], count - i);
+}
+#endif
+
+#if defined(MMD_HAS_AVX2)
+/* \brief can we run the AVX2 kernel? */
+static int mmd_deform_avx2_supported(void)
+{
+   return mmd_cpu_has_avx2();
+}
+#endif
+
+/* \brief SSE2, NEON and scalar kernels run everywhere they compile */
+static int mmd_deform_baseline_supported(void)
+{
+   return 1;
+}
+
+/* \brief kernels compiled in, best first */
+const mmd_deform_kernel* mmd_deform_kernels(void)
+{
+   static const mmd_deform_kernel kernels[] = {
+#if defined(MMD_HAS_AVX2)
+      { "avx2", mmd_deform_avx2, mmd_deform_avx2_supported },
+#endif
+#if defined(MMD_HAS_SSE2)
+      { "sse2", mmd_deform_sse2, mmd_deform_baseline_supported },
+#endif
+#if defined(MMD_HAS_NEON)
+      { "neon", mmd_deform_neon, mmd_deform_baseline_supported },
+#endif
+      { "scalar", mmd_deform_scalar, mmd_deform_baseline_supported },
+      { NULL, NULL, NULL }
+   };
+
+   return kernels;
+}
+
+/* \brief deform range of vertices with best kernel */
+int mmd_deform_range(const mmd_data *mmd, const float *palette, unsigned int first, unsigned int count, float *out_vertices, float *out_normals)
+{
+   static mmd_deform_fn best;
+   mmd_deform_fn deform;
+   assert(mmd && palette && out_vertices && out_normals);
+
+   if (!mmd->num_bones || !mmd->vertices || !mmd->normals || !mmd->weights)
+      return RETURN_FAIL;
+
+   if (first > mmd->num_vertices || count > mmd->num_vertices - first)
+      return RETURN_FAIL;
+
+   if (!(deform = MMD_ATOMIC_LOAD(best))) {
+      const mmd_deform_kernel *kernel;
+      for (kernel = mmd_deform_kernels(); !kernel->supported(); ++kernel);
+      MMD_ATOMIC_STORE(best, (deform = kernel->deform));
+   }
+
+   deform(&mmd->vertices[first * 3], &mmd->normals[first * 3], &mmd->weights[first], palette, mmd->num_bones,
+          &out_vertices[first * 3], &out_normals[first * 3], count);
+   return RETURN_OK;
+}
+
+/* \brief task of mmd_deform */
+static void mmd_deform_task_run(void *arg)
+{
+   mmd_deform_task *task = arg;
+   task->ret = mmd_deform_range(task->mmd, task->palette, task->first, task->count, task->out_vertices, task->out_normals);
+}
+
+/* \brief deform all vertices, ranges on threads */
+int mmd_deform(const mmd_data *mmd, const float *palette, float *out_vertices, float *out_normals, const mmd_executor *executor)
+{
+   mmd_deform_task tasks[MMD_MAX_THREADS];
+   void *args[MMD_MAX_THREADS];
+   unsigned int i, threads, num_tasks, range;
+   assert(mmd && palette && out_vertices && out_normals);
+
+   threads = mmd_cpu_count();
+   num_tasks = (mmd->num_vertices + MMD_DEFORM_MIN_RANGE - 1) / MMD_DEFORM_MIN_RANGE;
+   num_tasks = (num_tasks < threads ? num_tasks : threads);
+   num_tasks = (num_tasks < MMD_MAX_THREADS ? num_tasks : MMD_MAX_THREADS);
+
+   /* small meshes are not worth waking threads for */
+   if (num_tasks <= 1)
+      return mmd_deform_range(mmd, palette, 0, mmd->num_vertices, out_vertices, out_normals);
+
+   range = (mmd->num_vertices + num_tasks - 1) / num_tasks;
+   for (i = 0; i < num_tasks; ++i) {
+      tasks[i].mmd = mmd;
+      tasks[i].palette = palette;
+      tasks[i].out_vertices = out_vertices;
+      tasks[i].out_normals = out_normals;
+      tasks[i].first = i * range;
+      tasks[i].count = (mmd->num_vertices - tasks[i].first < range ? mmd->num_vertices - tasks[i].first : range);
+      tasks[i].ret = RETURN_OK;
+      args[i] = &tasks[i];
+   }
+
+   if (executor) {
+      executor->run(executor->user, mmd_deform_task_run, args, num_tasks);
+   } else {
+      mmd_run_tasks(mmd_deform_task_run, args, num_tasks, num_tasks);
+   }
+
+   for (i = 0; i < num_tasks; ++i)
+      if (tasks[i].ret != RETURN_OK)
+         return RETURN_FAIL;
+
+   return RETURN_OK;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,305 @@
+#include "internal.h"
+#include <stdint.h> /* for standard integers */
+#include <string.h> /* for memcpy */
+#include <assert.h> /* for assert */
+
+/* interleaved vertex buffer export.
+ *
+ * vertices are converted in chunks: every attribute of the chunk
+ * is converted from contiguous floats to its format in one flat
+ * loop, and then copied to its place in the interleaved vertices.
+ * the chunk stays in cache between the two. */
+
+enum {
+   /* vertices converted at once */
+   MMD_EXPORT_CHUNK = 256,
+
+   /* most components of attribute */
+   MMD_EXPORT_MAX_COMPONENTS = 3
+};
+
+/* \brief components of attribute */
+static unsigned int mmd_attrib_components(unsigned int attrib)
+{
+   switch (attrib) {
+      case MMD_ATTRIB_POSITION:
+      case MMD_ATTRIB_NORMAL:
+         return 3;
+      case MMD_ATTRIB_COORD:
+      case MMD_ATTRIB_BONES:
+      case MMD_ATTRIB_WEIGHTS:
+         return 2;
+      case MMD_ATTRIB_EDGE:
+         return 1;
+      default:
+         return 0;
+   }
+}
+
+/* \brief size of single component in format */
+unsigned int mmd_format_size(unsigned int format)
+{
+   switch (format) {
+      case MMD_FORMAT_FLOAT32:
+         return 4;
+      case MMD_FORMAT_FLOAT16:
+      case MMD_FORMAT_SNORM16:
+      case MMD_FORMAT_UNORM16:
+      case MMD_FORMAT_UINT16:
+         return 2;
+      case MMD_FORMAT_SNORM8:
+      case MMD_FORMAT_UNORM8:
+      case MMD_FORMAT_UINT8:
+         return 1;
+      default:
+         return 0;
+   }
+}
+
+/* \brief bytes of attribute in format */
+unsigned int mmd_vertex_attrib_size(unsigned int attrib, unsigned int format)
+{
+   return mmd_attrib_components(attrib) * mmd_format_size(format);
+}
+
+/* \brief lay out attributes in order, each aligned to 4 bytes */
+unsigned int mmd_vertex_layout_pack(mmd_vertex_layout *layout)
+{
+   unsigned int a, offset = 0;
+   assert(layout);
+
+   for (a = 0; a < layout->num_attribs && a < MMD_ATTRIB_LAST; ++a) {
+      layout->attribs[a].offset = offset;
+      offset += (mmd_vertex_attrib_size(layout->attribs[a].attrib, layout->attribs[a].format) + 3) & ~3u;
+   }
+
+   layout->stride = offset;
+   return offset;
+}
+
+/* \brief float to half float, round to nearest even.
+ * all cases are computed and selected, so loops over it vectorize */
+static inline uint16_t mmd_half(float value)
+{
+   const uint32_t f16max = (uint32_t)(127 + 16) << 23, f32infty = 255u << 23;
+   const uint32_t denorm_magic_u = (uint32_t)((127 - 15) + (23 - 10) + 1) << 23;
+   uint32_t f, sign, normal, denorm;
+   float denorm_f, magic;
+
+   memcpy(&f, &value, sizeof(f));
+   sign = f & 0x80000000u;
+   f ^= sign;
+
+   /* below smallest normal half, float add does the rounding */
+   memcpy(&denorm_f, &f, sizeof(f));
+   memcpy(&magic, &denorm_magic_u, sizeof(magic));
+   denorm_f += magic;
+   memcpy(&denorm, &denorm_f, sizeof(denorm));
+   denorm -= denorm_magic_u;
+
+   /* rebias exponent and round mantissa */
+   normal = (f + ((uint32_t)(15 - 127) << 23) + 0xfff + ((f >> 13) & 1)) >> 13;
+
+   f = (f >= f16max ? (f > f32infty ? 0x7e00 : 0x7c00) : (f < (113u << 23) ? denorm : normal));
+   return (uint16_t)(f | (sign >> 16));
+}
+
+/* \brief clamp to range */
+static inline float mmd_clampf(float v, float lo, float hi)
+{
+   return (v < lo ? lo : (v > hi ? hi : v));
+}
+
+/* \brief round half away from zero */
+static inline float mmd_roundf(float v)
+{
+   return (v < 0.0f ? v - 0.5f : v + 0.5f);
+}
+
+/* \brief convert count floats to format */
+static void mmd_convert(const float *MMD_RESTRICT src, size_t count, unsigned int format, void *MMD_RESTRICT out)
+{
+   size_t i;
+
+   switch (format) {
+      case MMD_FORMAT_FLOAT32:
+         memcpy(out, src, count * sizeof(float));
+         break;
+
+      case MMD_FORMAT_FLOAT16:
+         for (i = 0; i < count; ++i)
+            ((uint16_t*)out)[i] = mmd_half(src[i]);
+         break;
+
+      case MMD_FORMAT_SNORM16:
+         for (i = 0; i < count; ++i)
+            ((int16_t*)out)[i] = (int16_t)mmd_roundf(mmd_clampf(src[i], -1.0f, 1.0f) * 32767.0f);
+         break;
+
+      case MMD_FORMAT_UNORM16:
+         for (i = 0; i < count; ++i)
+            ((uint16_t*)out)[i] = (uint16_t)(mmd_clampf(src[i], 0.0f, 1.0f) * 65535.0f + 0.5f);
+         break;
+
+      case MMD_FORMAT_UINT16:
+         for (i = 0; i < count; ++i)
+            ((uint16_t*)out)[i] = (uint16_t)(mmd_clampf(src[i], 0.0f, 65535.0f) + 0.5f);
+         break;
+
+      case MMD_FORMAT_SNORM8:
+         for (i = 0; i < count; ++i)
+            ((int8_t*)out)[i] = (int8_t)mmd_roundf(mmd_clampf(src[i], -1.0f, 1.0f) * 127.0f);
+         break;
+
+      case MMD_FORMAT_UNORM8:
+         for (i = 0; i < count; ++i)
+            ((uint8_t*)out)[i] = (uint8_t)(mmd_clampf(src[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+         break;
+
+      case MMD_FORMAT_UINT8:
+         for (i = 0; i < count; ++i)
+            ((uint8_t*)out)[i] = (uint8_t)(mmd_clampf(src[i], 0.0f, 255.0f) + 0.5f);
+         break;
+
+      default:
+         break;
+   }
+}
+
+/* \brief contiguous floats of attribute for count vertices from first,
+ * attributes not stored as floats are expanded to scratch */
+static const float* mmd_export_source(const mmd_data *mmd, unsigned int attrib, unsigned int first, unsigned int count, float *scratch)
+{
+   const mmd_weight *weights = &mmd->weights[first];
+   unsigned int i;
+
+   switch (attrib) {
+      case MMD_ATTRIB_POSITION:
+         return &mmd->vertices[first * 3];
+      case MMD_ATTRIB_NORMAL:
+         return &mmd->normals[first * 3];
+      case MMD_ATTRIB_COORD:
+         return &mmd->coords[first * 2];
+
+      case MMD_ATTRIB_BONES:
+         for (i = 0; i < count; ++i) {
+            scratch[i * 2 + 0] = weights[i].bone_index[0];
+            scratch[i * 2 + 1] = weights[i].bone_index[1];
+         }
+         return scratch;
+
+      case MMD_ATTRIB_WEIGHTS:
+         for (i = 0; i < count; ++i) {
+            scratch[i * 2 + 0] = (weights[i].weight > 100 ? 100 : weights[i].weight) * 0.01f;
+            scratch[i * 2 + 1] = 1.0f - scratch[i * 2 + 0];
+         }
+         return scratch;
+
+      case MMD_ATTRIB_EDGE:
+         for (i = 0; i < count; ++i)
+            scratch[i] = weights[i].edge_flag;
+         return scratch;
+
+      default:
+         return scratch;
+   }
+}
+
+/* \brief copy count packed attributes of size bytes to every stride bytes of out */
+static void mmd_export_scatter(const unsigned char *MMD_RESTRICT packed, size_t size, size_t count, unsigned char *MMD_RESTRICT out, size_t stride)
+{
+   size_t i;
+
+   /* fixed size copies become plain loads and stores */
+   switch (size) {
+      case 2:
+         for (i = 0; i < count; ++i) memcpy(out + i * stride, packed + i * 2, 2);
+         break;
+      case 4:
+         for (i = 0; i < count; ++i) memcpy(out + i * stride, packed + i * 4, 4);
+         break;
+      case 6:
+         for (i = 0; i < count; ++i) memcpy(out + i * stride, packed + i * 6, 6);
+         break;
+      case 8:
+         for (i = 0; i < count; ++i) memcpy(out + i * stride, packed + i * 8, 8);
+         break;
+      case 12:
+         for (i = 0; i < count; ++i) memcpy(out + i * stride, packed + i * 12, 12);
+         break;
+      default:
+         for (i = 0; i < count; ++i) memcpy(out + i * stride, packed + i * size, size);
+         break;
+   }
+}
+
+/* \brief is layout usable? */
+static int mmd_vertex_layout_valid(const mmd_vertex_layout *layout)
+{
+   unsigned int a, size;
+
+   if (layout->num_attribs > MMD_ATTRIB_LAST)
+      return 0;
+
+   for (a = 0; a < layout->num_attribs; ++a) {
+      size = mmd_vertex_attrib_size(layout->attribs[a].attrib, layout->attribs[a].format);
+
+      if (!size || layout->attribs[a].offset > layout->stride || size > layout->stride - layout->attribs[a].offset)
+         return 0;
+   }
+
+   return 1;
+}
+
+/* \brief write interleaved vertices first to first + count */
+int mmd_export_vertices(const mmd_data *mmd, const mmd_vertex_layout *layout, unsigned int first, unsigned int count, void *out)
+{
+   float scratch[MMD_EXPORT_CHUNK * MMD_EXPORT_MAX_COMPONENTS];
+   uint32_t packed[MMD_EXPORT_CHUNK * MMD_EXPORT_MAX_COMPONENTS];
+   const mmd_vertex_attrib *attrib;
+   unsigned char *dst;
+   unsigned int c, n, a, components;
+   assert(mmd && layout && (out || !count));
+
+   if (!mmd_vertex_layout_valid(layout) || first > mmd->num_vertices || count > mmd->num_vertices - first)
+      return RETURN_FAIL;
+
+   for (c = first; c < first + count; c += n) {
+      n = (first + count - c < MMD_EXPORT_CHUNK ? first + count - c : MMD_EXPORT_CHUNK);
+      dst = (unsigned char*)out + (size_t)c * layout->stride;
+
+      for (a = 0; a < layout->num_attribs; ++a) {
+         attrib = &layout->attribs[a];
+         components = mmd_attrib_components(attrib->attrib);
+
+         mmd_convert(mmd_export_source(mmd, attrib->attrib, c, n, scratch), (size_t)n * components, attrib->format, packed);
+         mmd_export_scatter((const unsigned char*)packed, components * mmd_format_size(attrib->format), n,
+                            dst + attrib->offset, layout->stride);
+      }
+   }
+
+   return RETURN_OK;
+}
+
+/* \brief index range of every material */
+int mmd_export_ranges(const mmd_data *mmd, mmd_index_range *ranges)
+{
+   unsigned int m, first = 0;
+   int ret = RETURN_OK;
+   assert(mmd && (ranges || !mmd->num_materials));
+
+   /* materials take faces from the index buffer in order */
+   for (m = 0; m < mmd->num_materials; ++m) {
+      ranges[m].first = first;
+      ranges[m].count = (mmd->materials[m].face < mmd->num_indices - first ? mmd->materials[m].face : mmd->num_indices - first);
+
+      if (ranges[m].count != mmd->materials[m].face)
+         ret = RETURN_FAIL;
+
+      first += ranges[m].count;
+   }
+
+   return ret;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,444 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <math.h>   /* for sqrtf */
+#include <assert.h> /* for assert */
+
+/* CCD IK over PMD ik chains.
+ *
+ * bone state of every pose in the batch is kept as rows of
+ * batch floats per bone and component, the kernels run over
+ * the poses of a row without branches, so the compiler can
+ * vectorize them.
+ *
+ * quaternions are x, y, z, w, world = parent * local. */
+
+/* stop iterating when every effector is this close to its target */
+#define MMD_IK_EPSILON 1e-4f
+
+/* knees bend from -180 to -0.5 degrees around x,
+ * stored as sine and cosine of the upper half angle */
+#define MMD_IK_KNEE_SIN -0.0043633093f
+#define MMD_IK_KNEE_COS  0.9999904807f
+
+/* \brief single ik chain of solver */
+typedef struct mmd_ik_chain {
+   /* ik bone (target position) and effector bone */
+   unsigned short target, effector;
+   unsigned short iterations;
+
+   /* cos and sin of half angle limit per step, cos is -1 without limit */
+   float limit_cos, limit_sin;
+
+   /* links from effector upwards, with position of each in path, or -1 */
+   unsigned short *links;
+   int *link_path;
+   unsigned char *knee;
+   unsigned int num_links;
+
+   /* bones from topmost link down to effector, parents first */
+   unsigned short *path;
+   unsigned int num_path;
+} mmd_ik_chain;
+
+struct mmd_ik_solver {
+   unsigned int num_bones, batch;
+
+   /* bone order with parents first, parent and rest offset from it */
+   unsigned short *order, *parent;
+   float *offset;
+
+   mmd_ik_chain *chains;
+   unsigned int num_chains;
+
+   /* local translation and rotation, world position and rotation.
+    * component c of bone b in pose i is at c * stride + b * batch + i */
+   float *lt, *lq, *wp, *wq;
+   size_t stride;
+   float *state;
+};
+
+/* \brief is bone a knee? */
+static int mmd_ik_is_knee(const char *name)
+{
+   return (name && strstr(name, "ひざ") != NULL);
+}
+
+/* \brief world transforms of bones, parents must be up to date */
+static void mmd_ik_forward(mmd_ik_solver *solver, const unsigned short *bones, unsigned int num_bones, unsigned int count)
+{
+   const size_t s = solver->stride;
+   size_t row, prow;
+   unsigned int b, c;
+
+   for (b = 0; b < num_bones; ++b) {
+      row = bones[b] * solver->batch;
+
+      if (solver->parent[bones[b]] == MMD_BONE_NONE) {
+         for (c = 0; c < 4; ++c)
+            memcpy(&solver->wq[c * s + row], &solver->lq[c * s + row], count * sizeof(float));
+
+         for (c = 0; c < 3; ++c)
+            memcpy(&solver->wp[c * s + row], &solver->lt[c * s + row], count * sizeof(float));
+
+         continue;
+      }
+
+      prow = solver->parent[bones[b]] * solver->batch;
+      mmd_bone_forward(&solver->wq[row], &solver->wp[row], &solver->lq[row], &solver->lt[row],
+                       &solver->wq[prow], &solver->wp[prow], s, count);
+   }
+}
+
+/* \brief keep only the twist of knee around x, clamped to bent range */
+static inline void mmd_ik_limit_knee(float *q)
+{
+   const float x = (q[3] < 0.0f ? -q[0] : q[0]), w = (q[3] < 0.0f ? -q[3] : q[3]);
+   const float len = sqrtf(x * x + w * w);
+   const float inv = 1.0f / (len > 1e-12f ? len : 1.0f);
+   const int bent = (x * inv <= MMD_IK_KNEE_SIN);
+
+   q[0] = (bent ? x * inv : MMD_IK_KNEE_SIN);
+   q[3] = (bent ? w * inv : MMD_IK_KNEE_COS);
+   q[1] = q[2] = 0.0f;
+}
+
+/* \brief rotate link towards target for count poses.
+ * lq is local rotation of link, wq its world rotation,
+ * lp, ep and tp world positions of link, effector and target.
+ * component c of every argument is c * s floats after the first */
+static void mmd_ik_step_link(float *MMD_RESTRICT lq, const float *MMD_RESTRICT wq, const float *MMD_RESTRICT lp,
+                             const float *MMD_RESTRICT ep, const float *MMD_RESTRICT tp, size_t s,
+                             float limit_cos, float limit_sin, int knee, int first, unsigned int count)
+{
+   const int flip = (first && knee);
+   float q[4], k[4], dq[4], ve[3], vt[3], cx, cy, cz, axis, len, inv, scale;
+   int valid, limited;
+   unsigned int i;
+
+   for (i = 0; i < count; ++i) {
+      /* effector and target in link space */
+      mmd_quat_rotate(-wq[i], -wq[s + i], -wq[2*s + i], wq[3*s + i], ep[i] - lp[i], ep[s + i] - lp[s + i], ep[2*s + i] - lp[2*s + i], ve);
+      mmd_quat_rotate(-wq[i], -wq[s + i], -wq[2*s + i], wq[3*s + i], tp[i] - lp[i], tp[s + i] - lp[s + i], tp[2*s + i] - lp[2*s + i], vt);
+
+      /* knees turn only around x, solve in the plane they turn in */
+      ve[0] = (knee ? 0.0f : ve[0]);
+      vt[0] = (knee ? 0.0f : vt[0]);
+
+      /* shortest arc from ve to vt as quaternion: (cross, |ve| * |vt| + dot) */
+      cx = ve[1] * vt[2] - ve[2] * vt[1];
+      cy = ve[2] * vt[0] - ve[0] * vt[2];
+      cz = ve[0] * vt[1] - ve[1] * vt[0];
+      dq[3] = sqrtf((ve[0] * ve[0] + ve[1] * ve[1] + ve[2] * ve[2]) * (vt[0] * vt[0] + vt[1] * vt[1] + vt[2] * vt[2])) +
+              ve[0] * vt[0] + ve[1] * vt[1] + ve[2] * vt[2];
+      axis = cx * cx + cy * cy + cz * cz;
+      len = sqrtf(axis + dq[3] * dq[3]);
+
+      /* degenerate or opposite vectors leave link as is */
+      valid = (len >= 1e-12f) & (axis >= 1e-24f);
+      inv = 1.0f / (valid ? len : 1.0f);
+      dq[3] = (valid ? dq[3] * inv : 1.0f);
+
+      /* control weight limits angle per step */
+      limited = (dq[3] < limit_cos);
+      scale = limit_sin / sqrtf(valid ? axis : 1.0f);
+      scale = (limited ? scale : inv);
+      dq[3] = (limited ? limit_cos : dq[3]);
+      dq[0] = cx * scale;
+      dq[1] = cy * scale;
+      dq[2] = cz * scale;
+
+      /* straight knee would only ever turn forward and stay stuck,
+       * so the first iteration turns it the bending way instead */
+      dq[0] = (flip & (dq[0] > 0.0f) ? -dq[0] : dq[0]);
+
+      /* q = lq * dq */
+      q[0] = lq[3*s + i] * dq[0] + lq[i] * dq[3] + lq[s + i] * dq[2] - lq[2*s + i] * dq[1];
+      q[1] = lq[3*s + i] * dq[1] - lq[i] * dq[2] + lq[s + i] * dq[3] + lq[2*s + i] * dq[0];
+      q[2] = lq[3*s + i] * dq[2] + lq[i] * dq[1] - lq[s + i] * dq[0] + lq[2*s + i] * dq[3];
+      q[3] = lq[3*s + i] * dq[3] - lq[i] * dq[0] - lq[s + i] * dq[1] - lq[2*s + i] * dq[2];
+
+      /* both results are computed, so the loop has no branches */
+      k[0] = q[0]; k[1] = q[1]; k[2] = q[2]; k[3] = q[3];
+      mmd_ik_limit_knee(k);
+      inv = 1.0f / sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+
+      lq[i] = (knee ? k[0] : q[0] * inv);
+      lq[s + i] = (knee ? k[1] : q[1] * inv);
+      lq[2*s + i] = (knee ? k[2] : q[2] * inv);
+      lq[3*s + i] = (knee ? k[3] : q[3] * inv);
+   }
+}
+
+/* \brief rotate link of chain towards target in every pose of batch */
+static void mmd_ik_step(mmd_ik_solver *solver, const mmd_ik_chain *chain, unsigned int link, int first, unsigned int count)
+{
+   const size_t lrow = chain->links[link] * solver->batch;
+
+   mmd_ik_step_link(&solver->lq[lrow], &solver->wq[lrow], &solver->wp[lrow],
+                    &solver->wp[chain->effector * solver->batch], &solver->wp[chain->target * solver->batch],
+                    solver->stride, chain->limit_cos, chain->limit_sin, chain->knee[link], first, count);
+}
+
+/* \brief is every effector of batch at its target? */
+static int mmd_ik_converged(const mmd_ik_solver *solver, const mmd_ik_chain *chain, unsigned int count)
+{
+   const size_t s = solver->stride;
+   const float *ep = &solver->wp[chain->effector * solver->batch], *tp = &solver->wp[chain->target * solver->batch];
+   float dx, dy, dz;
+   unsigned int i;
+
+   for (i = 0; i < count; ++i) {
+      dx = ep[i] - tp[i];
+      dy = ep[s + i] - tp[s + i];
+      dz = ep[2*s + i] - tp[2*s + i];
+
+      if (dx * dx + dy * dy + dz * dz > MMD_IK_EPSILON * MMD_IK_EPSILON)
+         return 0;
+   }
+
+   return 1;
+}
+
+/* \brief solve chain for batch */
+static void mmd_ik_solve_chain(mmd_ik_solver *solver, const mmd_ik_chain *chain, unsigned int count)
+{
+   const size_t s = solver->stride;
+   unsigned int it, l, i, c;
+   float q[4], *lq;
+
+   /* knees start bent, so the first step has a direction to turn */
+   for (l = 0; l < chain->num_links; ++l) {
+      if (!chain->knee[l])
+         continue;
+
+      lq = &solver->lq[chain->links[l] * solver->batch];
+      for (i = 0; i < count; ++i) {
+         for (c = 0; c < 4; ++c)
+            q[c] = lq[c * s + i];
+
+         mmd_ik_limit_knee(q);
+
+         for (c = 0; c < 4; ++c)
+            lq[c * s + i] = q[c];
+      }
+
+      if (chain->link_path[l] >= 0)
+         mmd_ik_forward(solver, &chain->path[chain->link_path[l]], chain->num_path - chain->link_path[l], count);
+   }
+
+   for (it = 0; it < chain->iterations; ++it) {
+      if (mmd_ik_converged(solver, chain, count))
+         break;
+
+      for (l = 0; l < chain->num_links; ++l) {
+         mmd_ik_step(solver, chain, l, (it == 0), count);
+
+         if (chain->link_path[l] >= 0)
+            mmd_ik_forward(solver, &chain->path[chain->link_path[l]], chain->num_path - chain->link_path[l], count);
+      }
+   }
+}
+
+/* \brief does ik reference only bones of mmd? */
+static int mmd_ik_valid(const mmd_data *mmd, const mmd_ik *ik)
+{
+   unsigned int l;
+
+   if (ik->bone_index >= mmd->num_bones || ik->target_bone_index >= mmd->num_bones || !ik->chain_length)
+      return 0;
+
+   for (l = 0; l < ik->chain_length; ++l)
+      if (ik->child_bone_index[l] >= mmd->num_bones)
+         return 0;
+
+   return 1;
+}
+
+/* \brief collect chain of valid ik */
+static int mmd_ik_build_chain(mmd_ik_solver *solver, mmd_data *mmd, const mmd_ik *ik, mmd_ik_chain *chain)
+{
+   const float pi = 3.14159265358979f;
+   unsigned int l, b, top = 0, found;
+   float limit;
+
+   chain->target = ik->bone_index;
+   chain->effector = ik->target_bone_index;
+   chain->iterations = ik->iterations;
+   chain->num_links = ik->chain_length;
+
+   limit = ik->cotrol_weight * pi;
+   chain->limit_cos = (limit > 0.0f && limit < pi ? cosf(limit * 0.5f) : -1.0f);
+   chain->limit_sin = (limit > 0.0f && limit < pi ? sinf(limit * 0.5f) : 0.0f);
+
+   if (!(chain->links = calloc(chain->num_links, sizeof(unsigned short))) ||
+       !(chain->link_path = calloc(chain->num_links, sizeof(int))) ||
+       !(chain->knee = calloc(chain->num_links, sizeof(unsigned char))) ||
+       !(chain->path = calloc(mmd->num_bones, sizeof(unsigned short))))
+      return RETURN_FAIL;
+
+   for (l = 0; l < chain->num_links; ++l) {
+      chain->links[l] = ik->child_bone_index[l];
+      chain->knee[l] = mmd_ik_is_knee(mmd->bones[chain->links[l]].name ? mmd->bones[chain->links[l]].name :
+                                      mmd_get_string(mmd, mmd->bones[chain->links[l]].name_id));
+   }
+
+   /* walk from effector up to the farthest link */
+   for (l = 0; l < chain->num_links; ++l) {
+      for (found = 0, b = chain->effector; b != MMD_BONE_NONE; b = solver->parent[b]) {
+         if (b == chain->links[l]) {
+            found = 1;
+            break;
+         }
+      }
+
+      if (found)
+         top = l + 1;
+   }
+
+   for (b = chain->effector; top && b != MMD_BONE_NONE; b = solver->parent[b]) {
+      chain->path[chain->num_path++] = (unsigned short)b;
+      if (b == chain->links[top - 1])
+         break;
+   }
+
+   /* parents first */
+   for (l = 0; l < chain->num_path / 2; ++l) {
+      b = chain->path[l];
+      chain->path[l] = chain->path[chain->num_path - 1 - l];
+      chain->path[chain->num_path - 1 - l] = (unsigned short)b;
+   }
+
+   for (l = 0; l < chain->num_links; ++l) {
+      chain->link_path[l] = -1;
+      for (b = 0; b < chain->num_path; ++b) {
+         if (chain->path[b] == chain->links[l]) {
+            chain->link_path[l] = (int)b;
+            break;
+         }
+      }
+   }
+
+   return RETURN_OK;
+}
+
+/* \brief create CCD IK solver for ik chains of mmd */
+mmd_ik_solver* mmd_ik_solver_new(mmd_data *mmd, unsigned int batch)
+{
+   mmd_ik_solver *solver;
+   unsigned int b, c, p;
+   assert(mmd);
+
+   if (!(solver = calloc(1, sizeof(mmd_ik_solver))))
+      return NULL;
+
+   solver->num_bones = mmd->num_bones;
+   solver->batch = (batch ? batch : 1);
+   solver->stride = (size_t)solver->num_bones * solver->batch;
+
+   if (!(solver->order = calloc(mmd->num_bones + 1, sizeof(unsigned short))) ||
+       !(solver->parent = calloc(mmd->num_bones + 1, sizeof(unsigned short))) ||
+       !(solver->offset = calloc(mmd->num_bones * 3 + 1, sizeof(float))) ||
+       !(solver->chains = calloc(mmd->num_ik + 1, sizeof(mmd_ik_chain))) ||
+       !(solver->state = calloc(solver->stride * 14 + 1, sizeof(float))))
+      goto fail;
+
+   solver->lt = solver->state;
+   solver->lq = solver->lt + solver->stride * 3;
+   solver->wp = solver->lq + solver->stride * 4;
+   solver->wq = solver->wp + solver->stride * 3;
+
+   if (mmd_bone_order(mmd, solver->order, solver->parent, NULL) < 0)
+      goto fail;
+
+   for (b = 0; b < mmd->num_bones; ++b) {
+      p = solver->parent[b];
+      for (c = 0; c < 3; ++c)
+         solver->offset[b * 3 + c] = mmd->bones[b].head_pos[c] - (p != MMD_BONE_NONE ? mmd->bones[p].head_pos[c] : 0.0f);
+   }
+
+   /* chains referencing missing bones are skipped */
+   for (b = 0; b < mmd->num_ik; ++b) {
+      if (!mmd_ik_valid(mmd, &mmd->ik[b]))
+         continue;
+
+      if (mmd_ik_build_chain(solver, mmd, &mmd->ik[b], &solver->chains[solver->num_chains++]) != RETURN_OK)
+         goto fail;
+   }
+
+   return solver;
+
+fail:
+   mmd_ik_solver_free(solver);
+   return NULL;
+}
+
+/* \brief solve up to batch poses */
+static void mmd_ik_solve_batch(mmd_ik_solver *solver, mmd_pose **poses, unsigned int count)
+{
+   const size_t batch = solver->batch, s = solver->stride;
+   unsigned int b, i, c, k, l;
+
+   for (b = 0; b < solver->num_bones; ++b) {
+      for (i = 0; i < count; ++i) {
+         for (c = 0; c < 3; ++c)
+            solver->lt[c * s + b * batch + i] = solver->offset[b * 3 + c] + poses[i]->translations[b * 3 + c];
+
+         for (c = 0; c < 4; ++c)
+            solver->lq[c * s + b * batch + i] = poses[i]->rotations[b * 4 + c];
+      }
+   }
+
+   for (k = 0; k < solver->num_chains; ++k) {
+      /* earlier chains may have moved any bone */
+      mmd_ik_forward(solver, solver->order, solver->num_bones, count);
+      mmd_ik_solve_chain(solver, &solver->chains[k], count);
+   }
+
+   for (k = 0; k < solver->num_chains; ++k) {
+      for (l = 0; l < solver->chains[k].num_links; ++l) {
+         b = solver->chains[k].links[l];
+         for (i = 0; i < count; ++i)
+            for (c = 0; c < 4; ++c)
+               poses[i]->rotations[b * 4 + c] = solver->lq[c * s + b * batch + i];
+      }
+   }
+}
+
+/* \brief solve ik chains of poses */
+void mmd_ik_solve(mmd_ik_solver *solver, mmd_pose **poses, unsigned int count)
+{
+   unsigned int i;
+   assert(solver && (poses || !count));
+
+   for (i = 0; i < count; ++i)
+      assert(poses[i] && poses[i]->num_bones == solver->num_bones);
+
+   for (i = 0; i < count; i += solver->batch)
+      mmd_ik_solve_batch(solver, poses + i, (count - i < solver->batch ? count - i : solver->batch));
+}
+
+/* \brief free solver */
+void mmd_ik_solver_free(mmd_ik_solver *solver)
+{
+   unsigned int i;
+   assert(solver);
+
+   if (solver->chains) {
+      for (i = 0; i < solver->num_chains; ++i) {
+         if (solver->chains[i].links) free(solver->chains[i].links);
+         if (solver->chains[i].link_path) free(solver->chains[i].link_path);
+         if (solver->chains[i].knee) free(solver->chains[i].knee);
+         if (solver->chains[i].path) free(solver->chains[i].path);
+      }
+
+      free(solver->chains);
+   }
+
+   if (solver->order) free(solver->order);
+   if (solver->parent) free(solver->parent);
+   if (solver->offset) free(solver->offset);
+   if (solver->state) free(solver->state);
+   free(solver);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,409 @@
+#ifndef __mmd_internal_h__
+#define __mmd_internal_h__
+
+#include "mmd.h"
+#include <stddef.h> /* for size_t */
+#include <stdint.h> /* for standard integers */
+#include <string.h> /* for memcpy */
+
+#if defined(_MSC_VER) && !defined(__cplusplus)
+#  define inline __inline
+#endif
+
+enum {
+   RETURN_OK = 0, RETURN_FAIL = -1
+};
+
+/* pointer arguments that do not alias, lets loops over them vectorize */
+#if defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER)
+#  define MMD_RESTRICT __restrict
+#else
+#  define MMD_RESTRICT
+#endif
+
+/* SIMD instruction sets that can be compiled on this target */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define MMD_HAS_SSE2 1
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#  define MMD_HAS_AVX2 1
+#  define MMD_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#  define MMD_HAS_AVX2 1
+#  define MMD_TARGET_AVX2
+#endif
+
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && !defined(__ARM_BIG_ENDIAN)
+#  define MMD_HAS_NEON 1
+#endif
+
+/* sizes of PMD records in file */
+enum {
+   MMD_HEADER_SIZE = 3 + sizeof(uint32_t) + 20 + 256,
+   MMD_VERTEX_SIZE = sizeof(uint32_t) * 9 + 2,
+   MMD_INDEX_SIZE = sizeof(uint16_t),
+   MMD_MATERIAL_SIZE = sizeof(uint32_t) * 12 + 20 + 2,
+   MMD_BONE_SIZE = 20 + sizeof(uint16_t) * 3 + 1 + sizeof(uint32_t) * 3,
+   MMD_IK_SIZE = sizeof(uint16_t) * 3 + sizeof(uint32_t) + 1,
+   MMD_IK_LINK_SIZE = sizeof(uint16_t),
+   MMD_SKIN_SIZE = 20 + sizeof(uint32_t) + 1,
+   MMD_SKIN_VERTEX_SIZE = sizeof(uint32_t) * 4,
+   MMD_SKIN_DISPLAY_SIZE = sizeof(uint16_t),
+   MMD_BONE_NAME_SIZE = 50
+};
+
+/* does the cpu we run on support AVX2? */
+int mmd_cpu_has_avx2(void);
+
+/* number of online cpus, at least 1 */
+unsigned int mmd_cpu_count(void);
+
+/* upper limit for threads of internal pool */
+#define MMD_MAX_THREADS 64
+
+/* mutex, lock and unlock accept NULL and do nothing */
+typedef struct mmd_mutex mmd_mutex;
+mmd_mutex* mmd_mutex_new(void);
+void mmd_mutex_free(mmd_mutex *mutex);
+void mmd_mutex_lock(mmd_mutex *mutex);
+void mmd_mutex_unlock(mmd_mutex *mutex);
+
+/* pointer set lazily and read by every thread, racing threads
+ * store the same value. elsewhere aligned pointer accesses are
+ * single instructions and MSVC volatile gives the same ordering */
+#if defined(__GNUC__) || defined(__clang__)
+#  define MMD_ATOMIC_LOAD(var) __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#  define MMD_ATOMIC_STORE(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELEASE)
+#else
+#  define MMD_ATOMIC_LOAD(var) (var)
+#  define MMD_ATOMIC_STORE(var, value) ((var) = (value))
+#endif
+
+/* variable with copy per thread */
+#if defined(_MSC_VER)
+#  define MMD_THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+#  define MMD_THREAD_LOCAL _Thread_local
+#else
+#  define MMD_THREAD_LOCAL __thread
+#endif
+
+/* monotonic time in seconds */
+double mmd_time(void);
+
+/* run fn for every argument on up to threads threads,
+ * calling thread is one of them, returns when all are done */
+void mmd_run_tasks(mmd_task_fn fn, void **args, unsigned int count, unsigned int threads);
+
+/* decoder for packed PMD vertex records */
+typedef void (*mmd_vertex_decode_fn)(const unsigned char *data, size_t count, float *vertices, float *normals, float *coords, mmd_weight *weights);
+
+typedef struct mmd_vertex_kernel {
+   const char *name;
+   mmd_vertex_decode_fn decode;
+   int (*supported)(void);
+} mmd_vertex_kernel;
+
+/* kernels compiled in, best first, terminated by NULL name.
+ * the last kernel is portable and always supported */
+const mmd_vertex_kernel* mmd_vertex_kernels(void);
+
+/* solve count MMD bezier curves: x -> s on x1, x2 and then s -> y on y1, y2,
+ * control points are normalized to 0-1 */
+typedef void (*mmd_bezier_fn)(const float *x, const float *x1, const float *y1, const float *x2, const float *y2, float *y, size_t count);
+
+/* slerp count quaternions, a, b and out hold 4 arrays (x, y, z, w)
+ * of stride floats each, t is the interpolation amount */
+typedef void (*mmd_slerp_fn)(const float *a, const float *b, const float *t, float *out, size_t count, size_t stride);
+
+typedef struct mmd_curve_kernel {
+   const char *name;
+   mmd_bezier_fn bezier;
+   mmd_slerp_fn slerp;
+   int (*supported)(void);
+} mmd_curve_kernel;
+
+/* curve kernels compiled in, best first, terminated by NULL name */
+const mmd_curve_kernel* mmd_curve_kernels(void);
+
+/* best supported curve kernel for this cpu */
+const mmd_curve_kernel* mmd_curve_kernel_best(void);
+
+/* deform count vertices and normals with blend of their two bone matrices,
+ * palette is num_bones column major 4x4 matrices */
+typedef void (*mmd_deform_fn)(const float *vertices, const float *normals, const mmd_weight *weights, const float *palette, unsigned int num_bones, float *out_vertices, float *out_normals, size_t count);
+
+typedef struct mmd_deform_kernel {
+   const char *name;
+   mmd_deform_fn deform;
+   int (*supported)(void);
+} mmd_deform_kernel;
+
+/* deform kernels compiled in, best first, terminated by NULL name */
+const mmd_deform_kernel* mmd_deform_kernels(void);
+
+/* parent index of root bones */
+#define MMD_BONE_NONE 0xFFFF
+
+/* sort bones of mmd by depth, parents first, into order.
+ * parent gets parent of every bone, MMD_BONE_NONE for roots
+ * and for bones cut from parent cycles. when levels is not NULL
+ * it gets first position of every depth in order followed by num_bones,
+ * it must hold num_bones + 1 entries.
+ * returns number of depths, or RETURN_FAIL */
+int mmd_bone_order(const mmd_data *mmd, unsigned short *order, unsigned short *parent, unsigned int *levels);
+
+/* \brief rotate (x, y, z) by quaternion (qx, qy, qz, qw) */
+static inline void mmd_quat_rotate(float qx, float qy, float qz, float qw, float x, float y, float z, float *out)
+{
+   /* t = 2 * cross(q.xyz, v), out = v + w * t + cross(q.xyz, t) */
+   const float tx = 2.0f * (qy * z - qz * y);
+   const float ty = 2.0f * (qz * x - qx * z);
+   const float tz = 2.0f * (qx * y - qy * x);
+   out[0] = x + qw * tx + (qy * tz - qz * ty);
+   out[1] = y + qw * ty + (qz * tx - qx * tz);
+   out[2] = z + qw * tz + (qx * ty - qy * tx);
+}
+
+/* \brief world rotation wq and position wp of count bones
+ * from local lq, lt and parent world pq, pp.
+ * component c of every argument is c * s floats after the first */
+static inline void mmd_bone_forward(float *MMD_RESTRICT wq, float *MMD_RESTRICT wp, const float *MMD_RESTRICT lq, const float *MMD_RESTRICT lt,
+                                    const float *MMD_RESTRICT pq, const float *MMD_RESTRICT pp, size_t s, size_t count)
+{
+   float t[3];
+   size_t i;
+
+   for (i = 0; i < count; ++i) {
+      wq[i] = pq[3*s + i] * lq[i] + pq[i] * lq[3*s + i] + pq[s + i] * lq[2*s + i] - pq[2*s + i] * lq[s + i];
+      wq[s + i] = pq[3*s + i] * lq[s + i] - pq[i] * lq[2*s + i] + pq[s + i] * lq[3*s + i] + pq[2*s + i] * lq[i];
+      wq[2*s + i] = pq[3*s + i] * lq[2*s + i] + pq[i] * lq[s + i] - pq[s + i] * lq[i] + pq[2*s + i] * lq[3*s + i];
+      wq[3*s + i] = pq[3*s + i] * lq[3*s + i] - pq[i] * lq[i] - pq[s + i] * lq[s + i] - pq[2*s + i] * lq[2*s + i];
+
+      mmd_quat_rotate(pq[i], pq[s + i], pq[2*s + i], pq[3*s + i], lt[i], lt[s + i], lt[2*s + i], t);
+      wp[i] = pp[i] + t[0];
+      wp[s + i] = pp[s + i] + t[1];
+      wp[2*s + i] = pp[2*s + i] + t[2];
+   }
+}
+
+/* map whole file, writes go to private copy when writable.
+ * returns NULL for empty or missing files */
+void* mmd_map_file(const char *path, int writable, size_t *out_size);
+
+/* release mapping of mmd_map_file, accepts NULL */
+void mmd_unmap_file(void *map, size_t size);
+
+/* new mmd_data reading from map, the map is released by mmd_free */
+mmd_data* mmd_new_from_map(void *map, size_t size);
+
+/* alignment of arrays in arena */
+#define MMD_ARENA_ALIGN 16
+#define MMD_ARENA_ALIGN_SIZE(x) (((x) + MMD_ARENA_ALIGN - 1) & ~(size_t)(MMD_ARENA_ALIGN - 1))
+
+/* add memb * size bytes array and its alignment to footprint, fails on overflow */
+int mmd_footprint_add(size_t *footprint, size_t memb, size_t size);
+
+/* allocate arena of footprint bytes, does nothing when there is one */
+int mmd_reserve_arena(mmd_data *mmd, size_t footprint);
+
+/* memory of mmd_data from its allocator, calls for one mmd_data
+ * do not overlap. zero sizes are passed to allocator as 1 */
+void* mmd_alloc(mmd_data *mmd, size_t size);
+void* mmd_realloc(mmd_data *mmd, void *ptr, size_t size);
+void mmd_dealloc(mmd_data *mmd, void *ptr);
+
+/* temporary buffer of load from scratch allocator, freeing
+ * does nothing when scratch has no free */
+void* mmd_scratch_alloc(mmd_data *mmd, size_t size);
+void mmd_scratch_free(mmd_data *mmd, void *ptr);
+
+/* allocate zeroed array, from arena when one is in use */
+void* mmd_calloc(mmd_data *mmd, size_t nmemb, size_t size);
+
+/* reference little endian array of memory source directly,
+ * NULL when it has to be copied */
+void* mmd_view(mmd_data *mmd, const unsigned char *data, size_t align);
+
+/* array of mmd that can be modified in place,
+ * arrays referencing the memory source are copied first */
+void* mmd_writable(mmd_data *mmd, void *array, size_t nmemb, size_t size);
+
+/* SJIS name, interned to string pool when one is in use */
+int mmd_name(mmd_data *mmd, const unsigned char *data, size_t size, const char **name, mmd_string *id);
+
+/* UTF8 name of size bytes, interned to string pool when one is in use */
+int mmd_name_utf8(mmd_data *mmd, const char *utf8, size_t size, const char **name, mmd_string *id);
+
+/* section being read on a thread, allocations and errors
+ * in between mmd_span_begin and mmd_span_end belong to it */
+typedef struct mmd_span {
+   mmd_data *mmd;
+   unsigned int section;
+
+   /* input offset of section start, and start time */
+   size_t offset;
+   double start;
+
+   /* measured only when stats are enabled */
+   mmd_section_stats stats;
+
+   /* span that was current before this one */
+   struct mmd_span *outer;
+} mmd_span;
+
+/* start reading section at input offset on this thread,
+ * calls begin hook when stats are enabled */
+void mmd_span_begin(mmd_data *mmd, mmd_span *span, unsigned int section, size_t offset);
+
+/* end span at input offset past the section, adds it
+ * to the stats and calls end hook. returns ret */
+int mmd_span_end(mmd_span *span, size_t end, int ret);
+
+/* count allocation of bytes to current span, when measuring */
+void mmd_count_alloc(mmd_data *mmd, size_t bytes);
+
+/* record error of load, first one wins. section
+ * MMD_SECTION_LAST takes the section of current span */
+void mmd_fail(mmd_data *mmd, int code, unsigned int section, size_t offset);
+
+/* record error at start of current span */
+void mmd_fail_span(mmd_data *mmd, int code);
+
+/* input offset of pointer into memory source */
+size_t mmd_input_offset(mmd_data *mmd, const unsigned char *data);
+
+/* intern UTF8 string, kept apart from SJIS strings of same bytes */
+mmd_string mmd_string_pool_intern_utf8(mmd_string_pool *pool, const char *utf8, size_t size);
+
+/* shared copy of size bytes of data, NULL on failure.
+ * caller gets a reference, dropped by mmd_blob_store_release */
+const void* mmd_blob_store_intern(mmd_blob_store *store, const void *data, size_t size);
+
+/* drop reference to array of mmd_blob_store_intern */
+void mmd_blob_store_release(mmd_blob_store *store, const void *data);
+
+/* read PMX model from size bytes of data, used gets the bytes decoded.
+ * strings tells if names take arena space, they do not with string pool.
+ * sections is mask of sections to decode, the rest only get their counts */
+int mmd_pmx_load(mmd_data *mmd, const unsigned char *data, size_t size, unsigned int flags, int strings, unsigned int sections, size_t *used);
+
+/* size of count field in front of section, 0 for header */
+static inline size_t mmd_count_size(unsigned int section)
+{
+   switch (section) {
+      case MMD_SECTION_VERTEX:
+      case MMD_SECTION_INDEX:
+      case MMD_SECTION_MATERIAL:
+         return sizeof(uint32_t);
+      case MMD_SECTION_BONE:
+      case MMD_SECTION_IK:
+      case MMD_SECTION_SKIN:
+         return sizeof(uint16_t);
+      case MMD_SECTION_SKIN_DISPLAY:
+      case MMD_SECTION_BONE_NAME:
+         return sizeof(uint8_t);
+      default:
+         return 0;
+   }
+}
+
+/* store count of section to mmd_data */
+void mmd_set_count(mmd_data *mmd, unsigned int section, unsigned int count);
+
+/* allocate arrays of section once its count is known */
+int mmd_alloc_section(mmd_data *mmd, unsigned int section);
+
+/* record decoders shared by the readers and mmd_parser */
+int mmd_decode_header(mmd_data *mmd, const unsigned char *data);
+int mmd_decode_material(mmd_data *mmd, mmd_material *material, const unsigned char *data);
+int mmd_decode_bone(mmd_data *mmd, mmd_bone *bone, const unsigned char *data);
+int mmd_decode_ik(mmd_data *mmd, mmd_ik *ik, const unsigned char *data);
+
+/* decodes name, type and vertex count of skin,
+ * the caller allocates the vertices once their bytes are checked */
+int mmd_decode_skin(mmd_data *mmd, mmd_skin *skin, const unsigned char *data);
+void mmd_decode_skin_vertices(mmd_skin_vertex *vertices, const unsigned char *data, size_t count);
+void mmd_decode_skin_displays(unsigned int *displays, const unsigned char *data, size_t count);
+
+/* decode count packed PMD vertex records into vertices,
+ * normals, coords and weights using best kernel for this cpu */
+void mmd_decode_vertices(const unsigned char *data, size_t count, float *vertices, float *normals, float *coords, mmd_weight *weights);
+
+/* mmd_decode_vertices in chunks, each chunk grows bounds
+ * while its positions are still in cache.
+ * bounds are tightened by caller at the end of the section */
+void mmd_decode_vertices_bounded(const unsigned char *data, size_t count, float *vertices, float *normals, float *coords, mmd_weight *weights, mmd_bounds *bounds);
+
+/* empty bounds, and grow them by count positions.
+ * tighten once after the last positions are added */
+void mmd_bounds_reset(mmd_bounds *bounds);
+void mmd_bounds_add(mmd_bounds *bounds, const float *positions, size_t count);
+void mmd_bounds_tighten(mmd_bounds *bounds);
+
+/* bounds of materials once indices and materials are decoded,
+ * and of bones once vertices and bones are decoded */
+void mmd_material_bounds(mmd_data *mmd);
+void mmd_bone_bounds(mmd_data *mmd);
+
+/* \brief is host little endian? */
+static inline int mmd_is_little_endian(void)
+{
+   const uint16_t v = 1;
+   return *(const unsigned char*)&v;
+}
+
+/* \brief decode little endian uint16_t */
+static inline unsigned short mmd_u16(const unsigned char *data)
+{
+   return (unsigned short)(data[0] | data[1] << 8);
+}
+
+/* \brief decode little endian uint32_t */
+static inline unsigned int mmd_u32(const unsigned char *data)
+{
+   return (unsigned int)data[0] | (unsigned int)data[1] << 8 |
+          (unsigned int)data[2] << 16 | (unsigned int)data[3] << 24;
+}
+
+/* \brief decode little endian float */
+static inline float mmd_f32(const unsigned char *data)
+{
+   float v;
+   uint32_t u = mmd_u32(data);
+   memcpy(&v, &u, sizeof(v));
+   return v;
+}
+
+/* \brief decode array of little endian floats */
+static inline void mmd_f32v(float *dst, const unsigned char *data, size_t memb)
+{
+   size_t i;
+
+   if (mmd_is_little_endian()) {
+      memcpy(dst, data, memb * sizeof(float));
+      return;
+   }
+
+   for (i = 0; i < memb; ++i)
+      dst[i] = mmd_f32(data + i * sizeof(uint32_t));
+}
+
+/* \brief decode array of little endian uint16_t */
+static inline void mmd_u16v(unsigned short *dst, const unsigned char *data, size_t memb)
+{
+   size_t i;
+
+   if (mmd_is_little_endian()) {
+      memcpy(dst, data, memb * sizeof(uint16_t));
+      return;
+   }
+
+   for (i = 0; i < memb; ++i)
+      dst[i] = mmd_u16(data + i * sizeof(uint16_t));
+}
+
+#endif /* __mmd_internal_h__ */
+
+/* vim: set ts=8 sw=3 tw=0 :*/
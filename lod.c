@@ -0,0 +1,594 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h> /* for memcpy, memset, memcmp */
+#include <math.h> /* for sqrt */
+#include <assert.h> /* for assert */
+
+/* level of detail generation.
+ *
+ * every material is simplified on its own task with half edge
+ * collapses ordered by quadric error (Garland and Heckbert,
+ * "Surface simplification using quadric error metrics", 1997).
+ * collapses move a vertex onto its neighbour, so every level
+ * indexes the original vertex arrays.
+ *
+ * each pass sorts all possible collapses, and takes them in
+ * order while they don't touch neighbourhood of earlier collapse
+ * of the same pass, so flip test sees the real triangles. */
+
+enum {
+   /* vertex shares position with another vertex (uv seam) */
+   MMD_LOD_SEAM = 1 << 0,
+
+   /* vertex is used by more than one material */
+   MMD_LOD_SHARED = 1 << 1,
+
+   /* vertex is moved by morph */
+   MMD_LOD_MORPH = 1 << 2,
+
+   /* vertex is on open or non manifold edge of material */
+   MMD_LOD_BORDER = 1 << 3
+};
+
+enum {
+   /* collapses are sorted by sign, exponent and 7 mantissa bits of cost */
+   MMD_LOD_BUCKET_SHIFT = 16,
+   MMD_LOD_BUCKETS = 1 << (32 - MMD_LOD_BUCKET_SHIFT)
+};
+
+/* \brief symmetric 4x4 error quadric, upper triangle */
+typedef struct mmd_quadric {
+   double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+} mmd_quadric;
+
+/* \brief possible collapse of u onto v */
+typedef struct mmd_collapse {
+   float cost;
+   unsigned int u, v;
+} mmd_collapse;
+
+/* \brief simplification of single material */
+typedef struct mmd_lod_task {
+   const mmd_data *mmd;
+   const unsigned char *flags;
+   const float *ratios;
+   unsigned int num_levels;
+
+   /* indices of material */
+   unsigned int first, count;
+
+   /* num_levels * count indices, and count and error of every level */
+   unsigned short *out;
+   unsigned int *out_count;
+   float *out_error;
+
+   int ret;
+} mmd_lod_task;
+
+/* \brief add plane ax + by + cz + d = 0 with weight w to quadric */
+static void mmd_quadric_add_plane(mmd_quadric *q, double a, double b, double c, double d, double w)
+{
+   q->a2 += w * a * a; q->ab += w * a * b; q->ac += w * a * c; q->ad += w * a * d;
+   q->b2 += w * b * b; q->bc += w * b * c; q->bd += w * b * d;
+   q->c2 += w * c * c; q->cd += w * c * d;
+   q->d2 += w * d * d;
+}
+
+/* \brief error of position p */
+static double mmd_quadric_error(const mmd_quadric *q, const float *p)
+{
+   const double x = p[0], y = p[1], z = p[2];
+   const double e = q->a2 * x * x + 2 * q->ab * x * y + 2 * q->ac * x * z + 2 * q->ad * x +
+                    q->b2 * y * y + 2 * q->bc * y * z + 2 * q->bd * y +
+                    q->c2 * z * z + 2 * q->cd * z + q->d2;
+   return (e > 0.0 ? e : 0.0);
+}
+
+/* \brief a += b */
+static void mmd_quadric_sum(mmd_quadric *a, const mmd_quadric *b)
+{
+   a->a2 += b->a2; a->ab += b->ab; a->ac += b->ac; a->ad += b->ad;
+   a->b2 += b->b2; a->bc += b->bc; a->bd += b->bd;
+   a->c2 += b->c2; a->cd += b->cd;
+   a->d2 += b->d2;
+}
+
+/* \brief unnormalized normal of triangle */
+static void mmd_triangle_normal(const float *p0, const float *p1, const float *p2, double *n)
+{
+   const double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+   const double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+   n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+   n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+   n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+static int mmd_compare_uint(const void *a, const void *b)
+{
+   const unsigned int x = *(const unsigned int*)a, y = *(const unsigned int*)b;
+   return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+/* \brief order edges as pairs of unsigned int */
+static int mmd_compare_edge(const void *a, const void *b)
+{
+   const unsigned int *x = a, *y = b;
+   return (x[0] != y[0] ? (x[0] < y[0] ? -1 : 1) : (x[1] < y[1] ? -1 : (x[1] > y[1] ? 1 : 0)));
+}
+
+/* \brief sort count collapses to out by cost.
+ * costs are never negative, so their high bits order them well enough,
+ * counting sort on those keeps the passes linear */
+static void mmd_sort_collapses(const mmd_collapse *collapses, unsigned int count, unsigned int *histogram, mmd_collapse *out)
+{
+   unsigned int i, key, sum = 0, next;
+
+   memset(histogram, 0, MMD_LOD_BUCKETS * sizeof(unsigned int));
+
+   for (i = 0; i < count; ++i) {
+      memcpy(&key, &collapses[i].cost, sizeof(key));
+      histogram[key >> MMD_LOD_BUCKET_SHIFT]++;
+   }
+
+   for (i = 0; i < MMD_LOD_BUCKETS; ++i) {
+      next = sum + histogram[i];
+      histogram[i] = sum;
+      sum = next;
+   }
+
+   for (i = 0; i < count; ++i) {
+      memcpy(&key, &collapses[i].cost, sizeof(key));
+      out[histogram[key >> MMD_LOD_BUCKET_SHIFT]++] = collapses[i];
+   }
+}
+
+/* \brief vertex position with its index, for finding seams */
+typedef struct mmd_lod_position {
+   float p[3];
+   unsigned int index;
+} mmd_lod_position;
+
+/* \brief order by position bits */
+static int mmd_compare_position(const void *a, const void *b)
+{
+   return memcmp(((const mmd_lod_position*)a)->p, ((const mmd_lod_position*)b)->p, 3 * sizeof(float));
+}
+
+/* \brief can u be collapsed onto v? */
+static int mmd_lod_can_collapse(const mmd_data *mmd, const unsigned int *verts, const unsigned char *lock, unsigned int u, unsigned int v)
+{
+   const mmd_weight *weights = mmd->weights;
+
+   if (lock[u])
+      return 0;
+
+   /* outline is drawn per vertex, don't let it spread or vanish */
+   return (!weights || weights[verts[u]].edge_flag == weights[verts[v]].edge_flag);
+}
+
+/* \brief does moving u onto v keep triangles around u facing the same way?
+ * triangles removed by the collapse are counted to removed */
+static int mmd_lod_keeps_orientation(const float *positions, const unsigned int *verts, const unsigned int *tris,
+                                     const unsigned int *offsets, const unsigned int *adjacency,
+                                     unsigned int u, unsigned int v, unsigned int *removed)
+{
+   const unsigned int *t;
+   const float *p[3], *q[3];
+   double before[3], after[3], dot, len;
+   unsigned int i, k;
+
+   *removed = 0;
+   for (i = offsets[u]; i < offsets[u + 1]; ++i) {
+      t = &tris[adjacency[i] * 3];
+
+      if (t[0] == v || t[1] == v || t[2] == v) {
+         ++*removed;
+         continue;
+      }
+
+      for (k = 0; k < 3; ++k) {
+         p[k] = &positions[verts[t[k]] * 3];
+         q[k] = (t[k] == u ? &positions[verts[v] * 3] : p[k]);
+      }
+
+      mmd_triangle_normal(p[0], p[1], p[2], before);
+      mmd_triangle_normal(q[0], q[1], q[2], after);
+      dot = before[0] * after[0] + before[1] * after[1] + before[2] * after[2];
+      len = (before[0] * before[0] + before[1] * before[1] + before[2] * before[2]) *
+            (after[0] * after[0] + after[1] * after[1] + after[2] * after[2]);
+
+      /* folds over, or bends more than ~60 degrees */
+      if (dot <= 0.0 || dot * dot < 0.25 * len)
+         return 0;
+   }
+
+   return 1;
+}
+
+/* \brief simplify material, writing every level */
+static int mmd_lod_simplify(mmd_lod_task *task)
+{
+   const mmd_data *mmd = task->mmd;
+   const float *positions = mmd->vertices;
+   const unsigned short *indices = &mmd->indices[task->first];
+   const unsigned int num_source = task->count / 3;
+   unsigned int *verts = NULL, *tris = NULL, *edges = NULL, *offsets = NULL, *adjacency = NULL, *collapse = NULL, *histogram = NULL;
+   unsigned int num_verts = 0, num_tris, num_candidates, i, k, l, c, u, v, w, target, removed, gone;
+   unsigned char *lock = NULL, *touched = NULL;
+   mmd_quadric *quadrics = NULL;
+   mmd_collapse *candidates = NULL, *sorted = NULL;
+   double n[3], len;
+   float error = 0.0f;
+   int ret = RETURN_FAIL;
+
+   if (!(verts = calloc(num_source * 3 + 1, sizeof(unsigned int))) ||
+       !(tris = calloc(num_source * 3 + 1, sizeof(unsigned int))) ||
+       !(edges = calloc(num_source * 6 + 1, sizeof(unsigned int))) ||
+       !(adjacency = calloc(num_source * 3 + 1, sizeof(unsigned int))) ||
+       !(candidates = calloc(num_source * 3 + 1, sizeof(mmd_collapse))) ||
+       !(sorted = calloc(num_source * 3 + 1, sizeof(mmd_collapse))) ||
+       !(histogram = calloc(MMD_LOD_BUCKETS, sizeof(unsigned int))))
+      goto out;
+
+   /* vertices of material, triangles use indices to them */
+   for (i = 0; i < num_source * 3; ++i)
+      verts[i] = indices[i];
+
+   qsort(verts, num_source * 3, sizeof(unsigned int), mmd_compare_uint);
+   for (i = 0; i < num_source * 3; ++i)
+      if (!num_verts || verts[num_verts - 1] != verts[i])
+         verts[num_verts++] = verts[i];
+
+   /* degenerate triangles draw nothing, leave them out of every level */
+   for (i = 0, num_tris = 0; i < num_source; ++i) {
+      if (indices[i * 3] == indices[i * 3 + 1] || indices[i * 3 + 1] == indices[i * 3 + 2] || indices[i * 3 + 2] == indices[i * 3])
+         continue;
+
+      for (k = 0; k < 3; ++k) {
+         w = indices[i * 3 + k];
+         tris[num_tris * 3 + k] = (unsigned int)((unsigned int*)bsearch(&w, verts, num_verts, sizeof(unsigned int), mmd_compare_uint) - verts);
+      }
+
+      ++num_tris;
+   }
+
+   if (!(offsets = calloc(num_verts + 2, sizeof(unsigned int))) ||
+       !(collapse = calloc(num_verts + 1, sizeof(unsigned int))) ||
+       !(lock = calloc(num_verts + 1, sizeof(unsigned char))) ||
+       !(touched = calloc(num_verts + 1, sizeof(unsigned char))) ||
+       !(quadrics = calloc(num_verts + 1, sizeof(mmd_quadric))))
+      goto out;
+
+   for (i = 0; i < num_verts; ++i)
+      lock[i] = task->flags[verts[i]];
+
+   /* edges used by single triangle (or more than two) are border */
+   for (i = 0; i < num_tris * 3; ++i) {
+      u = tris[i], v = tris[i - i % 3 + (i + 1) % 3];
+      edges[i * 2 + 0] = (u < v ? u : v);
+      edges[i * 2 + 1] = (u < v ? v : u);
+   }
+
+   qsort(edges, num_tris * 3, 2 * sizeof(unsigned int), mmd_compare_edge);
+   for (i = 0; i < num_tris * 3; i = k) {
+      for (k = i + 1; k < num_tris * 3 && !mmd_compare_edge(&edges[i * 2], &edges[k * 2]); ++k);
+
+      if (k - i != 2) {
+         lock[edges[i * 2 + 0]] |= MMD_LOD_BORDER;
+         lock[edges[i * 2 + 1]] |= MMD_LOD_BORDER;
+      }
+   }
+
+   /* plane of every triangle, weighted by its area */
+   for (i = 0; i < num_tris; ++i) {
+      const float *p0 = &positions[verts[tris[i * 3 + 0]] * 3];
+      mmd_triangle_normal(p0, &positions[verts[tris[i * 3 + 1]] * 3], &positions[verts[tris[i * 3 + 2]] * 3], n);
+
+      if ((len = n[0] * n[0] + n[1] * n[1] + n[2] * n[2]) <= 0.0)
+         continue;
+
+      len = sqrt(len);
+      for (k = 0; k < 3; ++k)
+         mmd_quadric_add_plane(&quadrics[tris[i * 3 + k]], n[0] / len, n[1] / len, n[2] / len,
+                               -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]) / len, len * 0.5);
+   }
+
+   for (l = 0; l < task->num_levels; ++l) {
+      target = (unsigned int)(task->ratios[l] * num_source + 0.5f);
+
+      while (num_tris > target) {
+         /* triangles around every vertex */
+         memset(offsets, 0, (num_verts + 2) * sizeof(unsigned int));
+         for (i = 0; i < num_tris * 3; ++i)
+            offsets[tris[i] + 2]++;
+         for (i = 0; i < num_verts; ++i)
+            offsets[i + 2] += offsets[i + 1];
+         for (i = 0; i < num_tris * 3; ++i)
+            adjacency[offsets[tris[i] + 1]++] = i / 3;
+
+         /* every half edge collapses its start onto its end,
+          * the opposite half edge of neighbour triangle does the reverse */
+         for (i = 0, num_candidates = 0; i < num_tris * 3; ++i) {
+            u = tris[i], v = tris[i - i % 3 + (i + 1) % 3];
+
+            if (!mmd_lod_can_collapse(mmd, verts, lock, u, v))
+               continue;
+
+            candidates[num_candidates].cost = (float)(mmd_quadric_error(&quadrics[u], &positions[verts[v] * 3]) +
+                                                      mmd_quadric_error(&quadrics[v], &positions[verts[v] * 3]));
+            candidates[num_candidates].u = u;
+            candidates[num_candidates++].v = v;
+         }
+
+         mmd_sort_collapses(candidates, num_candidates, histogram, sorted);
+         memset(touched, 0, num_verts);
+
+         for (i = 0; i < num_verts; ++i)
+            collapse[i] = i;
+
+         for (gone = 0, c = 0; c < num_candidates && num_tris - gone > target; ++c) {
+            u = sorted[c].u, v = sorted[c].v;
+
+            if (touched[u] || touched[v] ||
+                !mmd_lod_keeps_orientation(positions, verts, tris, offsets, adjacency, u, v, &removed))
+               continue;
+
+            collapse[u] = v;
+            mmd_quadric_sum(&quadrics[v], &quadrics[u]);
+            error = (sorted[c].cost > error ? sorted[c].cost : error);
+            gone += removed;
+
+            for (i = offsets[u]; i < offsets[u + 1]; ++i)
+               for (k = 0; k < 3; ++k)
+                  touched[tris[adjacency[i] * 3 + k]] = 1;
+         }
+
+         if (!gone)
+            break;
+
+         /* move collapsed vertices, drop triangles that became degenerate */
+         for (i = 0, k = 0; i < num_tris; ++i) {
+            const unsigned int a = collapse[tris[i * 3 + 0]], b = collapse[tris[i * 3 + 1]], d = collapse[tris[i * 3 + 2]];
+
+            if (a == b || b == d || d == a)
+               continue;
+
+            tris[k * 3 + 0] = a;
+            tris[k * 3 + 1] = b;
+            tris[k * 3 + 2] = d;
+            ++k;
+         }
+
+         num_tris = k;
+      }
+
+      for (i = 0; i < num_tris * 3; ++i)
+         task->out[l * task->count + i] = (unsigned short)verts[tris[i]];
+
+      task->out_count[l] = num_tris * 3;
+      task->out_error[l] = error;
+   }
+
+   ret = RETURN_OK;
+
+out:
+   if (verts) free(verts);
+   if (tris) free(tris);
+   if (edges) free(edges);
+   if (offsets) free(offsets);
+   if (adjacency) free(adjacency);
+   if (collapse) free(collapse);
+   if (lock) free(lock);
+   if (touched) free(touched);
+   if (quadrics) free(quadrics);
+   if (candidates) free(candidates);
+   if (sorted) free(sorted);
+   if (histogram) free(histogram);
+   return ret;
+}
+
+/* \brief task entry for mmd_run_tasks */
+static void mmd_lod_task_run(void *arg)
+{
+   mmd_lod_task *task = arg;
+   task->ret = mmd_lod_simplify(task);
+}
+
+/* \brief vertices that must not move, shared by every material */
+static unsigned char* mmd_lod_flags(const mmd_data *mmd, const mmd_index_range *ranges, unsigned int flags)
+{
+   const mmd_skin *base = NULL;
+   mmd_lod_position *order = NULL;
+   unsigned int *last = NULL, i, k, m, s;
+   unsigned char *out;
+
+   if (!(out = calloc(mmd->num_vertices + 1, sizeof(unsigned char))) ||
+       !(order = calloc(mmd->num_vertices + 1, sizeof(mmd_lod_position))) ||
+       !(last = calloc(mmd->num_vertices + 1, sizeof(unsigned int))))
+      goto fail;
+
+   /* vertices on the same position are split by uv or normal */
+   for (i = 0; i < mmd->num_vertices; ++i) {
+      memcpy(order[i].p, &mmd->vertices[i * 3], sizeof(order[i].p));
+      order[i].index = i;
+   }
+
+   qsort(order, mmd->num_vertices, sizeof(mmd_lod_position), mmd_compare_position);
+
+   for (i = 0; i + 1 < mmd->num_vertices; ++i) {
+      if (mmd_compare_position(&order[i], &order[i + 1]))
+         continue;
+
+      out[order[i].index] |= MMD_LOD_SEAM;
+      out[order[i + 1].index] |= MMD_LOD_SEAM;
+   }
+
+   /* last is material + 1 that used vertex */
+   for (m = 0; m < mmd->num_materials; ++m) {
+      for (i = ranges[m].first; i < ranges[m].first + ranges[m].count; ++i) {
+         k = mmd->indices[i];
+         if (last[k] && last[k] != m + 1)
+            out[k] |= MMD_LOD_SHARED;
+         last[k] = m + 1;
+      }
+   }
+
+   if (flags & MMD_LOD_LOCK_MORPHS) {
+      for (s = 0; s < mmd->num_skins && !base; ++s)
+         base = (mmd->skin[s].type == MMD_SKIN_BASE ? &mmd->skin[s] : NULL);
+
+      /* base skin lists every morphed vertex */
+      for (s = 0; s < mmd->num_skins; ++s) {
+         if (base && &mmd->skin[s] != base)
+            continue;
+
+         for (i = 0; i < mmd->skin[s].num_vertices; ++i)
+            if (mmd->skin[s].vertices[i].index < mmd->num_vertices)
+               out[mmd->skin[s].vertices[i].index] |= MMD_LOD_MORPH;
+      }
+   }
+
+   free(order);
+   free(last);
+   return out;
+
+fail:
+   if (out) free(out);
+   if (order) free(order);
+   if (last) free(last);
+   return NULL;
+}
+
+/* \brief free chain */
+void mmd_lod_chain_free(mmd_lod_chain *chain)
+{
+   unsigned int l;
+
+   if (!chain)
+      return;
+
+   if (chain->levels) {
+      for (l = 0; l < chain->num_levels; ++l) {
+         if (chain->levels[l].indices) free(chain->levels[l].indices);
+         if (chain->levels[l].ranges) free(chain->levels[l].ranges);
+      }
+      free(chain->levels);
+   }
+
+   free(chain);
+}
+
+/* \brief simplify every material of mmd to ratios of its triangles */
+mmd_lod_chain* mmd_lod_chain_new(const mmd_data *mmd, const float *ratios, unsigned int num_levels, unsigned int flags, const mmd_executor *executor)
+{
+   mmd_lod_chain *chain = NULL;
+   mmd_index_range *ranges = NULL;
+   mmd_lod_task *tasks = NULL;
+   mmd_lod *level;
+   void **args = NULL;
+   unsigned char *locked = NULL;
+   unsigned short *out = NULL;
+   unsigned int *counts = NULL, i, l, m, threads, first;
+   float *errors = NULL;
+   assert(mmd && (ratios || !num_levels));
+
+   /* levels are 16-bit, like the indices they come from */
+   if ((!mmd->vertices && mmd->num_vertices) || (!mmd->indices && mmd->num_indices))
+      return NULL;
+
+   for (i = 0; i < mmd->num_indices; ++i)
+      if (mmd->indices[i] >= mmd->num_vertices)
+         return NULL;
+
+   for (l = 0; l < num_levels; ++l)
+      if (!(ratios[l] >= 0.0f && ratios[l] <= 1.0f))
+         return NULL;
+
+   if (!(ranges = calloc(mmd->num_materials + 1, sizeof(mmd_index_range))) ||
+       !(tasks = calloc(mmd->num_materials + 1, sizeof(mmd_lod_task))) ||
+       !(args = calloc(mmd->num_materials + 1, sizeof(void*))) ||
+       !(out = calloc((size_t)num_levels * mmd->num_indices + 1, sizeof(unsigned short))) ||
+       !(counts = calloc((size_t)num_levels * mmd->num_materials + 1, sizeof(unsigned int))) ||
+       !(errors = calloc((size_t)num_levels * mmd->num_materials + 1, sizeof(float))))
+      goto fail;
+
+   /* face counts that do not fit are clamped */
+   mmd_export_ranges(mmd, ranges);
+
+   if (!(locked = mmd_lod_flags(mmd, ranges, flags)))
+      goto fail;
+
+   for (m = 0; m < mmd->num_materials; ++m) {
+      tasks[m].mmd = mmd;
+      tasks[m].flags = locked;
+      tasks[m].ratios = ratios;
+      tasks[m].num_levels = num_levels;
+      tasks[m].first = ranges[m].first;
+      tasks[m].count = ranges[m].count / 3 * 3;
+      tasks[m].out = &out[(size_t)num_levels * ranges[m].first];
+      tasks[m].out_count = &counts[m * num_levels];
+      tasks[m].out_error = &errors[m * num_levels];
+      tasks[m].ret = RETURN_OK;
+      args[m] = &tasks[m];
+   }
+
+   if (executor) {
+      executor->run(executor->user, mmd_lod_task_run, args, mmd->num_materials);
+   } else {
+      threads = mmd_cpu_count();
+      mmd_run_tasks(mmd_lod_task_run, args, mmd->num_materials, (threads < mmd->num_materials ? threads : mmd->num_materials));
+   }
+
+   for (m = 0; m < mmd->num_materials; ++m)
+      if (tasks[m].ret != RETURN_OK)
+         goto fail;
+
+   if (!(chain = calloc(1, sizeof(mmd_lod_chain))) ||
+       !(chain->levels = calloc(num_levels + 1, sizeof(mmd_lod))))
+      goto fail;
+
+   chain->num_levels = num_levels;
+   chain->num_materials = mmd->num_materials;
+
+   /* materials of every level follow each other like in mmd */
+   for (l = 0; l < num_levels; ++l) {
+      level = &chain->levels[l];
+
+      for (m = 0; m < mmd->num_materials; ++m)
+         level->num_indices += counts[m * num_levels + l];
+
+      if (!(level->indices = calloc(level->num_indices + 1, sizeof(unsigned short))) ||
+          !(level->ranges = calloc(mmd->num_materials + 1, sizeof(mmd_index_range))))
+         goto fail;
+
+      for (m = 0, first = 0; m < mmd->num_materials; ++m) {
+         level->ranges[m].first = first;
+         level->ranges[m].count = counts[m * num_levels + l];
+         level->error = (errors[m * num_levels + l] > level->error ? errors[m * num_levels + l] : level->error);
+         memcpy(&level->indices[first], tasks[m].out + (size_t)l * tasks[m].count, level->ranges[m].count * sizeof(unsigned short));
+         first += level->ranges[m].count;
+      }
+   }
+
+   free(ranges);
+   free(tasks);
+   free(args);
+   free(out);
+   free(counts);
+   free(errors);
+   free(locked);
+   return chain;
+
+fail:
+   if (ranges) free(ranges);
+   if (tasks) free(tasks);
+   if (args) free(args);
+   if (out) free(out);
+   if (counts) free(counts);
+   if (errors) free(errors);
+   if (locked) free(locked);
+   mmd_lod_chain_free(chain);
+   return NULL;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -1,670 +1,2531 @@
 #include "mmd.h"
-#include "buffer.h"
+#include "internal.h"
 #include "sjis.h"
 #include <stdio.h>  /* for FILE* */
 #include <stdint.h> /* for standard integers */
 #include <string.h> /* for memcmp, memcpy */
 #include <assert.h> /* for assert */
+#include <limits.h> /* for LONG_MAX */
 #include <stdlib.h>
 
-enum {
-   RETURN_OK = 0, RETURN_FAIL = -1
+#if defined(_WIN32)
+#  define WIN32_LEAN_AND_MEAN
+#  include <windows.h> /* for CreateFileMapping, MapViewOfFile */
+#elif defined(__unix__) || defined(__APPLE__)
+#  define MMD_HAS_MMAP 1
+#  include <sys/mman.h> /* for mmap */
+#  include <sys/stat.h> /* for fstat */
+#  include <fcntl.h>    /* for open */
+#  include <unistd.h>   /* for close */
+#endif
+
+/* \brief section offsets and counts found by mmd_scan */
+typedef struct mmd_layout {
+   /* input range the layout was computed from */
+   size_t start, size;
+
+   /* section offsets relative to start, and element counts */
+   size_t offset[MMD_SECTION_LAST];
+   unsigned int count[MMD_SECTION_LAST];
+
+   /* variable length children: IK links and skin vertices */
+   size_t num_ik_links, num_skin_vertices;
+
+   /* offset just past the last section */
+   size_t end;
+} mmd_layout;
+
+/* \brief private state behind mmd_data */
+typedef struct mmd_private {
+   /* public data, must be first */
+   mmd_data data;
+
+   /* memory of everything below, and of temporary buffers of loads */
+   mmd_allocator allocator, scratch;
+
+   /* staging buffer for reads from FILE */
+   unsigned char *buf;
+   size_t buf_size;
+
+   /* memory source, NULL when reading from FILE */
+   const unsigned char *memory;
+   size_t size, offset;
+
+   /* input offset of memory source, FILE position it was read from */
+   size_t origin;
+
+   /* may arrays reference the memory source? */
+   int views;
+
+   /* memory mapping owned by us, if any */
+   void *map;
+   size_t map_size;
+
+   /* single allocation arena, see mmd_use_arena */
+   unsigned char *arena;
+   size_t arena_size, arena_used;
+
+   /* something was allocated outside the arena */
+   int spilled;
+
+   /* names are interned here instead of converted, see mmd_set_string_pool */
+   mmd_string_pool *pool;
+
+   /* mask of sections loads decode, see mmd_set_sections */
+   unsigned int sections;
+
+   /* arrays of loads are shared here, see mmd_set_blob_store */
+   mmd_blob_store *blobs;
+
+   /* arrays owned by blobs, sorted by address */
+   const void **shared;
+   unsigned int num_shared;
+
+   /* guards arena and error while sections decode concurrently */
+   mmd_mutex *lock;
+
+   /* first error since load started */
+   mmd_error error;
+
+   /* MMD_SECTION_LAST totals and hooks, NULL when not measuring */
+   mmd_section_stats *stats;
+   mmd_trace trace;
+} mmd_private;
+
+/* \brief section decoded by mmd_load_parallel */
+typedef struct mmd_section_task {
+   mmd_data *mmd;
+   const unsigned char *data;
+   size_t offset, size;
+   unsigned int section;
+   int ret;
+
+   /* arrays allocated for the task before it runs */
+   mmd_span setup;
+} mmd_section_task;
+
+/* \brief malloc behind NULL allocator */
+static void* mmd_malloc_alloc(void *user, size_t size)
+{
+   (void)user;
+   return malloc(size);
+}
+
+static void* mmd_malloc_realloc(void *user, void *ptr, size_t size)
+{
+   (void)user;
+   return realloc(ptr, size);
+}
+
+static void mmd_malloc_free(void *user, void *ptr)
+{
+   (void)user;
+   free(ptr);
+}
+
+static const mmd_allocator mmd_malloc_allocator = {
+   mmd_malloc_alloc,
+   mmd_malloc_realloc,
+   mmd_malloc_free,
+   NULL
 };
 
-/* TODO:
- * Figure out what most of the data actually does and,
- * then refactor into saner structs */
+/* \brief size bytes from allocator of mmd, calls for one mmd never overlap */
+void* mmd_alloc(mmd_data *mmd, size_t size)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   void *ptr;
+
+   mmd_mutex_lock(priv->lock);
+   ptr = priv->allocator.alloc(priv->allocator.user, (size ? size : 1));
+   mmd_mutex_unlock(priv->lock);
+   return ptr;
+}
+
+/* \brief resize memory of mmd_alloc, NULL ptr allocates */
+void* mmd_realloc(mmd_data *mmd, void *ptr, size_t size)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+
+   mmd_mutex_lock(priv->lock);
+   ptr = priv->allocator.realloc(priv->allocator.user, ptr, (size ? size : 1));
+   mmd_mutex_unlock(priv->lock);
+   return ptr;
+}
+
+/* \brief release memory of mmd_alloc, accepts NULL */
+void mmd_dealloc(mmd_data *mmd, void *ptr)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+
+   if (!ptr)
+      return;
+
+   mmd_mutex_lock(priv->lock);
+   priv->allocator.free(priv->allocator.user, ptr);
+   mmd_mutex_unlock(priv->lock);
+}
+
+/* \brief zeroed memory from allocator of mmd */
+static void* mmd_alloc_zero(mmd_data *mmd, size_t size)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   void *ptr;
+
+   /* calloc gets large blocks as pages that are zero already */
+   if (priv->allocator.alloc == mmd_malloc_alloc)
+      return calloc(1, (size ? size : 1));
+
+   if ((ptr = mmd_alloc(mmd, size)))
+      memset(ptr, 0, size);
+
+   return ptr;
+}
+
+/* \brief temporary buffer of load from scratch allocator */
+void* mmd_scratch_alloc(mmd_data *mmd, size_t size)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   void *ptr;
+
+   mmd_mutex_lock(priv->lock);
+   ptr = priv->scratch.alloc(priv->scratch.user, (size ? size : 1));
+   mmd_mutex_unlock(priv->lock);
+   return ptr;
+}
+
+/* \brief release buffer of mmd_scratch_alloc, scratch without free keeps it */
+void mmd_scratch_free(mmd_data *mmd, void *ptr)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+
+   if (!ptr || !priv->scratch.free)
+      return;
+
+   mmd_mutex_lock(priv->lock);
+   priv->scratch.free(priv->scratch.user, ptr);
+   mmd_mutex_unlock(priv->lock);
+}
+
+/* \brief span open on this thread, allocations and errors go to it */
+static MMD_THREAD_LOCAL mmd_span *mmd_current_span;
+
+/* \brief input offset of read position */
+static size_t mmd_position(mmd_data *mmd)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   long pos;
+
+   if (priv->memory)
+      return priv->origin + priv->offset;
+
+   return (mmd->f && (pos = ftell(mmd->f)) >= 0 ? (size_t)pos : 0);
+}
+
+/* \brief input offset of pointer into memory source */
+size_t mmd_input_offset(mmd_data *mmd, const unsigned char *data)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   assert(priv->memory && data >= priv->memory);
+   return priv->origin + (size_t)(data - priv->memory);
+}
+
+/* \brief forget error of previous load */
+static void mmd_clear_error(mmd_private *priv)
+{
+   priv->error.code = MMD_ERROR_NONE;
+   priv->error.section = MMD_SECTION_LAST;
+   priv->error.offset = 0;
+}
+
+/* \brief record why load fails, first error wins */
+void mmd_fail(mmd_data *mmd, int code, unsigned int section, size_t offset)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   const mmd_span *span = mmd_current_span;
+
+   if (section == MMD_SECTION_LAST && span && span->mmd == mmd)
+      section = span->section;
+
+   mmd_mutex_lock(priv->lock);
+
+   if (priv->error.code == MMD_ERROR_NONE) {
+      priv->error.code = code;
+      priv->error.section = section;
+      priv->error.offset = offset;
+   }
+
+   mmd_mutex_unlock(priv->lock);
+}
+
+/* \brief record error at start of section read on this thread */
+void mmd_fail_span(mmd_data *mmd, int code)
+{
+   const mmd_span *span = mmd_current_span;
+
+   if (span && span->mmd == mmd) {
+      mmd_fail(mmd, code, span->section, span->offset);
+   } else {
+      mmd_fail(mmd, code, MMD_SECTION_LAST, mmd_position(mmd));
+   }
+}
+
+/* \brief count allocation to section read on this thread */
+void mmd_count_alloc(mmd_data *mmd, size_t bytes)
+{
+   mmd_span *span;
+
+   if (!((mmd_private*)mmd)->stats || !(span = mmd_current_span) || span->mmd != mmd)
+      return;
+
+   span->stats.allocations++;
+   span->stats.allocated += bytes;
+}
+
+/* \brief make span current without measuring it */
+static void mmd_span_enter(mmd_data *mmd, mmd_span *span, unsigned int section, size_t offset)
+{
+   memset(span, 0, sizeof(mmd_span));
+   span->mmd = mmd;
+   span->section = section;
+   span->offset = offset;
+   span->outer = mmd_current_span;
+   mmd_current_span = span;
+}
+
+/* \brief restore span that was current before span */
+static void mmd_span_leave(mmd_span *span)
+{
+   mmd_current_span = span->outer;
+}
+
+/* \brief start reading section at input offset on this thread */
+void mmd_span_begin(mmd_data *mmd, mmd_span *span, unsigned int section, size_t offset)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+
+   mmd_span_enter(mmd, span, section, offset);
+
+   if (!priv->stats)
+      return;
+
+   if (priv->trace.begin)
+      priv->trace.begin(priv->trace.user, mmd, section);
+
+   span->start = mmd_time();
+}
+
+/* \brief end span at input offset, adds it to the totals */
+int mmd_span_end(mmd_span *span, size_t end, int ret)
+{
+   mmd_private *priv = (mmd_private*)span->mmd;
+   mmd_section_stats *total;
+
+   mmd_span_leave(span);
+
+   if (!priv->stats)
+      return ret;
+
+   span->stats.seconds = mmd_time() - span->start;
+   span->stats.bytes = (end > span->offset ? end - span->offset : 0);
+
+   /* every section is read by one thread at a time */
+   total = &priv->stats[span->section];
+   total->seconds += span->stats.seconds;
+   total->bytes += span->stats.bytes;
+   total->allocations += span->stats.allocations;
+   total->allocated += span->stats.allocated;
+
+   if (priv->trace.end)
+      priv->trace.end(priv->trace.user, span->mmd, span->section, &span->stats, ret);
+
+   return ret;
+}
+
+/* \brief get pointer to next size bytes of input and advance
+ * memory sources are referenced directly, FILE sources are read to staging buffer */
+static const unsigned char* mmd_fetch(mmd_data *mmd, size_t size)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   const unsigned char *data;
+
+   size_t filled;
+
+   if (priv->memory) {
+      if (size > priv->size - priv->offset) {
+         mmd_fail(mmd, MMD_ERROR_TRUNCATED, MMD_SECTION_LAST, priv->origin + priv->offset);
+         return NULL;
+      }
+
+      data = priv->memory + priv->offset;
+      priv->offset += size;
+      return data;
+   }
+
+   if (!mmd->f) {
+      mmd_fail(mmd, MMD_ERROR_IO, MMD_SECTION_LAST, 0);
+      return NULL;
+   }
+
+   if (!priv->buf || size > priv->buf_size) {
+      if (!(data = mmd_realloc(mmd, priv->buf, size))) {
+         mmd_fail_span(mmd, MMD_ERROR_MEMORY);
+         return NULL;
+      }
+
+      priv->buf = (unsigned char*)data;
+      priv->buf_size = size;
+   }
+
+   /* short read leaves file past the bytes that were there */
+   if (size && (filled = fread(priv->buf, 1, size, mmd->f)) != size) {
+      mmd_fail(mmd, (ferror(mmd->f) ? MMD_ERROR_IO : MMD_ERROR_TRUNCATED), MMD_SECTION_LAST, mmd_position(mmd) - filled);
+      return NULL;
+   }
+
+   return priv->buf;
+}
+
+/* \brief get pointer to next memb * size bytes of input and advance */
+static const unsigned char* mmd_fetch_array(mmd_data *mmd, size_t memb, size_t size)
+{
+   if (size && memb > (size_t)~0 / size) {
+      mmd_fail(mmd, MMD_ERROR_TRUNCATED, MMD_SECTION_LAST, mmd_position(mmd));
+      return NULL;
+   }
+
+   return mmd_fetch(mmd, memb * size);
+}
+
+/* \brief step over next memb * size bytes of input without reading them
+ * FILE sources are seeked, reading the last byte tells if it was there */
+static int mmd_pass(mmd_data *mmd, size_t memb, size_t size)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   const size_t start = mmd_position(mmd);
+   size_t bytes;
+
+   if (size && memb > (size_t)~0 / size)
+      goto truncated;
+
+   bytes = memb * size;
+
+   if (priv->memory) {
+      if (bytes > priv->size - priv->offset)
+         goto truncated;
+
+      priv->offset += bytes;
+      return RETURN_OK;
+   }
+
+   if (!bytes)
+      return RETURN_OK;
+
+   if (!mmd->f || bytes - 1 > LONG_MAX || fseek(mmd->f, (long)(bytes - 1), SEEK_CUR) != 0) {
+      mmd_fail(mmd, MMD_ERROR_IO, MMD_SECTION_LAST, start);
+      return RETURN_FAIL;
+   }
+
+   if (fgetc(mmd->f) == EOF) {
+      mmd_fail(mmd, (ferror(mmd->f) ? MMD_ERROR_IO : MMD_ERROR_TRUNCATED), MMD_SECTION_LAST, start);
+      return RETURN_FAIL;
+   }
+
+   return RETURN_OK;
+
+truncated:
+   mmd_fail(mmd, MMD_ERROR_TRUNCATED, MMD_SECTION_LAST, start);
+   return RETURN_FAIL;
+}
+
+/* \brief reference little endian array in memory source directly
+ * returns NULL when the data has to be copied instead */
+void* mmd_view(mmd_data *mmd, const unsigned char *data, size_t align)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+
+   if (!priv->memory || !priv->views || !mmd_is_little_endian() || (uintptr_t)data % align)
+      return NULL;
+
+   return (void*)data;
+}
+
+/* \brief does pointer point inside our memory source? */
+static int mmd_is_view(const mmd_private *priv, const void *ptr)
+{
+   return (priv->memory && priv->views && (const unsigned char*)ptr >= priv->memory &&
+           (const unsigned char*)ptr < priv->memory + priv->size);
+}
+
+/* \brief does pointer point inside our arena? */
+static int mmd_in_arena(const mmd_private *priv, const void *ptr)
+{
+   return (priv->arena && (const unsigned char*)ptr >= priv->arena &&
+           (const unsigned char*)ptr < priv->arena + priv->arena_size);
+}
+
+/* \brief index of pointer in shared arrays, num_shared if it is not shared */
+static unsigned int mmd_shared_index(const mmd_private *priv, const void *ptr)
+{
+   unsigned int lo = 0, hi = priv->num_shared, mid;
+
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if ((uintptr_t)priv->shared[mid] < (uintptr_t)ptr) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+
+   return (lo < priv->num_shared && priv->shared[lo] == ptr ? lo : priv->num_shared);
+}
+
+/* \brief does pointer point to blob of our blob store? */
+static int mmd_is_shared(const mmd_private *priv, const void *ptr)
+{
+   return (priv->num_shared && mmd_shared_index(priv, ptr) < priv->num_shared);
+}
+
+/* \brief allocate zeroed array, from arena when one is in use */
+void* mmd_calloc(mmd_data *mmd, size_t nmemb, size_t size)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   size_t offset;
+   void *ptr;
+
+   if (size && nmemb > (size_t)~0 / size) {
+      mmd_fail_span(mmd, MMD_ERROR_MEMORY);
+      return NULL;
+   }
+
+   mmd_count_alloc(mmd, nmemb * size);
+   mmd_mutex_lock(priv->lock);
+   offset = MMD_ARENA_ALIGN_SIZE(priv->arena_used);
+
+   if (priv->arena && offset <= priv->arena_size && nmemb * size <= priv->arena_size - offset) {
+      ptr = priv->arena + offset;
+      priv->arena_used = offset + nmemb * size;
+      mmd_mutex_unlock(priv->lock);
+      return ptr;
+   }
+
+   /* arena was sized from the counts, so this only happens
+    * if the input changed under us, stay correct anyway */
+   if (priv->arena)
+      priv->spilled = 1;
+
+   mmd_mutex_unlock(priv->lock);
+
+   if (!(ptr = mmd_alloc_zero(mmd, nmemb * size)))
+      mmd_fail_span(mmd, MMD_ERROR_MEMORY);
+
+   return ptr;
+}
+
+/* \brief convert SJIS string to UTF8, into arena when one is in use */
+static char* mmd_sjis(mmd_data *mmd, const unsigned char *data, size_t size)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   char *utf8, *copy;
+   size_t len;
+
+   if (!(utf8 = chckSJISToUTF8(data, size, NULL, 1))) {
+      mmd_fail_span(mmd, MMD_ERROR_MEMORY);
+      return NULL;
+   }
+
+   len = strlen(utf8) + 1;
+   mmd_count_alloc(mmd, len);
+
+   /* chck allocates with malloc as well, keep its string */
+   if (!priv->arena && priv->allocator.alloc == mmd_malloc_alloc)
+      return utf8;
+
+   copy = NULL;
+   mmd_mutex_lock(priv->lock);
+
+   if (priv->arena && len <= priv->arena_size - priv->arena_used) {
+      copy = (char*)priv->arena + priv->arena_used;
+      priv->arena_used += len;
+   } else if (priv->arena) {
+      priv->spilled = 1;
+   }
+
+   mmd_mutex_unlock(priv->lock);
+
+   if (!copy && !(copy = mmd_alloc(mmd, len))) {
+      mmd_fail_span(mmd, MMD_ERROR_MEMORY);
+      free(utf8);
+      return NULL;
+   }
+
+   memcpy(copy, utf8, len);
+   free(utf8);
+   return copy;
+}
+
+/* \brief SJIS name, interned to string pool when one is in use */
+int mmd_name(mmd_data *mmd, const unsigned char *data, size_t size, const char **name, mmd_string *id)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+
+   if (priv->pool) {
+      if (!(*id = mmd_string_pool_intern(priv->pool, data, size)))
+         mmd_fail_span(mmd, MMD_ERROR_MEMORY);
+
+      return (*id ? RETURN_OK : RETURN_FAIL);
+   }
+
+   return ((*name = mmd_sjis(mmd, data, size)) ? RETURN_OK : RETURN_FAIL);
+}
+
+/* \brief UTF8 name, interned to string pool when one is in use */
+int mmd_name_utf8(mmd_data *mmd, const char *utf8, size_t size, const char **name, mmd_string *id)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   char *copy = NULL;
+
+   if (priv->pool) {
+      if (!(*id = mmd_string_pool_intern_utf8(priv->pool, utf8, size)))
+         mmd_fail_span(mmd, MMD_ERROR_MEMORY);
+
+      return (*id ? RETURN_OK : RETURN_FAIL);
+   }
+
+   mmd_count_alloc(mmd, size + 1);
+   mmd_mutex_lock(priv->lock);
+
+   if (priv->arena && size < priv->arena_size - priv->arena_used) {
+      copy = (char*)priv->arena + priv->arena_used;
+      priv->arena_used += size + 1;
+   } else if (priv->arena) {
+      priv->spilled = 1;
+   }
+
+   mmd_mutex_unlock(priv->lock);
+
+   if (!copy && !(copy = mmd_alloc(mmd, size + 1))) {
+      mmd_fail_span(mmd, MMD_ERROR_MEMORY);
+      return RETURN_FAIL;
+   }
+
+   memcpy(copy, utf8, size);
+   copy[size] = 0;
+   *name = copy;
+   return RETURN_OK;
+}
+
+/* \brief array that can be modified, views of memory source and shared arrays are copied.
+ * shared array is released when copied, so the copy must replace it */
+void* mmd_writable(mmd_data *mmd, void *array, size_t nmemb, size_t size)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   unsigned int i;
+   void *copy;
+   assert(mmd);
+
+   if (!array)
+      return array;
+
+   i = mmd_shared_index(priv, array);
+
+   if (i == priv->num_shared && !mmd_is_view(priv, array))
+      return array;
+
+   if (!(copy = mmd_calloc(mmd, nmemb, size)))
+      return NULL;
+
+   memcpy(copy, array, nmemb * size);
+
+   if (i < priv->num_shared) {
+      memmove(&priv->shared[i], &priv->shared[i + 1], (priv->num_shared - i - 1) * sizeof(void*));
+      priv->num_shared--;
+      mmd_blob_store_release(priv->blobs, array);
+   }
+
+   return copy;
+}
+
+/* \brief free memory that is not owned by arena, memory source or blob store */
+static void mmd_release(mmd_private *priv, const void *ptr)
+{
+   if (!ptr || mmd_in_arena(priv, ptr) || mmd_is_view(priv, ptr) || mmd_is_shared(priv, ptr))
+      return;
+
+   mmd_dealloc(&priv->data, (void*)ptr);
+}
+
+/* \brief copy bytes at offset of the layout's input range */
+static int mmd_peek(mmd_data *mmd, const mmd_layout *layout, size_t offset, void *dst, size_t size)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+
+   if (offset > layout->size || size > layout->size - offset)
+      return RETURN_FAIL;
+
+   if (priv->memory) {
+      memcpy(dst, priv->memory + layout->start + offset, size);
+      return RETURN_OK;
+   }
+
+   if (fseek(mmd->f, (long)(layout->start + offset), SEEK_SET) != 0)
+      return RETURN_FAIL;
+
+   return (fread(dst, 1, size, mmd->f) == size ? RETURN_OK : RETURN_FAIL);
+}
+
+/* \brief step over memb records of size, fails if they do not fit the input */
+static int mmd_skip(const mmd_layout *layout, size_t *offset, size_t memb, size_t size)
+{
+   if (*offset > layout->size || (size && memb > (layout->size - *offset) / size))
+      return RETURN_FAIL;
+
+   *offset += memb * size;
+   return RETURN_OK;
+}
+
+/* \brief walk the section counts from current input position without decoding
+ * rejects counts that do not fit the input */
+static int mmd_scan(mmd_data *mmd, mmd_layout *layout)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   unsigned char record[MMD_SKIN_SIZE];
+   size_t offset = 0;
+   unsigned int i;
+   long pos = 0, end;
+   assert(mmd && layout);
+
+   memset(layout, 0, sizeof(mmd_layout));
+
+   if (priv->memory) {
+      layout->start = priv->offset;
+      layout->size = priv->size - priv->offset;
+   } else {
+      if (!mmd->f || (pos = ftell(mmd->f)) < 0 || fseek(mmd->f, 0, SEEK_END) != 0) {
+         mmd_fail(mmd, MMD_ERROR_IO, MMD_SECTION_LAST, 0);
+         return RETURN_FAIL;
+      }
+
+      if ((end = ftell(mmd->f)) < pos) {
+         mmd_fail(mmd, MMD_ERROR_IO, MMD_SECTION_LAST, (size_t)pos);
+         goto fail;
+      }
+
+      layout->start = (size_t)pos;
+      layout->size = (size_t)(end - pos);
+   }
+
+   /* header */
+   layout->offset[MMD_SECTION_HEADER] = offset;
+   if (mmd_skip(layout, &offset, 1, MMD_HEADER_SIZE) != RETURN_OK)
+      goto fail;
+
+   /* vertices */
+   layout->offset[MMD_SECTION_VERTEX] = offset;
+   if (mmd_peek(mmd, layout, offset, record, sizeof(uint32_t)) != RETURN_OK)
+      goto fail;
+
+   layout->count[MMD_SECTION_VERTEX] = mmd_u32(record);
+   offset += sizeof(uint32_t);
+   if (mmd_skip(layout, &offset, layout->count[MMD_SECTION_VERTEX], MMD_VERTEX_SIZE) != RETURN_OK)
+      goto fail;
+
+   /* indices */
+   layout->offset[MMD_SECTION_INDEX] = offset;
+   if (mmd_peek(mmd, layout, offset, record, sizeof(uint32_t)) != RETURN_OK)
+      goto fail;
+
+   layout->count[MMD_SECTION_INDEX] = mmd_u32(record);
+   offset += sizeof(uint32_t);
+   if (mmd_skip(layout, &offset, layout->count[MMD_SECTION_INDEX], MMD_INDEX_SIZE) != RETURN_OK)
+      goto fail;
+
+   /* materials */
+   layout->offset[MMD_SECTION_MATERIAL] = offset;
+   if (mmd_peek(mmd, layout, offset, record, sizeof(uint32_t)) != RETURN_OK)
+      goto fail;
+
+   layout->count[MMD_SECTION_MATERIAL] = mmd_u32(record);
+   offset += sizeof(uint32_t);
+   if (mmd_skip(layout, &offset, layout->count[MMD_SECTION_MATERIAL], MMD_MATERIAL_SIZE) != RETURN_OK)
+      goto fail;
+
+   /* bones */
+   layout->offset[MMD_SECTION_BONE] = offset;
+   if (mmd_peek(mmd, layout, offset, record, sizeof(uint16_t)) != RETURN_OK)
+      goto fail;
+
+   layout->count[MMD_SECTION_BONE] = mmd_u16(record);
+   offset += sizeof(uint16_t);
+   if (mmd_skip(layout, &offset, layout->count[MMD_SECTION_BONE], MMD_BONE_SIZE) != RETURN_OK)
+      goto fail;
+
+   /* IKs, each followed by its chain */
+   layout->offset[MMD_SECTION_IK] = offset;
+   if (mmd_peek(mmd, layout, offset, record, sizeof(uint16_t)) != RETURN_OK)
+      goto fail;
+
+   layout->count[MMD_SECTION_IK] = mmd_u16(record);
+   offset += sizeof(uint16_t);
+   for (i = 0; i < layout->count[MMD_SECTION_IK]; ++i) {
+      if (mmd_peek(mmd, layout, offset, record, MMD_IK_SIZE) != RETURN_OK)
+         goto fail;
+
+      offset += MMD_IK_SIZE;
+      layout->num_ik_links += record[sizeof(uint16_t) * 2];
+      if (mmd_skip(layout, &offset, record[sizeof(uint16_t) * 2], MMD_IK_LINK_SIZE) != RETURN_OK)
+         goto fail;
+   }
+
+   /* skins, each followed by its vertices */
+   layout->offset[MMD_SECTION_SKIN] = offset;
+   if (mmd_peek(mmd, layout, offset, record, sizeof(uint16_t)) != RETURN_OK)
+      goto fail;
+
+   layout->count[MMD_SECTION_SKIN] = mmd_u16(record);
+   offset += sizeof(uint16_t);
+   for (i = 0; i < layout->count[MMD_SECTION_SKIN]; ++i) {
+      if (mmd_peek(mmd, layout, offset, record, MMD_SKIN_SIZE) != RETURN_OK)
+         goto fail;
+
+      offset += MMD_SKIN_SIZE;
+      layout->num_skin_vertices += mmd_u32(record + 20);
+      if (mmd_skip(layout, &offset, mmd_u32(record + 20), MMD_SKIN_VERTEX_SIZE) != RETURN_OK)
+         goto fail;
+   }
+
+   /* skin displays */
+   layout->offset[MMD_SECTION_SKIN_DISPLAY] = offset;
+   if (mmd_peek(mmd, layout, offset, record, sizeof(uint8_t)) != RETURN_OK)
+      goto fail;
+
+   layout->count[MMD_SECTION_SKIN_DISPLAY] = record[0];
+   offset += sizeof(uint8_t);
+   if (mmd_skip(layout, &offset, layout->count[MMD_SECTION_SKIN_DISPLAY], MMD_SKIN_DISPLAY_SIZE) != RETURN_OK)
+      goto fail;
+
+   /* bone names */
+   layout->offset[MMD_SECTION_BONE_NAME] = offset;
+   if (mmd_peek(mmd, layout, offset, record, sizeof(uint8_t)) != RETURN_OK)
+      goto fail;
+
+   layout->count[MMD_SECTION_BONE_NAME] = record[0];
+   offset += sizeof(uint8_t);
+   if (mmd_skip(layout, &offset, layout->count[MMD_SECTION_BONE_NAME], MMD_BONE_NAME_SIZE) != RETURN_OK)
+      goto fail;
+
+   layout->end = offset;
+
+   if (!priv->memory && fseek(mmd->f, pos, SEEK_SET) != 0) {
+      mmd_fail(mmd, MMD_ERROR_IO, MMD_SECTION_LAST, (size_t)pos);
+      return RETURN_FAIL;
+   }
+
+   return RETURN_OK;
+
+fail:
+   /* sections are entered in order, last one with offset failed */
+   i = MMD_SECTION_LAST - 1;
+   while (i > MMD_SECTION_HEADER && !layout->offset[i])
+      --i;
+
+   mmd_fail(mmd, MMD_ERROR_TRUNCATED, i, (priv->memory ? priv->origin : 0) + layout->start + offset);
+
+   if (!priv->memory) fseek(mmd->f, pos, SEEK_SET);
+   return RETURN_FAIL;
+}
+
+/* \brief add array to footprint, fails on overflow */
+int mmd_footprint_add(size_t *footprint, size_t memb, size_t size)
+{
+   size_t bytes;
+
+   if (size && memb > (size_t)~0 / size)
+      return RETURN_FAIL;
+
+   /* worst case padding for the alignment */
+   bytes = memb * size + MMD_ARENA_ALIGN - 1;
+
+   if (bytes < memb * size || bytes > (size_t)~0 - *footprint)
+      return RETURN_FAIL;
+
+   *footprint += bytes;
+   return RETURN_OK;
+}
+
+/* \brief compute arena footprint needed for sections of the layout
+ * strings are reserved for the worst case SJIS -> UTF8 expansion,
+ * unless they go to string pool */
+static int mmd_footprint(const mmd_layout *layout, int strings, unsigned int sections, size_t *out_footprint)
+{
+   size_t footprint = 0;
+   const size_t utf8 = (strings ? 3 : 0);
+   int ret = RETURN_OK;
+   assert(layout && out_footprint);
+
+   /* header */
+   if (sections & (1 << MMD_SECTION_HEADER)) {
+      ret |= mmd_footprint_add(&footprint, 1, 20 * utf8 + 1);
+      ret |= mmd_footprint_add(&footprint, 1, 256 * utf8 + 1);
+   }
+
+   /* vertices, normals, coords and weights */
+   if (sections & (1 << MMD_SECTION_VERTEX)) {
+      ret |= mmd_footprint_add(&footprint, layout->count[MMD_SECTION_VERTEX], 3 * sizeof(float));
+      ret |= mmd_footprint_add(&footprint, layout->count[MMD_SECTION_VERTEX], 3 * sizeof(float));
+      ret |= mmd_footprint_add(&footprint, layout->count[MMD_SECTION_VERTEX], 2 * sizeof(float));
+      ret |= mmd_footprint_add(&footprint, layout->count[MMD_SECTION_VERTEX], sizeof(mmd_weight));
+   }
+
+   /* indices */
+   if (sections & (1 << MMD_SECTION_INDEX))
+      ret |= mmd_footprint_add(&footprint, layout->count[MMD_SECTION_INDEX], sizeof(uint16_t));
+
+   /* materials and their textures */
+   if (sections & (1 << MMD_SECTION_MATERIAL)) {
+      ret |= mmd_footprint_add(&footprint, layout->count[MMD_SECTION_MATERIAL], sizeof(mmd_material));
+      ret |= mmd_footprint_add(&footprint, layout->count[MMD_SECTION_MATERIAL], 20 * utf8 + 1);
+   }
+
+   /* bones and their names */
+   if (sections & (1 << MMD_SECTION_BONE)) {
+      ret |= mmd_footprint_add(&footprint, layout->count[MMD_SECTION_BONE], sizeof(mmd_bone));
+      ret |= mmd_footprint_add(&footprint, layout->count[MMD_SECTION_BONE], 20 * utf8 + 1);
+   }
+
+   /* IKs and their chains */
+   if (sections & (1 << MMD_SECTION_IK)) {
+      ret |= mmd_footprint_add(&footprint, layout->count[MMD_SECTION_IK], sizeof(mmd_ik));
+      ret |= mmd_footprint_add(&footprint, layout->count[MMD_SECTION_IK], MMD_ARENA_ALIGN);
+      ret |= mmd_footprint_add(&footprint, layout->num_ik_links, sizeof(unsigned short));
+   }
+
+   /* skins, their names and vertices */
+   if (sections & (1 << MMD_SECTION_SKIN)) {
+      ret |= mmd_footprint_add(&footprint, layout->count[MMD_SECTION_SKIN], sizeof(mmd_skin));
+      ret |= mmd_footprint_add(&footprint, layout->count[MMD_SECTION_SKIN], 20 * utf8 + 1 + MMD_ARENA_ALIGN);
+      ret |= mmd_footprint_add(&footprint, layout->num_skin_vertices, sizeof(mmd_skin_vertex));
+   }
+
+   /* skin displays */
+   if (sections & (1 << MMD_SECTION_SKIN_DISPLAY))
+      ret |= mmd_footprint_add(&footprint, layout->count[MMD_SECTION_SKIN_DISPLAY], sizeof(unsigned int));
+
+   /* bone names */
+   if (sections & (1 << MMD_SECTION_BONE_NAME)) {
+      ret |= mmd_footprint_add(&footprint, layout->count[MMD_SECTION_BONE_NAME], sizeof(mmd_bone_name));
+      ret |= mmd_footprint_add(&footprint, layout->count[MMD_SECTION_BONE_NAME], 50 * utf8 + 1);
+   }
+
+   *out_footprint = footprint;
+   return (ret == RETURN_OK ? RETURN_OK : RETURN_FAIL);
+}
+
+/* \brief allocate arena of footprint bytes, unless there is one */
+int mmd_reserve_arena(mmd_data *mmd, size_t footprint)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+
+   if (priv->arena)
+      return RETURN_OK;
+
+   if (!(priv->arena = mmd_alloc_zero(mmd, footprint))) {
+      mmd_fail_span(mmd, MMD_ERROR_MEMORY);
+      return RETURN_FAIL;
+   }
+
+   priv->arena_size = footprint;
+   priv->arena_used = 0;
+   return RETURN_OK;
+}
+
+/* \brief allocate arena for sections of scanned layout that loads decode */
+static int mmd_alloc_arena(mmd_data *mmd, const mmd_layout *layout)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   size_t footprint;
+
+   if (priv->arena)
+      return RETURN_OK;
+
+   if (mmd_footprint(layout, !priv->pool, priv->sections, &footprint) != RETURN_OK) {
+      mmd_fail(mmd, MMD_ERROR_MEMORY, MMD_SECTION_LAST, (priv->memory ? priv->origin : 0) + layout->start);
+      return RETURN_FAIL;
+   }
+
+   return mmd_reserve_arena(mmd, footprint);
+}
+
+/* \brief pre-size single arena for all the data */
+int mmd_use_arena(mmd_data *mmd)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   mmd_layout layout;
+   assert(mmd);
+
+   if (priv->arena)
+      return RETURN_OK;
+
+   mmd_clear_error(priv);
+
+   if (mmd_scan(mmd, &layout) != RETURN_OK)
+      return RETURN_FAIL;
+
+   return mmd_alloc_arena(mmd, &layout);
+}
+
+/* \brief store count of section to mmd_data */
+void mmd_set_count(mmd_data *mmd, unsigned int section, unsigned int count)
+{
+   assert(mmd);
+
+   switch (section) {
+      case MMD_SECTION_VERTEX:
+         mmd->num_vertices = count;
+         break;
+      case MMD_SECTION_INDEX:
+         mmd->num_indices = count;
+         break;
+      case MMD_SECTION_MATERIAL:
+         mmd->num_materials = count;
+         break;
+      case MMD_SECTION_BONE:
+         mmd->num_bones = (unsigned short)count;
+         break;
+      case MMD_SECTION_IK:
+         mmd->num_ik = (unsigned short)count;
+         break;
+      case MMD_SECTION_SKIN:
+         mmd->num_skins = (unsigned short)count;
+         break;
+      case MMD_SECTION_SKIN_DISPLAY:
+         mmd->num_skin_displays = (unsigned char)count;
+         break;
+      case MMD_SECTION_BONE_NAME:
+         mmd->num_bone_names = (unsigned char)count;
+         break;
+      default:
+         break;
+   }
+}
+
+/* \brief allocate arrays of section once its count is known */
+int mmd_alloc_section(mmd_data *mmd, unsigned int section)
+{
+   assert(mmd);
+
+   switch (section) {
+      case MMD_SECTION_VERTEX:
+         mmd_bounds_reset(&mmd->bounds);
+
+         /* vertices */
+         if (!(mmd->vertices = mmd_calloc(mmd, mmd->num_vertices, 3 * sizeof(float))))
+            return RETURN_FAIL;
+
+         /* normals */
+         if (!(mmd->normals = mmd_calloc(mmd, mmd->num_vertices, 3 * sizeof(float))))
+            return RETURN_FAIL;
+
+         /* coords */
+         if (!(mmd->coords = mmd_calloc(mmd, mmd->num_vertices, 2 * sizeof(float))))
+            return RETURN_FAIL;
+
+         /* vertex weights */
+         if (!(mmd->weights = mmd_calloc(mmd, mmd->num_vertices, sizeof(mmd_weight))))
+            return RETURN_FAIL;
+         break;
+
+      case MMD_SECTION_INDEX:
+         if (!(mmd->indices = mmd_calloc(mmd, mmd->num_indices, sizeof(uint16_t))))
+            return RETURN_FAIL;
+         break;
+
+      case MMD_SECTION_MATERIAL:
+         if (!(mmd->materials = mmd_calloc(mmd, mmd->num_materials, sizeof(mmd_material))))
+            return RETURN_FAIL;
+         break;
+
+      case MMD_SECTION_BONE:
+         if (!(mmd->bones = mmd_calloc(mmd, mmd->num_bones, sizeof(mmd_bone))))
+            return RETURN_FAIL;
+         break;
+
+      case MMD_SECTION_IK:
+         if (!(mmd->ik = mmd_calloc(mmd, mmd->num_ik, sizeof(mmd_ik))))
+            return RETURN_FAIL;
+         break;
+
+      case MMD_SECTION_SKIN:
+         if (!(mmd->skin = mmd_calloc(mmd, mmd->num_skins, sizeof(mmd_skin))))
+            return RETURN_FAIL;
+         break;
+
+      case MMD_SECTION_SKIN_DISPLAY:
+         if (!(mmd->skin_display = mmd_calloc(mmd, mmd->num_skin_displays, sizeof(unsigned int))))
+            return RETURN_FAIL;
+         break;
+
+      case MMD_SECTION_BONE_NAME:
+         if (!(mmd->bone_name = mmd_calloc(mmd, mmd->num_bone_names, sizeof(mmd_bone_name))))
+            return RETURN_FAIL;
+         break;
+
+      default:
+         break;
+   }
+
+   return RETURN_OK;
+}
+
+/* \brief decode PMD header record */
+int mmd_decode_header(mmd_data *mmd, const unsigned char *data)
+{
+   assert(mmd && data);
+
+   if (memcmp(data, "Pmd", 3)) {
+      mmd_fail_span(mmd, MMD_ERROR_FORMAT);
+      return RETURN_FAIL;
+   }
+
+   data += 3;
+
+   /* FLOAT: version */
+   mmd->header.version = mmd_f32(data);
+   data += sizeof(uint32_t);
+
+   /* SHIFT-JIS STRING: name (20 bytes) */
+   if (mmd_name(mmd, data, 20, &mmd->header.name, &mmd->header.name_id) != RETURN_OK)
+      return RETURN_FAIL;
+
+   data += 20;
+
+   /* SHIFT-JIS STRING: comment (256 bytes) */
+   return mmd_name(mmd, data, 256, &mmd->header.comment, &mmd->header.comment_id);
+}
+
+/* \brief decode material record */
+int mmd_decode_material(mmd_data *mmd, mmd_material *material, const unsigned char *data)
+{
+   const char *texture = NULL;
+   assert(mmd && material && data);
+
+   /* 3xFLOAT: diffuse */
+   mmd_f32v(material->diffuse, data, 3);
+   data += sizeof(uint32_t) * 3;
+
+   /* FLOAT: alpha */
+   material->alpha = mmd_f32(data);
+   data += sizeof(uint32_t);
+
+   /* FLOAT: power */
+   material->power = mmd_f32(data);
+   data += sizeof(uint32_t);
+
+   /* 3xFLOAT: specular */
+   mmd_f32v(material->specular, data, 3);
+   data += sizeof(uint32_t) * 3;
+
+   /* 3xFLOAT: ambient */
+   mmd_f32v(material->ambient, data, 3);
+   data += sizeof(uint32_t) * 3;
+
+   /* uint8_t: toon flag */
+   material->toon = *data++;
+
+   /* uint8_t: edge flag */
+   material->edge = *data++;
+
+   /* uint32_t: face indices */
+   material->face = mmd_u32(data);
+   data += sizeof(uint32_t);
+
+   /* STRING (SJIS?): texture (20 bytes) */
+   if (mmd_name(mmd, data, 20, &texture, &material->texture_id) != RETURN_OK)
+      return RETURN_FAIL;
+
+   material->texture = (char*)texture;
+   return RETURN_OK;
+}
+
+/* \brief decode bone record */
+int mmd_decode_bone(mmd_data *mmd, mmd_bone *bone, const unsigned char *data)
+{
+   assert(mmd && bone && data);
+
+   /* SJIS STRING: bone name (20 bytes) */
+   if (mmd_name(mmd, data, 20, &bone->name, &bone->name_id) != RETURN_OK)
+      return RETURN_FAIL;
+
+   data += 20;
+
+   /* uint16_t: parent bone index */
+   bone->parent_bone_index = mmd_u16(data);
+   data += sizeof(uint16_t);
+
+   /* uint16_t: tail bone index */
+   bone->tail_pos_bone_index = mmd_u16(data);
+   data += sizeof(uint16_t);
+
+   /* uint8_t: bone type */
+   bone->type = *data++;
+
+   /* uint16_t: ik parent bone index */
+   bone->ik_parend_bone_index = mmd_u16(data);
+   data += sizeof(uint16_t);
+
+   /* 3xFLOAT: head bone position */
+   mmd_f32v(bone->head_pos, data, 3);
+   return RETURN_OK;
+}
+
+/* \brief decode IK record and allocate its chain */
+int mmd_decode_ik(mmd_data *mmd, mmd_ik *ik, const unsigned char *data)
+{
+   assert(mmd && ik && data);
+
+   /* uint16_t: ik bone index */
+   ik->bone_index = mmd_u16(data);
+   data += sizeof(uint16_t);
+
+   /* uint16_t: bone index */
+   ik->target_bone_index = mmd_u16(data);
+   data += sizeof(uint16_t);
+
+   /* uint8_t: chain length */
+   ik->chain_length = *data++;
+
+   /* uint16_t: iterations */
+   ik->iterations = mmd_u16(data);
+   data += sizeof(uint16_t);
+
+   /* FLOAT: cotrol weight */
+   ik->cotrol_weight = mmd_f32(data);
+
+   /* child bone indices */
+   if (!(ik->child_bone_index = mmd_calloc(mmd, ik->chain_length, sizeof(unsigned short))))
+      return RETURN_FAIL;
+
+   return RETURN_OK;
+}
+
+/* \brief decode skin record and allocate its vertices */
+int mmd_decode_skin(mmd_data *mmd, mmd_skin *skin, const unsigned char *data)
+{
+   assert(mmd && skin && data);
+
+   /* SJIS STRING: skin name (20 bytes) */
+   if (mmd_name(mmd, data, 20, &skin->name, &skin->name_id) != RETURN_OK)
+      return RETURN_FAIL;
+
+   data += 20;
+
+   /* uint32_t: vertex count */
+   skin->num_vertices = mmd_u32(data);
+   data += sizeof(uint32_t);
+
+   /* uint8_t: skin type */
+   skin->type = *data;
+   return RETURN_OK;
+}
+
+/* \brief decode skin vertex records */
+void mmd_decode_skin_vertices(mmd_skin_vertex *vertices, const unsigned char *data, size_t count)
+{
+   size_t i;
+   assert(vertices || !count);
+
+   for (i = 0; i < count; ++i) {
+      /* uint32_t: vertex index */
+      vertices[i].index = mmd_u32(data);
+      data += sizeof(uint32_t);
+
+      /* 3xFLOAT: translation */
+      mmd_f32v(vertices[i].translation, data, 3);
+      data += sizeof(uint32_t) * 3;
+   }
+}
+
+/* \brief decode skin display records */
+void mmd_decode_skin_displays(unsigned int *displays, const unsigned char *data, size_t count)
+{
+   size_t i;
+   assert(displays || !count);
+
+   /* uint16_t: indices */
+   for (i = 0; i < count; ++i)
+      displays[i] = mmd_u16(data + i * MMD_SKIN_DISPLAY_SIZE);
+}
 
 /* \brief read PMD header */
-int mmd_read_header(mmd_data *mmd)
+static int mmd_read_header_section(mmd_data *mmd)
+{
+   const unsigned char *data;
+   assert(mmd);
+
+   if (!(data = mmd_fetch(mmd, MMD_HEADER_SIZE)))
+      return RETURN_FAIL;
+
+   return mmd_decode_header(mmd, data);
+}
+
+/* \breif read vertex data */
+static int mmd_read_vertex_section(mmd_data *mmd)
 {
-   chckBuffer *buf;
-   size_t header_size = 3 + sizeof(uint32_t) + 20 + 256;
-   unsigned char charbuf[256];
+   const unsigned char *data;
    assert(mmd);
 
-   if (!(buf = chckBufferNew(header_size, CHCK_BUFFER_ENDIAN_LITTLE)))
+   if (!(data = mmd_fetch(mmd, sizeof(uint32_t))))
       goto fail;
 
-   if (chckBufferFillFromFile(mmd->f, 1, header_size, buf) != header_size)
+   /* uint32_t: vertex count */
+   mmd->num_vertices = mmd_u32(data);
+
+   /* get all the data at once */
+   if (!(data = mmd_fetch_array(mmd, mmd->num_vertices, MMD_VERTEX_SIZE)))
       goto fail;
 
-   if (memcmp(chckBufferGetPointer(buf), "Pmd", 3))
+   if (mmd_alloc_section(mmd, MMD_SECTION_VERTEX) != RETURN_OK)
       goto fail;
 
-   chckBufferSeek(buf, 3, SEEK_CUR);
+   /* deinterleave in bulk */
+   mmd_decode_vertices_bounded(data, mmd->num_vertices, mmd->vertices, mmd->normals, mmd->coords, mmd->weights, &mmd->bounds);
+   mmd_bounds_tighten(&mmd->bounds);
 
-   /* FLOAT: version */
-   if (!chckBufferReadUInt32(buf, (unsigned int*)&mmd->header.version))
+   return RETURN_OK;
+
+fail:
+   return RETURN_FAIL;
+}
+
+/* \brief ead index data */
+static int mmd_read_index_section(mmd_data *mmd)
+{
+   const unsigned char *data;
+   assert(mmd);
+
+   if (!(data = mmd_fetch(mmd, sizeof(uint32_t))))
       goto fail;
 
-   /* SHIFT-JIS STRING: name (20 bytes) */
-   if (chckBufferRead(charbuf, 1, 20, buf) != 20)
+   /* uint32_t: index count */
+   mmd->num_indices = mmd_u32(data);
+
+   /* get all the data at once */
+   if (!(data = mmd_fetch_array(mmd, mmd->num_indices, MMD_INDEX_SIZE)))
       goto fail;
 
-   mmd->header.name = chckSJISToUTF8(charbuf, 20, NULL, 1);
+   /* uint16_t: indices, referenced directly from memory when possible */
+   if ((mmd->indices = mmd_view(mmd, data, sizeof(uint16_t))))
+      return RETURN_OK;
 
-   /* SHIFT-JIS STRING: comment (256 bytes) */
-   if (chckBufferRead(charbuf, 1, 256, buf) != 256)
+   if (mmd_alloc_section(mmd, MMD_SECTION_INDEX) != RETURN_OK)
+      goto fail;
+
+   mmd_u16v(mmd->indices, data, mmd->num_indices);
+   return RETURN_OK;
+
+fail:
+   return RETURN_FAIL;
+}
+
+/* \brief read material data */
+static int mmd_read_material_section(mmd_data *mmd)
+{
+   const unsigned char *data;
+   unsigned int i;
+   assert(mmd);
+
+   if (!(data = mmd_fetch(mmd, sizeof(uint32_t))))
+      goto fail;
+
+   /* uint32_t: material count */
+   mmd->num_materials = mmd_u32(data);
+
+   /* get all the data at once */
+   if (!(data = mmd_fetch_array(mmd, mmd->num_materials, MMD_MATERIAL_SIZE)))
+      goto fail;
+
+   if (mmd_alloc_section(mmd, MMD_SECTION_MATERIAL) != RETURN_OK)
       goto fail;
 
-   mmd->header.comment = chckSJISToUTF8(charbuf, 256, NULL, 1);
+   for (i = 0; i < mmd->num_materials; ++i, data += MMD_MATERIAL_SIZE)
+      if (mmd_decode_material(mmd, &mmd->materials[i], data) != RETURN_OK)
+         goto fail;
 
-   chckBufferFree(buf);
+   mmd_material_bounds(mmd);
    return RETURN_OK;
 
 fail:
-   if (buf) chckBufferFree(buf);
    return RETURN_FAIL;
 }
 
-/* \breif read vertex data */
-int mmd_read_vertex_data(mmd_data *mmd)
+/* \brief read bone data */
+static int mmd_read_bone_section(mmd_data *mmd)
 {
-   chckBuffer *buf;
+   const unsigned char *data;
    unsigned int i;
-   size_t block_size;
    assert(mmd);
 
-   if (!(buf = chckBufferNew(sizeof(uint32_t), CHCK_BUFFER_ENDIAN_LITTLE)))
+   if (!(data = mmd_fetch(mmd, sizeof(uint16_t))))
       goto fail;
 
-   if (chckBufferFillFromFile(mmd->f, sizeof(uint32_t), 1, buf) != 1)
+   /* uint16_t: bone count */
+   mmd->num_bones = mmd_u16(data);
+
+   /* get all the data at once */
+   if (!(data = mmd_fetch_array(mmd, mmd->num_bones, MMD_BONE_SIZE)))
       goto fail;
 
-   /* uint32_t: vertex count */
-   if (!chckBufferReadUInt32(buf, &mmd->num_vertices))
+   if (mmd_alloc_section(mmd, MMD_SECTION_BONE) != RETURN_OK)
+      goto fail;
+
+   for (i = 0; i < mmd->num_bones; ++i, data += MMD_BONE_SIZE)
+      if (mmd_decode_bone(mmd, &mmd->bones[i], data) != RETURN_OK)
+         goto fail;
+
+   mmd_bone_bounds(mmd);
+   return RETURN_OK;
+
+fail:
+   return RETURN_FAIL;
+}
+
+/* \brief read IK data */
+static int mmd_read_ik_section(mmd_data *mmd)
+{
+   const unsigned char *data;
+   unsigned int i;
+   assert(mmd);
+
+   if (!(data = mmd_fetch(mmd, sizeof(uint16_t))))
       goto fail;
 
-   /* resize our buffer to fit all the data */
-   block_size = mmd->num_vertices * (sizeof(uint32_t) * 9 + 2);
-   chckBufferResize(buf, block_size);
-   chckBufferSeek(buf, 0, SEEK_SET);
+    /* uint16_t: IK count */
+   mmd->num_ik = mmd_u16(data);
 
-   if (chckBufferFillFromFile(mmd->f, 1, block_size, buf) != block_size)
+   if (mmd_alloc_section(mmd, MMD_SECTION_IK) != RETURN_OK)
       goto fail;
 
-   /* vertices */
-   if (!(mmd->vertices = calloc(mmd->num_vertices, 3 * sizeof(float))))
+   for (i = 0; i < mmd->num_ik; ++i) {
+      if (!(data = mmd_fetch(mmd, MMD_IK_SIZE)))
+         goto fail;
+
+      if (mmd_decode_ik(mmd, &mmd->ik[i], data) != RETURN_OK)
+         goto fail;
+
+      if (!(data = mmd_fetch_array(mmd, mmd->ik[i].chain_length, MMD_IK_LINK_SIZE)))
+         goto fail;
+
+      /* uint16_t: child bone index */
+      mmd_u16v(mmd->ik[i].child_bone_index, data, mmd->ik[i].chain_length);
+   }
+
+   return RETURN_OK;
+
+fail:
+   return RETURN_FAIL;
+}
+
+/* \brief read skin data */
+static int mmd_read_skin_section(mmd_data *mmd)
+{
+   const unsigned char *data;
+   unsigned int i;
+   assert(mmd);
+
+   if (!(data = mmd_fetch(mmd, sizeof(uint16_t))))
+      goto fail;
+
+   /* uint16_t: skin count */
+   mmd->num_skins = mmd_u16(data);
+
+   if (mmd_alloc_section(mmd, MMD_SECTION_SKIN) != RETURN_OK)
+      goto fail;
+
+   for(i = 0; i < mmd->num_skins; ++i) {
+      if (!(data = mmd_fetch(mmd, MMD_SKIN_SIZE)))
+         goto fail;
+
+      if (mmd_decode_skin(mmd, &mmd->skin[i], data) != RETURN_OK)
+         goto fail;
+
+      /* get all the data at once, count is checked against it before allocating */
+      if (!(data = mmd_fetch_array(mmd, mmd->skin[i].num_vertices, MMD_SKIN_VERTEX_SIZE)))
+         goto fail;
+
+      if (!(mmd->skin[i].vertices = mmd_calloc(mmd, mmd->skin[i].num_vertices, sizeof(mmd_skin_vertex))))
+         goto fail;
+
+      mmd_decode_skin_vertices(mmd->skin[i].vertices, data, mmd->skin[i].num_vertices);
+   }
+
+   return RETURN_OK;
+
+fail:
+   return RETURN_FAIL;
+}
+
+/* \brief read skin display data */
+static int mmd_read_skin_display_section(mmd_data *mmd)
+{
+   const unsigned char *data;
+   assert(mmd);
+
+   if (!(data = mmd_fetch(mmd, sizeof(uint8_t))))
       goto fail;
 
-   /* normals */
-   if (!(mmd->normals = calloc(mmd->num_vertices, 3 * sizeof(float))))
+   /* uint8_t: skin display count */
+   mmd->num_skin_displays = *data;
+
+   /* get all the data at once */
+   if (!(data = mmd_fetch_array(mmd, mmd->num_skin_displays, MMD_SKIN_DISPLAY_SIZE)))
+      goto fail;
+
+   if (mmd_alloc_section(mmd, MMD_SECTION_SKIN_DISPLAY) != RETURN_OK)
+      goto fail;
+
+   mmd_decode_skin_displays(mmd->skin_display, data, mmd->num_skin_displays);
+   return RETURN_OK;
+
+fail:
+   return RETURN_FAIL;
+}
+
+/* \brief read bone name data */
+static int mmd_read_bone_name_section(mmd_data *mmd)
+{
+   const unsigned char *data;
+   unsigned int i;
+   assert(mmd);
+
+   if (!(data = mmd_fetch(mmd, sizeof(uint8_t))))
       goto fail;
 
-   /* coords */
-   if (!(mmd->coords = calloc(mmd->num_vertices, 2 * sizeof(float))))
+   /* uint8_t: bone name count */
+   mmd->num_bone_names = *data;
+
+   /* get all the data at once */
+   if (!(data = mmd_fetch_array(mmd, mmd->num_bone_names, MMD_BONE_NAME_SIZE)))
       goto fail;
 
-   /* vertex weights */
-   if (!(mmd->weights = calloc(mmd->num_vertices, sizeof(mmd_weight))))
+   if (mmd_alloc_section(mmd, MMD_SECTION_BONE_NAME) != RETURN_OK)
       goto fail;
 
-   for (i = 0; i < mmd->num_vertices; ++i) {
-      /* 3xFLOAT: vertex */
-      if (chckBufferRead(&mmd->vertices[i*3], sizeof(uint32_t), 3, buf) != 3)
+   /* SJIS STRING: bone name (50 bytes) */
+   for(i = 0; i < mmd->num_bone_names; ++i, data += MMD_BONE_NAME_SIZE)
+      if (mmd_name(mmd, data, MMD_BONE_NAME_SIZE, &mmd->bone_name[i].name, &mmd->bone_name[i].name_id) != RETURN_OK)
          goto fail;
 
-      if (!chckBufferIsNativeEndian(buf))
-         chckBufferSwap(&mmd->vertices[i*3], sizeof(uint32_t), 3);
+   return RETURN_OK;
+
+fail:
+   return RETURN_FAIL;
+}
+
+/* \brief check magic and read version of header that is not wanted */
+static int mmd_pass_header(mmd_data *mmd, const unsigned char *data)
+{
+   if (memcmp(data, "Pmd", 3)) {
+      mmd_fail_span(mmd, MMD_ERROR_FORMAT);
+      return RETURN_FAIL;
+   }
+
+   mmd->header.version = mmd_f32(data + 3);
+   return RETURN_OK;
+}
+
+/* \brief step over section, only its counts are read and set */
+static int mmd_pass_section(mmd_data *mmd, unsigned int section)
+{
+   const unsigned char *data;
+   unsigned int i, count;
+   assert(mmd);
+
+   if (section == MMD_SECTION_HEADER)
+      return ((data = mmd_fetch(mmd, MMD_HEADER_SIZE)) ? mmd_pass_header(mmd, data) : RETURN_FAIL);
+
+   if (!(data = mmd_fetch(mmd, mmd_count_size(section))))
+      return RETURN_FAIL;
+
+   switch (mmd_count_size(section)) {
+      case sizeof(uint32_t):
+         count = mmd_u32(data);
+         break;
+      case sizeof(uint16_t):
+         count = mmd_u16(data);
+         break;
+      default:
+         count = *data;
+         break;
+   }
+
+   mmd_set_count(mmd, section, count);
+
+   switch (section) {
+      case MMD_SECTION_VERTEX:
+         mmd_bounds_reset(&mmd->bounds);
+         return mmd_pass(mmd, count, MMD_VERTEX_SIZE);
+
+      case MMD_SECTION_INDEX:
+         return mmd_pass(mmd, count, MMD_INDEX_SIZE);
+
+      case MMD_SECTION_MATERIAL:
+         return mmd_pass(mmd, count, MMD_MATERIAL_SIZE);
+
+      case MMD_SECTION_BONE:
+         return mmd_pass(mmd, count, MMD_BONE_SIZE);
+
+      case MMD_SECTION_IK:
+         /* uint8_t: chain length, after bone indices */
+         for (i = 0; i < count; ++i)
+            if (!(data = mmd_fetch(mmd, MMD_IK_SIZE)) ||
+                mmd_pass(mmd, data[sizeof(uint16_t) * 2], MMD_IK_LINK_SIZE) != RETURN_OK)
+               return RETURN_FAIL;
+         break;
+
+      case MMD_SECTION_SKIN:
+         /* uint32_t: vertex count, after name */
+         for (i = 0; i < count; ++i)
+            if (!(data = mmd_fetch(mmd, MMD_SKIN_SIZE)) ||
+                mmd_pass(mmd, mmd_u32(data + 20), MMD_SKIN_VERTEX_SIZE) != RETURN_OK)
+               return RETURN_FAIL;
+         break;
+
+      case MMD_SECTION_SKIN_DISPLAY:
+         return mmd_pass(mmd, count, MMD_SKIN_DISPLAY_SIZE);
+
+      case MMD_SECTION_BONE_NAME:
+         return mmd_pass(mmd, count, MMD_BONE_NAME_SIZE);
+   }
+
+   return RETURN_OK;
+}
+
+/* \brief read section at read position, measured when stats are enabled
+ * NULL reader steps over the section instead */
+static int mmd_read_section(mmd_data *mmd, unsigned int section, int (*reader)(mmd_data*))
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   mmd_span span;
+   int ret;
+   assert(mmd);
+
+   mmd_clear_error(priv);
+   mmd_span_begin(mmd, &span, section, mmd_position(mmd));
+   ret = (reader ? reader(mmd) : mmd_pass_section(mmd, section));
+   return mmd_span_end(&span, (priv->stats ? mmd_position(mmd) : 0), ret);
+}
+
+/* \brief read PMD header */
+int mmd_read_header(mmd_data *mmd)
+{
+   return mmd_read_section(mmd, MMD_SECTION_HEADER, mmd_read_header_section);
+}
+
+/* \brief read vertex data */
+int mmd_read_vertex_data(mmd_data *mmd)
+{
+   return mmd_read_section(mmd, MMD_SECTION_VERTEX, mmd_read_vertex_section);
+}
+
+/* \brief read index data */
+int mmd_read_index_data(mmd_data *mmd)
+{
+   return mmd_read_section(mmd, MMD_SECTION_INDEX, mmd_read_index_section);
+}
+
+/* \brief read material data */
+int mmd_read_material_data(mmd_data *mmd)
+{
+   return mmd_read_section(mmd, MMD_SECTION_MATERIAL, mmd_read_material_section);
+}
+
+/* \brief read bone data */
+int mmd_read_bone_data(mmd_data *mmd)
+{
+   return mmd_read_section(mmd, MMD_SECTION_BONE, mmd_read_bone_section);
+}
+
+/* \brief read IK data */
+int mmd_read_ik_data(mmd_data *mmd)
+{
+   return mmd_read_section(mmd, MMD_SECTION_IK, mmd_read_ik_section);
+}
+
+/* \brief read skin data */
+int mmd_read_skin_data(mmd_data *mmd)
+{
+   return mmd_read_section(mmd, MMD_SECTION_SKIN, mmd_read_skin_section);
+}
+
+/* \brief read skin display data */
+int mmd_read_skin_display_data(mmd_data *mmd)
+{
+   return mmd_read_section(mmd, MMD_SECTION_SKIN_DISPLAY, mmd_read_skin_display_section);
+}
+
+/* \brief read bone name data */
+int mmd_read_bone_name_data(mmd_data *mmd)
+{
+   return mmd_read_section(mmd, MMD_SECTION_BONE_NAME, mmd_read_bone_name_section);
+}
+
+/* \brief readers of PMD sections, in file order */
+static int (*const mmd_section_readers[MMD_SECTION_LAST])(mmd_data*) = {
+   mmd_read_header_section,
+   mmd_read_vertex_section,
+   mmd_read_index_section,
+   mmd_read_material_section,
+   mmd_read_bone_section,
+   mmd_read_ik_section,
+   mmd_read_skin_section,
+   mmd_read_skin_display_section,
+   mmd_read_bone_name_section
+};
 
-      /* 3xFLOAT: normal */
-      if (chckBufferRead(&mmd->normals[i*3], sizeof(uint32_t), 3, buf) != 3)
-         goto fail;
+/* \brief read rest of FILE with one read and decode it as memory,
+ * nothing may reference it after mmd_end_load */
+static int mmd_begin_load(mmd_data *mmd, unsigned char **out_file)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   unsigned char *file;
+   long pos, end;
+   size_t size;
 
-      if (!chckBufferIsNativeEndian(buf))
-         chckBufferSwap(&mmd->normals[i*3], sizeof(uint32_t), 3);
+   *out_file = NULL;
 
-      /* 2xFLOAT: texture coordinate */
-      if (chckBufferRead(&mmd->coords[i*2], sizeof(uint32_t), 2, buf) != 2)
-         goto fail;
+   if (priv->memory)
+      return RETURN_OK;
 
-      if (!chckBufferIsNativeEndian(buf))
-         chckBufferSwap(&mmd->coords[i*2], sizeof(uint32_t), 2);
+   if (!mmd->f || (pos = ftell(mmd->f)) < 0 || fseek(mmd->f, 0, SEEK_END) != 0) {
+      mmd_fail(mmd, MMD_ERROR_IO, MMD_SECTION_LAST, 0);
+      return RETURN_FAIL;
+   }
 
-      /* uint32_t: weight vertex index */
-      if (!chckBufferReadUInt32(buf, &mmd->weights[i].vertex_index))
-         goto fail;
+   if ((end = ftell(mmd->f)) < pos || fseek(mmd->f, pos, SEEK_SET) != 0) {
+      mmd_fail(mmd, MMD_ERROR_IO, MMD_SECTION_LAST, (size_t)pos);
+      return RETURN_FAIL;
+   }
 
-      /* uint8_t: vertex weight */
-      if (!chckBufferReadUInt8(buf, &mmd->weights[i].weight))
-         goto fail;
+   size = (size_t)(end - pos);
+   if (!(file = mmd_scratch_alloc(mmd, size))) {
+      mmd_fail(mmd, MMD_ERROR_MEMORY, MMD_SECTION_LAST, (size_t)pos);
+      return RETURN_FAIL;
+   }
 
-      /* uint8_t: edge flag */
-      if (!chckBufferReadUInt8(buf, &mmd->weights[i].edge_flag))
-         goto fail;
+   if (fread(file, 1, size, mmd->f) != size) {
+      mmd_fail(mmd, MMD_ERROR_IO, MMD_SECTION_LAST, (size_t)pos);
+      mmd_scratch_free(mmd, file);
+      return RETURN_FAIL;
    }
 
-   chckBufferFree(buf);
+   priv->memory = file;
+   priv->size = size;
+   priv->offset = 0;
+   priv->origin = (size_t)pos;
+   priv->views = 0;
+   *out_file = file;
    return RETURN_OK;
-
-fail:
-   if (buf) chckBufferFree(buf);
-   return RETURN_FAIL;
 }
 
-/* \brief ead index data */
-int mmd_read_index_data(mmd_data *mmd)
+/* \brief release file read by mmd_begin_load */
+static void mmd_end_load(mmd_data *mmd, unsigned char *file)
 {
-   chckBuffer *buf;
-   size_t block_size;
-   assert(mmd);
+   mmd_private *priv = (mmd_private*)mmd;
 
-   if (!(buf = chckBufferNew(sizeof(uint32_t), CHCK_BUFFER_ENDIAN_LITTLE)))
-      goto fail;
+   if (!file)
+      return;
 
-   if (chckBufferFillFromFile(mmd->f, sizeof(uint32_t), 1, buf) != 1)
-      goto fail;
+   priv->memory = NULL;
+   priv->size = priv->offset = priv->origin = 0;
+   mmd_scratch_free(mmd, file);
+}
 
-   /* uint32_t: index count */
-   if (!chckBufferReadUInt32(buf, &mmd->num_indices))
-      goto fail;
+/* \brief does the rest of input start with PMX magic? */
+static int mmd_is_pmx(mmd_private *priv)
+{
+   return (priv->memory && priv->size - priv->offset >= 4 && !memcmp(priv->memory + priv->offset, "PMX ", 4));
+}
 
-   /* resize our buffer to fit all the data */
-   block_size = mmd->num_indices * sizeof(uint16_t);
-   chckBufferResize(buf, block_size);
-   chckBufferSeek(buf, 0, SEEK_SET);
+/* \brief does FILE continue with PMX magic? read position is kept */
+static int mmd_file_is_pmx(mmd_data *mmd)
+{
+   unsigned char magic[4];
+   size_t filled;
+   long pos;
 
-   if (chckBufferFillFromFile(mmd->f, 1, block_size, buf) != block_size)
-      goto fail;
+   if (!mmd->f || (pos = ftell(mmd->f)) < 0)
+      return 0;
 
-   /* indices */
-   if (!(mmd->indices = calloc(mmd->num_indices, sizeof(uint16_t))))
-      goto fail;
+   filled = fread(magic, 1, sizeof(magic), mmd->f);
 
-   /* uint16_t: indices */
-   if (chckBufferRead(mmd->indices, sizeof(uint16_t), mmd->num_indices, buf) != mmd->num_indices)
-      goto fail;
+   if (fseek(mmd->f, pos, SEEK_SET) != 0)
+      return 0;
+
+   return (filled == sizeof(magic) && !memcmp(magic, "PMX ", 4));
+}
 
-   if (!chckBufferIsNativeEndian(buf))
-      chckBufferSwap(mmd->indices, sizeof(uint16_t), mmd->num_indices);
+/* \brief read rest of input as PMX */
+static int mmd_load_rest_pmx(mmd_data *mmd, unsigned int flags)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   size_t used;
+
+   if (mmd_pmx_load(mmd, priv->memory + priv->offset, priv->size - priv->offset, flags, !priv->pool, priv->sections, &used) != RETURN_OK)
+      return RETURN_FAIL;
 
-   chckBufferFree(buf);
+   priv->offset += used;
    return RETURN_OK;
+}
 
-fail:
-   if (buf) chckBufferFree(buf);
-   return RETURN_FAIL;
+/* \brief order of shared arrays */
+static int mmd_shared_cmp(const void *a, const void *b)
+{
+   uintptr_t pa = (uintptr_t)*(const void* const*)a, pb = (uintptr_t)*(const void* const*)b;
+   return (pa > pb) - (pa < pb);
 }
 
-/* \brief read material data */
-int mmd_read_material_data(mmd_data *mmd)
+/* \brief replace heap array with blob of identical bytes, array is kept on failure */
+static void* mmd_share(mmd_data *mmd, void *array, size_t bytes)
 {
-   chckBuffer *buf;
-   unsigned int i;
-   size_t block_size;
-   unsigned char charbuf[20];
-   assert(mmd);
+   mmd_private *priv = (mmd_private*)mmd;
+   const void *blob;
 
-   if (!(buf = chckBufferNew(sizeof(uint32_t), CHCK_BUFFER_ENDIAN_LITTLE)))
-      goto fail;
+   if (!array || !bytes || mmd_in_arena(priv, array) || mmd_is_view(priv, array))
+      return array;
 
-   if (chckBufferFillFromFile(mmd->f, sizeof(uint32_t), 1, buf) != 1)
-      goto fail;
+   if (!(blob = mmd_blob_store_intern(priv->blobs, array, bytes)))
+      return array;
 
-   /* uint32_t: material count */
-   if (!chckBufferReadUInt32(buf, &mmd->num_materials))
-      goto fail;
+   mmd_dealloc(mmd, array);
+   priv->shared[priv->num_shared++] = blob;
+   return (void*)blob;
+}
 
-   /* resize our buffer to fit all the data */
-   block_size = mmd->num_materials * (sizeof(uint32_t) * 12 + 20 + 2);
-   chckBufferResize(buf, block_size);
-   chckBufferSeek(buf, 0, SEEK_SET);
+/* \brief share vertex, index and skin arrays of finished load through blob store */
+static void mmd_share_arrays(mmd_data *mmd)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   const void **shared;
+   unsigned int i;
 
-   if (chckBufferFillFromFile(mmd->f, 1, block_size, buf) != block_size)
-      goto fail;
+   if (!priv->blobs)
+      return;
 
-   /* materials */
-   if (!(mmd->materials = calloc(mmd->num_materials, sizeof(mmd_material))))
-      goto fail;
+   /* room for every array up front, nothing is shared without it */
+   if (!(shared = mmd_realloc(mmd, priv->shared, ((size_t)priv->num_shared + 6 + mmd->num_skins) * sizeof(void*))))
+      return;
 
-   for (i = 0; i < mmd->num_materials; ++i) {
-      /* 3xFLOAT: diffuse */
-      if (chckBufferRead(mmd->materials[i].diffuse, sizeof(uint32_t), 3, buf) != 3)
-         goto fail;
+   priv->shared = shared;
 
-      if (!chckBufferIsNativeEndian(buf))
-         chckBufferSwap(mmd->materials[i].diffuse, sizeof(uint32_t), 3);
+   mmd->vertices = mmd_share(mmd, mmd->vertices, (size_t)mmd->num_vertices * 3 * sizeof(float));
+   mmd->normals = mmd_share(mmd, mmd->normals, (size_t)mmd->num_vertices * 3 * sizeof(float));
+   mmd->coords = mmd_share(mmd, mmd->coords, (size_t)mmd->num_vertices * 2 * sizeof(float));
+   mmd->weights = mmd_share(mmd, mmd->weights, (size_t)mmd->num_vertices * sizeof(mmd_weight));
+   mmd->indices = mmd_share(mmd, mmd->indices, (size_t)mmd->num_indices * sizeof(unsigned short));
+   mmd->indices32 = mmd_share(mmd, mmd->indices32, (size_t)mmd->num_indices * sizeof(unsigned int));
 
-      /* FLOAT: alpha */
-      if (!chckBufferReadUInt32(buf, (unsigned int*)&mmd->materials[i].alpha))
-         goto fail;
+   for (i = 0; mmd->skin && i < mmd->num_skins; ++i)
+      mmd->skin[i].vertices = mmd_share(mmd, mmd->skin[i].vertices, (size_t)mmd->skin[i].num_vertices * sizeof(mmd_skin_vertex));
 
-      /* FLOAT: power */
-      if (!chckBufferReadUInt32(buf, (unsigned int*)&mmd->materials[i].power))
-         goto fail;
+   qsort(priv->shared, priv->num_shared, sizeof(void*), mmd_shared_cmp);
+}
 
-      /* 3xFLOAT: specular */
-      if (chckBufferRead(mmd->materials[i].specular, sizeof(uint32_t), 3, buf) != 3)
-         goto fail;
+/* \brief read whole PMD file in one pass */
+int mmd_load(mmd_data *mmd, unsigned int flags)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   unsigned char *file = NULL;
+   unsigned int s;
+   int ret = RETURN_FAIL;
+   assert(mmd);
 
-      if (!chckBufferIsNativeEndian(buf))
-         chckBufferSwap(mmd->materials[i].specular, sizeof(uint32_t), 3);
+   mmd_clear_error(priv);
 
-      /* 3xFLOAT: ambient */
-      if (chckBufferRead(mmd->materials[i].ambient, sizeof(uint32_t), 3, buf) != 3)
-         goto fail;
+   /* skipped PMD sections of FILE are seeked over instead of read */
+   if ((priv->sections == MMD_SECTION_MASK_ALL || priv->memory || mmd_file_is_pmx(mmd)) &&
+       mmd_begin_load(mmd, &file) != RETURN_OK)
+      return RETURN_FAIL;
 
-      if (!chckBufferIsNativeEndian(buf))
-         chckBufferSwap(mmd->materials[i].ambient, sizeof(uint32_t), 3);
+   if (mmd_is_pmx(priv)) {
+      ret = mmd_load_rest_pmx(mmd, flags);
+      goto out;
+   }
 
-      /* uint8_t: toon flag */
-      if (!chckBufferReadUInt8(buf, &mmd->materials[i].toon))
-         goto fail;
+   if ((flags & MMD_LOAD_ARENA) && mmd_use_arena(mmd) != RETURN_OK)
+      goto out;
 
-      /* uint8_t: edge flag */
-      if (!chckBufferReadUInt8(buf, &mmd->materials[i].edge))
-         goto fail;
+   for (s = 0; s < MMD_SECTION_LAST; ++s)
+      if (mmd_read_section(mmd, s, (priv->sections & (1 << s) ? mmd_section_readers[s] : NULL)) != RETURN_OK)
+         goto out;
 
-      /* uint32_t: face indices */
-      if (!chckBufferReadUInt32(buf, &mmd->materials[i].face))
-         goto fail;
+   ret = RETURN_OK;
 
-      /* STRING (SJIS?): texture (20 bytes) */
-      if (chckBufferRead(charbuf, 1, 20, buf) != 20)
-         goto fail;
+out:
+   if (ret == RETURN_OK)
+      mmd_share_arrays(mmd);
 
-      if (!(mmd->materials[i].texture = chckSJISToUTF8(charbuf, 20, NULL, 1)))
-         goto fail;
+   mmd_end_load(mmd, file);
+   return ret;
+}
+
+/* \brief decode records of section, count and arrays are already set */
+static int mmd_decode_section(mmd_data *mmd, unsigned int section, const unsigned char *data)
+{
+   unsigned int i;
+
+   switch (section) {
+      case MMD_SECTION_HEADER:
+         return mmd_decode_header(mmd, data);
+
+      case MMD_SECTION_VERTEX:
+         mmd_decode_vertices_bounded(data, mmd->num_vertices, mmd->vertices, mmd->normals, mmd->coords, mmd->weights, &mmd->bounds);
+         mmd_bounds_tighten(&mmd->bounds);
+         break;
+
+      case MMD_SECTION_INDEX:
+         if (!mmd_is_view((mmd_private*)mmd, mmd->indices))
+            mmd_u16v(mmd->indices, data, mmd->num_indices);
+         break;
+
+      case MMD_SECTION_MATERIAL:
+         for (i = 0; i < mmd->num_materials; ++i, data += MMD_MATERIAL_SIZE)
+            if (mmd_decode_material(mmd, &mmd->materials[i], data) != RETURN_OK)
+               return RETURN_FAIL;
+         break;
+
+      case MMD_SECTION_BONE:
+         for (i = 0; i < mmd->num_bones; ++i, data += MMD_BONE_SIZE)
+            if (mmd_decode_bone(mmd, &mmd->bones[i], data) != RETURN_OK)
+               return RETURN_FAIL;
+         break;
+
+      case MMD_SECTION_IK:
+         for (i = 0; i < mmd->num_ik; ++i) {
+            if (mmd_decode_ik(mmd, &mmd->ik[i], data) != RETURN_OK)
+               return RETURN_FAIL;
+
+            data += MMD_IK_SIZE;
+            mmd_u16v(mmd->ik[i].child_bone_index, data, mmd->ik[i].chain_length);
+            data += mmd->ik[i].chain_length * MMD_IK_LINK_SIZE;
+         }
+         break;
+
+      case MMD_SECTION_SKIN:
+         for (i = 0; i < mmd->num_skins; ++i) {
+            /* mmd_scan checked every vertex count against the input */
+            if (mmd_decode_skin(mmd, &mmd->skin[i], data) != RETURN_OK ||
+                !(mmd->skin[i].vertices = mmd_calloc(mmd, mmd->skin[i].num_vertices, sizeof(mmd_skin_vertex))))
+               return RETURN_FAIL;
+
+            data += MMD_SKIN_SIZE;
+            mmd_decode_skin_vertices(mmd->skin[i].vertices, data, mmd->skin[i].num_vertices);
+            data += (size_t)mmd->skin[i].num_vertices * MMD_SKIN_VERTEX_SIZE;
+         }
+         break;
+
+      case MMD_SECTION_SKIN_DISPLAY:
+         mmd_decode_skin_displays(mmd->skin_display, data, mmd->num_skin_displays);
+         break;
+
+      case MMD_SECTION_BONE_NAME:
+         for (i = 0; i < mmd->num_bone_names; ++i, data += MMD_BONE_NAME_SIZE)
+            if (mmd_name(mmd, data, MMD_BONE_NAME_SIZE, &mmd->bone_name[i].name, &mmd->bone_name[i].name_id) != RETURN_OK)
+               return RETURN_FAIL;
+         break;
    }
 
-   chckBufferFree(buf);
    return RETURN_OK;
+}
 
-fail:
-   if (buf) chckBufferFree(buf);
-   return RETURN_FAIL;
+/* \brief task of mmd_load_parallel */
+static void mmd_section_task_run(void *arg)
+{
+   mmd_section_task *task = arg;
+   mmd_span span;
+
+   mmd_span_begin(task->mmd, &span, task->section, task->offset);
+   span.stats.allocations += task->setup.stats.allocations;
+   span.stats.allocated += task->setup.stats.allocated;
+
+   task->ret = mmd_decode_section(task->mmd, task->section, task->data);
+   task->ret = mmd_span_end(&span, task->offset + task->size, task->ret);
 }
 
-/* \brief read bone data */
-int mmd_read_bone_data(mmd_data *mmd)
+/* \brief read whole PMD file, decoding sections concurrently */
+int mmd_load_parallel(mmd_data *mmd, unsigned int flags, const mmd_executor *executor)
 {
-   unsigned int i;
-   size_t block_size;
-   unsigned char charbuf[50];
-   chckBuffer *buf;
+   mmd_private *priv = (mmd_private*)mmd;
+   mmd_section_task tasks[MMD_SECTION_LAST];
+   void *args[MMD_SECTION_LAST];
+   const unsigned char *base;
+   unsigned char *file;
+   unsigned int i, s, num_tasks = 0, threads;
+   mmd_layout layout;
+   size_t next;
+   int alloc, ret = RETURN_FAIL;
    assert(mmd);
 
-   if (!(buf = chckBufferNew(sizeof(uint16_t), CHCK_BUFFER_ENDIAN_LITTLE)))
-      goto fail;
+   mmd_clear_error(priv);
 
-   if (chckBufferFillFromFile(mmd->f, sizeof(uint16_t), 1, buf) != 1)
-      goto fail;
+   if (mmd_begin_load(mmd, &file) != RETURN_OK)
+      return RETURN_FAIL;
 
-   /* uint16_t: bone count */
-   if (!chckBufferReadUInt16(buf, &mmd->num_bones))
-      goto fail;
+   /* PMX records are variable length, they are decoded in order */
+   if (mmd_is_pmx(priv)) {
+      ret = mmd_load_rest_pmx(mmd, flags);
+      goto out;
+   }
 
-   /* resize our buffer to fit all the data */
-   block_size = mmd->num_bones * (50 + 1 + sizeof(uint16_t) * 3 + sizeof(uint32_t) * 3);
-   chckBufferResize(buf, block_size);
-   chckBufferSeek(buf, 0, SEEK_SET);
+   /* phase one: find sections */
+   if (mmd_scan(mmd, &layout) != RETURN_OK)
+      goto out;
+
+   if ((flags & MMD_LOAD_ARENA) && mmd_alloc_arena(mmd, &layout) != RETURN_OK)
+      goto out;
+
+   /* counts and arrays are set up here, so tasks only
+    * allocate IK chains, skin vertices and names */
+   base = priv->memory + layout.start;
+   for (s = 0; s < MMD_SECTION_LAST; ++s) {
+      tasks[s].mmd = mmd;
+      tasks[s].section = s;
+      tasks[s].data = base + layout.offset[s] + mmd_count_size(s);
+      tasks[s].offset = mmd_input_offset(mmd, base + layout.offset[s]);
+      next = (s + 1 < MMD_SECTION_LAST ? layout.offset[s + 1] : layout.end);
+      tasks[s].size = next - layout.offset[s];
+      tasks[s].ret = RETURN_OK;
+
+      mmd_set_count(mmd, s, layout.count[s]);
+
+      /* arrays are allocated on behalf of the task, it counts them */
+      mmd_span_enter(mmd, &tasks[s].setup, s, tasks[s].offset);
+
+      if (!(priv->sections & (1 << s))) {
+         /* skipped sections only get their counts, header its magic and version */
+         if (s == MMD_SECTION_VERTEX)
+            mmd_bounds_reset(&mmd->bounds);
+
+         alloc = (s == MMD_SECTION_HEADER ? mmd_pass_header(mmd, tasks[s].data) : RETURN_OK);
+      } else if (s == MMD_SECTION_INDEX && (mmd->indices = mmd_view(mmd, tasks[s].data, sizeof(uint16_t)))) {
+         alloc = RETURN_OK;
+      } else {
+         alloc = mmd_alloc_section(mmd, s);
+      }
 
-   /* allocate bones */
-   if (!(mmd->bones = calloc(mmd->num_bones, sizeof(mmd_bone))))
-      goto fail;
+      mmd_span_leave(&tasks[s].setup);
 
-   for (i = 0; i < mmd->num_bones; ++i) {
-      /* SJIS STRING: bone name (50 bytes) */
-      if (chckBufferRead(charbuf, 1, 50, buf) != 50)
-         goto fail;
+      if (alloc != RETURN_OK)
+         goto out;
+   }
 
-      if (!(mmd->bones[i].name = chckSJISToUTF8(charbuf, 50, NULL, 1)))
-         goto fail;
+   /* largest sections first, so they start on their own threads */
+   for (s = 0; s < MMD_SECTION_LAST; ++s) {
+      if (!(priv->sections & (1 << s)))
+         continue;
 
-      /* uint16_t: parent bone index */
-      if (!chckBufferReadUInt16(buf, &mmd->bones[i].parent_bone_index))
-         goto fail;
+      for (i = num_tasks; i > 0 && ((mmd_section_task*)args[i - 1])->size < tasks[s].size; --i)
+         args[i] = args[i - 1];
+      args[i] = &tasks[s];
+      num_tasks++;
+   }
 
-      /* uint16_t: tail bone index */
-      if (!chckBufferReadUInt16(buf, &mmd->bones[i].tail_pos_bone_index))
-         goto fail;
+   /* phase two: decode */
+   threads = mmd_cpu_count();
+   if ((executor || threads > 1) && !(priv->lock = mmd_mutex_new()))
+      goto out;
 
-      /* uint8_t: bone type */
-      if (!chckBufferReadUInt8(buf, &mmd->bones[i].type))
-         goto fail;
+   if (executor) {
+      executor->run(executor->user, mmd_section_task_run, args, num_tasks);
+   } else {
+      mmd_run_tasks(mmd_section_task_run, args, num_tasks, threads);
+   }
 
-      /* uint16_t: parent bone index */
-      if (!chckBufferReadUInt16(buf, &mmd->bones[i].parent_bone_index))
-         goto fail;
+   for (s = 0; s < MMD_SECTION_LAST; ++s)
+      if (tasks[s].ret != RETURN_OK)
+         goto out;
 
-       /* 3xFLOAT: head bone position */
-      if (chckBufferRead(mmd->bones[i].head_pos, sizeof(uint32_t), 3, buf) != 3)
-         goto fail;
+   /* these need sections decoded on other tasks */
+   mmd_material_bounds(mmd);
+   mmd_bone_bounds(mmd);
+
+   priv->offset = layout.start + layout.end;
+   ret = RETURN_OK;
 
-      if (!chckBufferIsNativeEndian(buf))
-         chckBufferSwap(mmd->bones[i].head_pos, sizeof(uint32_t), 3);
+out:
+   if (priv->lock) {
+      mmd_mutex_free(priv->lock);
+      priv->lock = NULL;
    }
 
-   chckBufferFree(buf);
-   return RETURN_OK;
+   if (ret == RETURN_OK)
+      mmd_share_arrays(mmd);
 
-fail:
-   if (buf) chckBufferFree(buf);
-   return RETURN_FAIL;
+   mmd_end_load(mmd, file);
+   return ret;
 }
 
-/* \brief read IK data */
-int mmd_read_ik_data(mmd_data *mmd)
+/* \brief decode only sections of mask on following loads */
+void mmd_set_sections(mmd_data *mmd, unsigned int sections)
 {
-   unsigned int i;
-   size_t block_size;
-   chckBuffer *buf;
    assert(mmd);
+   ((mmd_private*)mmd)->sections = sections & MMD_SECTION_MASK_ALL;
+}
 
-   if (!(buf = chckBufferNew(sizeof(uint16_t), CHCK_BUFFER_ENDIAN_LITTLE)))
-      goto fail;
-
-   if (chckBufferFillFromFile(mmd->f, sizeof(uint16_t), 1, buf) != 1)
-      goto fail;
-
-    /* uint16_t: IK count */
-   if (!chckBufferReadUInt16(buf, &mmd->num_ik))
-      goto fail;
-
-   /* alloc IKs */
-   if (!(mmd->ik = calloc(mmd->num_ik, sizeof(mmd_ik))))
-      goto fail;
+/* \brief intern names to string pool instead of converting them */
+void mmd_set_string_pool(mmd_data *mmd, mmd_string_pool *pool)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   assert(mmd);
 
-   for (i = 0; i < mmd->num_ik; ++i) {
-      /* resize our buffer to fit all the data */
-      block_size = sizeof(uint16_t) * 3 + sizeof(uint32_t) + 1;
-      chckBufferResize(buf, block_size);
-      chckBufferSeek(buf, 0, SEEK_SET);
+   if (pool) mmd_string_pool_ref(pool);
+   if (priv->pool) mmd_string_pool_free(priv->pool);
+   priv->pool = pool;
+}
 
-      if (chckBufferFillFromFile(mmd->f, 1, block_size, buf) != block_size)
-         goto fail;
+/* \brief share arrays of following loads through blob store */
+void mmd_set_blob_store(mmd_data *mmd, mmd_blob_store *store)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   assert(mmd);
 
-      /* uint16_t: ik bone index */
-      if (!chckBufferReadUInt16(buf, &mmd->ik[i].bone_index))
-         goto fail;
+   /* arrays shared already keep their references to the old store */
+   if (priv->num_shared && store != priv->blobs)
+      return;
 
-      /* uint16_t: bone index */
-      if (!chckBufferReadUInt16(buf, &mmd->ik[i].target_bone_index))
-         goto fail;
+   if (store) mmd_blob_store_ref(store);
+   if (priv->blobs) mmd_blob_store_free(priv->blobs);
+   priv->blobs = store;
+}
 
-      /* uint8_t: chain length */
-      if (!chckBufferReadUInt8(buf, &mmd->ik[i].chain_length))
-         goto fail;
+/* \brief private copies of shared and viewed arrays of sections */
+int mmd_detach(mmd_data *mmd, unsigned int sections)
+{
+   unsigned int i;
+   void *array;
+   assert(mmd);
 
-      /* uint16_t: iterations */
-      if (!chckBufferReadUInt16(buf, &mmd->ik[i].iterations))
-         goto fail;
+   /* mmd_writable returns NULL for NULL array too, so only failed copies fail */
+   if (sections & (1 << MMD_SECTION_VERTEX)) {
+      if (!(array = mmd_writable(mmd, mmd->vertices, mmd->num_vertices, 3 * sizeof(float))) && mmd->vertices)
+         return RETURN_FAIL;
+      mmd->vertices = array;
 
-      /* FLOAT: cotrol weight */
-      if (!chckBufferReadUInt32(buf, (unsigned int*)&mmd->ik[i].cotrol_weight))
-         goto fail;
+      if (!(array = mmd_writable(mmd, mmd->normals, mmd->num_vertices, 3 * sizeof(float))) && mmd->normals)
+         return RETURN_FAIL;
+      mmd->normals = array;
 
-      /* child bone indices */
-      if (!(mmd->ik[i].child_bone_index = calloc(mmd->ik[i].chain_length, sizeof(unsigned short))))
-         goto fail;
+      if (!(array = mmd_writable(mmd, mmd->coords, mmd->num_vertices, 2 * sizeof(float))) && mmd->coords)
+         return RETURN_FAIL;
+      mmd->coords = array;
 
-      /* resize our buffer to fit all the data */
-      block_size = mmd->ik[i].chain_length * sizeof(uint16_t);
-      chckBufferResize(buf, block_size);
-      chckBufferSeek(buf, 0, SEEK_SET);
+      if (!(array = mmd_writable(mmd, mmd->weights, mmd->num_vertices, sizeof(mmd_weight))) && mmd->weights)
+         return RETURN_FAIL;
+      mmd->weights = array;
+   }
 
-      if (chckBufferFillFromFile(mmd->f, 1, block_size, buf) != block_size)
-         goto fail;
+   if (sections & (1 << MMD_SECTION_INDEX)) {
+      if (!(array = mmd_writable(mmd, mmd->indices, mmd->num_indices, sizeof(unsigned short))) && mmd->indices)
+         return RETURN_FAIL;
+      mmd->indices = array;
 
-      /* uint16_t: child bone index */
-      if (chckBufferRead(mmd->ik[i].child_bone_index, sizeof(uint16_t), mmd->ik[i].chain_length, buf) != mmd->ik[i].chain_length)
-         goto fail;
+      if (!(array = mmd_writable(mmd, mmd->indices32, mmd->num_indices, sizeof(unsigned int))) && mmd->indices32)
+         return RETURN_FAIL;
+      mmd->indices32 = array;
+   }
 
-      if (!chckBufferIsNativeEndian(buf))
-         chckBufferSwap(mmd->ik[i].child_bone_index, sizeof(uint16_t), mmd->ik[i].chain_length);
+   for (i = 0; (sections & (1 << MMD_SECTION_SKIN)) && mmd->skin && i < mmd->num_skins; ++i) {
+      if (!(array = mmd_writable(mmd, mmd->skin[i].vertices, mmd->skin[i].num_vertices, sizeof(mmd_skin_vertex))) && mmd->skin[i].vertices)
+         return RETURN_FAIL;
+      mmd->skin[i].vertices = array;
    }
 
-   chckBufferFree(buf);
    return RETURN_OK;
+}
 
-fail:
-   if (buf) chckBufferFree(buf);
-   return RETURN_FAIL;
+/* \brief get UTF8 string of handle */
+const char* mmd_get_string(mmd_data *mmd, mmd_string string)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   assert(mmd);
+
+   return (priv->pool ? mmd_string_pool_get(priv->pool, string) : NULL);
 }
 
-/* \brief read skin data */
-int mmd_read_skin_data(mmd_data *mmd)
+/* \brief why last load failed */
+const mmd_error* mmd_get_error(const mmd_data *mmd)
 {
-   unsigned int i, i2;
-   size_t block_size;
-   unsigned char charbuf[20];
-   chckBuffer *buf;
    assert(mmd);
+   return &((const mmd_private*)mmd)->error;
+}
 
-   if (!(buf = chckBufferNew(sizeof(uint16_t), CHCK_BUFFER_ENDIAN_LITTLE)))
-      goto fail;
+/* \brief measure following loads, calling hooks of trace */
+int mmd_enable_stats(mmd_data *mmd, const mmd_trace *trace)
+{
+   mmd_private *priv = (mmd_private*)mmd;
+   assert(mmd);
 
-   if (chckBufferFillFromFile(mmd->f, sizeof(uint16_t), 1, buf) != 1)
-      goto fail;
+   if (!priv->stats && !(priv->stats = mmd_alloc_zero(mmd, MMD_SECTION_LAST * sizeof(mmd_section_stats))))
+      return RETURN_FAIL;
 
-   /* uint16_t: skin count */
-   if (!chckBufferReadUInt16(buf, &mmd->num_skins))
-      goto fail;
+   memset(priv->stats, 0, MMD_SECTION_LAST * sizeof(mmd_section_stats));
 
-   /* skins */
-   if (!(mmd->skin = calloc(mmd->num_skins, sizeof(mmd_skin))))
-      goto fail;
+   if (trace) {
+      priv->trace = *trace;
+   } else {
+      memset(&priv->trace, 0, sizeof(mmd_trace));
+   }
 
-   for(i = 0; i < mmd->num_skins; ++i) {
-      /* resize our buffer to fit all the data */
-      block_size = 20 + sizeof(uint32_t) + 1;
-      chckBufferResize(buf, block_size);
-      chckBufferSeek(buf, 0, SEEK_SET);
+   return RETURN_OK;
+}
 
-      if (chckBufferFillFromFile(mmd->f, 1, block_size, buf) != block_size)
-         goto fail;
+/* \brief stats of every section, NULL when not measuring */
+const mmd_section_stats* mmd_get_stats(const mmd_data *mmd)
+{
+   assert(mmd);
+   return ((const mmd_private*)mmd)->stats;
+}
 
-      /* SJIS STRING: skin name (20 bytes) */
-      if (chckBufferRead(charbuf, 1, 20, buf) != 20)
-         goto fail;
+/* \brief add array of section to usage, heap gets bytes outside arena */
+static void mmd_usage_add(const mmd_private *priv, mmd_memory *out, size_t *heap, unsigned int section, const void *ptr, size_t bytes)
+{
+   if (!ptr)
+      return;
 
-      if (!(mmd->skin[i].name = chckSJISToUTF8(charbuf, 20, NULL, 1)))
-         goto fail;
+   if (mmd_is_view(priv, ptr)) {
+      out->views += bytes;
+      return;
+   }
 
-      /* uint32_t: vertex count */
-      if (!chckBufferReadUInt32(buf, &mmd->skin[i].num_vertices))
-         goto fail;
+   if (mmd_is_shared(priv, ptr)) {
+      out->shared += bytes;
+      return;
+   }
 
-      /* uint8_t: skin type */
-      if (!chckBufferReadUInt8(buf, &mmd->skin[i].type))
-         goto fail;
+   out->sections[section] += bytes;
 
-      /* skin data */
-      if (!(mmd->skin[i].vertices = calloc(mmd->skin[i].num_vertices, sizeof(mmd_skin_vertex))))
-         goto fail;
+   if (!mmd_in_arena(priv, ptr))
+      *heap += bytes;
+}
 
-      /* resize our buffer to fit all the data */
-      block_size = mmd->skin[i].num_vertices * (sizeof(uint32_t) * 4);
-      chckBufferResize(buf, block_size);
-      chckBufferSeek(buf, 0, SEEK_SET);
+/* \brief add name of section to usage */
+static void mmd_usage_name(const mmd_private *priv, mmd_memory *out, size_t *heap, unsigned int section, const char *name)
+{
+   if (name)
+      mmd_usage_add(priv, out, heap, section, name, strlen(name) + 1);
+}
 
-      if (chckBufferFillFromFile(mmd->f, 1, block_size, buf) != block_size)
-         goto fail;
+/* \brief memory held by mmd_data per section */
+void mmd_memory_usage(const mmd_data *mmd, mmd_memory *out)
+{
+   const mmd_private *priv = (const mmd_private*)mmd;
+   size_t heap = 0;
+   unsigned int i;
+   assert(mmd && out);
+
+   memset(out, 0, sizeof(mmd_memory));
 
-      for(i2 = 0; i2 < mmd->skin[i].num_vertices; ++i2) {
-         /* uint32_t: vertex index */
-         if (!chckBufferReadUInt32(buf, &mmd->skin[i].vertices[i2].index))
-            goto fail;
+   /* header */
+   mmd_usage_name(priv, out, &heap, MMD_SECTION_HEADER, mmd->header.name);
+   mmd_usage_name(priv, out, &heap, MMD_SECTION_HEADER, mmd->header.comment);
 
-         /* 3xFLOAT: translation */
-         if (chckBufferRead(mmd->skin[i].vertices[i2].translation, sizeof(uint32_t), 3, buf) != 3)
-            goto fail;
+   /* vertices, normals, coords and weights */
+   mmd_usage_add(priv, out, &heap, MMD_SECTION_VERTEX, mmd->vertices, (size_t)mmd->num_vertices * 3 * sizeof(float));
+   mmd_usage_add(priv, out, &heap, MMD_SECTION_VERTEX, mmd->normals, (size_t)mmd->num_vertices * 3 * sizeof(float));
+   mmd_usage_add(priv, out, &heap, MMD_SECTION_VERTEX, mmd->coords, (size_t)mmd->num_vertices * 2 * sizeof(float));
+   mmd_usage_add(priv, out, &heap, MMD_SECTION_VERTEX, mmd->weights, (size_t)mmd->num_vertices * sizeof(mmd_weight));
 
-         if (!chckBufferIsNativeEndian(buf))
-            chckBufferSwap(mmd->skin[i].vertices[i2].translation, sizeof(uint32_t), 3);
-      }
+   /* indices */
+   mmd_usage_add(priv, out, &heap, MMD_SECTION_INDEX, mmd->indices, (size_t)mmd->num_indices * sizeof(unsigned short));
+   mmd_usage_add(priv, out, &heap, MMD_SECTION_INDEX, mmd->indices32, (size_t)mmd->num_indices * sizeof(unsigned int));
+
+   /* materials and their textures */
+   mmd_usage_add(priv, out, &heap, MMD_SECTION_MATERIAL, mmd->materials, (size_t)mmd->num_materials * sizeof(mmd_material));
+   for (i = 0; mmd->materials && i < mmd->num_materials; ++i)
+      mmd_usage_name(priv, out, &heap, MMD_SECTION_MATERIAL, mmd->materials[i].texture);
+
+   /* bones and their names */
+   mmd_usage_add(priv, out, &heap, MMD_SECTION_BONE, mmd->bones, (size_t)mmd->num_bones * sizeof(mmd_bone));
+   for (i = 0; mmd->bones && i < mmd->num_bones; ++i)
+      mmd_usage_name(priv, out, &heap, MMD_SECTION_BONE, mmd->bones[i].name);
+
+   /* IKs and their chains */
+   mmd_usage_add(priv, out, &heap, MMD_SECTION_IK, mmd->ik, (size_t)mmd->num_ik * sizeof(mmd_ik));
+   for (i = 0; mmd->ik && i < mmd->num_ik; ++i)
+      mmd_usage_add(priv, out, &heap, MMD_SECTION_IK, mmd->ik[i].child_bone_index, (size_t)mmd->ik[i].chain_length * sizeof(unsigned short));
+
+   /* skins, their names and vertices */
+   mmd_usage_add(priv, out, &heap, MMD_SECTION_SKIN, mmd->skin, (size_t)mmd->num_skins * sizeof(mmd_skin));
+   for (i = 0; mmd->skin && i < mmd->num_skins; ++i) {
+      mmd_usage_name(priv, out, &heap, MMD_SECTION_SKIN, mmd->skin[i].name);
+      mmd_usage_add(priv, out, &heap, MMD_SECTION_SKIN, mmd->skin[i].vertices, (size_t)mmd->skin[i].num_vertices * sizeof(mmd_skin_vertex));
    }
 
-   chckBufferFree(buf);
-   return RETURN_OK;
+   /* skin displays */
+   mmd_usage_add(priv, out, &heap, MMD_SECTION_SKIN_DISPLAY, mmd->skin_display, (size_t)mmd->num_skin_displays * sizeof(unsigned int));
 
-fail:
-   if (buf) chckBufferFree(buf);
-   return RETURN_FAIL;
+   /* bone names */
+   mmd_usage_add(priv, out, &heap, MMD_SECTION_BONE_NAME, mmd->bone_name, (size_t)mmd->num_bone_names * sizeof(mmd_bone_name));
+   for (i = 0; mmd->bone_name && i < mmd->num_bone_names; ++i)
+      mmd_usage_name(priv, out, &heap, MMD_SECTION_BONE_NAME, mmd->bone_name[i].name);
+
+   out->arena = priv->arena_size;
+   out->arena_used = priv->arena_used;
+   out->other = sizeof(mmd_private) + priv->buf_size + (priv->stats ? MMD_SECTION_LAST * sizeof(mmd_section_stats) : 0);
+   out->total = out->other + out->arena + heap;
 }
 
-/* \brief read skin display data */
-int mmd_read_skin_display_data(mmd_data *mmd)
+/* \brief allocate new mmd_data structure with memory from allocator */
+mmd_data* mmd_new_with_allocator(FILE *f, const mmd_allocator *allocator, const mmd_allocator *scratch)
 {
-   size_t block_size;
-   chckBuffer *buf;
-   assert(mmd);
-
-   if (!(buf = chckBufferNew(sizeof(uint8_t), CHCK_BUFFER_ENDIAN_LITTLE)))
-      goto fail;
-
-   if (chckBufferFillFromFile(mmd->f, sizeof(uint8_t), 1, buf) != 1)
-      goto fail;
+   mmd_private *priv;
+   char float_is_not_size_of_uint32[sizeof(uint32_t)-sizeof(float)];
+   (void)float_is_not_size_of_uint32;
 
-   /* uint8_t: skin display count */
-   if (!chckBufferReadUInt8(buf, &mmd->num_skin_displays))
-      goto fail;
+   if (!allocator) allocator = &mmd_malloc_allocator;
+   if (!scratch) scratch = allocator;
+   assert(allocator->alloc && allocator->realloc && allocator->free && scratch->alloc);
 
-   /* skin displays */
-   if (!(mmd->skin_display = calloc(mmd->num_skin_displays, sizeof(unsigned int))))
-      goto fail;
+   if (!(priv = allocator->alloc(allocator->user, sizeof(mmd_private))))
+      return NULL;
 
-   /* resize our buffer to fit all the data */
-   block_size = mmd->num_skin_displays * sizeof(uint32_t);
-   chckBufferResize(buf, block_size);
-   chckBufferSeek(buf, 0, SEEK_SET);
+   memset(priv, 0, sizeof(mmd_private));
+   priv->allocator = *allocator;
+   priv->scratch = *scratch;
+   priv->sections = MMD_SECTION_MASK_ALL;
+   priv->data.f = f;
+   mmd_clear_error(priv);
+   return &priv->data;
+}
 
-   if (chckBufferFillFromFile(mmd->f, 1, block_size, buf) != block_size)
-      goto fail;
+/* \brief allocate new mmd_data structure */
+mmd_data* mmd_new(FILE *f)
+{
+   return mmd_new_with_allocator(f, NULL, NULL);
+}
 
-   /* uint32_t: indices */
-   if (chckBufferRead(mmd->skin_display, sizeof(uint32_t), mmd->num_skin_displays, buf) != mmd->num_skin_displays)
-      goto fail;
+/* \brief allocate new mmd_data structure reading from memory, with memory from allocator */
+mmd_data* mmd_new_from_memory_with_allocator(const void *data, size_t size, const mmd_allocator *allocator, const mmd_allocator *scratch)
+{
+   mmd_private *priv;
+   assert(data || !size);
 
-   if (!chckBufferIsNativeEndian(buf))
-      chckBufferSwap(mmd->skin_display, sizeof(uint32_t), mmd->num_skin_displays);
+   if (!(priv = (mmd_private*)mmd_new_with_allocator(NULL, allocator, scratch)))
+      return NULL;
 
-   chckBufferFree(buf);
-   return RETURN_OK;
+   priv->memory = data;
+   priv->size = size;
+   priv->views = 1;
+   return &priv->data;
+}
 
-fail:
-   if (buf) chckBufferFree(buf);
-   return RETURN_FAIL;
+/* \brief allocate new mmd_data structure reading from memory */
+mmd_data* mmd_new_from_memory(const void *data, size_t size)
+{
+   return mmd_new_from_memory_with_allocator(data, size, NULL, NULL);
 }
 
-/* \brief read bone name data */
-int mmd_read_bone_name_data(mmd_data *mmd)
+/* \brief map file, copy on write when writable */
+void* mmd_map_file(const char *path, int writable, size_t *out_size)
 {
-   unsigned int i;
-   size_t block_size;
-   unsigned char charbuf[50];
-   chckBuffer *buf;
-   assert(mmd);
+   void *map = NULL;
+   size_t size = 0;
+   assert(path && out_size);
 
-   if (!(buf = chckBufferNew(sizeof(uint8_t), CHCK_BUFFER_ENDIAN_LITTLE)))
-      goto fail;
+   *out_size = 0;
 
-   if (chckBufferFillFromFile(mmd->f, sizeof(uint8_t), 1, buf) != 1)
-      goto fail;
+#if defined(_WIN32)
+   {
+      HANDLE file, mapping;
+      LARGE_INTEGER file_size;
 
-   /* uint8_t: bone name count */
-   if (!chckBufferReadUInt8(buf, &mmd->num_bone_names))
-      goto fail;
+      if ((file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE)
+         return NULL;
 
-   /* bone names */
-   if (!(mmd->bone_name = calloc(mmd->num_bone_names, sizeof(mmd_bone_name))))
-      goto fail;
+      if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart <= 0 || (unsigned long long)file_size.QuadPart > (size_t)~0) {
+         CloseHandle(file);
+         return NULL;
+      }
 
-   /* resize our buffer to fit all the data */
-   block_size = mmd->num_bone_names * 50;
-   chckBufferResize(buf, block_size);
-   chckBufferSeek(buf, 0, SEEK_SET);
+      size = (size_t)file_size.QuadPart;
+      mapping = CreateFileMappingA(file, NULL, (writable ? PAGE_WRITECOPY : PAGE_READONLY), 0, 0, NULL);
+      CloseHandle(file);
 
-   if (chckBufferFillFromFile(mmd->f, 1, block_size, buf) != block_size)
-      goto fail;
+      if (!mapping)
+         return NULL;
 
-   for(i = 0; i < mmd->num_bone_names; ++i) {
-      /* SJIS STRING: bone name (50 bytes) */
-      if (chckBufferRead(charbuf, 1, 50, buf) != 50)
-         goto fail;
+      map = MapViewOfFile(mapping, (writable ? FILE_MAP_COPY : FILE_MAP_READ), 0, 0, 0);
+      CloseHandle(mapping);
 
-      if (!(mmd->bone_name[i].name = chckSJISToUTF8(charbuf, 50, NULL, 1)))
-         goto fail;
+      if (!map)
+         return NULL;
    }
+#elif defined(MMD_HAS_MMAP)
+   {
+      int fd;
+      struct stat st;
 
-   chckBufferFree(buf);
-   return RETURN_OK;
+      if ((fd = open(path, O_RDONLY)) < 0)
+         return NULL;
 
-fail:
-   if (buf) chckBufferFree(buf);
-   return RETURN_FAIL;
+      if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+         close(fd);
+         return NULL;
+      }
+
+      size = (size_t)st.st_size;
+      map = mmap(NULL, size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_PRIVATE, fd, 0);
+      close(fd);
+
+      if (map == MAP_FAILED)
+         return NULL;
+   }
+#else
+   (void)path;
+   (void)writable;
+   return NULL;
+#endif
+
+   *out_size = size;
+   return map;
 }
 
-/* \brief allocate new mmd_data structure */
-mmd_data* mmd_new(FILE *f)
+/* \brief release mapping of mmd_map_file */
+void mmd_unmap_file(void *map, size_t size)
+{
+   if (!map)
+      return;
+
+#if defined(_WIN32)
+   (void)size;
+   UnmapViewOfFile(map);
+#elif defined(MMD_HAS_MMAP)
+   munmap(map, size);
+#else
+   (void)size;
+#endif
+}
+
+/* \brief allocate new mmd_data structure reading from mapping it owns */
+mmd_data* mmd_new_from_map(void *map, size_t size)
 {
    mmd_data *mmd;
-   char float_is_not_size_of_uint32[sizeof(uint32_t)-sizeof(float)];
-   (void)float_is_not_size_of_uint32;
+   assert(map);
+
+   if (!(mmd = mmd_new_from_memory(map, size)))
+      return NULL;
 
-   if (!(mmd = calloc(1, sizeof(mmd_data))))
+   ((mmd_private*)mmd)->map = map;
+   ((mmd_private*)mmd)->map_size = size;
+   return mmd;
+}
+
+/* \brief allocate new mmd_data structure reading from memory mapped file */
+mmd_data* mmd_new_from_path_mmap(const char *path)
+{
+   mmd_data *mmd;
+   void *map;
+   size_t size;
+   assert(path);
+
+   /* copy on write, views of it are handed out as writable arrays */
+   if (!(map = mmd_map_file(path, 1, &size)))
       return NULL;
 
-   mmd->f = f;
+   if (!(mmd = mmd_new_from_map(map, size)))
+      mmd_unmap_file(map, size);
+
    return mmd;
 }
 
 /* \brief free mmd_data structure */
 void mmd_free(mmd_data *mmd)
 {
+   mmd_private *priv = (mmd_private*)mmd;
+   mmd_allocator allocator;
    unsigned int i;
    assert(mmd);
 
+   /* everything lives in the arena, skip the walk */
+   if (priv->arena && !priv->spilled)
+      goto arena;
+
    /* header */
-   if (mmd->header.name) free((char*)mmd->header.name);
-   if (mmd->header.comment) free((char*)mmd->header.comment);
+   mmd_release(priv, mmd->header.name);
+   mmd_release(priv, mmd->header.comment);
 
    /* vertices */
-   if (mmd->vertices) free(mmd->vertices);
-   if (mmd->normals) free(mmd->normals);
-   if (mmd->coords) free(mmd->coords);
+   mmd_release(priv, mmd->vertices);
+   mmd_release(priv, mmd->normals);
+   mmd_release(priv, mmd->coords);
 
    /* indices */
-   if (mmd->indices) free(mmd->indices);
+   mmd_release(priv, mmd->indices);
+   mmd_release(priv, mmd->indices32);
 
    /* bone indices */
-   if (mmd->weights) free(mmd->weights);
+   mmd_release(priv, mmd->weights);
 
    /* bones array */
    if (mmd->bones) {
       for (i = 0; i < mmd->num_bones; ++i)
-         if (mmd->bones[i].name) free((char*)mmd->bones[i].name);
-      free(mmd->bones);
+         mmd_release(priv, mmd->bones[i].name);
+      mmd_release(priv, mmd->bones);
+   }
+
+   if (mmd->bone_name) {
+      for (i = 0; i < mmd->num_bone_names; ++i)
+         mmd_release(priv, mmd->bone_name[i].name);
+      mmd_release(priv, mmd->bone_name);
    }
-   if (mmd->bone_name) free(mmd->bone_name);
 
    if (mmd->ik) {
       for(i = 0; i < mmd->num_ik; ++i)
-         if (mmd->ik[i].child_bone_index)
-            free(mmd->ik[i].child_bone_index);
-      free(mmd->ik);
+         mmd_release(priv, mmd->ik[i].child_bone_index);
+      mmd_release(priv, mmd->ik);
    }
 
    /* skin */
    if (mmd->skin) {
       for (i = 0; i < mmd->num_skins; ++i) {
-         if (mmd->skin[i].name) free((char*)mmd->skin[i].name);
-         if (mmd->skin[i].vertices) free(mmd->skin[i].vertices);
+         mmd_release(priv, mmd->skin[i].name);
+         mmd_release(priv, mmd->skin[i].vertices);
       }
-      free(mmd->skin);
+      mmd_release(priv, mmd->skin);
    }
-   if (mmd->skin_display) free(mmd->skin_display);
+   mmd_release(priv, mmd->skin_display);
 
    /* materials */
    if (mmd->materials) {
       for (i = 0; i < mmd->num_materials; ++i)
-         if (mmd->materials[i].texture) free((char*)mmd->materials[i].texture);
-      free(mmd->materials);
+         mmd_release(priv, mmd->materials[i].texture);
+      mmd_release(priv, mmd->materials);
    }
 
+arena:
+   if (priv->arena) mmd_dealloc(mmd, priv->arena);
+
+   /* string pool */
+   if (priv->pool) mmd_string_pool_free(priv->pool);
+
+   /* shared arrays, never in arena */
+   for (i = 0; i < priv->num_shared; ++i)
+      mmd_blob_store_release(priv->blobs, priv->shared[i]);
+   if (priv->shared) mmd_dealloc(mmd, priv->shared);
+   if (priv->blobs) mmd_blob_store_free(priv->blobs);
+
+   /* staging buffer */
+   if (priv->buf) mmd_dealloc(mmd, priv->buf);
+
+   /* stats */
+   if (priv->stats) mmd_dealloc(mmd, priv->stats);
+
+   /* memory mapping */
+   if (priv->map) mmd_unmap_file(priv->map, priv->map_size);
+
    /* finally free the struct itself */
-   free(mmd);
+   allocator = priv->allocator;
+   allocator.free(allocator.user, priv);
 }
 
 /* vim: set ts=8 sw=3 tw=0 :*/
@@ -9,21 +9,73 @@
 extern "C" {
 #endif
 
+/* handle to string in mmd_string_pool, 0 is no string */
+typedef unsigned int mmd_string;
+
+/* pool of interned names, see mmd_set_string_pool */
+typedef struct mmd_string_pool mmd_string_pool;
+
+/* store of arrays shared by models, see mmd_set_blob_store */
+typedef struct mmd_blob_store mmd_blob_store;
+
+/* incremental PMD decoder, see mmd_parser_feed */
+typedef struct mmd_parser mmd_parser;
+
+/* task run by mmd_executor */
+typedef void (*mmd_task_fn)(void *arg);
+
+/* thread pool supplied by the user, see mmd_load_parallel */
+typedef struct mmd_executor {
+   /* call fn(args[i]) for every i < count, in any order and
+    * on any threads, return when all of them have returned */
+   void (*run)(void *user, mmd_task_fn fn, void **args, unsigned int count);
+   void *user;
+} mmd_executor;
+
+/* memory for mmd_data, see mmd_new_with_allocator.
+ * alloc returns size bytes aligned as malloc, or NULL,
+ * realloc resizes ptr, NULL ptr allocates, and free
+ * releases memory of either of them */
+typedef struct mmd_allocator {
+   void* (*alloc)(void *user, size_t size);
+   void* (*realloc)(void *user, void *ptr, size_t size);
+   void (*free)(void *user, void *ptr);
+   void *user;
+} mmd_allocator;
+
 typedef struct mmd_header {
    const char *name;
    const char *comment;
    float version;
+
+   /* names in string pool */
+   mmd_string name_id;
+   mmd_string comment_id;
 } mmd_header;
 
 typedef struct mmd_weight {
-   unsigned int vertex_index;
+   /* bones deforming the vertex */
+   unsigned short bone_index[2];
+
+   /* influence of first bone in percent (0-100),
+    * second bone gets the rest */
    unsigned char weight;
    unsigned char edge_flag;
 } mmd_weight;
 
+/* axis aligned box and sphere around points,
+ * empty bounds have min above max and negative radius */
+typedef struct mmd_bounds {
+   float min[3];
+   float max[3];
+   float center[3];
+   float radius;
+} mmd_bounds;
+
 typedef struct mmd_bone {
    /* bone name */
    const char *name;
+   mmd_string name_id;
 
    /* type */
    unsigned char type;
@@ -35,6 +87,9 @@ typedef struct mmd_bone {
 
    /* head position */
    float head_pos[3];
+
+   /* rest positions of vertices this bone moves */
+   mmd_bounds bounds;
 } mmd_bone;
 
 typedef struct mmd_ik {
@@ -56,8 +111,19 @@ typedef struct mmd_ik {
 typedef struct mmd_bone_name {
    /* bone name */
    const char *name;
+   mmd_string name_id;
 } mmd_bone_name;
 
+/* skin types, vertices of base skin index mesh vertices,
+ * vertices of the other skins index base skin vertices */
+enum {
+   MMD_SKIN_BASE,
+   MMD_SKIN_EYEBROW,
+   MMD_SKIN_EYE,
+   MMD_SKIN_LIP,
+   MMD_SKIN_OTHER
+};
+
 typedef struct mmd_skin_vertex {
    /* index */
    unsigned int index;
@@ -69,6 +135,7 @@ typedef struct mmd_skin_vertex {
 typedef struct mmd_skin {
    /* skin name */
    const char *name;
+   mmd_string name_id;
 
    /* vertices on this skin */
    unsigned int num_vertices;
@@ -95,6 +162,10 @@ typedef struct mmd_material {
 
    /* file path */
    char *texture;
+   mmd_string texture_id;
+
+   /* vertices of faces of this material */
+   mmd_bounds bounds;
 } mmd_material;
 
 typedef struct mmd_data {
@@ -114,6 +185,11 @@ typedef struct mmd_data {
    unsigned char num_skin_displays;
    unsigned char num_bone_names;
 
+   /* vertex, index and skin vertex arrays may be shared with
+    * other models (mmd_set_blob_store) or point into read-only
+    * input (mmd_new_from_memory), treat them as const until
+    * mmd_detach gives private copies */
+
    /* vertex */
    float *vertices;
    float *normals;
@@ -122,6 +198,10 @@ typedef struct mmd_data {
    /* index */
    unsigned short *indices;
 
+   /* PMX models that index past 65535 vertices get
+    * 32-bit indices here instead, indices is NULL then */
+   unsigned int *indices32;
+
    /* weights */
    mmd_weight *weights;
 
@@ -136,16 +216,789 @@ typedef struct mmd_data {
 
    /* material */
    mmd_material *materials;
+
+   /* every vertex, computed while decoding vertices */
+   mmd_bounds bounds;
 } mmd_data;
 
+/* bezier curves of bone keyframe */
+enum {
+   MMD_BEZIER_X,
+   MMD_BEZIER_Y,
+   MMD_BEZIER_Z,
+   MMD_BEZIER_ROTATION,
+   MMD_BEZIER_BONE_CURVES
+};
+
+/* bezier curves of camera keyframe */
+enum {
+   MMD_BEZIER_CAMERA_X,
+   MMD_BEZIER_CAMERA_Y,
+   MMD_BEZIER_CAMERA_Z,
+   MMD_BEZIER_CAMERA_ROTATION,
+   MMD_BEZIER_CAMERA_DISTANCE,
+   MMD_BEZIER_CAMERA_FOV,
+   MMD_BEZIER_CAMERA_CURVES
+};
+
+/* bezier curve is stored as x1, y1, x2, y2 control points in 0-127 range,
+ * the curve goes from (0, 0) to (127, 127) */
+#define MMD_BEZIER_SIZE 4
+
+/* keyframes of single bone, sorted by frame */
+typedef struct mmd_bone_track {
+   /* bone name */
+   const char *name;
+
+   /* index to mmd_data bones, -1 when not bound, see mmd_motion_bind */
+   int bone_index;
+
+   /* keyframes */
+   unsigned int num_keys;
+   unsigned int *frames;
+
+   /* 3 floats per key */
+   float *positions;
+
+   /* quaternion, x y z w per key */
+   float *rotations;
+
+   /* MMD_BEZIER_BONE_CURVES * MMD_BEZIER_SIZE per key */
+   unsigned char *bezier;
+} mmd_bone_track;
+
+/* keyframes of single morph, sorted by frame */
+typedef struct mmd_morph_track {
+   /* skin name */
+   const char *name;
+
+   /* index to mmd_data skin, -1 when not bound, see mmd_motion_bind */
+   int skin_index;
+
+   /* keyframes */
+   unsigned int num_keys;
+   unsigned int *frames;
+   float *weights;
+} mmd_morph_track;
+
+/* camera keyframes, sorted by frame */
+typedef struct mmd_camera_track {
+   unsigned int num_keys;
+   unsigned int *frames;
+   float *distances;
+
+   /* 3 floats per key */
+   float *positions;
+   float *rotations;
+
+   /* view angle in degrees */
+   unsigned int *fovs;
+   unsigned char *perspectives;
+
+   /* MMD_BEZIER_CAMERA_CURVES * MMD_BEZIER_SIZE per key */
+   unsigned char *bezier;
+} mmd_camera_track;
+
+typedef struct mmd_motion {
+   /* name of model the motion was made for */
+   const char *name;
+
+   /* last keyframe */
+   unsigned int num_frames;
+
+   /* tracks */
+   unsigned int num_bone_tracks;
+   unsigned int num_morph_tracks;
+   mmd_bone_track *bone_tracks;
+   mmd_morph_track *morph_tracks;
+   mmd_camera_track camera;
+} mmd_motion;
+
+/* sampled state of bones and skins, see mmd_sampler_sample */
+typedef struct mmd_pose {
+   unsigned int num_bones;
+   unsigned int num_skins;
+
+   /* 3 floats per bone, local translation */
+   float *translations;
+
+   /* quaternion, x y z w per bone */
+   float *rotations;
+
+   /* weight per skin */
+   float *weights;
+} mmd_pose;
+
+/* samples motion tracks to pose, see mmd_sampler_new */
+typedef struct mmd_sampler mmd_sampler;
+
+/* applies skin weights to vertices, see mmd_morpher_new */
+typedef struct mmd_morpher mmd_morpher;
+
+/* solves ik chains of poses, see mmd_ik_solver_new */
+typedef struct mmd_ik_solver mmd_ik_solver;
+
+/* bone hierarchy in evaluation order, see mmd_skeleton_new */
+typedef struct mmd_skeleton mmd_skeleton;
+
+/* vertex attributes, see mmd_vertex_layout */
+enum {
+   /* 3 components */
+   MMD_ATTRIB_POSITION,
+   MMD_ATTRIB_NORMAL,
+
+   /* 2 components */
+   MMD_ATTRIB_COORD,
+
+   /* 2 components, indices of the two bones */
+   MMD_ATTRIB_BONES,
+
+   /* 2 components, weights of the two bones in 0-1 */
+   MMD_ATTRIB_WEIGHTS,
+
+   /* 1 component, edge flag of PMD vertex */
+   MMD_ATTRIB_EDGE,
+
+   MMD_ATTRIB_LAST
+};
+
+/* formats of attribute components.
+ * normalized formats clamp to their range (-1-1 or 0-1),
+ * integer formats round and clamp */
+enum {
+   MMD_FORMAT_FLOAT32,
+   MMD_FORMAT_FLOAT16,
+   MMD_FORMAT_SNORM16,
+   MMD_FORMAT_UNORM16,
+   MMD_FORMAT_UINT16,
+   MMD_FORMAT_SNORM8,
+   MMD_FORMAT_UNORM8,
+   MMD_FORMAT_UINT8,
+   MMD_FORMAT_LAST
+};
+
+typedef struct mmd_vertex_attrib {
+   /* MMD_ATTRIB_* and MMD_FORMAT_* */
+   unsigned int attrib;
+   unsigned int format;
+
+   /* byte offset inside vertex */
+   unsigned int offset;
+} mmd_vertex_attrib;
+
+/* interleaved vertex, see mmd_export_vertices */
+typedef struct mmd_vertex_layout {
+   /* bytes from vertex to next */
+   unsigned int stride;
+
+   /* attributes written, in any order */
+   unsigned int num_attribs;
+   mmd_vertex_attrib attribs[MMD_ATTRIB_LAST];
+} mmd_vertex_layout;
+
+/* indices of single material */
+typedef struct mmd_index_range {
+   unsigned int first;
+   unsigned int count;
+} mmd_index_range;
+
+/* result of mmd_optimize_vertex_cache */
+typedef struct mmd_optimize_stats {
+   /* simulated FIFO cache size */
+   unsigned int cache_size;
+
+   /* average cache misses per triangle */
+   float acmr_before;
+   float acmr_after;
+} mmd_optimize_stats;
+
+/* flags for mmd_lod_chain_new */
+enum {
+   /* keep vertices moved by skins */
+   MMD_LOD_LOCK_MORPHS = 1 << 0
+};
+
+/* single level of detail, indexes vertices of source mmd */
+typedef struct mmd_lod {
+   unsigned short *indices;
+   unsigned int num_indices;
+
+   /* indices of every material, in material order */
+   mmd_index_range *ranges;
+
+   /* largest quadric error of collapse taken,
+    * area weighted squared distance in model units */
+   float error;
+} mmd_lod;
+
+/* levels from mmd_lod_chain_new */
+typedef struct mmd_lod_chain {
+   unsigned int num_levels;
+   unsigned int num_materials;
+   mmd_lod *levels;
+} mmd_lod_chain;
+
+/* sections of PMD file, in file order */
+enum {
+   MMD_SECTION_HEADER,
+   MMD_SECTION_VERTEX,
+   MMD_SECTION_INDEX,
+   MMD_SECTION_MATERIAL,
+   MMD_SECTION_BONE,
+   MMD_SECTION_IK,
+   MMD_SECTION_SKIN,
+   MMD_SECTION_SKIN_DISPLAY,
+   MMD_SECTION_BONE_NAME,
+   MMD_SECTION_LAST
+};
+
+/* mask of (1 << MMD_SECTION_*) with every section, see mmd_set_sections */
+enum {
+   MMD_SECTION_MASK_ALL = (1 << MMD_SECTION_LAST) - 1
+};
+
+/* results of mmd_parser_feed */
+enum {
+   MMD_PARSER_ERROR = -1,
+   MMD_PARSER_NEED_MORE = 0,
+   MMD_PARSER_SECTION_READY = 1,
+   MMD_PARSER_DONE = 2
+};
+
+/* flags for mmd_load */
+enum {
+   /* allocate everything from single arena, see mmd_use_arena */
+   MMD_LOAD_ARENA = 1 << 0
+};
+
+/* reasons of failed load, see mmd_get_error */
+enum {
+   MMD_ERROR_NONE,
+
+   /* FILE could not be read */
+   MMD_ERROR_IO,
+
+   /* not PMD or PMX, or a count or field out of range */
+   MMD_ERROR_FORMAT,
+
+   /* section runs past end of input */
+   MMD_ERROR_TRUNCATED,
+
+   /* allocation or name conversion failed */
+   MMD_ERROR_MEMORY
+};
+
+/* first error of the last load */
+typedef struct mmd_error {
+   /* MMD_ERROR_* */
+   int code;
+
+   /* MMD_SECTION_* read, MMD_SECTION_LAST outside of sections */
+   unsigned int section;
+
+   /* bytes from start of input, for FILE input from position
+    * loading started at. for truncated input where the failed
+    * read starts, otherwise where the section starts */
+   size_t offset;
+} mmd_error;
+
+/* measurements of one section, summed over loads */
+typedef struct mmd_section_stats {
+   /* wall time spent in section */
+   double seconds;
+
+   /* input bytes of section */
+   size_t bytes;
+
+   /* allocations made for section and their bytes,
+    * both arena and heap. strings interned to
+    * string pool are not allocations of mmd */
+   unsigned int allocations;
+   size_t allocated;
+} mmd_section_stats;
+
+/* callbacks around every section read, to forward them
+ * to profiler as spans. with mmd_load_parallel they are
+ * called on the threads decoding the sections */
+typedef struct mmd_trace {
+   /* section starts, may be NULL */
+   void (*begin)(void *user, mmd_data *mmd, unsigned int section);
+
+   /* section ended with ret, stats are of this read alone */
+   void (*end)(void *user, mmd_data *mmd, unsigned int section, const mmd_section_stats *stats, int ret);
+
+   void *user;
+} mmd_trace;
+
+/* heap memory held by mmd_data, see mmd_memory_usage */
+typedef struct mmd_memory {
+   /* arrays and names of every section owned by mmd_data,
+    * in arena or heap */
+   size_t sections[MMD_SECTION_LAST];
+
+   /* arrays referencing input memory instead of copies */
+   size_t views;
+
+   /* arrays referencing blob store, owned by the store */
+   size_t shared;
+
+   /* arena size and bytes of it in use */
+   size_t arena, arena_used;
+
+   /* state of mmd_data itself and FILE staging buffer */
+   size_t other;
+
+   /* everything held, arena counted by its size */
+   size_t total;
+} mmd_memory;
+
 /* allocate new mmd_data structure
  * which holds all vertices,
  * indices, materials and etc. */
 mmd_data* mmd_new(FILE *f);
 
+/* allocate new mmd_data structure
+ * which reads from PMD file in memory.
+ * the memory must stay valid until mmd_free,
+ * on little endian hosts fixed layout arrays
+ * (indices) point directly into the memory
+ * when they are suitably aligned.
+ * such arrays are read-only, as the memory is,
+ * despite their non-const type. */
+mmd_data* mmd_new_from_memory(const void *data, size_t size);
+
+/* mmd_new and mmd_new_from_memory with mmd_data, its
+ * arrays, names and buffers allocated from allocator.
+ * temporary buffers of loading, such as FILE contents
+ * and PMX decode tables, come from scratch instead and
+ * are freed before the load returns. scratch without
+ * free is expected to release them itself at once, as
+ * frame or bump allocator does, and only needs alloc.
+ * NULL allocator is malloc, NULL scratch is allocator.
+ * the structs are copied, their user must stay valid
+ * until mmd_free. calls for one mmd_data do not overlap,
+ * also when mmd_load_parallel decodes on many threads. */
+mmd_data* mmd_new_with_allocator(FILE *f, const mmd_allocator *allocator, const mmd_allocator *scratch);
+mmd_data* mmd_new_from_memory_with_allocator(const void *data, size_t size, const mmd_allocator *allocator, const mmd_allocator *scratch);
+
+/* allocate new mmd_data structure
+ * which reads from memory mapped PMD file.
+ * the mapping is copy on write, so arrays
+ * pointing into it may be written without
+ * touching the file.
+ * the mapping is released by mmd_free. */
+mmd_data* mmd_new_from_path_mmap(const char *path);
+
+/* hash of PMD file contents, identifies source of cache */
+unsigned long long mmd_cache_hash(const void *data, size_t size);
+
+/* write fully read mmd to cache file at path.
+ * source_hash is mmd_cache_hash of the PMD it was read from.
+ * names interned to string pool are stored as UTF8 strings.
+ * the file is written next to path and renamed over it. */
+int mmd_cache_write(mmd_data *mmd, const char *path, unsigned long long source_hash);
+
+/* allocate new mmd_data structure from cache file.
+ * the file is memory mapped copy on write and only pointers
+ * are fixed up, arrays are used in place until mmd_free.
+ * returns NULL when the cache is missing, damaged, made by
+ * other version or host, or from other source than source_hash.
+ * names are UTF8 strings, string pool is not used. */
+mmd_data* mmd_new_from_cache(const char *path, unsigned long long source_hash);
+
+/* allocate new mmd_data structure for PMD file at path
+ * through cache at cache_path. when the cache is stale
+ * the PMD is read with mmd_load and flags, and the cache
+ * is written again. */
+mmd_data* mmd_new_from_path_cached(const char *path, const char *cache_path, unsigned int flags);
+
+/* pre-size single allocation for all the data.
+ * walks the counts in the file, rejects counts that
+ * do not fit the file and lays out every array and
+ * string inside one allocation, mmd_free is then O(1).
+ * call before mmd_read_header. */
+int mmd_use_arena(mmd_data *mmd);
+
 /* frees the MMD structure */
 void mmd_free(mmd_data *mmd);
 
+/* read the whole MMD file in one pass.
+ * FILE input is read with a single read,
+ * memory input is decoded in place.
+ * replaces calling mmd_read_* functions below.
+ *
+ * PMX 2.0 and 2.1 files are read as well, into the same fields:
+ * - UTF16 and UTF8 names are converted or interned as UTF8.
+ * - BDEF4 and QDEF weights keep their two largest bones,
+ *   SDEF weights are read as BDEF2.
+ * - IK bones become ik entries, link angle limits are dropped.
+ * - vertex morphs become skins indexing mesh vertices, without
+ *   base skin, group morphs become the sum of their vertex morphs.
+ *   other morph types have no counterpart and are skipped.
+ * - morphs of display frames become skin_display and names of
+ *   the other frames become bone_name.
+ * - rigid bodies and joints are not read, as with PMD. */
+int mmd_load(mmd_data *mmd, unsigned int flags);
+
+/* read the whole MMD file in two phases.
+ * first the counts are walked to find every section,
+ * then sections are decoded concurrently on executor,
+ * or on internal threads when executor is NULL.
+ * the result is identical to mmd_load.
+ * PMX files are decoded in order on the calling thread. */
+int mmd_load_parallel(mmd_data *mmd, unsigned int flags, const mmd_executor *executor);
+
+/* decode only sections in mask of (1 << MMD_SECTION_*) on
+ * following mmd_load and mmd_load_parallel calls. the other
+ * sections are stepped over from their counts: their counts
+ * are set, but nothing is decoded, allocated or converted
+ * and their arrays and names stay NULL, so such partial
+ * model is not for functions that need whole model, such
+ * as mmd_cache_write.
+ * header magic and version are read even when header is
+ * skipped, and bounds need vertices, and indices for the
+ * bounds of materials.
+ * mmd_load seeks over skipped PMD sections of FILE input
+ * instead of reading the whole file. PMX files are walked
+ * whole as their records vary in length, and there bones
+ * come with IK, and skin displays with bone names, as they
+ * share records. mmd_read_* functions read their section
+ * regardless. MMD_SECTION_MASK_ALL is the default. */
+void mmd_set_sections(mmd_data *mmd, unsigned int sections);
+
+/* why the last load or mmd_read_* call failed.
+ * code is MMD_ERROR_NONE after success */
+const mmd_error* mmd_get_error(const mmd_data *mmd);
+
+/* collect mmd_section_stats of following loads and
+ * mmd_read_* calls, and call hooks of trace when it
+ * is not NULL. stats start from zero every call.
+ * without it the loaders skip all measuring.
+ * PMX header stats include walking the whole file,
+ * IK is measured with bones and bone names with
+ * skin displays, as they share records there. */
+int mmd_enable_stats(mmd_data *mmd, const mmd_trace *trace);
+
+/* MMD_SECTION_LAST stats, NULL unless mmd_enable_stats was called */
+const mmd_section_stats* mmd_get_stats(const mmd_data *mmd);
+
+/* memory held by mmd_data per section.
+ * names interned to string pool belong to the pool */
+void mmd_memory_usage(const mmd_data *mmd, mmd_memory *out);
+
+/* create pool for names.
+ * the pool keeps raw SJIS bytes, stores identical
+ * strings once and converts them to UTF8 on first access.
+ * one pool can be shared by any number of mmd_data,
+ * and used from any number of threads. */
+mmd_string_pool* mmd_string_pool_new(void);
+
+/* add reference to string pool */
+mmd_string_pool* mmd_string_pool_ref(mmd_string_pool *pool);
+
+/* drop reference to string pool, frees it with the last one */
+void mmd_string_pool_free(mmd_string_pool *pool);
+
+/* intern SJIS string of fixed width field */
+mmd_string mmd_string_pool_intern(mmd_string_pool *pool, const unsigned char *sjis, size_t size);
+
+/* UTF8 encoded string, NULL for invalid handle */
+const char* mmd_string_pool_get(mmd_string_pool *pool, mmd_string string);
+
+/* number of unique strings in pool */
+unsigned int mmd_string_pool_count(const mmd_string_pool *pool);
+
+/* intern names to pool instead of converting them.
+ * name, comment and texture fields are then left NULL
+ * and their *_id handles are set instead.
+ * call before reading, mmd_data keeps a reference. */
+void mmd_set_string_pool(mmd_data *mmd, mmd_string_pool *pool);
+
+/* UTF8 encoded string of handle in mmd_data's pool */
+const char* mmd_get_string(mmd_data *mmd, mmd_string string);
+
+/* create store for vertex, index and skin arrays.
+ * models loaded with identical arrays share one
+ * immutable copy of them, kept until the last
+ * model using it is freed.
+ * one store can be shared by any number of mmd_data,
+ * and used from any number of threads. */
+mmd_blob_store* mmd_blob_store_new(void);
+
+/* add reference to blob store */
+mmd_blob_store* mmd_blob_store_ref(mmd_blob_store *store);
+
+/* drop reference to blob store, frees it with the last one */
+void mmd_blob_store_free(mmd_blob_store *store);
+
+/* number of distinct arrays in store */
+unsigned int mmd_blob_store_count(const mmd_blob_store *store);
+
+/* bytes of arrays in store */
+size_t mmd_blob_store_size(const mmd_blob_store *store);
+
+/* share vertices, normals, coords, weights, indices and
+ * skin vertices of successful mmd_load and mmd_load_parallel
+ * through store, their copies are freed then.
+ * arrays in arena or viewing input memory are left alone,
+ * so loads with MMD_LOAD_ARENA share nothing.
+ * shared arrays must not be written, call mmd_detach before
+ * changing them in place. mmd_optimize_* do that themselves.
+ * call before reading, mmd_data keeps a reference. */
+void mmd_set_blob_store(mmd_data *mmd, mmd_blob_store *store);
+
+/* give private copies of arrays shared through blob store
+ * or pointing into input memory, so they can be written.
+ * sections is mask of (1 << MMD_SECTION_*), of which vertex,
+ * index and skin have such arrays. other models sharing
+ * the arrays keep the originals.
+ * returns 0 on success, -1 when out of memory, arrays
+ * copied before the failure stay copied. */
+int mmd_detach(mmd_data *mmd, unsigned int sections);
+
+/* model of mmd_load_batch, read from path or
+ * from data and size when path is NULL */
+typedef struct mmd_batch_item {
+   const char *path;
+   const void *data;
+   size_t size;
+
+   /* set by mmd_load_batch, mmd is owned by the caller */
+   mmd_data *mmd;
+   int status;
+} mmd_batch_item;
+
+/* called for every item as soon as it is done,
+ * in order of completion and never concurrently */
+typedef void (*mmd_batch_fn)(void *user, unsigned int index, mmd_batch_item *item);
+
+/* load count models concurrently, each with mmd_load and flags.
+ * paths are memory mapped, data must stay valid until mmd_free.
+ * every model interns its names to pool, or to pool created
+ * for the batch when NULL, so identical texture paths across
+ * the batch are stored once and share their texture_id.
+ * status of item is 0 when it loaded, -1 otherwise.
+ * models are loaded on executor, or on internal threads
+ * when executor is NULL. returns 0 when every model loaded. */
+int mmd_load_batch(mmd_batch_item *items, unsigned int count, unsigned int flags, mmd_string_pool *pool,
+                   mmd_batch_fn callback, void *user, const mmd_executor *executor);
+
+/* create push parser decoding into mmd.
+ * mmd is usually created with mmd_new(NULL),
+ * set string pool on it before feeding.
+ * mmd is not owned by the parser.
+ * arrays of a section are allocated whole once its count
+ * arrives, before the records, so counts are checked
+ * against limit of the stream size, 256 MiB by default,
+ * see mmd_parser_set_limit. */
+mmd_parser* mmd_parser_new(mmd_data *mmd);
+
+/* set most bytes the PMD stream may have, 0 for no limit.
+ * a section or skin whose count of records can't fit
+ * in the rest of the limit fails the feed with
+ * MMD_ERROR_FORMAT, see mmd_get_error. allocations
+ * stay within a small multiple of the limit. */
+void mmd_parser_set_limit(mmd_parser *parser, size_t bytes);
+
+/* free push parser, decoded data stays in mmd */
+void mmd_parser_free(mmd_parser *parser);
+
+/* feed next chunk of PMD file, of any size.
+ * the whole chunk is consumed, so it can be released
+ * right after the call, partial records are kept
+ * in small fixed size buffer inside the parser.
+ * returns MMD_PARSER_SECTION_READY when sections were
+ * completed by this chunk, see mmd_parser_ready_sections,
+ * MMD_PARSER_DONE once the last section is decoded and
+ * MMD_PARSER_ERROR on invalid data or allocation failure. */
+int mmd_parser_feed(mmd_parser *parser, const void *bytes, size_t len);
+
+/* mask of (1 << MMD_SECTION_*) completed by last mmd_parser_feed,
+ * arrays of completed sections can be used right away */
+unsigned int mmd_parser_ready_sections(const mmd_parser *parser);
+
+/* MMD_SECTION_* being decoded, MMD_SECTION_LAST when done */
+unsigned int mmd_parser_section(const mmd_parser *parser);
+
+/* allocate new mmd_motion structure
+ * which reads VMD file from FILE */
+mmd_motion* mmd_motion_new(FILE *f);
+
+/* allocate new mmd_motion structure
+ * which reads VMD file in memory,
+ * the memory is only used by mmd_motion_load */
+mmd_motion* mmd_motion_new_from_memory(const void *data, size_t size);
+
+/* read bone, morph and camera keyframes.
+ * keyframes are grouped to tracks by name
+ * and every track is sorted by frame. */
+int mmd_motion_load(mmd_motion *motion);
+
+/* bind tracks to bones and skins of mmd by name,
+ * tracks without match get -1 index */
+int mmd_motion_bind(mmd_motion *motion, mmd_data *mmd);
+
+/* free mmd_motion structure */
+void mmd_motion_free(mmd_motion *motion);
+
+/* allocate pose sized for bones and skins of mmd */
+mmd_pose* mmd_pose_new(const mmd_data *mmd);
+
+/* reset pose to rest: no translation,
+ * identity rotation and zero weights */
+void mmd_pose_reset(mmd_pose *pose);
+
+/* free pose */
+void mmd_pose_free(mmd_pose *pose);
+
+/* create sampler for tracks of motion,
+ * call mmd_motion_bind first, unbound tracks are skipped.
+ * sampler keeps cursor per track, so playback that moves
+ * forward costs O(1) per track, seeking falls back to
+ * binary search. motion must outlive the sampler. */
+mmd_sampler* mmd_sampler_new(const mmd_motion *motion);
+
+/* sample every track at frame to pose.
+ * bones and skins without track are left at rest. */
+void mmd_sampler_sample(mmd_sampler *sampler, float frame, mmd_pose *pose);
+
+/* free sampler */
+void mmd_sampler_free(mmd_sampler *sampler);
+
+/* create morpher for skins of mmd.
+ * skin vertex indices are resolved to mesh vertices through
+ * the base skin and sorted once here, mmd can be freed after. */
+mmd_morpher* mmd_morpher_new(const mmd_data *mmd);
+
+/* apply skin weights (num_skins floats, as in mmd_pose) to vertices.
+ * vertices start at rest (copy of mmd vertices, or mmd vertices itself
+ * after mmd_detach of MMD_SECTION_VERTEX)
+ * and keep the result of previous call: only skins whose weight
+ * changed are applied, by the difference of weights.
+ * returns number of skins applied. */
+unsigned int mmd_morpher_apply(mmd_morpher *morpher, const float *weights, float *vertices);
+
+/* range of vertices changed by last mmd_morpher_apply,
+ * count is 0 when nothing changed */
+void mmd_morpher_dirty(const mmd_morpher *morpher, unsigned int *first, unsigned int *count);
+
+/* forget applied weights, call when vertices are reset to rest */
+void mmd_morpher_reset(mmd_morpher *morpher);
+
+/* free morpher */
+void mmd_morpher_free(mmd_morpher *morpher);
+
+/* create CCD IK solver for ik chains of mmd.
+ * chains are solved for up to batch poses at once,
+ * poses of many characters sharing the model should
+ * be passed in single mmd_ik_solve call. */
+mmd_ik_solver* mmd_ik_solver_new(mmd_data *mmd, unsigned int batch);
+
+/* solve ik chains of every pose in order of mmd ik,
+ * rotations of chain bones are replaced with the solution.
+ * per iteration, each link rotates at most cotrol_weight * pi,
+ * knees (bones named ひざ) only bend around x from -180 to -0.5 degrees. */
+void mmd_ik_solve(mmd_ik_solver *solver, mmd_pose **poses, unsigned int count);
+
+/* free solver */
+void mmd_ik_solver_free(mmd_ik_solver *solver);
+
+/* create skeleton for bones of mmd, once after loading.
+ * bones are sorted parents first (bones in parent cycles become roots)
+ * and rest offsets from parent heads are computed here,
+ * mmd can be freed after. */
+mmd_skeleton* mmd_skeleton_new(const mmd_data *mmd);
+
+/* compute world transforms of every bone of pose.
+ * local translation is rest offset + pose translation,
+ * local rotation is pose rotation, world = parent * local. */
+void mmd_skeleton_update(mmd_skeleton *skeleton, const mmd_pose *pose);
+
+/* write skinning matrices of last update for mmd_deform,
+ * num_bones column major 4x4 matrices in bone order */
+void mmd_skeleton_palette(const mmd_skeleton *skeleton, float *palette);
+
+/* world position (3 floats) and rotation (x y z w) of bone
+ * after last update, either can be NULL */
+void mmd_skeleton_world(const mmd_skeleton *skeleton, unsigned int bone, float *position, float *rotation);
+
+/* num_bones bone indices, parents before children */
+const unsigned short* mmd_skeleton_order(const mmd_skeleton *skeleton);
+
+/* free skeleton */
+void mmd_skeleton_free(mmd_skeleton *skeleton);
+
+/* deform vertices first to first + count of mmd on cpu.
+ * palette holds num_bones column major 4x4 bone matrices,
+ * each vertex is moved by blend of its two bones (mmd_weight).
+ * out_vertices and out_normals are sized for all vertices (3 floats each)
+ * and only the range is written, so ranges can run on different threads.
+ * normals are rotated by the blended matrix, but not renormalized. */
+int mmd_deform_range(const mmd_data *mmd, const float *palette, unsigned int first, unsigned int count, float *out_vertices, float *out_normals);
+
+/* deform all vertices of mmd, see mmd_deform_range.
+ * vertices are split to ranges run by executor,
+ * or by internal pool when executor is NULL. */
+int mmd_deform(const mmd_data *mmd, const float *palette, float *out_vertices, float *out_normals, const mmd_executor *executor);
+
+/* size of single component in MMD_FORMAT_*, 0 for unknown format */
+unsigned int mmd_format_size(unsigned int format);
+
+/* bytes of MMD_ATTRIB_* in MMD_FORMAT_* */
+unsigned int mmd_vertex_attrib_size(unsigned int attrib, unsigned int format);
+
+/* set offsets of layout attributes in their order,
+ * each aligned to 4 bytes, and the stride.
+ * returns the stride */
+unsigned int mmd_vertex_layout_pack(mmd_vertex_layout *layout);
+
+/* write vertices first to first + count of mmd as interleaved
+ * layout to out, which is sized for all vertices (stride each).
+ * only the attribute bytes of the range are written,
+ * so ranges can run on different threads. */
+int mmd_export_vertices(const mmd_data *mmd, const mmd_vertex_layout *layout, unsigned int first, unsigned int count, void *out);
+
+/* index range of every material (num_materials ranges),
+ * materials take face indices from mmd indices in order.
+ * fails when face counts do not fit the indices,
+ * ranges are clamped to them then. */
+int mmd_export_ranges(const mmd_data *mmd, mmd_index_range *ranges);
+
+/* reorder triangles inside every material for post transform
+ * vertex cache of cache_size entries (0 for default of 16),
+ * then renumber vertices in order of first use. vertices,
+ * normals, coords, weights and skin vertex indices are remapped
+ * with them, remap (num_vertices, may be NULL) gets new index
+ * of every old vertex. stats (may be NULL) gets ACMR before and after.
+ * call after loading and before creating objects from mmd,
+ * fails without changes when indices reference missing vertices,
+ * or when mmd has 32-bit indices. */
+int mmd_optimize_vertex_cache(mmd_data *mmd, unsigned int cache_size, unsigned int *remap, mmd_optimize_stats *stats);
+
+/* simplify every material of mmd to num_levels levels,
+ * level l keeps about ratios[l] (0 - 1) of triangles of material.
+ * every level continues from the previous one, so ratios should
+ * decrease. vertices on uv seams, shared by materials, on open
+ * edges, or with MMD_LOD_LOCK_MORPHS in any skin never move, and
+ * vertices only collapse onto vertices with same edge_flag, so
+ * levels may keep more triangles than asked.
+ * materials are simplified by executor,
+ * or by internal pool when executor is NULL.
+ * returns NULL for mmd with 32-bit indices. */
+mmd_lod_chain* mmd_lod_chain_new(const mmd_data *mmd, const float *ratios, unsigned int num_levels, unsigned int flags, const mmd_executor *executor);
+
+/* free chain from mmd_lod_chain_new */
+void mmd_lod_chain_free(mmd_lod_chain *chain);
+
+/* recompute bounds of mmd, its materials and bones.
+ * loading sets them, call after changing vertices,
+ * which must be detached first (see mmd_detach) */
+void mmd_update_bounds(mmd_data *mmd);
+
+/* bounds containing mmd skinned by palette (see mmd_deform),
+ * from bone bounds alone. vertices moved by skins are not covered */
+void mmd_skinned_bounds(const mmd_data *mmd, const float *palette, mmd_bounds *out);
+
 /* 1 - read header from MMD file */
 int mmd_read_header(mmd_data *mmd);
 
@@ -185,24 +1038,20 @@ int mmd_read_bone_name_data(mmd_data *mmd);
  * if (!(mmd = mmd_new(f)))
  *    exit(EXIT_FAILURE);
  *
- * if (mmd_read_header(mmd) != 0)
+ * // reads everything, or call mmd_read_* functions
+ * // in order to read only the sections you need.
+ * // MMD_LOAD_ARENA keeps it all in one allocation,
+ * // models sharing arrays through mmd_set_blob_store
+ * // are loaded without it
+ * if (mmd_load(mmd, MMD_LOAD_ARENA) != 0)
  *    exit(EXIT_FAILURE);
  *
+ * fclose(f);
+ *
  * // UTF8 encoded
  * if (mmd->header.name) puts(mmd->header.name);
  * if (mmd->header.comment) puts(mmd->header.comment);
  *
- * if (mmd_read_vertex_data(mmd) != 0)
- *    exit(EXIT_FAILURE);
- *
- * if (mmd_read_index_data(mmd) != 0)
- *    exit(EXIT_FAILURE);
- *
- * if (mmd_read_material_data(mmd) != 0)
- *    exit(EXIT_FAILURE);
- *
- * fclose(f);
- *
  * // there are many ways you could handle storing or rendering MMD object
  * // which has many materials and only one set of texture coordinates.
  * //
@@ -220,7 +1069,9 @@ int mmd_read_bone_name_data(mmd_data *mmd);
  * // I'm not gonna make example out of that.
  * // Option 1 approach below :
  *
- * // Pack single big VBO here
+ * // Pack single big VBO here, or let mmd_export_vertices
+ * // write it in your layout and mmd_export_ranges give
+ * // index range of every material
  * for(i = 0; i != mmd->num_vertices; ++i) {
  *    // handle vertices,
  *    // coords and normals here
@@ -0,0 +1,248 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <assert.h> /* for assert */
+
+#if defined(MMD_HAS_SSE2)
+#  include <emmintrin.h>
+#endif
+
+#if defined(MMD_HAS_NEON)
+#  include <arm_neon.h>
+#endif
+
+/* skin deltas are stored as 4 floats (x, y, z, 0),
+ * so SIMD kernels add them with single 4 float load and store.
+ * the extra lane adds 0 to x of the following vertex. */
+enum {
+   MMD_MORPH_DELTA = 4
+};
+
+/* \brief deltas of single skin */
+typedef struct mmd_morph {
+   /* first delta and number of them */
+   size_t offset;
+   unsigned int count;
+
+   /* lowest and highest vertex moved */
+   unsigned int first, last;
+} mmd_morph;
+
+struct mmd_morpher {
+   mmd_morph *morphs;
+   unsigned int num_morphs, num_vertices;
+
+   /* mesh vertex and delta of every skin vertex, sorted by vertex per skin */
+   unsigned int *indices;
+   float *deltas;
+
+   /* weight last applied per skin */
+   float *applied;
+
+   /* vertices changed by last apply */
+   unsigned int dirty_first, dirty_last;
+   int dirty;
+};
+
+/* \brief qsort comparator for skin vertices */
+static int mmd_skin_vertex_cmp(const void *a, const void *b)
+{
+   const unsigned int ia = ((const mmd_skin_vertex*)a)->index, ib = ((const mmd_skin_vertex*)b)->index;
+   return (ia > ib) - (ia < ib);
+}
+
+/* \brief add amount of count deltas to vertices, scalar */
+static void mmd_morph_add_scalar(const unsigned int *indices, const float *deltas, size_t count, float amount, float *vertices)
+{
+   size_t i;
+
+   for (i = 0; i < count; ++i, deltas += MMD_MORPH_DELTA) {
+      vertices[indices[i] * 3 + 0] += deltas[0] * amount;
+      vertices[indices[i] * 3 + 1] += deltas[1] * amount;
+      vertices[indices[i] * 3 + 2] += deltas[2] * amount;
+   }
+}
+
+/* \brief add amount of count deltas to vertices,
+ * with 4 float stores where the vertex is not the last one */
+static void mmd_morph_add(const unsigned int *indices, const float *deltas, size_t count, float amount, float *vertices, unsigned int num_vertices)
+{
+   size_t i = 0;
+
+#if defined(MMD_HAS_SSE2)
+   const __m128 a = _mm_set1_ps(amount);
+   float *v;
+
+   /* indices are sorted, so only the tail can hit the last vertex */
+   for (; i < count && indices[i] + 1 < num_vertices; ++i, deltas += MMD_MORPH_DELTA) {
+      v = &vertices[indices[i] * 3];
+      _mm_storeu_ps(v, _mm_add_ps(_mm_loadu_ps(v), _mm_mul_ps(_mm_loadu_ps(deltas), a)));
+   }
+#elif defined(MMD_HAS_NEON)
+   float *v;
+
+   for (; i < count && indices[i] + 1 < num_vertices; ++i, deltas += MMD_MORPH_DELTA) {
+      v = &vertices[indices[i] * 3];
+      vst1q_f32(v, vmlaq_n_f32(vld1q_f32(v), vld1q_f32(deltas), amount));
+   }
+#else
+   (void)num_vertices;
+#endif
+
+   mmd_morph_add_scalar(&indices[i], deltas, count - i, amount, vertices);
+}
+
+/* \brief create morpher for skins of mmd */
+mmd_morpher* mmd_morpher_new(const mmd_data *mmd)
+{
+   mmd_morpher *morpher;
+   const mmd_skin *base = NULL, *skin;
+   mmd_skin_vertex *sorted = NULL;
+   mmd_morph *morph;
+   unsigned int s, i, index, max_vertices = 0;
+   size_t total = 0;
+   assert(mmd);
+
+   for (s = 0; s < mmd->num_skins; ++s) {
+      if (!base && mmd->skin[s].type == MMD_SKIN_BASE) {
+         base = &mmd->skin[s];
+         continue;
+      }
+
+      total += mmd->skin[s].num_vertices;
+      max_vertices = (mmd->skin[s].num_vertices > max_vertices ? mmd->skin[s].num_vertices : max_vertices);
+   }
+
+   if (!(morpher = calloc(1, sizeof(mmd_morpher))))
+      return NULL;
+
+   morpher->num_morphs = mmd->num_skins;
+   morpher->num_vertices = mmd->num_vertices;
+
+   if (!(morpher->morphs = calloc(mmd->num_skins + 1, sizeof(mmd_morph))) ||
+       !(morpher->applied = calloc(mmd->num_skins + 1, sizeof(float))) ||
+       !(morpher->indices = calloc(total + 1, sizeof(unsigned int))) ||
+       !(morpher->deltas = calloc((total + 1) * MMD_MORPH_DELTA, sizeof(float))) ||
+       !(sorted = calloc(max_vertices + 1, sizeof(mmd_skin_vertex))))
+      goto fail;
+
+   for (s = 0, total = 0; s < mmd->num_skins; ++s) {
+      skin = &mmd->skin[s];
+      morph = &morpher->morphs[s];
+      morph->offset = total;
+
+      if (skin == base)
+         continue;
+
+      /* resolve to mesh vertices, dropping indices out of range */
+      for (i = 0, morph->count = 0; i < skin->num_vertices; ++i) {
+         index = skin->vertices[i].index;
+
+         if (base) {
+            if (index >= base->num_vertices)
+               continue;
+
+            index = base->vertices[index].index;
+         }
+
+         if (index >= mmd->num_vertices)
+            continue;
+
+         sorted[morph->count] = skin->vertices[i];
+         sorted[morph->count++].index = index;
+      }
+
+      qsort(sorted, morph->count, sizeof(mmd_skin_vertex), mmd_skin_vertex_cmp);
+
+      /* merge deltas of same vertex */
+      for (i = 0; i < morph->count; ++i) {
+         if (total > morph->offset && morpher->indices[total - 1] == sorted[i].index) {
+            morpher->deltas[(total - 1) * MMD_MORPH_DELTA + 0] += sorted[i].translation[0];
+            morpher->deltas[(total - 1) * MMD_MORPH_DELTA + 1] += sorted[i].translation[1];
+            morpher->deltas[(total - 1) * MMD_MORPH_DELTA + 2] += sorted[i].translation[2];
+            continue;
+         }
+
+         morpher->indices[total] = sorted[i].index;
+         memcpy(&morpher->deltas[total * MMD_MORPH_DELTA], sorted[i].translation, sizeof(float) * 3);
+         total++;
+      }
+
+      morph->count = (unsigned int)(total - morph->offset);
+      if (morph->count) {
+         morph->first = morpher->indices[morph->offset];
+         morph->last = morpher->indices[total - 1];
+      }
+   }
+
+   free(sorted);
+   return morpher;
+
+fail:
+   if (sorted) free(sorted);
+   mmd_morpher_free(morpher);
+   return NULL;
+}
+
+/* \brief apply changed skin weights to vertices */
+unsigned int mmd_morpher_apply(mmd_morpher *morpher, const float *weights, float *vertices)
+{
+   const mmd_morph *morph;
+   unsigned int s, applied = 0;
+   float amount;
+   assert(morpher && weights && vertices);
+
+   morpher->dirty = 0;
+
+   for (s = 0; s < morpher->num_morphs; ++s) {
+      morph = &morpher->morphs[s];
+      amount = weights[s] - morpher->applied[s];
+
+      if (amount == 0.0f || !morph->count)
+         continue;
+
+      mmd_morph_add(&morpher->indices[morph->offset], &morpher->deltas[morph->offset * MMD_MORPH_DELTA],
+                    morph->count, amount, vertices, morpher->num_vertices);
+      morpher->applied[s] = weights[s];
+
+      if (!morpher->dirty || morph->first < morpher->dirty_first)
+         morpher->dirty_first = morph->first;
+
+      if (!morpher->dirty || morph->last > morpher->dirty_last)
+         morpher->dirty_last = morph->last;
+
+      morpher->dirty = 1;
+      applied++;
+   }
+
+   return applied;
+}
+
+/* \brief range of vertices changed by last apply */
+void mmd_morpher_dirty(const mmd_morpher *morpher, unsigned int *first, unsigned int *count)
+{
+   assert(morpher && first && count);
+   *first = (morpher->dirty ? morpher->dirty_first : 0);
+   *count = (morpher->dirty ? morpher->dirty_last - morpher->dirty_first + 1 : 0);
+}
+
+/* \brief forget applied weights */
+void mmd_morpher_reset(mmd_morpher *morpher)
+{
+   assert(morpher);
+   memset(morpher->applied, 0, morpher->num_morphs * sizeof(float));
+   morpher->dirty = 0;
+}
+
+/* \brief free morpher */
+void mmd_morpher_free(mmd_morpher *morpher)
+{
+   assert(morpher);
+
+   if (morpher->morphs) free(morpher->morphs);
+   if (morpher->applied) free(morpher->applied);
+   if (morpher->indices) free(morpher->indices);
+   if (morpher->deltas) free(morpher->deltas);
+   free(morpher);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
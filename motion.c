@@ -0,0 +1,660 @@
+#include "internal.h"
+#include "sjis.h"
+#include <stdio.h>  /* for FILE* */
+#include <stdlib.h>
+#include <string.h> /* for memcmp, memcpy, memmove */
+#include <assert.h> /* for assert */
+
+/* sizes of VMD records in file */
+enum {
+   MMD_VMD_MAGIC_SIZE = 30,
+   MMD_VMD_TRACK_NAME_SIZE = 15,
+   MMD_VMD_BONE_SIZE = 15 + sizeof(uint32_t) * 8 + 64,
+   MMD_VMD_MORPH_SIZE = 15 + sizeof(uint32_t) * 2,
+   MMD_VMD_CAMERA_SIZE = sizeof(uint32_t) * 9 + 24 + 1
+};
+
+enum {
+   /* FILE input is read in blocks of this size */
+   MMD_VMD_BLOCK_SIZE = 64 * 1024
+};
+
+/* \brief key position while sorting */
+typedef struct mmd_motion_order {
+   unsigned int frame, index;
+} mmd_motion_order;
+
+/* \brief private state behind mmd_motion */
+typedef struct mmd_motion_private {
+   /* public data, must be first */
+   mmd_motion motion;
+
+   /* FILE source and its block buffer */
+   FILE *f;
+   unsigned char *block;
+   size_t block_used, block_offset;
+
+   /* memory source */
+   const unsigned char *memory;
+
+   /* input size, (size_t)~0 when not known, and bytes consumed */
+   size_t size, offset;
+
+   /* track names, handle - 1 is the track index */
+   mmd_string_pool *bone_names, *morph_names;
+
+   /* every key of every track, tracks point inside */
+   mmd_bone_track bone_keys;
+   mmd_morph_track morph_keys;
+} mmd_motion_private;
+
+/* \brief get pointer to next size bytes of input and advance */
+static const unsigned char* mmd_motion_fetch(mmd_motion_private *priv, size_t size)
+{
+   const unsigned char *data;
+   size_t remain;
+
+   if (size > priv->size - priv->offset)
+      return NULL;
+
+   if (priv->memory) {
+      data = priv->memory + priv->offset;
+      priv->offset += size;
+      return data;
+   }
+
+   assert(size <= MMD_VMD_BLOCK_SIZE);
+
+   /* keep the partial record, refill rest of the block */
+   if (size > priv->block_used - priv->block_offset) {
+      remain = priv->block_used - priv->block_offset;
+      memmove(priv->block, priv->block + priv->block_offset, remain);
+      priv->block_used = remain + fread(priv->block + remain, 1, MMD_VMD_BLOCK_SIZE - remain, priv->f);
+      priv->block_offset = 0;
+
+      if (size > priv->block_used)
+         return NULL;
+   }
+
+   data = priv->block + priv->block_offset;
+   priv->block_offset += size;
+   priv->offset += size;
+   return data;
+}
+
+/* \brief read uint32_t count of records, fails if they do not fit the input
+ * missing trailing sections are read as empty */
+static int mmd_motion_count(mmd_motion_private *priv, size_t record_size, unsigned int *out_count)
+{
+   const unsigned char *data;
+
+   *out_count = 0;
+
+   if (!(data = mmd_motion_fetch(priv, sizeof(uint32_t))))
+      return RETURN_OK;
+
+   *out_count = mmd_u32(data);
+
+   if (*out_count > (priv->size - priv->offset) / record_size)
+      return RETURN_FAIL;
+
+   return RETURN_OK;
+}
+
+/* \brief frame first, file order second */
+static int mmd_motion_order_cmp(const void *a, const void *b)
+{
+   const mmd_motion_order *oa = a, *ob = b;
+
+   if (oa->frame != ob->frame)
+      return (oa->frame < ob->frame ? -1 : 1);
+
+   return (oa->index < ob->index ? -1 : (oa->index > ob->index));
+}
+
+/* \brief order keys by track, then by frame
+ * first receives num_tracks + 1 offsets to the order */
+static mmd_motion_order* mmd_motion_order_keys(const unsigned int *tracks, const unsigned int *frames, unsigned int count, unsigned int num_tracks, unsigned int *first)
+{
+   mmd_motion_order *order;
+   unsigned int i, t, sorted;
+
+   if (!(order = malloc((count ? count : 1) * sizeof(mmd_motion_order))))
+      return NULL;
+
+   memset(first, 0, (num_tracks + 1) * sizeof(unsigned int));
+
+   /* counting sort by track keeps file order */
+   for (i = 0; i < count; ++i)
+      first[(tracks ? tracks[i] : 0) + 1]++;
+
+   for (t = 0; t < num_tracks; ++t)
+      first[t + 1] += first[t];
+
+   for (i = 0; i < count; ++i) {
+      t = (tracks ? tracks[i] : 0);
+      order[first[t]].frame = frames[i];
+      order[first[t]++].index = i;
+   }
+
+   for (t = num_tracks; t > 0; --t)
+      first[t] = first[t - 1];
+   first[0] = 0;
+
+   /* keys are usually already in order */
+   for (t = 0; t < num_tracks; ++t) {
+      for (sorted = 1, i = first[t] + 1; i < first[t + 1] && sorted; ++i)
+         sorted = (order[i - 1].frame <= order[i].frame);
+
+      if (!sorted)
+         qsort(order + first[t], first[t + 1] - first[t], sizeof(mmd_motion_order), mmd_motion_order_cmp);
+   }
+
+   return order;
+}
+
+/* \brief allocate keys of bone track in one block */
+static int mmd_bone_keys_alloc(mmd_bone_track *keys, unsigned int count)
+{
+   const size_t key_size = sizeof(unsigned int) + sizeof(float) * 7 + MMD_BEZIER_BONE_CURVES * MMD_BEZIER_SIZE;
+   unsigned char *block;
+
+   if (!(block = calloc((count ? count : 1), key_size)))
+      return RETURN_FAIL;
+
+   keys->num_keys = count;
+   keys->frames = (unsigned int*)block;
+   keys->positions = (float*)(keys->frames + count);
+   keys->rotations = keys->positions + count * 3;
+   keys->bezier = (unsigned char*)(keys->rotations + count * 4);
+   return RETURN_OK;
+}
+
+/* \brief allocate keys of morph track in one block */
+static int mmd_morph_keys_alloc(mmd_morph_track *keys, unsigned int count)
+{
+   unsigned char *block;
+
+   if (!(block = calloc((count ? count : 1), sizeof(unsigned int) + sizeof(float))))
+      return RETURN_FAIL;
+
+   keys->num_keys = count;
+   keys->frames = (unsigned int*)block;
+   keys->weights = (float*)(keys->frames + count);
+   return RETURN_OK;
+}
+
+/* \brief allocate keys of camera track in one block */
+static int mmd_camera_keys_alloc(mmd_camera_track *keys, unsigned int count)
+{
+   const size_t key_size = sizeof(unsigned int) * 2 + sizeof(float) * 7 + 1 + MMD_BEZIER_CAMERA_CURVES * MMD_BEZIER_SIZE;
+   unsigned char *block;
+
+   if (!(block = calloc((count ? count : 1), key_size)))
+      return RETURN_FAIL;
+
+   keys->num_keys = count;
+   keys->frames = (unsigned int*)block;
+   keys->fovs = keys->frames + count;
+   keys->distances = (float*)(keys->fovs + count);
+   keys->positions = keys->distances + count;
+   keys->rotations = keys->positions + count * 3;
+   keys->bezier = (unsigned char*)(keys->rotations + count * 3);
+   keys->perspectives = keys->bezier + count * MMD_BEZIER_CAMERA_CURVES * MMD_BEZIER_SIZE;
+   return RETURN_OK;
+}
+
+/* \brief track index of raw VMD name */
+static int mmd_motion_track(mmd_string_pool *names, const unsigned char *data, unsigned int *out_track)
+{
+   mmd_string string;
+
+   if (!(string = mmd_string_pool_intern(names, data, MMD_VMD_TRACK_NAME_SIZE)))
+      return RETURN_FAIL;
+
+   *out_track = string - 1;
+   return RETURN_OK;
+}
+
+/* \brief extend length of motion to frame */
+static void mmd_motion_frames(mmd_motion *motion, const unsigned int *frames, unsigned int count)
+{
+   unsigned int i;
+
+   for (i = 0; i < count; ++i)
+      if (frames[i] > motion->num_frames)
+         motion->num_frames = frames[i];
+}
+
+/* \brief read VMD header */
+static int mmd_motion_read_header(mmd_motion_private *priv)
+{
+   const unsigned char *data;
+   size_t name_size;
+
+   if (!(data = mmd_motion_fetch(priv, MMD_VMD_MAGIC_SIZE)))
+      return RETURN_FAIL;
+
+   /* old files have shorter model name */
+   if (!memcmp(data, "Vocaloid Motion Data 0002", 25)) {
+      name_size = 20;
+   } else if (!memcmp(data, "Vocaloid Motion Data file", 25)) {
+      name_size = 10;
+   } else {
+      return RETURN_FAIL;
+   }
+
+   /* SHIFT-JIS STRING: model name */
+   if (!(data = mmd_motion_fetch(priv, name_size)))
+      return RETURN_FAIL;
+
+   if (!(priv->motion.name = chckSJISToUTF8(data, name_size, NULL, 1)))
+      return RETURN_FAIL;
+
+   return RETURN_OK;
+}
+
+/* \brief read bone keyframes */
+static int mmd_motion_read_bones(mmd_motion_private *priv)
+{
+   mmd_motion *motion = &priv->motion;
+   mmd_bone_track keys, *track;
+   mmd_motion_order *order = NULL;
+   unsigned int *tracks = NULL, *first = NULL;
+   const unsigned char *data, *bezier;
+   unsigned int i, c, t, count;
+   unsigned char *dst;
+   int ret = RETURN_FAIL;
+
+   memset(&keys, 0, sizeof(keys));
+
+   if (mmd_motion_count(priv, MMD_VMD_BONE_SIZE, &count) != RETURN_OK)
+      return RETURN_FAIL;
+
+   if (mmd_bone_keys_alloc(&keys, count) != RETURN_OK)
+      return RETURN_FAIL;
+
+   if (!(tracks = malloc((count ? count : 1) * sizeof(unsigned int))))
+      goto out;
+
+   for (i = 0; i < count; ++i) {
+      if (!(data = mmd_motion_fetch(priv, MMD_VMD_BONE_SIZE)))
+         goto out;
+
+      /* SJIS STRING: bone name (15 bytes) */
+      if (mmd_motion_track(priv->bone_names, data, &tracks[i]) != RETURN_OK)
+         goto out;
+
+      data += MMD_VMD_TRACK_NAME_SIZE;
+
+      /* uint32_t: frame */
+      keys.frames[i] = mmd_u32(data);
+      data += sizeof(uint32_t);
+
+      /* 3xFLOAT: position */
+      mmd_f32v(&keys.positions[i*3], data, 3);
+      data += sizeof(uint32_t) * 3;
+
+      /* 4xFLOAT: rotation quaternion */
+      mmd_f32v(&keys.rotations[i*4], data, 4);
+      data += sizeof(uint32_t) * 4;
+
+      /* 64xuint8_t: interpolation, first 16 bytes hold x1[4], y1[4], x2[4], y2[4]
+       * for X, Y, Z and rotation, rest repeats them shifted */
+      dst = &keys.bezier[i * MMD_BEZIER_BONE_CURVES * MMD_BEZIER_SIZE];
+      for (c = 0, bezier = data; c < MMD_BEZIER_BONE_CURVES; ++c, dst += MMD_BEZIER_SIZE) {
+         dst[0] = bezier[c];
+         dst[1] = bezier[4 + c];
+         dst[2] = bezier[8 + c];
+         dst[3] = bezier[12 + c];
+      }
+   }
+
+   motion->num_bone_tracks = mmd_string_pool_count(priv->bone_names);
+
+   if (!(first = malloc((motion->num_bone_tracks + 1) * sizeof(unsigned int))))
+      goto out;
+
+   if (!(order = mmd_motion_order_keys(tracks, keys.frames, count, motion->num_bone_tracks, first)))
+      goto out;
+
+   if (mmd_bone_keys_alloc(&priv->bone_keys, count) != RETURN_OK)
+      goto out;
+
+   /* gather keys to track order */
+   for (i = 0; i < count; ++i) {
+      c = order[i].index;
+      priv->bone_keys.frames[i] = keys.frames[c];
+      memcpy(&priv->bone_keys.positions[i*3], &keys.positions[c*3], sizeof(float) * 3);
+      memcpy(&priv->bone_keys.rotations[i*4], &keys.rotations[c*4], sizeof(float) * 4);
+      memcpy(&priv->bone_keys.bezier[i * MMD_BEZIER_BONE_CURVES * MMD_BEZIER_SIZE],
+             &keys.bezier[c * MMD_BEZIER_BONE_CURVES * MMD_BEZIER_SIZE], MMD_BEZIER_BONE_CURVES * MMD_BEZIER_SIZE);
+   }
+
+   if (!(motion->bone_tracks = calloc((motion->num_bone_tracks ? motion->num_bone_tracks : 1), sizeof(mmd_bone_track))))
+      goto out;
+
+   for (t = 0; t < motion->num_bone_tracks; ++t) {
+      track = &motion->bone_tracks[t];
+      track->bone_index = -1;
+      track->num_keys = first[t + 1] - first[t];
+      track->frames = &priv->bone_keys.frames[first[t]];
+      track->positions = &priv->bone_keys.positions[first[t] * 3];
+      track->rotations = &priv->bone_keys.rotations[first[t] * 4];
+      track->bezier = &priv->bone_keys.bezier[first[t] * MMD_BEZIER_BONE_CURVES * MMD_BEZIER_SIZE];
+
+      if (!(track->name = mmd_string_pool_get(priv->bone_names, t + 1)))
+         goto out;
+   }
+
+   mmd_motion_frames(motion, keys.frames, count);
+   ret = RETURN_OK;
+
+out:
+   if (keys.frames) free(keys.frames);
+   if (tracks) free(tracks);
+   if (first) free(first);
+   if (order) free(order);
+   return ret;
+}
+
+/* \brief read morph keyframes */
+static int mmd_motion_read_morphs(mmd_motion_private *priv)
+{
+   mmd_motion *motion = &priv->motion;
+   mmd_morph_track keys, *track;
+   mmd_motion_order *order = NULL;
+   unsigned int *tracks = NULL, *first = NULL;
+   const unsigned char *data;
+   unsigned int i, t, count;
+   int ret = RETURN_FAIL;
+
+   memset(&keys, 0, sizeof(keys));
+
+   if (mmd_motion_count(priv, MMD_VMD_MORPH_SIZE, &count) != RETURN_OK)
+      return RETURN_FAIL;
+
+   if (mmd_morph_keys_alloc(&keys, count) != RETURN_OK)
+      return RETURN_FAIL;
+
+   if (!(tracks = malloc((count ? count : 1) * sizeof(unsigned int))))
+      goto out;
+
+   for (i = 0; i < count; ++i) {
+      if (!(data = mmd_motion_fetch(priv, MMD_VMD_MORPH_SIZE)))
+         goto out;
+
+      /* SJIS STRING: skin name (15 bytes) */
+      if (mmd_motion_track(priv->morph_names, data, &tracks[i]) != RETURN_OK)
+         goto out;
+
+      data += MMD_VMD_TRACK_NAME_SIZE;
+
+      /* uint32_t: frame */
+      keys.frames[i] = mmd_u32(data);
+      data += sizeof(uint32_t);
+
+      /* FLOAT: weight */
+      keys.weights[i] = mmd_f32(data);
+   }
+
+   motion->num_morph_tracks = mmd_string_pool_count(priv->morph_names);
+
+   if (!(first = malloc((motion->num_morph_tracks + 1) * sizeof(unsigned int))))
+      goto out;
+
+   if (!(order = mmd_motion_order_keys(tracks, keys.frames, count, motion->num_morph_tracks, first)))
+      goto out;
+
+   if (mmd_morph_keys_alloc(&priv->morph_keys, count) != RETURN_OK)
+      goto out;
+
+   /* gather keys to track order */
+   for (i = 0; i < count; ++i) {
+      priv->morph_keys.frames[i] = keys.frames[order[i].index];
+      priv->morph_keys.weights[i] = keys.weights[order[i].index];
+   }
+
+   if (!(motion->morph_tracks = calloc((motion->num_morph_tracks ? motion->num_morph_tracks : 1), sizeof(mmd_morph_track))))
+      goto out;
+
+   for (t = 0; t < motion->num_morph_tracks; ++t) {
+      track = &motion->morph_tracks[t];
+      track->skin_index = -1;
+      track->num_keys = first[t + 1] - first[t];
+      track->frames = &priv->morph_keys.frames[first[t]];
+      track->weights = &priv->morph_keys.weights[first[t]];
+
+      if (!(track->name = mmd_string_pool_get(priv->morph_names, t + 1)))
+         goto out;
+   }
+
+   mmd_motion_frames(motion, keys.frames, count);
+   ret = RETURN_OK;
+
+out:
+   if (keys.frames) free(keys.frames);
+   if (tracks) free(tracks);
+   if (first) free(first);
+   if (order) free(order);
+   return ret;
+}
+
+/* \brief read camera keyframes */
+static int mmd_motion_read_camera(mmd_motion_private *priv)
+{
+   mmd_motion *motion = &priv->motion;
+   mmd_camera_track keys, *camera = &motion->camera;
+   mmd_motion_order *order = NULL;
+   const unsigned char *data;
+   unsigned int i, c, first[2], count;
+   unsigned char *dst;
+   int ret = RETURN_FAIL;
+
+   memset(&keys, 0, sizeof(keys));
+
+   if (mmd_motion_count(priv, MMD_VMD_CAMERA_SIZE, &count) != RETURN_OK)
+      return RETURN_FAIL;
+
+   if (mmd_camera_keys_alloc(&keys, count) != RETURN_OK)
+      return RETURN_FAIL;
+
+   for (i = 0; i < count; ++i) {
+      if (!(data = mmd_motion_fetch(priv, MMD_VMD_CAMERA_SIZE)))
+         goto out;
+
+      /* uint32_t: frame */
+      keys.frames[i] = mmd_u32(data);
+      data += sizeof(uint32_t);
+
+      /* FLOAT: distance */
+      keys.distances[i] = mmd_f32(data);
+      data += sizeof(uint32_t);
+
+      /* 3xFLOAT: position */
+      mmd_f32v(&keys.positions[i*3], data, 3);
+      data += sizeof(uint32_t) * 3;
+
+      /* 3xFLOAT: rotation */
+      mmd_f32v(&keys.rotations[i*3], data, 3);
+      data += sizeof(uint32_t) * 3;
+
+      /* 24xuint8_t: interpolation, x1 x2 y1 y2 for each curve */
+      dst = &keys.bezier[i * MMD_BEZIER_CAMERA_CURVES * MMD_BEZIER_SIZE];
+      for (c = 0; c < MMD_BEZIER_CAMERA_CURVES; ++c, data += 4, dst += MMD_BEZIER_SIZE) {
+         dst[0] = data[0];
+         dst[1] = data[2];
+         dst[2] = data[1];
+         dst[3] = data[3];
+      }
+
+      /* uint32_t: view angle */
+      keys.fovs[i] = mmd_u32(data);
+      data += sizeof(uint32_t);
+
+      /* uint8_t: perspective flag */
+      keys.perspectives[i] = *data;
+   }
+
+   if (!(order = mmd_motion_order_keys(NULL, keys.frames, count, 1, first)))
+      goto out;
+
+   if (mmd_camera_keys_alloc(camera, count) != RETURN_OK)
+      goto out;
+
+   /* gather keys to frame order */
+   for (i = 0; i < count; ++i) {
+      c = order[i].index;
+      camera->frames[i] = keys.frames[c];
+      camera->distances[i] = keys.distances[c];
+      camera->fovs[i] = keys.fovs[c];
+      camera->perspectives[i] = keys.perspectives[c];
+      memcpy(&camera->positions[i*3], &keys.positions[c*3], sizeof(float) * 3);
+      memcpy(&camera->rotations[i*3], &keys.rotations[c*3], sizeof(float) * 3);
+      memcpy(&camera->bezier[i * MMD_BEZIER_CAMERA_CURVES * MMD_BEZIER_SIZE],
+             &keys.bezier[c * MMD_BEZIER_CAMERA_CURVES * MMD_BEZIER_SIZE], MMD_BEZIER_CAMERA_CURVES * MMD_BEZIER_SIZE);
+   }
+
+   mmd_motion_frames(motion, keys.frames, count);
+   ret = RETURN_OK;
+
+out:
+   if (keys.frames) free(keys.frames);
+   if (order) free(order);
+   return ret;
+}
+
+/* \brief read VMD file */
+int mmd_motion_load(mmd_motion *motion)
+{
+   mmd_motion_private *priv = (mmd_motion_private*)motion;
+   long pos, end;
+   int ret = RETURN_FAIL;
+   assert(motion);
+
+   if (motion->name)
+      return RETURN_FAIL;
+
+   if (!priv->memory) {
+      if (!priv->f || !(priv->block = malloc(MMD_VMD_BLOCK_SIZE)))
+         return RETURN_FAIL;
+
+      /* size lets us reject bogus counts, pipes don't have one */
+      priv->size = (size_t)~0;
+      if ((pos = ftell(priv->f)) >= 0 && fseek(priv->f, 0, SEEK_END) == 0) {
+         if ((end = ftell(priv->f)) >= pos)
+            priv->size = (size_t)(end - pos);
+
+         if (fseek(priv->f, pos, SEEK_SET) != 0)
+            goto out;
+      }
+   }
+
+   if (!(priv->bone_names = mmd_string_pool_new()) || !(priv->morph_names = mmd_string_pool_new()))
+      goto out;
+
+   if (mmd_motion_read_header(priv) != RETURN_OK ||
+       mmd_motion_read_bones(priv) != RETURN_OK ||
+       mmd_motion_read_morphs(priv) != RETURN_OK ||
+       mmd_motion_read_camera(priv) != RETURN_OK)
+      goto out;
+
+   ret = RETURN_OK;
+
+out:
+   if (priv->block) {
+      free(priv->block);
+      priv->block = NULL;
+   }
+
+   priv->memory = NULL;
+   return ret;
+}
+
+/* \brief name of bone or skin in mmd_data */
+static const char* mmd_motion_target_name(mmd_data *mmd, const char *name, mmd_string id)
+{
+   return (name ? name : mmd_get_string(mmd, id));
+}
+
+/* \brief bind tracks to bones and skins by name */
+int mmd_motion_bind(mmd_motion *motion, mmd_data *mmd)
+{
+   const char *name;
+   unsigned int t, i;
+   assert(motion && mmd);
+
+   for (t = 0; t < motion->num_bone_tracks; ++t) {
+      motion->bone_tracks[t].bone_index = -1;
+
+      for (i = 0; i < mmd->num_bones; ++i) {
+         name = mmd_motion_target_name(mmd, mmd->bones[i].name, mmd->bones[i].name_id);
+         if (name && !strcmp(name, motion->bone_tracks[t].name)) {
+            motion->bone_tracks[t].bone_index = (int)i;
+            break;
+         }
+      }
+   }
+
+   for (t = 0; t < motion->num_morph_tracks; ++t) {
+      motion->morph_tracks[t].skin_index = -1;
+
+      for (i = 0; i < mmd->num_skins; ++i) {
+         name = mmd_motion_target_name(mmd, mmd->skin[i].name, mmd->skin[i].name_id);
+         if (name && !strcmp(name, motion->morph_tracks[t].name)) {
+            motion->morph_tracks[t].skin_index = (int)i;
+            break;
+         }
+      }
+   }
+
+   return RETURN_OK;
+}
+
+/* \brief allocate new mmd_motion structure */
+mmd_motion* mmd_motion_new(FILE *f)
+{
+   mmd_motion_private *priv;
+
+   if (!(priv = calloc(1, sizeof(mmd_motion_private))))
+      return NULL;
+
+   priv->f = f;
+   return &priv->motion;
+}
+
+/* \brief allocate new mmd_motion structure reading from memory */
+mmd_motion* mmd_motion_new_from_memory(const void *data, size_t size)
+{
+   mmd_motion_private *priv;
+   assert(data || !size);
+
+   if (!(priv = (mmd_motion_private*)mmd_motion_new(NULL)))
+      return NULL;
+
+   priv->memory = data;
+   priv->size = size;
+   return &priv->motion;
+}
+
+/* \brief free mmd_motion structure */
+void mmd_motion_free(mmd_motion *motion)
+{
+   mmd_motion_private *priv = (mmd_motion_private*)motion;
+   assert(motion);
+
+   if (motion->name) free((char*)motion->name);
+   if (motion->bone_tracks) free(motion->bone_tracks);
+   if (motion->morph_tracks) free(motion->morph_tracks);
+   if (motion->camera.frames) free(motion->camera.frames);
+   if (priv->bone_keys.frames) free(priv->bone_keys.frames);
+   if (priv->morph_keys.frames) free(priv->morph_keys.frames);
+   if (priv->block) free(priv->block);
+
+   /* track names live in the pools */
+   if (priv->bone_names) mmd_string_pool_free(priv->bone_names);
+   if (priv->morph_names) mmd_string_pool_free(priv->morph_names);
+   free(priv);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,335 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h> /* for memcpy, memset */
+#include <assert.h> /* for assert */
+
+/* vertex cache optimization.
+ *
+ * triangles of every material are reordered with tipsify
+ * (Sander, Nehab and Barczak, "Fast triangle reordering for
+ * vertex locality and reduced overdraw", 2007): fan around
+ * vertex, then continue from the youngest neighbour that
+ * still fits the cache, or from the last dead end.
+ * vertices are then renumbered in order of first use. */
+
+enum {
+   /* default simulated FIFO cache size */
+   MMD_OPTIMIZE_CACHE_SIZE = 16
+};
+
+/* \brief average cache misses per triangle with FIFO cache of cache_size */
+static float mmd_acmr(const unsigned short *indices, unsigned int num_indices, unsigned int *stamp, unsigned int num_vertices, unsigned int cache_size)
+{
+   unsigned int i, misses = 0;
+
+   /* stamp is miss count when vertex entered the cache, 0 for never */
+   memset(stamp, 0, num_vertices * sizeof(unsigned int));
+
+   for (i = 0; i < num_indices; ++i) {
+      if (stamp[indices[i]] && misses - stamp[indices[i]] < cache_size)
+         continue;
+
+      stamp[indices[i]] = ++misses;
+   }
+
+   return (num_indices >= 3 ? (float)misses / (num_indices / 3) : 0.0f);
+}
+
+/* \brief working state of tipsify over single material */
+typedef struct mmd_tipsify {
+   /* triangles of every vertex over whole mesh */
+   unsigned int *adjacency, *offsets;
+
+   /* live triangles of vertex and time it entered the cache */
+   unsigned int *live, *cache;
+
+   /* dead end stack and emitted flag per triangle */
+   unsigned int *dead_end, num_dead_end;
+   unsigned char *emitted;
+
+   unsigned int cache_size;
+} mmd_tipsify;
+
+/* \brief next vertex to fan around, or num_vertices when done */
+static unsigned int mmd_tipsify_next(mmd_tipsify *t, const unsigned int *candidates, unsigned int num_candidates, unsigned int stamp,
+                                     const unsigned short *indices, unsigned int num_indices, unsigned int *cursor, unsigned int num_vertices)
+{
+   unsigned int c, v, best = num_vertices, age;
+   int priority, best_priority = -1;
+
+   /* youngest neighbour whose remaining triangles still hit the cache */
+   for (c = 0; c < num_candidates; ++c) {
+      v = candidates[c];
+      if (!t->live[v])
+         continue;
+
+      age = stamp - t->cache[v];
+      priority = (age + 2 * t->live[v] <= t->cache_size ? (int)age : 0);
+
+      if (priority > best_priority) {
+         best_priority = priority;
+         best = v;
+      }
+   }
+
+   if (best != num_vertices)
+      return best;
+
+   while (t->num_dead_end) {
+      v = t->dead_end[--t->num_dead_end];
+      if (t->live[v])
+         return v;
+   }
+
+   for (; *cursor < num_indices; ++*cursor) {
+      if (t->live[indices[*cursor]])
+         return indices[*cursor];
+   }
+
+   return num_vertices;
+}
+
+/* \brief reorder triangles first to first + count of indices into out */
+static void mmd_tipsify_range(mmd_tipsify *t, const unsigned short *indices, unsigned int first, unsigned int count,
+                              unsigned int *candidates, unsigned short *out, unsigned int num_vertices)
+{
+   const unsigned int first_tri = first / 3, end_tri = (first + count) / 3;
+   unsigned int i, k, tri, v, fan, cursor = first, stamp = t->cache_size + 1, num_candidates, emitted = first;
+
+   for (i = first; i < first + count; ++i) {
+      t->live[indices[i]]++;
+      t->cache[indices[i]] = 0;
+   }
+
+   for (fan = (count ? indices[first] : num_vertices); fan < num_vertices;) {
+      num_candidates = 0;
+
+      for (i = t->offsets[fan]; i < t->offsets[fan + 1]; ++i) {
+         tri = t->adjacency[i];
+
+         /* triangles of other materials are not ours to emit */
+         if (tri < first_tri || tri >= end_tri || t->emitted[tri])
+            continue;
+
+         for (k = 0; k < 3; ++k) {
+            v = indices[tri * 3 + k];
+            out[emitted++] = (unsigned short)v;
+            t->dead_end[t->num_dead_end++] = v;
+            candidates[num_candidates++] = v;
+            t->live[v]--;
+
+            if (stamp - t->cache[v] > t->cache_size)
+               t->cache[v] = stamp++;
+         }
+
+         t->emitted[tri] = 1;
+      }
+
+      fan = mmd_tipsify_next(t, candidates, num_candidates, stamp, indices, first + count, &cursor, num_vertices);
+   }
+
+   t->num_dead_end = 0;
+}
+
+/* \brief reorder triangles of every material with tipsify */
+static int mmd_optimize_triangles(mmd_data *mmd, const mmd_index_range *ranges, unsigned int cache_size)
+{
+   const unsigned int num_tris = mmd->num_indices / 3;
+   unsigned int *candidates = NULL, m, i, max_fan = 0;
+   unsigned short *out = NULL;
+   mmd_tipsify t;
+   int ret = RETURN_FAIL;
+
+   memset(&t, 0, sizeof(t));
+   t.cache_size = cache_size;
+
+   if (!(t.offsets = calloc(mmd->num_vertices + 2, sizeof(unsigned int))) ||
+       !(t.adjacency = calloc(num_tris * 3 + 1, sizeof(unsigned int))) ||
+       !(t.live = calloc(mmd->num_vertices + 1, sizeof(unsigned int))) ||
+       !(t.cache = calloc(mmd->num_vertices + 1, sizeof(unsigned int))) ||
+       !(t.dead_end = calloc(num_tris * 3 + 1, sizeof(unsigned int))) ||
+       !(t.emitted = calloc(num_tris + 1, sizeof(unsigned char))) ||
+       !(out = calloc(mmd->num_indices + 1, sizeof(unsigned short))))
+      goto out;
+
+   /* triangles around every vertex, as offsets to one array */
+   for (i = 0; i < num_tris * 3; ++i)
+      t.offsets[mmd->indices[i] + 2]++;
+
+   for (i = 0; i < mmd->num_vertices; ++i) {
+      max_fan = (t.offsets[i + 2] > max_fan ? t.offsets[i + 2] : max_fan);
+      t.offsets[i + 2] += t.offsets[i + 1];
+   }
+
+   for (i = 0; i < num_tris * 3; ++i)
+      t.adjacency[t.offsets[mmd->indices[i] + 1]++] = i / 3;
+
+   if (!(candidates = calloc(max_fan * 3 + 1, sizeof(unsigned int))))
+      goto out;
+
+   /* indices not in any material, and materials not on triangle boundary, stay as they are */
+   memcpy(out, mmd->indices, mmd->num_indices * sizeof(unsigned short));
+
+   for (m = 0; m < mmd->num_materials; ++m)
+      if (ranges[m].first % 3 == 0)
+         mmd_tipsify_range(&t, mmd->indices, ranges[m].first, ranges[m].count / 3 * 3, candidates, out, mmd->num_vertices);
+
+   memcpy(mmd->indices, out, mmd->num_indices * sizeof(unsigned short));
+   ret = RETURN_OK;
+
+out:
+   if (t.offsets) free(t.offsets);
+   if (t.adjacency) free(t.adjacency);
+   if (t.live) free(t.live);
+   if (t.cache) free(t.cache);
+   if (t.dead_end) free(t.dead_end);
+   if (t.emitted) free(t.emitted);
+   if (candidates) free(candidates);
+   if (out) free(out);
+   return ret;
+}
+
+/* \brief permute count elements of size bytes by remap */
+static void mmd_permute(void *array, const unsigned int *remap, unsigned int count, size_t size, unsigned char *scratch)
+{
+   unsigned int i;
+
+   if (!array)
+      return;
+
+   for (i = 0; i < count; ++i)
+      memcpy(scratch + remap[i] * size, (unsigned char*)array + i * size, size);
+
+   memcpy(array, scratch, count * size);
+}
+
+/* \brief renumber vertices in order of first use */
+static int mmd_optimize_vertices(mmd_data *mmd, unsigned int *remap)
+{
+   unsigned char *scratch;
+   const mmd_skin *base = NULL;
+   unsigned int i, s, next = 0;
+   void *array;
+
+   /* arrays shared with other models are copied before they are renumbered */
+   if (!(array = mmd_writable(mmd, mmd->vertices, mmd->num_vertices, 3 * sizeof(float))) && mmd->vertices)
+      return RETURN_FAIL;
+   mmd->vertices = array;
+
+   if (!(array = mmd_writable(mmd, mmd->normals, mmd->num_vertices, 3 * sizeof(float))) && mmd->normals)
+      return RETURN_FAIL;
+   mmd->normals = array;
+
+   if (!(array = mmd_writable(mmd, mmd->coords, mmd->num_vertices, 2 * sizeof(float))) && mmd->coords)
+      return RETURN_FAIL;
+   mmd->coords = array;
+
+   if (!(array = mmd_writable(mmd, mmd->weights, mmd->num_vertices, sizeof(mmd_weight))) && mmd->weights)
+      return RETURN_FAIL;
+   mmd->weights = array;
+
+   /* base skin indexes mesh vertices, other skins index base skin.
+    * without base skin every skin indexes mesh vertices */
+   for (s = 0; s < mmd->num_skins && !base; ++s)
+      base = (mmd->skin[s].type == MMD_SKIN_BASE ? &mmd->skin[s] : NULL);
+
+   for (s = 0; s < mmd->num_skins; ++s) {
+      if (base && &mmd->skin[s] != base)
+         continue;
+
+      if (!(array = mmd_writable(mmd, mmd->skin[s].vertices, mmd->skin[s].num_vertices, sizeof(mmd_skin_vertex))) && mmd->skin[s].vertices)
+         return RETURN_FAIL;
+      mmd->skin[s].vertices = array;
+   }
+
+   if (!(scratch = malloc((mmd->num_vertices ? mmd->num_vertices : 1) * 3 * sizeof(float))))
+      return RETURN_FAIL;
+
+   for (i = 0; i < mmd->num_vertices; ++i)
+      remap[i] = mmd->num_vertices;
+
+   for (i = 0; i < mmd->num_indices; ++i) {
+      if (remap[mmd->indices[i]] == mmd->num_vertices)
+         remap[mmd->indices[i]] = next++;
+
+      mmd->indices[i] = (unsigned short)remap[mmd->indices[i]];
+   }
+
+   /* unused vertices keep their order after the used ones */
+   for (i = 0; i < mmd->num_vertices; ++i)
+      if (remap[i] == mmd->num_vertices)
+         remap[i] = next++;
+
+   mmd_permute(mmd->vertices, remap, mmd->num_vertices, 3 * sizeof(float), scratch);
+   mmd_permute(mmd->normals, remap, mmd->num_vertices, 3 * sizeof(float), scratch);
+   mmd_permute(mmd->coords, remap, mmd->num_vertices, 2 * sizeof(float), scratch);
+   mmd_permute(mmd->weights, remap, mmd->num_vertices, sizeof(mmd_weight), scratch);
+
+   for (s = 0; s < mmd->num_skins; ++s) {
+      if (base && &mmd->skin[s] != base)
+         continue;
+
+      for (i = 0; i < mmd->skin[s].num_vertices; ++i)
+         if (mmd->skin[s].vertices[i].index < mmd->num_vertices)
+            mmd->skin[s].vertices[i].index = remap[mmd->skin[s].vertices[i].index];
+   }
+
+   free(scratch);
+   return RETURN_OK;
+}
+
+/* \brief reorder triangles and vertices for vertex cache */
+int mmd_optimize_vertex_cache(mmd_data *mmd, unsigned int cache_size, unsigned int *remap, mmd_optimize_stats *stats)
+{
+   mmd_index_range *ranges = NULL;
+   unsigned int *order = remap, *stamp = NULL, i;
+   unsigned short *indices;
+   int ret = RETURN_FAIL;
+   assert(mmd);
+
+   cache_size = (cache_size ? cache_size : MMD_OPTIMIZE_CACHE_SIZE);
+
+   /* nothing is changed unless every index is valid,
+    * 32-bit indices of large PMX models are not handled */
+   if (!mmd->indices && mmd->num_indices)
+      return RETURN_FAIL;
+
+   for (i = 0; i < mmd->num_indices; ++i)
+      if (mmd->indices[i] >= mmd->num_vertices)
+         return RETURN_FAIL;
+
+   if (!(ranges = calloc(mmd->num_materials + 1, sizeof(mmd_index_range))) ||
+       !(stamp = calloc(mmd->num_vertices + 1, sizeof(unsigned int))) ||
+       (!order && !(order = calloc(mmd->num_vertices + 1, sizeof(unsigned int)))))
+      goto out;
+
+   if (!(indices = mmd_writable(mmd, mmd->indices, mmd->num_indices, sizeof(unsigned short))) && mmd->num_indices)
+      goto out;
+
+   mmd->indices = indices;
+
+   /* face counts that do not fit are clamped, the rest stays in place */
+   mmd_export_ranges(mmd, ranges);
+
+   if (stats) {
+      stats->cache_size = cache_size;
+      stats->acmr_before = mmd_acmr(mmd->indices, mmd->num_indices, stamp, mmd->num_vertices, cache_size);
+   }
+
+   if (mmd_optimize_triangles(mmd, ranges, cache_size) != RETURN_OK ||
+       mmd_optimize_vertices(mmd, order) != RETURN_OK)
+      goto out;
+
+   if (stats)
+      stats->acmr_after = mmd_acmr(mmd->indices, mmd->num_indices, stamp, mmd->num_vertices, cache_size);
+
+   ret = RETURN_OK;
+
+out:
+   if (ranges) free(ranges);
+   if (stamp) free(stamp);
+   if (order && order != remap) free(order);
+   return ret;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
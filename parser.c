@@ -0,0 +1,347 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h> /* for memcpy */
+#include <assert.h> /* for assert */
+
+enum {
+   /* partial record kept between chunks, fits the largest record (header) */
+   MMD_PARSER_CARRY_SIZE = 512
+};
+
+/* default of mmd_parser_set_limit */
+#define MMD_PARSER_DEFAULT_LIMIT ((size_t)256 << 20)
+
+/* stage inside section */
+enum {
+   MMD_PARSER_COUNT,
+   MMD_PARSER_RECORD,
+   MMD_PARSER_CHILD
+};
+
+/* \brief layout of section in file */
+typedef struct mmd_parser_layout {
+   /* size of record and its child records */
+   unsigned short record_size, child_size;
+} mmd_parser_layout;
+
+static const mmd_parser_layout mmd_parser_sections[MMD_SECTION_LAST] = {
+   { MMD_HEADER_SIZE, 0 },
+   { MMD_VERTEX_SIZE, 0 },
+   { MMD_INDEX_SIZE, 0 },
+   { MMD_MATERIAL_SIZE, 0 },
+   { MMD_BONE_SIZE, 0 },
+   { MMD_IK_SIZE, MMD_IK_LINK_SIZE },
+   { MMD_SKIN_SIZE, MMD_SKIN_VERTEX_SIZE },
+   { MMD_SKIN_DISPLAY_SIZE, 0 },
+   { MMD_BONE_NAME_SIZE, 0 }
+};
+
+struct mmd_parser {
+   mmd_data *mmd;
+
+   /* where we are */
+   unsigned int section, stage;
+   size_t index, count;
+   size_t child, num_children;
+
+   /* bytes taken so far and most the stream may have */
+   size_t offset, limit;
+
+   /* sections completed during last feed */
+   unsigned int ready;
+   int failed;
+
+   /* partial record */
+   unsigned char carry[MMD_PARSER_CARRY_SIZE];
+   size_t carry_size;
+};
+
+/* \brief get whole records straight from chunk, or one record through carry */
+static const unsigned char* mmd_parser_take(mmd_parser *parser, const unsigned char **data, size_t *len, size_t size, size_t max, size_t *count)
+{
+   const unsigned char *records;
+   size_t copy;
+   assert(size <= MMD_PARSER_CARRY_SIZE && max > 0);
+
+   if (!parser->carry_size && *len >= size) {
+      if ((*count = *len / size) > max)
+         *count = max;
+
+      records = *data;
+      *data += *count * size;
+      *len -= *count * size;
+      parser->offset += *count * size;
+      return records;
+   }
+
+   if ((copy = size - parser->carry_size) > *len)
+      copy = *len;
+
+   memcpy(parser->carry + parser->carry_size, *data, copy);
+   parser->carry_size += copy;
+   parser->offset += copy;
+   *data += copy;
+   *len -= copy;
+
+   if (parser->carry_size < size)
+      return NULL;
+
+   parser->carry_size = 0;
+   *count = 1;
+   return parser->carry;
+}
+
+/* \brief fail when count records of size can't fit in rest of the limit,
+ * so that a count of hostile stream can't force a huge allocation */
+static int mmd_parser_check_count(mmd_parser *parser, size_t count, size_t size)
+{
+   if (!parser->limit || (parser->offset <= parser->limit && count <= (parser->limit - parser->offset) / size))
+      return RETURN_OK;
+
+   mmd_fail(parser->mmd, MMD_ERROR_FORMAT, parser->section, parser->offset);
+   return RETURN_FAIL;
+}
+
+/* \brief store count of current section */
+static int mmd_parser_set_count(mmd_parser *parser, const unsigned char *data)
+{
+   switch (mmd_count_size(parser->section)) {
+      case sizeof(uint32_t):
+         parser->count = mmd_u32(data);
+         break;
+      case sizeof(uint16_t):
+         parser->count = mmd_u16(data);
+         break;
+      default:
+         parser->count = *data;
+         break;
+   }
+
+   if (mmd_parser_check_count(parser, parser->count, mmd_parser_sections[parser->section].record_size) != RETURN_OK)
+      return RETURN_FAIL;
+
+   mmd_set_count(parser->mmd, parser->section, (unsigned int)parser->count);
+   return mmd_alloc_section(parser->mmd, parser->section);
+}
+
+/* \brief decode count records of current section */
+static int mmd_parser_records(mmd_parser *parser, const unsigned char *data, size_t count)
+{
+   mmd_data *mmd = parser->mmd;
+   size_t i, first = parser->index;
+
+   switch (parser->section) {
+      case MMD_SECTION_HEADER:
+         return mmd_decode_header(mmd, data);
+
+      case MMD_SECTION_VERTEX:
+         mmd_decode_vertices_bounded(data, count, &mmd->vertices[first*3], &mmd->normals[first*3], &mmd->coords[first*2], &mmd->weights[first], &mmd->bounds);
+         break;
+
+      case MMD_SECTION_INDEX:
+         mmd_u16v(&mmd->indices[first], data, count);
+         break;
+
+      case MMD_SECTION_MATERIAL:
+         for (i = 0; i < count; ++i, data += MMD_MATERIAL_SIZE)
+            if (mmd_decode_material(mmd, &mmd->materials[first + i], data) != RETURN_OK)
+               return RETURN_FAIL;
+         break;
+
+      case MMD_SECTION_BONE:
+         for (i = 0; i < count; ++i, data += MMD_BONE_SIZE)
+            if (mmd_decode_bone(mmd, &mmd->bones[first + i], data) != RETURN_OK)
+               return RETURN_FAIL;
+         break;
+
+      case MMD_SECTION_IK:
+         /* uint8_t chain length is small enough to need no check */
+         if (mmd_decode_ik(mmd, &mmd->ik[first], data) != RETURN_OK)
+            return RETURN_FAIL;
+         parser->num_children = mmd->ik[first].chain_length;
+         break;
+
+      case MMD_SECTION_SKIN:
+         if (mmd_decode_skin(mmd, &mmd->skin[first], data) != RETURN_OK ||
+             mmd_parser_check_count(parser, mmd->skin[first].num_vertices, MMD_SKIN_VERTEX_SIZE) != RETURN_OK ||
+             !(mmd->skin[first].vertices = mmd_calloc(mmd, mmd->skin[first].num_vertices, sizeof(mmd_skin_vertex))))
+            return RETURN_FAIL;
+         parser->num_children = mmd->skin[first].num_vertices;
+         break;
+
+      case MMD_SECTION_SKIN_DISPLAY:
+         mmd_decode_skin_displays(&mmd->skin_display[first], data, count);
+         break;
+
+      case MMD_SECTION_BONE_NAME:
+         for (i = 0; i < count; ++i, data += MMD_BONE_NAME_SIZE)
+            if (mmd_name(mmd, data, MMD_BONE_NAME_SIZE, &mmd->bone_name[first + i].name, &mmd->bone_name[first + i].name_id) != RETURN_OK)
+               return RETURN_FAIL;
+         break;
+   }
+
+   return RETURN_OK;
+}
+
+/* \brief decode count child records of current record */
+static void mmd_parser_children(mmd_parser *parser, const unsigned char *data, size_t count)
+{
+   mmd_data *mmd = parser->mmd;
+
+   if (parser->section == MMD_SECTION_IK) {
+      /* uint16_t: child bone index */
+      mmd_u16v(&mmd->ik[parser->index].child_bone_index[parser->child], data, count);
+   } else {
+      mmd_decode_skin_vertices(&mmd->skin[parser->index].vertices[parser->child], data, count);
+   }
+}
+
+/* \brief decode as much of chunk as possible */
+static int mmd_parser_run(mmd_parser *parser, const unsigned char *data, size_t len)
+{
+   const mmd_parser_layout *section;
+   const unsigned char *records;
+   size_t count;
+
+   while (parser->section < MMD_SECTION_LAST) {
+      section = &mmd_parser_sections[parser->section];
+
+      switch (parser->stage) {
+         case MMD_PARSER_COUNT:
+            parser->index = 0;
+            parser->count = 1;
+
+            if (mmd_count_size(parser->section)) {
+               if (!(records = mmd_parser_take(parser, &data, &len, mmd_count_size(parser->section), 1, &count)))
+                  return RETURN_OK;
+
+               if (mmd_parser_set_count(parser, records) != RETURN_OK)
+                  goto fail;
+            }
+
+            parser->stage = MMD_PARSER_RECORD;
+            break;
+
+         case MMD_PARSER_RECORD:
+            if (parser->index >= parser->count) {
+               /* model sphere is whole with the last vertex,
+                * vertices and indices come before materials and bones */
+               if (parser->section == MMD_SECTION_VERTEX)
+                  mmd_bounds_tighten(&parser->mmd->bounds);
+               else if (parser->section == MMD_SECTION_MATERIAL)
+                  mmd_material_bounds(parser->mmd);
+               else if (parser->section == MMD_SECTION_BONE)
+                  mmd_bone_bounds(parser->mmd);
+
+               parser->ready |= 1 << parser->section;
+               parser->section++;
+               parser->stage = MMD_PARSER_COUNT;
+               break;
+            }
+
+            /* records with children are taken one at a time */
+            if (!(records = mmd_parser_take(parser, &data, &len, section->record_size,
+                        (section->child_size ? 1 : parser->count - parser->index), &count)))
+               return RETURN_OK;
+
+            if (mmd_parser_records(parser, records, count) != RETURN_OK)
+               goto fail;
+
+            if (section->child_size) {
+               parser->child = 0;
+               parser->stage = MMD_PARSER_CHILD;
+            } else {
+               parser->index += count;
+            }
+            break;
+
+         case MMD_PARSER_CHILD:
+            if (parser->child >= parser->num_children) {
+               parser->index++;
+               parser->stage = MMD_PARSER_RECORD;
+               break;
+            }
+
+            if (!(records = mmd_parser_take(parser, &data, &len, section->child_size, parser->num_children - parser->child, &count)))
+               return RETURN_OK;
+
+            mmd_parser_children(parser, records, count);
+            parser->child += count;
+            break;
+      }
+   }
+
+   /* trailing sections we don't decode are ignored */
+   return RETURN_OK;
+
+fail:
+   return RETURN_FAIL;
+}
+
+/* \brief create push parser decoding to mmd */
+mmd_parser* mmd_parser_new(mmd_data *mmd)
+{
+   mmd_parser *parser;
+   assert(mmd);
+
+   if (!(parser = calloc(1, sizeof(mmd_parser))))
+      return NULL;
+
+   parser->mmd = mmd;
+   parser->limit = MMD_PARSER_DEFAULT_LIMIT;
+   return parser;
+}
+
+/* \brief free push parser */
+void mmd_parser_free(mmd_parser *parser)
+{
+   assert(parser);
+   free(parser);
+}
+
+/* \brief set most bytes the stream may have, 0 for no limit */
+void mmd_parser_set_limit(mmd_parser *parser, size_t bytes)
+{
+   assert(parser);
+   parser->limit = bytes;
+}
+
+/* \brief feed next chunk of PMD file to parser */
+int mmd_parser_feed(mmd_parser *parser, const void *bytes, size_t len)
+{
+   assert(parser && (bytes || !len));
+
+   parser->ready = 0;
+
+   if (parser->failed)
+      return MMD_PARSER_ERROR;
+
+   if (parser->section >= MMD_SECTION_LAST)
+      return MMD_PARSER_DONE;
+
+   if (mmd_parser_run(parser, bytes, len) != RETURN_OK) {
+      parser->failed = 1;
+      return MMD_PARSER_ERROR;
+   }
+
+   if (parser->section >= MMD_SECTION_LAST)
+      return MMD_PARSER_DONE;
+
+   return (parser->ready ? MMD_PARSER_SECTION_READY : MMD_PARSER_NEED_MORE);
+}
+
+/* \brief sections completed by last mmd_parser_feed */
+unsigned int mmd_parser_ready_sections(const mmd_parser *parser)
+{
+   assert(parser);
+   return parser->ready;
+}
+
+/* \brief section currently being decoded */
+unsigned int mmd_parser_section(const mmd_parser *parser)
+{
+   assert(parser);
+   return parser->section;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,1298 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h> /* for memcpy, memset */
+#include <assert.h> /* for assert */
+
+/* PMX 2.0 and 2.1 import.
+ *
+ * PMX records are variable length: index fields are 1, 2 or 4
+ * bytes wide as told by the header, names carry their length and
+ * vertices their weight type. the file is walked once to find the
+ * sections and the counts of what they become in mmd_data, which
+ * also sizes the arena, and then walked again to decode them.
+ * vertices are repacked to PMD records a chunk at a time, so the
+ * SIMD vertex decoders and bounds do the bulk of the work. */
+
+enum {
+   /* vertices repacked to PMD records at once */
+   MMD_PMX_VERTEX_CHUNK = 256,
+
+   /* position, normal and uv, same bytes as start of PMD vertex */
+   MMD_PMX_VERTEX_BASE_SIZE = sizeof(float) * 8,
+
+   /* limit of uint8_t counts of mmd_data */
+   MMD_PMX_MAX_U8 = 0xFF
+};
+
+/* morph without skin counterpart */
+#define MMD_PMX_NONE (~0u)
+
+/* globals in header */
+enum {
+   MMD_PMX_ENCODING,
+   MMD_PMX_ADDITIONAL_UVS,
+   MMD_PMX_VERTEX_INDEX,
+   MMD_PMX_TEXTURE_INDEX,
+   MMD_PMX_MATERIAL_INDEX,
+   MMD_PMX_BONE_INDEX,
+   MMD_PMX_MORPH_INDEX,
+   MMD_PMX_RIGID_INDEX,
+   MMD_PMX_GLOBALS
+};
+
+/* vertex weight types */
+enum {
+   MMD_PMX_BDEF1,
+   MMD_PMX_BDEF2,
+   MMD_PMX_BDEF4,
+   MMD_PMX_SDEF,
+   MMD_PMX_QDEF
+};
+
+/* morph types, 3 - 7 are uv and additional uvs */
+enum {
+   MMD_PMX_MORPH_GROUP = 0,
+   MMD_PMX_MORPH_VERTEX = 1,
+   MMD_PMX_MORPH_BONE = 2,
+   MMD_PMX_MORPH_UV = 3,
+   MMD_PMX_MORPH_MATERIAL = 8,
+   MMD_PMX_MORPH_FLIP = 9,
+   MMD_PMX_MORPH_IMPULSE = 10
+};
+
+/* bone flags */
+enum {
+   MMD_PMX_BONE_TAIL_INDEX = 0x0001,
+   MMD_PMX_BONE_MOVABLE = 0x0004,
+   MMD_PMX_BONE_VISIBLE = 0x0008,
+   MMD_PMX_BONE_IK = 0x0020,
+   MMD_PMX_BONE_INHERIT_ROTATION = 0x0100,
+   MMD_PMX_BONE_INHERIT_TRANSLATION = 0x0200,
+   MMD_PMX_BONE_FIXED_AXIS = 0x0400,
+   MMD_PMX_BONE_LOCAL_AXIS = 0x0800,
+   MMD_PMX_BONE_EXTERNAL_PARENT = 0x2000
+};
+
+/* PMD bone types the flags map to */
+enum {
+   MMD_PMX_PMD_ROTATE = 0,
+   MMD_PMX_PMD_MOVE = 1,
+   MMD_PMX_PMD_IK = 2,
+   MMD_PMX_PMD_INHERIT = 5,
+   MMD_PMX_PMD_INVISIBLE = 7,
+   MMD_PMX_PMD_TWIST = 8
+};
+
+/* \brief text field, bytes in file encoding */
+typedef struct mmd_pmx_text {
+   const unsigned char *data;
+   size_t size;
+} mmd_pmx_text;
+
+/* \brief morph found by scan */
+typedef struct mmd_pmx_morph {
+   mmd_pmx_text name;
+   const unsigned char *offsets;
+   unsigned int count;
+
+   /* skin it becomes, or MMD_PMX_NONE, and vertices of the skin */
+   unsigned int skin, num_skin_vertices;
+
+   unsigned char panel, type;
+} mmd_pmx_morph;
+
+/* \brief state of PMX import */
+typedef struct mmd_pmx {
+   mmd_data *mmd;
+
+   /* input and read position */
+   const unsigned char *data;
+   size_t size, offset;
+
+   /* MMD_SECTION_* the scan is in and where the sections it
+    * becomes start, MMD_ERROR_* when input or memory ran out */
+   unsigned int section;
+   size_t starts[MMD_SECTION_LAST];
+   int error;
+
+   /* text encoding, additional uvs and index widths */
+   unsigned char globals[MMD_PMX_GLOBALS];
+
+   float version;
+   mmd_pmx_text name, comment;
+
+   /* sections, offsets after their counts */
+   size_t vertices, indices, materials, bones, frames, end;
+   unsigned int num_vertices, num_indices, num_materials, num_bones, num_frames;
+
+   /* indices that do not fit 16 bits */
+   int wide_indices;
+
+   mmd_pmx_text *textures;
+   unsigned int num_textures;
+
+   mmd_pmx_morph *morphs;
+   unsigned int num_morphs;
+
+   /* counts of what the sections become, and UTF8 bytes of their names */
+   unsigned int num_ik, num_skins, num_skin_displays, num_bone_names;
+   size_t num_ik_links, num_skin_vertices, string_bytes[MMD_SECTION_LAST];
+
+   /* UTF16 names are converted here */
+   char *utf8;
+   size_t utf8_size;
+} mmd_pmx;
+
+/* \brief next size bytes of input, NULL when they do not fit */
+static const unsigned char* mmd_pmx_take(mmd_pmx *pmx, size_t size)
+{
+   const unsigned char *data;
+
+   if (size > pmx->size - pmx->offset) {
+      pmx->error = MMD_ERROR_TRUNCATED;
+      return NULL;
+   }
+
+   data = pmx->data + pmx->offset;
+   pmx->offset += size;
+   return data;
+}
+
+/* \brief step over count records of size */
+static int mmd_pmx_skip(mmd_pmx *pmx, size_t count, size_t size)
+{
+   if (size && count > (pmx->size - pmx->offset) / size) {
+      pmx->error = MMD_ERROR_TRUNCATED;
+      return RETURN_FAIL;
+   }
+
+   pmx->offset += count * size;
+   return RETURN_OK;
+}
+
+/* \brief scan reaches records of section */
+static void mmd_pmx_enter(mmd_pmx *pmx, unsigned int section)
+{
+   pmx->section = section;
+   pmx->starts[section] = pmx->offset;
+}
+
+/* \brief zeroed scratch array of the import */
+static void* mmd_pmx_calloc(mmd_pmx *pmx, size_t nmemb, size_t size)
+{
+   void *ptr;
+
+   if (size && nmemb > (size_t)~0 / size) {
+      pmx->error = MMD_ERROR_MEMORY;
+      return NULL;
+   }
+
+   mmd_count_alloc(pmx->mmd, nmemb * size);
+
+   if (!(ptr = mmd_scratch_alloc(pmx->mmd, nmemb * size))) {
+      pmx->error = MMD_ERROR_MEMORY;
+      return NULL;
+   }
+
+   memset(ptr, 0, nmemb * size);
+   return ptr;
+}
+
+/* \brief int32_t count, negative counts fail */
+static int mmd_pmx_count(mmd_pmx *pmx, unsigned int *count)
+{
+   const unsigned char *data;
+
+   if (!(data = mmd_pmx_take(pmx, sizeof(uint32_t))) || mmd_u32(data) > 0x7FFFFFFF)
+      return RETURN_FAIL;
+
+   *count = mmd_u32(data);
+   return RETURN_OK;
+}
+
+/* \brief uint8_t field */
+static int mmd_pmx_byte(mmd_pmx *pmx, unsigned char *value)
+{
+   const unsigned char *data;
+
+   if (!(data = mmd_pmx_take(pmx, 1)))
+      return RETURN_FAIL;
+
+   *value = *data;
+   return RETURN_OK;
+}
+
+/* \brief text field, int32_t byte length and the bytes */
+static int mmd_pmx_text_read(mmd_pmx *pmx, mmd_pmx_text *text)
+{
+   unsigned int size;
+
+   if (mmd_pmx_count(pmx, &size) != RETURN_OK || !(text->data = mmd_pmx_take(pmx, size)))
+      return RETURN_FAIL;
+
+   text->size = size;
+   return RETURN_OK;
+}
+
+/* \brief signed index of width bytes, -1 is none */
+static int32_t mmd_pmx_index(const unsigned char *data, unsigned int width)
+{
+   switch (width) {
+      case 1:
+         return (int8_t)data[0];
+      case 2:
+         return (int16_t)mmd_u16(data);
+      default:
+         return (int32_t)mmd_u32(data);
+   }
+}
+
+/* \brief vertex index of width bytes, unsigned below 4 bytes */
+static uint32_t mmd_pmx_vertex_index(const unsigned char *data, unsigned int width)
+{
+   switch (width) {
+      case 1:
+         return data[0];
+      case 2:
+         return mmd_u16(data);
+      default:
+         return mmd_u32(data);
+   }
+}
+
+/* \brief signed index read from input */
+static int mmd_pmx_index_read(mmd_pmx *pmx, unsigned int global, int32_t *index)
+{
+   const unsigned char *data;
+
+   if (!(data = mmd_pmx_take(pmx, pmx->globals[global])))
+      return RETURN_FAIL;
+
+   *index = mmd_pmx_index(data, pmx->globals[global]);
+   return RETURN_OK;
+}
+
+/* \brief index to 16-bit field of mmd_data */
+static unsigned short mmd_pmx_u16(int32_t index, unsigned short none)
+{
+   return (index < 0 || index > 0xFFFF ? none : (unsigned short)index);
+}
+
+/* \brief bytes of weight record of type */
+static size_t mmd_pmx_weight_size(unsigned char type, size_t bone)
+{
+   switch (type) {
+      case MMD_PMX_BDEF1:
+         return bone;
+      case MMD_PMX_BDEF2:
+         return bone * 2 + sizeof(float);
+      case MMD_PMX_SDEF:
+         /* C, R0 and R1 follow the BDEF2 part */
+         return bone * 2 + sizeof(float) * 10;
+      case MMD_PMX_BDEF4:
+      case MMD_PMX_QDEF:
+         return bone * 4 + sizeof(float) * 4;
+      default:
+         return 0;
+   }
+}
+
+/* \brief bytes of offset record of morph type */
+static size_t mmd_pmx_morph_size(const mmd_pmx *pmx, unsigned char type)
+{
+   switch (type) {
+      case MMD_PMX_MORPH_GROUP:
+      case MMD_PMX_MORPH_FLIP:
+         return pmx->globals[MMD_PMX_MORPH_INDEX] + sizeof(float);
+      case MMD_PMX_MORPH_VERTEX:
+         return pmx->globals[MMD_PMX_VERTEX_INDEX] + sizeof(float) * 3;
+      case MMD_PMX_MORPH_BONE:
+         return pmx->globals[MMD_PMX_BONE_INDEX] + sizeof(float) * 7;
+      case MMD_PMX_MORPH_MATERIAL:
+         return pmx->globals[MMD_PMX_MATERIAL_INDEX] + 1 + sizeof(float) * 28;
+      case MMD_PMX_MORPH_IMPULSE:
+         return pmx->globals[MMD_PMX_RIGID_INDEX] + 1 + sizeof(float) * 6;
+      default:
+         /* uv and additional uvs */
+         return (type <= MMD_PMX_MORPH_UV + 4 ? pmx->globals[MMD_PMX_VERTEX_INDEX] + sizeof(float) * 4 : 0);
+   }
+}
+
+/* \brief reserve UTF8 bytes of name from text for section being scanned */
+static void mmd_pmx_add_string(mmd_pmx *pmx, const mmd_pmx_text *text)
+{
+   /* UTF16 unit is 3 UTF8 bytes at most, surrogate pair 4 */
+   pmx->string_bytes[pmx->section] += (pmx->globals[MMD_PMX_ENCODING] ? text->size : text->size / 2 * 3) + 1;
+}
+
+/* \brief walk header */
+static int mmd_pmx_scan_header(mmd_pmx *pmx)
+{
+   const unsigned char *data;
+   mmd_pmx_text skip;
+   unsigned char count;
+   unsigned int i;
+
+   mmd_pmx_enter(pmx, MMD_SECTION_HEADER);
+
+   if (!(data = mmd_pmx_take(pmx, 4 + sizeof(float))) || memcmp(data, "PMX ", 4))
+      return RETURN_FAIL;
+
+   pmx->version = mmd_f32(data + 4);
+
+   /* newer versions may add globals after the ones we know */
+   if (mmd_pmx_byte(pmx, &count) != RETURN_OK || count < MMD_PMX_GLOBALS || !(data = mmd_pmx_take(pmx, count)))
+      return RETURN_FAIL;
+
+   memcpy(pmx->globals, data, MMD_PMX_GLOBALS);
+
+   if (pmx->globals[MMD_PMX_ENCODING] > 1 || pmx->globals[MMD_PMX_ADDITIONAL_UVS] > 4)
+      return RETURN_FAIL;
+
+   for (i = MMD_PMX_VERTEX_INDEX; i < MMD_PMX_GLOBALS; ++i)
+      if (pmx->globals[i] != 1 && pmx->globals[i] != 2 && pmx->globals[i] != 4)
+         return RETURN_FAIL;
+
+   /* local and universal names and comments */
+   if (mmd_pmx_text_read(pmx, &pmx->name) != RETURN_OK ||
+       mmd_pmx_text_read(pmx, &skip) != RETURN_OK ||
+       mmd_pmx_text_read(pmx, &pmx->comment) != RETURN_OK ||
+       mmd_pmx_text_read(pmx, &skip) != RETURN_OK)
+      return RETURN_FAIL;
+
+   mmd_pmx_add_string(pmx, &pmx->name);
+   mmd_pmx_add_string(pmx, &pmx->comment);
+   return RETURN_OK;
+}
+
+/* \brief walk vertices and indices */
+static int mmd_pmx_scan_mesh(mmd_pmx *pmx)
+{
+   const size_t bone = pmx->globals[MMD_PMX_BONE_INDEX], width = pmx->globals[MMD_PMX_VERTEX_INDEX];
+   const size_t base = MMD_PMX_VERTEX_BASE_SIZE + pmx->globals[MMD_PMX_ADDITIONAL_UVS] * sizeof(float) * 4;
+   const unsigned char *data;
+   unsigned char type;
+   unsigned int i;
+   size_t weight;
+
+   mmd_pmx_enter(pmx, MMD_SECTION_VERTEX);
+
+   if (mmd_pmx_count(pmx, &pmx->num_vertices) != RETURN_OK)
+      return RETURN_FAIL;
+
+   pmx->vertices = pmx->offset;
+   for (i = 0; i < pmx->num_vertices; ++i) {
+      if (mmd_pmx_skip(pmx, 1, base) != RETURN_OK || mmd_pmx_byte(pmx, &type) != RETURN_OK)
+         return RETURN_FAIL;
+
+      /* weight record and edge scale */
+      if (!(weight = mmd_pmx_weight_size(type, bone)) || mmd_pmx_skip(pmx, 1, weight + sizeof(float)) != RETURN_OK)
+         return RETURN_FAIL;
+   }
+
+   mmd_pmx_enter(pmx, MMD_SECTION_INDEX);
+
+   if (mmd_pmx_count(pmx, &pmx->num_indices) != RETURN_OK)
+      return RETURN_FAIL;
+
+   pmx->indices = pmx->offset;
+   if (mmd_pmx_skip(pmx, pmx->num_indices, width) != RETURN_OK)
+      return RETURN_FAIL;
+
+   data = pmx->data + pmx->indices;
+   for (i = 0; width == 4 && i < pmx->num_indices && !pmx->wide_indices; ++i)
+      pmx->wide_indices = (mmd_u32(data + i * width) > 0xFFFF);
+
+   return RETURN_OK;
+}
+
+/* \brief walk textures and materials */
+static int mmd_pmx_scan_materials(mmd_pmx *pmx)
+{
+   const size_t texture = pmx->globals[MMD_PMX_TEXTURE_INDEX];
+   mmd_pmx_text skip;
+   unsigned char toon;
+   unsigned int i;
+   int32_t index;
+
+   /* textures are read with the materials */
+   mmd_pmx_enter(pmx, MMD_SECTION_MATERIAL);
+
+   if (mmd_pmx_count(pmx, &pmx->num_textures) != RETURN_OK ||
+       !(pmx->textures = mmd_pmx_calloc(pmx, pmx->num_textures + 1, sizeof(mmd_pmx_text))))
+      return RETURN_FAIL;
+
+   for (i = 0; i < pmx->num_textures; ++i)
+      if (mmd_pmx_text_read(pmx, &pmx->textures[i]) != RETURN_OK)
+         return RETURN_FAIL;
+
+   if (mmd_pmx_count(pmx, &pmx->num_materials) != RETURN_OK)
+      return RETURN_FAIL;
+
+   pmx->materials = pmx->offset;
+   for (i = 0; i < pmx->num_materials; ++i) {
+      /* names, colors, flags and edge, then texture, sphere, sphere mode and toon */
+      if (mmd_pmx_text_read(pmx, &skip) != RETURN_OK ||
+          mmd_pmx_text_read(pmx, &skip) != RETURN_OK ||
+          mmd_pmx_skip(pmx, 1, sizeof(float) * 11 + 1 + sizeof(float) * 5) != RETURN_OK ||
+          mmd_pmx_index_read(pmx, MMD_PMX_TEXTURE_INDEX, &index) != RETURN_OK ||
+          mmd_pmx_skip(pmx, 1, texture + 1) != RETURN_OK ||
+          mmd_pmx_byte(pmx, &toon) != RETURN_OK ||
+          mmd_pmx_skip(pmx, 1, (toon ? 1 : texture)) != RETURN_OK ||
+          mmd_pmx_text_read(pmx, &skip) != RETURN_OK ||
+          mmd_pmx_skip(pmx, 1, sizeof(uint32_t)) != RETURN_OK)
+         return RETURN_FAIL;
+
+      if (index >= 0 && (unsigned int)index < pmx->num_textures)
+         mmd_pmx_add_string(pmx, &pmx->textures[index]);
+      else
+         pmx->string_bytes[MMD_SECTION_MATERIAL]++;
+   }
+
+   return RETURN_OK;
+}
+
+/* \brief walk bones and their IK */
+static int mmd_pmx_scan_bones(mmd_pmx *pmx)
+{
+   const size_t bone = pmx->globals[MMD_PMX_BONE_INDEX];
+   const unsigned char *data;
+   mmd_pmx_text name, skip;
+   unsigned int i, l, links, flags;
+   unsigned char limits;
+
+   /* IK is part of the bones */
+   mmd_pmx_enter(pmx, MMD_SECTION_BONE);
+
+   if (mmd_pmx_count(pmx, &pmx->num_bones) != RETURN_OK || pmx->num_bones > 0xFFFF)
+      return RETURN_FAIL;
+
+   pmx->bones = pmx->offset;
+   for (i = 0; i < pmx->num_bones; ++i) {
+      /* names, position, parent and layer */
+      if (mmd_pmx_text_read(pmx, &name) != RETURN_OK ||
+          mmd_pmx_text_read(pmx, &skip) != RETURN_OK ||
+          mmd_pmx_skip(pmx, 1, sizeof(float) * 3 + bone + sizeof(uint32_t)) != RETURN_OK ||
+          !(data = mmd_pmx_take(pmx, sizeof(uint16_t))))
+         return RETURN_FAIL;
+
+      mmd_pmx_add_string(pmx, &name);
+      flags = mmd_u16(data);
+
+      if (mmd_pmx_skip(pmx, 1, (flags & MMD_PMX_BONE_TAIL_INDEX ? bone : sizeof(float) * 3)) != RETURN_OK ||
+          ((flags & (MMD_PMX_BONE_INHERIT_ROTATION | MMD_PMX_BONE_INHERIT_TRANSLATION)) && mmd_pmx_skip(pmx, 1, bone + sizeof(float)) != RETURN_OK) ||
+          ((flags & MMD_PMX_BONE_FIXED_AXIS) && mmd_pmx_skip(pmx, 1, sizeof(float) * 3) != RETURN_OK) ||
+          ((flags & MMD_PMX_BONE_LOCAL_AXIS) && mmd_pmx_skip(pmx, 1, sizeof(float) * 6) != RETURN_OK) ||
+          ((flags & MMD_PMX_BONE_EXTERNAL_PARENT) && mmd_pmx_skip(pmx, 1, sizeof(uint32_t)) != RETURN_OK))
+         return RETURN_FAIL;
+
+      if (!(flags & MMD_PMX_BONE_IK))
+         continue;
+
+      /* target, loop count, limit angle and links */
+      if (mmd_pmx_skip(pmx, 1, bone + sizeof(uint32_t) + sizeof(float)) != RETURN_OK ||
+          mmd_pmx_count(pmx, &links) != RETURN_OK)
+         return RETURN_FAIL;
+
+      for (l = 0; l < links; ++l) {
+         if (mmd_pmx_skip(pmx, 1, bone) != RETURN_OK || mmd_pmx_byte(pmx, &limits) != RETURN_OK ||
+             (limits && mmd_pmx_skip(pmx, 1, sizeof(float) * 6) != RETURN_OK))
+            return RETURN_FAIL;
+      }
+
+      pmx->num_ik++;
+      pmx->num_ik_links += (links < MMD_PMX_MAX_U8 ? links : MMD_PMX_MAX_U8);
+   }
+
+   return (pmx->num_ik <= 0xFFFF ? RETURN_OK : RETURN_FAIL);
+}
+
+/* \brief walk morphs and find the skins they become */
+static int mmd_pmx_scan_morphs(mmd_pmx *pmx)
+{
+   const size_t width = pmx->globals[MMD_PMX_MORPH_INDEX];
+   mmd_pmx_morph *morph, *child;
+   mmd_pmx_text skip;
+   unsigned int i, o;
+   int32_t index;
+   size_t size;
+
+   mmd_pmx_enter(pmx, MMD_SECTION_SKIN);
+
+   if (mmd_pmx_count(pmx, &pmx->num_morphs) != RETURN_OK ||
+       !(pmx->morphs = mmd_pmx_calloc(pmx, pmx->num_morphs + 1, sizeof(mmd_pmx_morph))))
+      return RETURN_FAIL;
+
+   for (i = 0; i < pmx->num_morphs; ++i) {
+      morph = &pmx->morphs[i];
+      morph->skin = MMD_PMX_NONE;
+
+      if (mmd_pmx_text_read(pmx, &morph->name) != RETURN_OK ||
+          mmd_pmx_text_read(pmx, &skip) != RETURN_OK ||
+          mmd_pmx_byte(pmx, &morph->panel) != RETURN_OK ||
+          mmd_pmx_byte(pmx, &morph->type) != RETURN_OK ||
+          mmd_pmx_count(pmx, &morph->count) != RETURN_OK)
+         return RETURN_FAIL;
+
+      morph->offsets = pmx->data + pmx->offset;
+      if (!(size = mmd_pmx_morph_size(pmx, morph->type)) || mmd_pmx_skip(pmx, morph->count, size) != RETURN_OK)
+         return RETURN_FAIL;
+   }
+
+   /* vertex morphs, and groups of them, become skins.
+    * groups can not contain groups, so one level is enough */
+   for (i = 0; i < pmx->num_morphs; ++i) {
+      morph = &pmx->morphs[i];
+
+      if (morph->type == MMD_PMX_MORPH_VERTEX) {
+         morph->num_skin_vertices = morph->count;
+      } else if (morph->type == MMD_PMX_MORPH_GROUP) {
+         for (o = 0; o < morph->count; ++o) {
+            index = mmd_pmx_index(morph->offsets + o * (width + sizeof(float)), (unsigned int)width);
+            child = (index >= 0 && (unsigned int)index < pmx->num_morphs ? &pmx->morphs[index] : NULL);
+
+            if (child && child->type == MMD_PMX_MORPH_VERTEX) {
+               if (morph->num_skin_vertices > ~0u - child->count)
+                  return RETURN_FAIL;
+
+               morph->num_skin_vertices += child->count;
+            }
+         }
+
+         if (!morph->num_skin_vertices)
+            continue;
+      } else {
+         continue;
+      }
+
+      if (pmx->num_skins >= 0xFFFF)
+         return RETURN_FAIL;
+
+      morph->skin = pmx->num_skins++;
+      pmx->num_skin_vertices += morph->num_skin_vertices;
+      mmd_pmx_add_string(pmx, &morph->name);
+   }
+
+   return RETURN_OK;
+}
+
+/* \brief walk display frames */
+static int mmd_pmx_scan_frames(mmd_pmx *pmx)
+{
+   mmd_pmx_text name, skip;
+   unsigned int i, e, count;
+   unsigned char special, type;
+   int32_t index;
+
+   /* frames become skin displays and bone names */
+   mmd_pmx_enter(pmx, MMD_SECTION_SKIN_DISPLAY);
+
+   if (mmd_pmx_count(pmx, &pmx->num_frames) != RETURN_OK)
+      return RETURN_FAIL;
+
+   pmx->frames = pmx->offset;
+   for (i = 0; i < pmx->num_frames; ++i) {
+      if (mmd_pmx_text_read(pmx, &name) != RETURN_OK ||
+          mmd_pmx_text_read(pmx, &skip) != RETURN_OK ||
+          mmd_pmx_byte(pmx, &special) != RETURN_OK ||
+          mmd_pmx_count(pmx, &count) != RETURN_OK)
+         return RETURN_FAIL;
+
+      /* root and expression frames are built in, the rest name bone groups */
+      if (!special && pmx->num_bone_names < MMD_PMX_MAX_U8) {
+         pmx->num_bone_names++;
+         mmd_pmx_add_string(pmx, &name);
+      }
+
+      for (e = 0; e < count; ++e) {
+         if (mmd_pmx_byte(pmx, &type) != RETURN_OK ||
+             mmd_pmx_index_read(pmx, (type ? MMD_PMX_MORPH_INDEX : MMD_PMX_BONE_INDEX), &index) != RETURN_OK)
+            return RETURN_FAIL;
+
+         if (type && index >= 0 && (unsigned int)index < pmx->num_morphs &&
+             pmx->morphs[index].skin != MMD_PMX_NONE && pmx->num_skin_displays < MMD_PMX_MAX_U8)
+            pmx->num_skin_displays++;
+      }
+   }
+
+   return RETURN_OK;
+}
+
+/* \brief walk the sections that are decoded, validating every size */
+static int mmd_pmx_scan(mmd_pmx *pmx)
+{
+   if (mmd_pmx_scan_header(pmx) != RETURN_OK ||
+       mmd_pmx_scan_mesh(pmx) != RETURN_OK ||
+       mmd_pmx_scan_materials(pmx) != RETURN_OK ||
+       mmd_pmx_scan_bones(pmx) != RETURN_OK ||
+       mmd_pmx_scan_morphs(pmx) != RETURN_OK ||
+       mmd_pmx_scan_frames(pmx) != RETURN_OK)
+      return RETURN_FAIL;
+
+   /* rigid bodies and joints follow, they are not read */
+   pmx->end = pmx->offset;
+   return RETURN_OK;
+}
+
+/* \brief sections decoded for mask, bones carry IK and
+ * display frames carry both skin displays and bone names */
+static unsigned int mmd_pmx_sections(unsigned int sections)
+{
+   const unsigned int bones = (1 << MMD_SECTION_BONE) | (1 << MMD_SECTION_IK);
+   const unsigned int frames = (1 << MMD_SECTION_SKIN_DISPLAY) | (1 << MMD_SECTION_BONE_NAME);
+
+   if (sections & bones) sections |= bones;
+   if (sections & frames) sections |= frames;
+   return sections;
+}
+
+/* \brief arena footprint of decoded sections, same as mmd_footprint for PMD */
+static int mmd_pmx_footprint(const mmd_pmx *pmx, int strings, unsigned int sections, size_t *out_footprint)
+{
+   size_t footprint = 0;
+   unsigned int s;
+   int ret = RETURN_OK;
+
+   for (s = 0; strings && s < MMD_SECTION_LAST; ++s)
+      if (sections & (1 << s))
+         ret |= mmd_footprint_add(&footprint, 1, pmx->string_bytes[s]);
+
+   if (sections & (1 << MMD_SECTION_VERTEX)) {
+      ret |= mmd_footprint_add(&footprint, pmx->num_vertices, 3 * sizeof(float));
+      ret |= mmd_footprint_add(&footprint, pmx->num_vertices, 3 * sizeof(float));
+      ret |= mmd_footprint_add(&footprint, pmx->num_vertices, 2 * sizeof(float));
+      ret |= mmd_footprint_add(&footprint, pmx->num_vertices, sizeof(mmd_weight));
+   }
+
+   if (sections & (1 << MMD_SECTION_INDEX))
+      ret |= mmd_footprint_add(&footprint, pmx->num_indices, (pmx->wide_indices ? sizeof(uint32_t) : sizeof(uint16_t)));
+
+   if (sections & (1 << MMD_SECTION_MATERIAL))
+      ret |= mmd_footprint_add(&footprint, pmx->num_materials, sizeof(mmd_material));
+
+   if (sections & (1 << MMD_SECTION_BONE)) {
+      ret |= mmd_footprint_add(&footprint, pmx->num_bones, sizeof(mmd_bone));
+      ret |= mmd_footprint_add(&footprint, pmx->num_ik, sizeof(mmd_ik) + MMD_ARENA_ALIGN);
+      ret |= mmd_footprint_add(&footprint, pmx->num_ik_links, sizeof(unsigned short));
+   }
+
+   if (sections & (1 << MMD_SECTION_SKIN)) {
+      ret |= mmd_footprint_add(&footprint, pmx->num_skins, sizeof(mmd_skin) + MMD_ARENA_ALIGN);
+      ret |= mmd_footprint_add(&footprint, pmx->num_skin_vertices, sizeof(mmd_skin_vertex));
+   }
+
+   if (sections & (1 << MMD_SECTION_SKIN_DISPLAY)) {
+      ret |= mmd_footprint_add(&footprint, pmx->num_skin_displays, sizeof(unsigned int));
+      ret |= mmd_footprint_add(&footprint, pmx->num_bone_names, sizeof(mmd_bone_name));
+   }
+
+   *out_footprint = footprint;
+   return (ret == RETURN_OK ? RETURN_OK : RETURN_FAIL);
+}
+
+/* \brief convert UTF16LE text to UTF8 buffer of pmx, returns length */
+static int mmd_pmx_utf16(mmd_pmx *pmx, const mmd_pmx_text *text, size_t *out_size)
+{
+   const size_t units = text->size / 2;
+   unsigned int c, low;
+   size_t i, size = 0;
+   char *tmp;
+
+   /* contents are not kept, so scratch needs no realloc */
+   if (units * 3 + 1 > pmx->utf8_size) {
+      mmd_count_alloc(pmx->mmd, units * 3 + 1);
+
+      if (!(tmp = mmd_scratch_alloc(pmx->mmd, units * 3 + 1))) {
+         mmd_fail_span(pmx->mmd, MMD_ERROR_MEMORY);
+         return RETURN_FAIL;
+      }
+
+      mmd_scratch_free(pmx->mmd, pmx->utf8);
+      pmx->utf8 = tmp;
+      pmx->utf8_size = units * 3 + 1;
+   }
+
+   for (i = 0; i < units; ++i) {
+      c = mmd_u16(text->data + i * 2);
+
+      /* surrogate pair, unpaired halves become U+FFFD */
+      if (c >= 0xD800 && c < 0xDC00 && i + 1 < units && (low = mmd_u16(text->data + i * 2 + 2)) >= 0xDC00 && low < 0xE000) {
+         c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+         ++i;
+      } else if (c >= 0xD800 && c < 0xE000) {
+         c = 0xFFFD;
+      }
+
+      if (c < 0x80) {
+         pmx->utf8[size++] = (char)c;
+      } else if (c < 0x800) {
+         pmx->utf8[size++] = (char)(0xC0 | (c >> 6));
+         pmx->utf8[size++] = (char)(0x80 | (c & 0x3F));
+      } else if (c < 0x10000) {
+         pmx->utf8[size++] = (char)(0xE0 | (c >> 12));
+         pmx->utf8[size++] = (char)(0x80 | ((c >> 6) & 0x3F));
+         pmx->utf8[size++] = (char)(0x80 | (c & 0x3F));
+      } else {
+         pmx->utf8[size++] = (char)(0xF0 | (c >> 18));
+         pmx->utf8[size++] = (char)(0x80 | ((c >> 12) & 0x3F));
+         pmx->utf8[size++] = (char)(0x80 | ((c >> 6) & 0x3F));
+         pmx->utf8[size++] = (char)(0x80 | (c & 0x3F));
+      }
+   }
+
+   *out_size = size;
+   return RETURN_OK;
+}
+
+/* \brief name of mmd from text in file encoding */
+static int mmd_pmx_name(mmd_pmx *pmx, mmd_data *mmd, const mmd_pmx_text *text, const char **name, mmd_string *id)
+{
+   size_t size;
+
+   if (pmx->globals[MMD_PMX_ENCODING])
+      return mmd_name_utf8(mmd, (const char*)text->data, text->size, name, id);
+
+   if (mmd_pmx_utf16(pmx, text, &size) != RETURN_OK)
+      return RETURN_FAIL;
+
+   return mmd_name_utf8(mmd, pmx->utf8, size, name, id);
+}
+
+/* \brief write PMD bone indices and weight for PMX weight record */
+static int mmd_pmx_weight(const unsigned char *data, unsigned char type, unsigned int width, unsigned char *out)
+{
+   int32_t bones[4] = { -1, -1, -1, -1 };
+   float weights[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, sum;
+   unsigned int i, a = 0, b = 1, percent;
+
+   switch (type) {
+      case MMD_PMX_BDEF1:
+         bones[0] = mmd_pmx_index(data, width);
+         weights[0] = 1.0f;
+         break;
+
+      case MMD_PMX_BDEF2:
+      case MMD_PMX_SDEF:
+         bones[0] = mmd_pmx_index(data, width);
+         bones[1] = mmd_pmx_index(data + width, width);
+         weights[0] = mmd_f32(data + width * 2);
+         weights[1] = 1.0f - weights[0];
+         break;
+
+      default:
+         for (i = 0; i < 4; ++i) {
+            bones[i] = mmd_pmx_index(data + width * i, width);
+            weights[i] = mmd_f32(data + width * 4 + sizeof(float) * i);
+         }
+         break;
+   }
+
+   for (i = 0; i < 4; ++i)
+      weights[i] = (bones[i] >= 0 && weights[i] > 0.0f ? weights[i] : 0.0f);
+
+   /* PMD blends two bones, keep the heaviest two */
+   for (i = 1; i < 4; ++i)
+      a = (weights[i] > weights[a] ? i : a);
+
+   b = (a ? 0 : 1);
+   for (i = 0; i < 4; ++i)
+      b = (i != a && weights[i] > weights[b] ? i : b);
+
+   if (bones[a] > 0xFFFF || bones[b] > 0xFFFF)
+      return RETURN_FAIL;
+
+   if (bones[a] < 0)
+      bones[a] = 0;
+
+   if (bones[b] < 0 || weights[b] <= 0.0f)
+      bones[b] = bones[a];
+
+   sum = weights[a] + weights[b];
+   percent = (sum > 0.0f ? (unsigned int)(weights[a] / sum * 100.0f + 0.5f) : 100);
+
+   out[0] = (unsigned char)(bones[a] & 0xFF);
+   out[1] = (unsigned char)(bones[a] >> 8);
+   out[2] = (unsigned char)(bones[b] & 0xFF);
+   out[3] = (unsigned char)(bones[b] >> 8);
+   out[4] = (unsigned char)(percent < 100 ? percent : 100);
+   return RETURN_OK;
+}
+
+/* \brief decode vertices, repacked to PMD records chunk by chunk */
+static int mmd_pmx_decode_vertices(mmd_pmx *pmx, mmd_data *mmd)
+{
+   const unsigned int bone = pmx->globals[MMD_PMX_BONE_INDEX];
+   const size_t base = MMD_PMX_VERTEX_BASE_SIZE + pmx->globals[MMD_PMX_ADDITIONAL_UVS] * sizeof(float) * 4;
+   unsigned char chunk[MMD_PMX_VERTEX_CHUNK * MMD_VERTEX_SIZE], *out;
+   const unsigned char *data;
+   unsigned int first, i, count;
+   unsigned char type;
+
+   mmd->num_vertices = pmx->num_vertices;
+   if (mmd_alloc_section(mmd, MMD_SECTION_VERTEX) != RETURN_OK)
+      return RETURN_FAIL;
+
+   pmx->offset = pmx->vertices;
+   for (first = 0; first < pmx->num_vertices; first += count) {
+      count = (pmx->num_vertices - first < MMD_PMX_VERTEX_CHUNK ? pmx->num_vertices - first : MMD_PMX_VERTEX_CHUNK);
+
+      for (i = 0, out = chunk; i < count; ++i, out += MMD_VERTEX_SIZE) {
+         /* position, normal and uv, additional uvs are skipped */
+         data = mmd_pmx_take(pmx, base);
+         memcpy(out, data, MMD_PMX_VERTEX_BASE_SIZE);
+
+         type = *mmd_pmx_take(pmx, 1);
+         data = mmd_pmx_take(pmx, mmd_pmx_weight_size(type, bone));
+         if (mmd_pmx_weight(data, type, bone, out + MMD_PMX_VERTEX_BASE_SIZE) != RETURN_OK)
+            return RETURN_FAIL;
+
+         /* edge scale, PMD has edge disable flag */
+         data = mmd_pmx_take(pmx, sizeof(float));
+         out[MMD_VERTEX_SIZE - 1] = (mmd_f32(data) == 0.0f);
+      }
+
+      mmd_decode_vertices_bounded(chunk, count, &mmd->vertices[first * 3], &mmd->normals[first * 3],
+                                  &mmd->coords[first * 2], &mmd->weights[first], &mmd->bounds);
+   }
+
+   mmd_bounds_tighten(&mmd->bounds);
+   return RETURN_OK;
+}
+
+/* \brief decode indices, 16-bit unless they do not fit */
+static int mmd_pmx_decode_indices(mmd_pmx *pmx, mmd_data *mmd)
+{
+   const unsigned int width = pmx->globals[MMD_PMX_VERTEX_INDEX];
+   const unsigned char *data = pmx->data + pmx->indices;
+   unsigned int i;
+
+   mmd->num_indices = pmx->num_indices;
+
+   if (pmx->wide_indices) {
+      if ((mmd->indices32 = mmd_view(mmd, data, sizeof(uint32_t))))
+         return RETURN_OK;
+
+      if (!(mmd->indices32 = mmd_calloc(mmd, mmd->num_indices, sizeof(uint32_t))))
+         return RETURN_FAIL;
+
+      for (i = 0; i < mmd->num_indices; ++i)
+         mmd->indices32[i] = mmd_u32(data + i * sizeof(uint32_t));
+
+      return RETURN_OK;
+   }
+
+   if (width == sizeof(uint16_t) && (mmd->indices = mmd_view(mmd, data, sizeof(uint16_t))))
+      return RETURN_OK;
+
+   if (mmd_alloc_section(mmd, MMD_SECTION_INDEX) != RETURN_OK)
+      return RETURN_FAIL;
+
+   if (width == sizeof(uint16_t)) {
+      mmd_u16v(mmd->indices, data, mmd->num_indices);
+      return RETURN_OK;
+   }
+
+   for (i = 0; i < mmd->num_indices; ++i)
+      mmd->indices[i] = (unsigned short)mmd_pmx_vertex_index(data + i * width, width);
+
+   return RETURN_OK;
+}
+
+/* \brief decode materials */
+static int mmd_pmx_decode_materials(mmd_pmx *pmx, mmd_data *mmd)
+{
+   const unsigned int texture = pmx->globals[MMD_PMX_TEXTURE_INDEX];
+   static const mmd_pmx_text none = { (const unsigned char*)"", 0 };
+   const unsigned char *data;
+   const char *name = NULL;
+   mmd_material *material;
+   mmd_pmx_text skip;
+   unsigned char flags = 0, toon = 0;
+   unsigned int i;
+   int32_t index = -1;
+
+   mmd->num_materials = pmx->num_materials;
+   if (mmd_alloc_section(mmd, MMD_SECTION_MATERIAL) != RETURN_OK)
+      return RETURN_FAIL;
+
+   pmx->offset = pmx->materials;
+   for (i = 0; i < mmd->num_materials; ++i) {
+      material = &mmd->materials[i];
+
+      /* local and universal names, no counterpart */
+      mmd_pmx_text_read(pmx, &skip);
+      mmd_pmx_text_read(pmx, &skip);
+
+      /* 4xFLOAT: diffuse and alpha, 3xFLOAT: specular, FLOAT: power, 3xFLOAT: ambient */
+      data = mmd_pmx_take(pmx, sizeof(float) * 11);
+      mmd_f32v(material->diffuse, data, 3);
+      material->alpha = mmd_f32(data + sizeof(float) * 3);
+      mmd_f32v(material->specular, data + sizeof(float) * 4, 3);
+      material->power = mmd_f32(data + sizeof(float) * 7);
+      mmd_f32v(material->ambient, data + sizeof(float) * 8, 3);
+
+      /* uint8_t: drawing flags, 0x10 draws edge. edge color and size follow */
+      mmd_pmx_byte(pmx, &flags);
+      material->edge = ((flags & 0x10) != 0);
+      mmd_pmx_take(pmx, sizeof(float) * 5);
+
+      /* texture, sphere texture and sphere mode */
+      mmd_pmx_index_read(pmx, MMD_PMX_TEXTURE_INDEX, &index);
+      mmd_pmx_take(pmx, texture + 1);
+
+      /* shared toon is toon index of PMD, toon textures are not */
+      mmd_pmx_byte(pmx, &toon);
+      data = mmd_pmx_take(pmx, (toon ? 1 : texture));
+      material->toon = (toon ? *data : 0xFF);
+
+      /* memo, and face index count */
+      mmd_pmx_text_read(pmx, &skip);
+      material->face = mmd_u32(mmd_pmx_take(pmx, sizeof(uint32_t)));
+
+      if (mmd_pmx_name(pmx, mmd, (index >= 0 && (unsigned int)index < pmx->num_textures ? &pmx->textures[index] : &none),
+                       &name, &material->texture_id) != RETURN_OK)
+         return RETURN_FAIL;
+
+      material->texture = (char*)name;
+   }
+
+   return RETURN_OK;
+}
+
+/* \brief PMD bone type closest to PMX bone flags */
+static unsigned char mmd_pmx_bone_type(unsigned int flags)
+{
+   if (flags & MMD_PMX_BONE_IK)
+      return MMD_PMX_PMD_IK;
+
+   if (flags & MMD_PMX_BONE_INHERIT_ROTATION)
+      return MMD_PMX_PMD_INHERIT;
+
+   if (flags & MMD_PMX_BONE_FIXED_AXIS)
+      return MMD_PMX_PMD_TWIST;
+
+   if (!(flags & MMD_PMX_BONE_VISIBLE))
+      return MMD_PMX_PMD_INVISIBLE;
+
+   return (flags & MMD_PMX_BONE_MOVABLE ? MMD_PMX_PMD_MOVE : MMD_PMX_PMD_ROTATE);
+}
+
+/* \brief decode IK of bone, input is at IK target */
+static int mmd_pmx_decode_ik(mmd_pmx *pmx, mmd_data *mmd, mmd_ik *ik, unsigned int bone)
+{
+   const unsigned int width = pmx->globals[MMD_PMX_BONE_INDEX];
+   const unsigned char *data;
+   unsigned int l, links = 0, loops;
+   unsigned char limits = 0;
+   int32_t index = -1;
+
+   ik->bone_index = (unsigned short)bone;
+
+   mmd_pmx_index_read(pmx, MMD_PMX_BONE_INDEX, &index);
+   ik->target_bone_index = mmd_pmx_u16(index, 0);
+
+   /* limit angle is in radians, cotrol weight in units of pi */
+   data = mmd_pmx_take(pmx, sizeof(uint32_t) + sizeof(float));
+   loops = mmd_u32(data);
+   ik->iterations = (unsigned short)(loops < 0xFFFF ? loops : 0xFFFF);
+   ik->cotrol_weight = mmd_f32(data + sizeof(uint32_t)) / 3.14159265358979f;
+
+   mmd_pmx_count(pmx, &links);
+   ik->chain_length = (unsigned char)(links < MMD_PMX_MAX_U8 ? links : MMD_PMX_MAX_U8);
+
+   if (!(ik->child_bone_index = mmd_calloc(mmd, ik->chain_length, sizeof(unsigned short))))
+      return RETURN_FAIL;
+
+   /* links start next to target, as PMD chains */
+   for (l = 0; l < links; ++l) {
+      data = mmd_pmx_take(pmx, width);
+      if (l < ik->chain_length)
+         ik->child_bone_index[l] = mmd_pmx_u16(mmd_pmx_index(data, width), 0);
+
+      mmd_pmx_byte(pmx, &limits);
+      if (limits)
+         mmd_pmx_take(pmx, sizeof(float) * 6);
+   }
+
+   return RETURN_OK;
+}
+
+/* \brief decode bones and IK */
+static int mmd_pmx_decode_bones(mmd_pmx *pmx, mmd_data *mmd)
+{
+   const unsigned int width = pmx->globals[MMD_PMX_BONE_INDEX];
+   const unsigned char *data;
+   mmd_pmx_text name, skip;
+   unsigned int i, flags, ik = 0;
+   mmd_bone *bone;
+   int32_t index = -1;
+
+   mmd->num_bones = (unsigned short)pmx->num_bones;
+   mmd->num_ik = (unsigned short)pmx->num_ik;
+   if (mmd_alloc_section(mmd, MMD_SECTION_BONE) != RETURN_OK || mmd_alloc_section(mmd, MMD_SECTION_IK) != RETURN_OK)
+      return RETURN_FAIL;
+
+   pmx->offset = pmx->bones;
+   for (i = 0; i < mmd->num_bones; ++i) {
+      bone = &mmd->bones[i];
+
+      mmd_pmx_text_read(pmx, &name);
+      mmd_pmx_text_read(pmx, &skip);
+
+      if (mmd_pmx_name(pmx, mmd, &name, &bone->name, &bone->name_id) != RETURN_OK)
+         return RETURN_FAIL;
+
+      /* 3xFLOAT: position, parent, layer and uint16_t: flags */
+      mmd_f32v(bone->head_pos, mmd_pmx_take(pmx, sizeof(float) * 3), 3);
+      mmd_pmx_index_read(pmx, MMD_PMX_BONE_INDEX, &index);
+      bone->parent_bone_index = mmd_pmx_u16(index, MMD_BONE_NONE);
+      mmd_pmx_take(pmx, sizeof(uint32_t));
+      flags = mmd_u16(mmd_pmx_take(pmx, sizeof(uint16_t)));
+      bone->type = mmd_pmx_bone_type(flags);
+
+      /* tail is bone or offset, PMD only has bones */
+      data = mmd_pmx_take(pmx, (flags & MMD_PMX_BONE_TAIL_INDEX ? width : sizeof(float) * 3));
+      bone->tail_pos_bone_index = (flags & MMD_PMX_BONE_TAIL_INDEX ? mmd_pmx_u16(mmd_pmx_index(data, width), 0) : 0);
+
+      /* inheriting bone is in ik parent field of PMD */
+      if (flags & (MMD_PMX_BONE_INHERIT_ROTATION | MMD_PMX_BONE_INHERIT_TRANSLATION)) {
+         data = mmd_pmx_take(pmx, width + sizeof(float));
+         bone->ik_parend_bone_index = mmd_pmx_u16(mmd_pmx_index(data, width), 0);
+      }
+
+      if (flags & MMD_PMX_BONE_FIXED_AXIS)
+         mmd_pmx_take(pmx, sizeof(float) * 3);
+
+      if (flags & MMD_PMX_BONE_LOCAL_AXIS)
+         mmd_pmx_take(pmx, sizeof(float) * 6);
+
+      if (flags & MMD_PMX_BONE_EXTERNAL_PARENT)
+         mmd_pmx_take(pmx, sizeof(uint32_t));
+
+      if ((flags & MMD_PMX_BONE_IK) && mmd_pmx_decode_ik(pmx, mmd, &mmd->ik[ik++], i) != RETURN_OK)
+         return RETURN_FAIL;
+   }
+
+   mmd_bone_bounds(mmd);
+   return RETURN_OK;
+}
+
+/* \brief append offsets of vertex morph to skin vertices, scaled by amount */
+static mmd_skin_vertex* mmd_pmx_skin_vertices(const mmd_pmx *pmx, const mmd_pmx_morph *morph, float amount, mmd_skin_vertex *out)
+{
+   const unsigned int width = pmx->globals[MMD_PMX_VERTEX_INDEX];
+   const size_t size = width + sizeof(float) * 3;
+   unsigned int o, c;
+
+   for (o = 0; o < morph->count; ++o, ++out) {
+      out->index = mmd_pmx_vertex_index(morph->offsets + o * size, width);
+      mmd_f32v(out->translation, morph->offsets + o * size + width, 3);
+
+      for (c = 0; c < 3; ++c)
+         out->translation[c] *= amount;
+   }
+
+   return out;
+}
+
+/* \brief decode vertex and group morphs to skins */
+static int mmd_pmx_decode_morphs(mmd_pmx *pmx, mmd_data *mmd)
+{
+   const unsigned int width = pmx->globals[MMD_PMX_MORPH_INDEX];
+   const mmd_pmx_morph *morph, *child;
+   mmd_skin_vertex *out;
+   mmd_skin *skin;
+   unsigned int i, o;
+   int32_t index;
+
+   mmd->num_skins = (unsigned short)pmx->num_skins;
+   if (mmd_alloc_section(mmd, MMD_SECTION_SKIN) != RETURN_OK)
+      return RETURN_FAIL;
+
+   for (i = 0; i < pmx->num_morphs; ++i) {
+      morph = &pmx->morphs[i];
+      if (morph->skin == MMD_PMX_NONE)
+         continue;
+
+      skin = &mmd->skin[morph->skin];
+      if (mmd_pmx_name(pmx, mmd, &morph->name, &skin->name, &skin->name_id) != RETURN_OK)
+         return RETURN_FAIL;
+
+      /* panels eyebrow, eye, lip and other are PMD skin types,
+       * system panel has no counterpart and base skin is not used */
+      skin->type = (morph->panel >= MMD_SKIN_EYEBROW && morph->panel <= MMD_SKIN_OTHER ? morph->panel : MMD_SKIN_OTHER);
+      skin->num_vertices = morph->num_skin_vertices;
+
+      if (!(skin->vertices = out = mmd_calloc(mmd, skin->num_vertices, sizeof(mmd_skin_vertex))))
+         return RETURN_FAIL;
+
+      if (morph->type == MMD_PMX_MORPH_VERTEX) {
+         mmd_pmx_skin_vertices(pmx, morph, 1.0f, out);
+         continue;
+      }
+
+      /* group is sum of its vertex morphs, duplicates are merged by morpher */
+      for (o = 0; o < morph->count; ++o) {
+         index = mmd_pmx_index(morph->offsets + o * (width + sizeof(float)), width);
+         child = (index >= 0 && (unsigned int)index < pmx->num_morphs ? &pmx->morphs[index] : NULL);
+
+         if (child && child->type == MMD_PMX_MORPH_VERTEX)
+            out = mmd_pmx_skin_vertices(pmx, child, mmd_f32(morph->offsets + o * (width + sizeof(float)) + width), out);
+      }
+   }
+
+   return RETURN_OK;
+}
+
+/* \brief decode display frames to skin displays and bone group names */
+static int mmd_pmx_decode_frames(mmd_pmx *pmx, mmd_data *mmd)
+{
+   mmd_pmx_text name, skip;
+   unsigned int i, e, count = 0, displays = 0, names = 0;
+   unsigned char special = 0, type = 0;
+   int32_t index = -1;
+
+   mmd->num_skin_displays = (unsigned char)pmx->num_skin_displays;
+   mmd->num_bone_names = (unsigned char)pmx->num_bone_names;
+   if (mmd_alloc_section(mmd, MMD_SECTION_SKIN_DISPLAY) != RETURN_OK || mmd_alloc_section(mmd, MMD_SECTION_BONE_NAME) != RETURN_OK)
+      return RETURN_FAIL;
+
+   pmx->offset = pmx->frames;
+   for (i = 0; i < pmx->num_frames; ++i) {
+      mmd_pmx_text_read(pmx, &name);
+      mmd_pmx_text_read(pmx, &skip);
+      mmd_pmx_byte(pmx, &special);
+      mmd_pmx_count(pmx, &count);
+
+      if (!special && names < mmd->num_bone_names &&
+          mmd_pmx_name(pmx, mmd, &name, &mmd->bone_name[names].name, &mmd->bone_name[names].name_id) != RETURN_OK)
+         return RETURN_FAIL;
+
+      names += !special;
+
+      for (e = 0; e < count; ++e) {
+         mmd_pmx_byte(pmx, &type);
+         mmd_pmx_index_read(pmx, (type ? MMD_PMX_MORPH_INDEX : MMD_PMX_BONE_INDEX), &index);
+
+         if (type && index >= 0 && (unsigned int)index < pmx->num_morphs &&
+             pmx->morphs[index].skin != MMD_PMX_NONE && displays < mmd->num_skin_displays)
+            mmd->skin_display[displays++] = pmx->morphs[index].skin;
+      }
+   }
+
+   return RETURN_OK;
+}
+
+/* \brief scan file, reserve arena and decode header names */
+static int mmd_pmx_decode_header(mmd_pmx *pmx, mmd_data *mmd, unsigned int flags, int strings, unsigned int sections)
+{
+   size_t footprint;
+   int error;
+
+   /* every size is checked here, decoding does not fail on input */
+   if (mmd_pmx_scan(pmx) != RETURN_OK) {
+      error = (pmx->error ? pmx->error : MMD_ERROR_FORMAT);
+      mmd_fail(mmd, error, pmx->section, mmd_input_offset(mmd, pmx->data) +
+               (error == MMD_ERROR_TRUNCATED ? pmx->offset : pmx->starts[pmx->section]));
+      return RETURN_FAIL;
+   }
+
+   if (flags & MMD_LOAD_ARENA) {
+      if (mmd_pmx_footprint(pmx, strings, sections, &footprint) != RETURN_OK) {
+         mmd_fail_span(mmd, MMD_ERROR_MEMORY);
+         return RETURN_FAIL;
+      }
+
+      if (mmd_reserve_arena(mmd, footprint) != RETURN_OK)
+         return RETURN_FAIL;
+   }
+
+   mmd->header.version = pmx->version;
+   if (!(sections & (1 << MMD_SECTION_HEADER)))
+      return RETURN_OK;
+
+   /* names go straight to header, so mmd_free releases name when comment fails */
+   if (mmd_pmx_name(pmx, mmd, &pmx->name, &mmd->header.name, &mmd->header.name_id) != RETURN_OK)
+      return RETURN_FAIL;
+
+   return mmd_pmx_name(pmx, mmd, &pmx->comment, &mmd->header.comment, &mmd->header.comment_id);
+}
+
+/* \brief counts of what sections of pmx become, for sections that are not decoded */
+static void mmd_pmx_set_counts(const mmd_pmx *pmx, mmd_data *mmd, unsigned int sections)
+{
+   const unsigned int counts[MMD_SECTION_LAST] = {
+      0, pmx->num_vertices, pmx->num_indices, pmx->num_materials, pmx->num_bones,
+      pmx->num_ik, pmx->num_skins, pmx->num_skin_displays, pmx->num_bone_names
+   };
+   unsigned int s;
+
+   for (s = 0; s < MMD_SECTION_LAST; ++s)
+      if (!(sections & (1 << s)))
+         mmd_set_count(mmd, s, counts[s]);
+
+   if (!(sections & (1 << MMD_SECTION_VERTEX)))
+      mmd_bounds_reset(&mmd->bounds);
+}
+
+/* \brief decode section that starts at starts[section] and ends at end,
+ * sections not in mask are left to mmd_pmx_set_counts */
+static int mmd_pmx_decode_section(mmd_pmx *pmx, mmd_data *mmd, unsigned int sections, unsigned int section, size_t end, int (*decode)(mmd_pmx*, mmd_data*))
+{
+   const size_t base = mmd_input_offset(mmd, pmx->data);
+   mmd_span span;
+   int ret;
+
+   if (!(sections & (1 << section)))
+      return RETURN_OK;
+
+   mmd_span_begin(mmd, &span, section, base + pmx->starts[section]);
+   ret = decode(pmx, mmd);
+   return mmd_span_end(&span, base + end, ret);
+}
+
+/* \brief read PMX model */
+int mmd_pmx_load(mmd_data *mmd, const unsigned char *data, size_t size, unsigned int flags, int strings, unsigned int sections, size_t *used)
+{
+   mmd_span span;
+   mmd_pmx pmx;
+   int header, ret = RETURN_FAIL;
+   assert(mmd && (data || !size) && used);
+
+   memset(&pmx, 0, sizeof(pmx));
+   pmx.mmd = mmd;
+   pmx.data = data;
+   pmx.size = size;
+
+   /* records are variable length, so the scan walks all of them anyway */
+   sections = mmd_pmx_sections(sections);
+
+   /* header span includes the scan and arena of the whole file */
+   mmd_span_begin(mmd, &span, MMD_SECTION_HEADER, mmd_input_offset(mmd, data));
+   header = mmd_pmx_decode_header(&pmx, mmd, flags, strings, sections);
+
+   if (mmd_span_end(&span, mmd_input_offset(mmd, data) + pmx.starts[MMD_SECTION_VERTEX], header) != RETURN_OK)
+      goto out;
+
+   mmd_pmx_set_counts(&pmx, mmd, sections);
+
+   if (mmd_pmx_decode_section(&pmx, mmd, sections, MMD_SECTION_VERTEX, pmx.starts[MMD_SECTION_INDEX], mmd_pmx_decode_vertices) != RETURN_OK ||
+       mmd_pmx_decode_section(&pmx, mmd, sections, MMD_SECTION_INDEX, pmx.starts[MMD_SECTION_MATERIAL], mmd_pmx_decode_indices) != RETURN_OK ||
+       mmd_pmx_decode_section(&pmx, mmd, sections, MMD_SECTION_MATERIAL, pmx.starts[MMD_SECTION_BONE], mmd_pmx_decode_materials) != RETURN_OK ||
+       mmd_pmx_decode_section(&pmx, mmd, sections, MMD_SECTION_BONE, pmx.starts[MMD_SECTION_SKIN], mmd_pmx_decode_bones) != RETURN_OK ||
+       mmd_pmx_decode_section(&pmx, mmd, sections, MMD_SECTION_SKIN, pmx.starts[MMD_SECTION_SKIN_DISPLAY], mmd_pmx_decode_morphs) != RETURN_OK ||
+       mmd_pmx_decode_section(&pmx, mmd, sections, MMD_SECTION_SKIN_DISPLAY, pmx.end, mmd_pmx_decode_frames) != RETURN_OK)
+      goto out;
+
+   mmd_material_bounds(mmd);
+   *used = pmx.end;
+   ret = RETURN_OK;
+
+out:
+   mmd_scratch_free(mmd, pmx.textures);
+   mmd_scratch_free(mmd, pmx.morphs);
+   mmd_scratch_free(mmd, pmx.utf8);
+   return ret;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,284 @@
+#include "internal.h"
+#include "sjis.h"
+#include <stdlib.h>
+#include <string.h> /* for memcmp, memcpy */
+#include <assert.h> /* for assert */
+
+enum {
+   MMD_POOL_BLOCK_SIZE = 64 * 1024
+};
+
+/* \brief interned string */
+typedef struct mmd_pool_entry {
+   /* raw bytes, without padding */
+   const unsigned char *sjis;
+   size_t size;
+   uint32_t hash;
+
+   /* bytes are UTF8 already (PMX) instead of SJIS */
+   unsigned char utf8_source;
+
+   /* converted on first access */
+   char *utf8;
+} mmd_pool_entry;
+
+/* \brief storage for the raw bytes */
+typedef struct mmd_pool_block {
+   struct mmd_pool_block *next;
+   size_t used, size;
+} mmd_pool_block;
+
+struct mmd_string_pool {
+   /* guards everything below, many loaders may share the pool */
+   mmd_mutex *lock;
+
+   /* references from mmd_data and users */
+   unsigned int refs;
+
+   /* strings, handle is index + 1 */
+   mmd_pool_entry *entries;
+   unsigned int num_entries, max_entries;
+
+   /* open addressing table of handles, 0 is empty */
+   mmd_string *buckets;
+   unsigned int num_buckets;
+
+   /* raw byte storage */
+   mmd_pool_block *blocks;
+};
+
+/* \brief FNV-1a */
+static uint32_t mmd_pool_hash(const unsigned char *data, size_t size)
+{
+   uint32_t hash = 2166136261u;
+   size_t i;
+
+   for (i = 0; i < size; ++i)
+      hash = (hash ^ data[i]) * 16777619u;
+
+   return hash;
+}
+
+/* \brief copy raw bytes to block storage */
+static const unsigned char* mmd_pool_store(mmd_string_pool *pool, const unsigned char *data, size_t size)
+{
+   mmd_pool_block *block = pool->blocks;
+   unsigned char *dst;
+   size_t block_size;
+
+   if (!block || size > block->size - block->used) {
+      block_size = (size > MMD_POOL_BLOCK_SIZE ? size : MMD_POOL_BLOCK_SIZE);
+
+      if (!(block = malloc(sizeof(mmd_pool_block) + block_size)))
+         return NULL;
+
+      block->size = block_size;
+      block->used = 0;
+      block->next = pool->blocks;
+      pool->blocks = block;
+   }
+
+   dst = (unsigned char*)(block + 1) + block->used;
+   memcpy(dst, data, size);
+   block->used += size;
+   return dst;
+}
+
+/* \brief grow the hash table */
+static int mmd_pool_rehash(mmd_string_pool *pool)
+{
+   unsigned int i, b, num_buckets = (pool->num_buckets ? pool->num_buckets * 2 : 256);
+   mmd_string *buckets;
+
+   if (!(buckets = calloc(num_buckets, sizeof(mmd_string))))
+      return RETURN_FAIL;
+
+   for (i = 0; i < pool->num_entries; ++i) {
+      for (b = pool->entries[i].hash & (num_buckets - 1); buckets[b]; b = (b + 1) & (num_buckets - 1));
+      buckets[b] = i + 1;
+   }
+
+   if (pool->buckets) free(pool->buckets);
+   pool->buckets = buckets;
+   pool->num_buckets = num_buckets;
+   return RETURN_OK;
+}
+
+/* \brief create string pool */
+mmd_string_pool* mmd_string_pool_new(void)
+{
+   mmd_string_pool *pool;
+
+   if (!(pool = calloc(1, sizeof(mmd_string_pool))))
+      return NULL;
+
+   if (!(pool->lock = mmd_mutex_new())) {
+      free(pool);
+      return NULL;
+   }
+
+   pool->refs = 1;
+   return pool;
+}
+
+/* \brief add reference to string pool */
+mmd_string_pool* mmd_string_pool_ref(mmd_string_pool *pool)
+{
+   assert(pool);
+   mmd_mutex_lock(pool->lock);
+   pool->refs++;
+   mmd_mutex_unlock(pool->lock);
+   return pool;
+}
+
+/* \brief drop reference to string pool */
+void mmd_string_pool_free(mmd_string_pool *pool)
+{
+   mmd_pool_block *block, *next;
+   unsigned int i, refs;
+   assert(pool && pool->refs);
+
+   mmd_mutex_lock(pool->lock);
+   refs = --pool->refs;
+   mmd_mutex_unlock(pool->lock);
+
+   if (refs)
+      return;
+
+   for (i = 0; i < pool->num_entries; ++i)
+      if (pool->entries[i].utf8) free(pool->entries[i].utf8);
+
+   for (block = pool->blocks; block; block = next) {
+      next = block->next;
+      free(block);
+   }
+
+   if (pool->entries) free(pool->entries);
+   if (pool->buckets) free(pool->buckets);
+   mmd_mutex_free(pool->lock);
+   free(pool);
+}
+
+/* \brief intern string of size bytes, pool is locked */
+static mmd_string mmd_pool_insert(mmd_string_pool *pool, const unsigned char *sjis, size_t size, uint32_t hash, unsigned char utf8_source)
+{
+   mmd_pool_entry *entry;
+   mmd_string string;
+   unsigned int b;
+   void *tmp;
+
+   if (pool->num_buckets) {
+      for (b = hash & (pool->num_buckets - 1); (string = pool->buckets[b]); b = (b + 1) & (pool->num_buckets - 1)) {
+         entry = &pool->entries[string - 1];
+         if (entry->hash == hash && entry->size == size && entry->utf8_source == utf8_source && (!size || !memcmp(entry->sjis, sjis, size)))
+            return string;
+      }
+   }
+
+   /* keep load factor under 1/2 */
+   if ((pool->num_entries + 1) * 2 > pool->num_buckets && mmd_pool_rehash(pool) != RETURN_OK)
+      return 0;
+
+   if (pool->num_entries >= pool->max_entries) {
+      unsigned int max_entries = (pool->max_entries ? pool->max_entries * 2 : 64);
+      if (!(tmp = realloc(pool->entries, max_entries * sizeof(mmd_pool_entry))))
+         return 0;
+
+      pool->entries = tmp;
+      pool->max_entries = max_entries;
+   }
+
+   entry = &pool->entries[pool->num_entries];
+   memset(entry, 0, sizeof(mmd_pool_entry));
+   entry->hash = hash;
+   entry->size = size;
+   entry->utf8_source = utf8_source;
+
+   if (size && !(entry->sjis = mmd_pool_store(pool, sjis, size)))
+      return 0;
+
+   string = ++pool->num_entries;
+   for (b = hash & (pool->num_buckets - 1); pool->buckets[b]; b = (b + 1) & (pool->num_buckets - 1));
+   pool->buckets[b] = string;
+   return string;
+}
+
+/* \brief intern raw SJIS string of fixed width field */
+mmd_string mmd_string_pool_intern(mmd_string_pool *pool, const unsigned char *sjis, size_t size)
+{
+   mmd_string string;
+   uint32_t hash;
+   size_t b;
+   assert(pool && (sjis || !size));
+
+   /* fixed width fields are NUL padded, sometimes with garbage after */
+   for (b = 0; b < size && sjis[b]; ++b);
+   size = b;
+
+   /* hash outside the lock, it is most of the work for short names */
+   hash = mmd_pool_hash(sjis, size);
+
+   mmd_mutex_lock(pool->lock);
+   string = mmd_pool_insert(pool, sjis, size, hash, 0);
+   mmd_mutex_unlock(pool->lock);
+   return string;
+}
+
+/* \brief intern UTF8 string of size bytes */
+mmd_string mmd_string_pool_intern_utf8(mmd_string_pool *pool, const char *utf8, size_t size)
+{
+   mmd_string string;
+   uint32_t hash;
+   assert(pool && (utf8 || !size));
+
+   hash = mmd_pool_hash((const unsigned char*)utf8, size);
+
+   /* empty string is the same in both encodings */
+   mmd_mutex_lock(pool->lock);
+   string = mmd_pool_insert(pool, (const unsigned char*)utf8, size, hash, (size != 0));
+   mmd_mutex_unlock(pool->lock);
+   return string;
+}
+
+/* \brief get UTF8 string, converted on first access */
+const char* mmd_string_pool_get(mmd_string_pool *pool, mmd_string string)
+{
+   mmd_pool_entry *entry;
+   const char *utf8 = NULL;
+   assert(pool);
+
+   /* entries move when the pool grows, converted strings do not */
+   mmd_mutex_lock(pool->lock);
+
+   if (string && string <= pool->num_entries) {
+      entry = &pool->entries[string - 1];
+
+      if (!entry->utf8 && entry->utf8_source) {
+         if ((entry->utf8 = malloc(entry->size + 1))) {
+            memcpy(entry->utf8, entry->sjis, entry->size);
+            entry->utf8[entry->size] = 0;
+         }
+      } else if (!entry->utf8) {
+         entry->utf8 = (entry->size ? chckSJISToUTF8(entry->sjis, entry->size, NULL, 1) : calloc(1, 1));
+      }
+
+      utf8 = entry->utf8;
+   }
+
+   mmd_mutex_unlock(pool->lock);
+   return utf8;
+}
+
+/* \brief number of unique strings */
+unsigned int mmd_string_pool_count(const mmd_string_pool *pool)
+{
+   unsigned int count;
+   assert(pool);
+
+   mmd_mutex_lock(pool->lock);
+   count = pool->num_entries;
+   mmd_mutex_unlock(pool->lock);
+   return count;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,271 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h> /* for memset */
+#include <assert.h> /* for assert */
+
+enum {
+   /* keys stepped over linearly before falling back to binary search */
+   MMD_SAMPLER_LINEAR_STEPS = 4,
+
+   /* scratch rows are padded to widest kernel */
+   MMD_SAMPLER_PAD = 8
+};
+
+struct mmd_sampler {
+   const mmd_curve_kernel *kernel;
+
+   /* bound tracks and the key each of them is at */
+   const mmd_bone_track **bones;
+   const mmd_morph_track **morphs;
+   unsigned int *bone_cursors, *morph_cursors;
+   unsigned int num_bones, num_morphs;
+
+   /* rows of stride floats: 4 curves per bone track */
+   size_t stride;
+   float *x, *x1, *y1, *x2, *y2, *y;
+
+   /* rows of stride floats: 4 quaternion components per bone track */
+   float *qa, *qb, *qo;
+
+   /* keys and bone of each sampled track */
+   unsigned int *k0, *k1, *active;
+};
+
+/* \brief last key at or before frame, continuing from cursor
+ * returns 0 when frame is before the first key */
+static unsigned int mmd_sampler_seek(const unsigned int *frames, unsigned int num_keys, unsigned int cursor, float frame)
+{
+   unsigned int lo, hi, mid, steps;
+
+   if (cursor >= num_keys)
+      cursor = 0;
+
+   if (frames[cursor] <= frame) {
+      /* playback moves forward by a key or two per sample */
+      for (steps = 0; cursor + 1 < num_keys && frames[cursor + 1] <= frame; ++cursor) {
+         if (++steps > MMD_SAMPLER_LINEAR_STEPS) {
+            lo = cursor;
+            hi = num_keys;
+            goto search;
+         }
+      }
+      return cursor;
+   }
+
+   lo = 0;
+   hi = cursor;
+
+search:
+   while (hi - lo > 1) {
+      mid = lo + (hi - lo) / 2;
+      if (frames[mid] <= frame) {
+         lo = mid;
+      } else {
+         hi = mid;
+      }
+   }
+
+   return lo;
+}
+
+/* \brief keys around frame and the amount between them */
+static float mmd_sampler_segment(const unsigned int *frames, unsigned int num_keys, unsigned int *cursor, float frame, unsigned int *k1)
+{
+   const unsigned int k0 = *cursor = mmd_sampler_seek(frames, num_keys, *cursor, frame);
+
+   if (k0 + 1 >= num_keys || frame <= frames[k0]) {
+      *k1 = k0;
+      return 0.0f;
+   }
+
+   *k1 = k0 + 1;
+   return (frame - frames[k0]) / (float)(frames[k0 + 1] - frames[k0]);
+}
+
+/* \brief allocate pose for mmd */
+mmd_pose* mmd_pose_new(const mmd_data *mmd)
+{
+   mmd_pose *pose;
+   assert(mmd);
+
+   if (!(pose = calloc(1, sizeof(mmd_pose) + (mmd->num_bones * 7 + mmd->num_skins) * sizeof(float))))
+      return NULL;
+
+   pose->num_bones = mmd->num_bones;
+   pose->num_skins = mmd->num_skins;
+   pose->translations = (float*)(pose + 1);
+   pose->rotations = pose->translations + pose->num_bones * 3;
+   pose->weights = pose->rotations + pose->num_bones * 4;
+   mmd_pose_reset(pose);
+   return pose;
+}
+
+/* \brief reset pose to rest */
+void mmd_pose_reset(mmd_pose *pose)
+{
+   unsigned int i;
+   assert(pose);
+
+   memset(pose->translations, 0, pose->num_bones * 3 * sizeof(float));
+   memset(pose->rotations, 0, pose->num_bones * 4 * sizeof(float));
+   memset(pose->weights, 0, pose->num_skins * sizeof(float));
+
+   for (i = 0; i < pose->num_bones; ++i)
+      pose->rotations[i * 4 + 3] = 1.0f;
+}
+
+/* \brief free pose */
+void mmd_pose_free(mmd_pose *pose)
+{
+   assert(pose);
+   free(pose);
+}
+
+/* \brief create sampler for bound tracks of motion */
+mmd_sampler* mmd_sampler_new(const mmd_motion *motion)
+{
+   mmd_sampler *sampler;
+   unsigned int i, num_bones = 0, num_morphs = 0;
+   size_t stride;
+   assert(motion);
+
+   for (i = 0; i < motion->num_bone_tracks; ++i)
+      num_bones += (motion->bone_tracks[i].bone_index >= 0 && motion->bone_tracks[i].num_keys);
+
+   for (i = 0; i < motion->num_morph_tracks; ++i)
+      num_morphs += (motion->morph_tracks[i].skin_index >= 0 && motion->morph_tracks[i].num_keys);
+
+   if (!(sampler = calloc(1, sizeof(mmd_sampler))))
+      return NULL;
+
+   stride = (num_bones + MMD_SAMPLER_PAD - 1) / MMD_SAMPLER_PAD * MMD_SAMPLER_PAD;
+   sampler->stride = stride;
+   sampler->kernel = mmd_curve_kernel_best();
+
+   if (!(sampler->bones = calloc(num_bones + 1, sizeof(mmd_bone_track*))) ||
+       !(sampler->morphs = calloc(num_morphs + 1, sizeof(mmd_morph_track*))) ||
+       !(sampler->bone_cursors = calloc(num_bones + 1, sizeof(unsigned int))) ||
+       !(sampler->morph_cursors = calloc(num_morphs + 1, sizeof(unsigned int))) ||
+       !(sampler->k0 = calloc(stride * 3 + 1, sizeof(unsigned int))) ||
+       !(sampler->x = calloc(stride * 4 * 9 + 1, sizeof(float))))
+      goto fail;
+
+   sampler->k1 = sampler->k0 + stride;
+   sampler->active = sampler->k1 + stride;
+   sampler->x1 = sampler->x + stride * 4;
+   sampler->y1 = sampler->x1 + stride * 4;
+   sampler->x2 = sampler->y1 + stride * 4;
+   sampler->y2 = sampler->x2 + stride * 4;
+   sampler->y = sampler->y2 + stride * 4;
+   sampler->qa = sampler->y + stride * 4;
+   sampler->qb = sampler->qa + stride * 4;
+   sampler->qo = sampler->qb + stride * 4;
+
+   for (i = 0; i < motion->num_bone_tracks; ++i)
+      if (motion->bone_tracks[i].bone_index >= 0 && motion->bone_tracks[i].num_keys)
+         sampler->bones[sampler->num_bones++] = &motion->bone_tracks[i];
+
+   for (i = 0; i < motion->num_morph_tracks; ++i)
+      if (motion->morph_tracks[i].skin_index >= 0 && motion->morph_tracks[i].num_keys)
+         sampler->morphs[sampler->num_morphs++] = &motion->morph_tracks[i];
+
+   return sampler;
+
+fail:
+   mmd_sampler_free(sampler);
+   return NULL;
+}
+
+/* \brief sample bound tracks at frame to pose */
+void mmd_sampler_sample(mmd_sampler *sampler, float frame, mmd_pose *pose)
+{
+   const size_t stride = sampler->stride;
+   const mmd_bone_track *bone;
+   const mmd_morph_track *morph;
+   const unsigned char *bezier;
+   unsigned int i, c, n, k0, k1;
+   float t;
+   assert(sampler && pose);
+
+   mmd_pose_reset(pose);
+
+   /* gather curve inputs and rotations of every track */
+   for (i = 0, n = 0; i < sampler->num_bones; ++i) {
+      bone = sampler->bones[i];
+
+      if ((unsigned int)bone->bone_index >= pose->num_bones)
+         continue;
+
+      t = mmd_sampler_segment(bone->frames, bone->num_keys, &sampler->bone_cursors[i], frame, &k1);
+      k0 = sampler->bone_cursors[i];
+
+      /* curve into the next key is stored on the next key */
+      bezier = &bone->bezier[k1 * MMD_BEZIER_BONE_CURVES * MMD_BEZIER_SIZE];
+      for (c = 0; c < MMD_BEZIER_BONE_CURVES; ++c, bezier += MMD_BEZIER_SIZE) {
+         sampler->x[c * stride + n] = t;
+         sampler->x1[c * stride + n] = bezier[0] * (1.0f / 127.0f);
+         sampler->y1[c * stride + n] = bezier[1] * (1.0f / 127.0f);
+         sampler->x2[c * stride + n] = bezier[2] * (1.0f / 127.0f);
+         sampler->y2[c * stride + n] = bezier[3] * (1.0f / 127.0f);
+      }
+
+      for (c = 0; c < 4; ++c) {
+         sampler->qa[c * stride + n] = bone->rotations[k0 * 4 + c];
+         sampler->qb[c * stride + n] = bone->rotations[k1 * 4 + c];
+      }
+
+      sampler->k0[n] = k0;
+      sampler->k1[n] = k1;
+      sampler->active[n++] = i;
+   }
+
+   /* evaluate the curves and rotations of all tracks at once */
+   for (c = 0; c < MMD_BEZIER_BONE_CURVES; ++c)
+      sampler->kernel->bezier(&sampler->x[c * stride], &sampler->x1[c * stride], &sampler->y1[c * stride],
+                              &sampler->x2[c * stride], &sampler->y2[c * stride], &sampler->y[c * stride], n);
+
+   sampler->kernel->slerp(sampler->qa, sampler->qb, &sampler->y[MMD_BEZIER_ROTATION * stride], sampler->qo, n, stride);
+
+   /* scatter to bones */
+   for (i = 0; i < n; ++i) {
+      bone = sampler->bones[sampler->active[i]];
+      k0 = sampler->k0[i];
+      k1 = sampler->k1[i];
+
+      for (c = 0; c < 3; ++c) {
+         pose->translations[bone->bone_index * 3 + c] = bone->positions[k0 * 3 + c] +
+            (bone->positions[k1 * 3 + c] - bone->positions[k0 * 3 + c]) * sampler->y[(MMD_BEZIER_X + c) * stride + i];
+      }
+
+      for (c = 0; c < 4; ++c)
+         pose->rotations[bone->bone_index * 4 + c] = sampler->qo[c * stride + i];
+   }
+
+   /* morphs interpolate linearly */
+   for (i = 0; i < sampler->num_morphs; ++i) {
+      morph = sampler->morphs[i];
+
+      if ((unsigned int)morph->skin_index >= pose->num_skins)
+         continue;
+
+      t = mmd_sampler_segment(morph->frames, morph->num_keys, &sampler->morph_cursors[i], frame, &k1);
+      k0 = sampler->morph_cursors[i];
+      pose->weights[morph->skin_index] = morph->weights[k0] + (morph->weights[k1] - morph->weights[k0]) * t;
+   }
+}
+
+/* \brief free sampler */
+void mmd_sampler_free(mmd_sampler *sampler)
+{
+   assert(sampler);
+
+   if (sampler->bones) free((void*)sampler->bones);
+   if (sampler->morphs) free((void*)sampler->morphs);
+   if (sampler->bone_cursors) free(sampler->bone_cursors);
+   if (sampler->morph_cursors) free(sampler->morph_cursors);
+   if (sampler->k0) free(sampler->k0);
+   if (sampler->x) free(sampler->x);
+   free(sampler);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
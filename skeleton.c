@@ -0,0 +1,279 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <stdint.h> /* for uintptr_t */
+#include <assert.h> /* for assert */
+
+/* bone hierarchy in evaluation order.
+ *
+ * bones are sorted by depth, every depth is a level whose
+ * parents all sit in earlier levels. transforms are kept
+ * in component rows indexed by position in that order, so
+ * a level is gathered from its parents and then computed
+ * in one flat loop. names and other cold data stay in mmd_data.
+ *
+ * quaternions are x, y, z, w, world = parent * local. */
+
+enum {
+   /* rows start on cache line */
+   MMD_SKELETON_ALIGN = 64,
+   MMD_SKELETON_ROW_PAD = MMD_SKELETON_ALIGN / sizeof(float),
+
+   /* offset, head, local translation, local rotation,
+    * world position, world rotation, parent position and rotation */
+   MMD_SKELETON_ROWS = 3 + 3 + 3 + 4 + 3 + 4 + 3 + 4
+};
+
+struct mmd_skeleton {
+   unsigned int num_bones, num_levels;
+
+   /* bone at position and position of bone */
+   unsigned short *order, *position;
+
+   /* position of parent, MMD_BONE_NONE for roots */
+   unsigned short *parent;
+
+   /* first position of every level, followed by num_bones */
+   unsigned int *levels;
+
+   /* component c of bone at position j is at c * stride + j */
+   size_t stride;
+   float *offset, *head, *lt, *lq, *wp, *wq, *pp, *pq;
+   void *block;
+};
+
+/* \brief sort bones parents first */
+int mmd_bone_order(const mmd_data *mmd, unsigned short *order, unsigned short *parent, unsigned int *levels)
+{
+   unsigned int *depth = NULL, *start = NULL;
+   unsigned int b, p, d, num_depths = 0;
+   int ret = RETURN_FAIL;
+   assert(mmd && order && parent);
+
+   if (!(depth = calloc(mmd->num_bones + 1, sizeof(unsigned int))) ||
+       !(start = calloc(mmd->num_bones + 2, sizeof(unsigned int))))
+      goto out;
+
+   for (b = 0; b < mmd->num_bones; ++b) {
+      p = mmd->bones[b].parent_bone_index;
+      parent[b] = (p < mmd->num_bones && p != b ? (unsigned short)p : MMD_BONE_NONE);
+   }
+
+   /* walks longer than bone count are in cycle, b is cut from its parent */
+   for (b = 0; b < mmd->num_bones; ++b) {
+      for (d = 0, p = b; parent[p] != MMD_BONE_NONE && d <= mmd->num_bones; p = parent[p], ++d);
+
+      if (d > mmd->num_bones)
+         parent[b] = MMD_BONE_NONE;
+   }
+
+   for (b = 0; b < mmd->num_bones; ++b) {
+      for (d = 0, p = b; parent[p] != MMD_BONE_NONE; p = parent[p], ++d);
+      depth[b] = d;
+      num_depths = (d + 1 > num_depths ? d + 1 : num_depths);
+   }
+
+   /* counting sort by depth */
+   for (b = 0; b < mmd->num_bones; ++b)
+      start[depth[b] + 1]++;
+
+   for (d = 0; d < num_depths; ++d)
+      start[d + 1] += start[d];
+
+   if (levels)
+      memcpy(levels, start, (num_depths + 1) * sizeof(unsigned int));
+
+   for (b = 0; b < mmd->num_bones; ++b)
+      order[start[depth[b]]++] = (unsigned short)b;
+
+   ret = (int)num_depths;
+
+out:
+   if (depth) free(depth);
+   if (start) free(start);
+   return ret;
+}
+
+/* \brief create skeleton for bones of mmd */
+mmd_skeleton* mmd_skeleton_new(const mmd_data *mmd)
+{
+   mmd_skeleton *skeleton;
+   unsigned short *parent = NULL;
+   unsigned int j, b, c;
+   int levels;
+   float *rows;
+   assert(mmd);
+
+   if (!(skeleton = calloc(1, sizeof(mmd_skeleton))))
+      return NULL;
+
+   skeleton->num_bones = mmd->num_bones;
+   skeleton->stride = (mmd->num_bones + MMD_SKELETON_ROW_PAD - 1) / MMD_SKELETON_ROW_PAD * MMD_SKELETON_ROW_PAD;
+
+   if (!(skeleton->order = calloc(mmd->num_bones + 1, sizeof(unsigned short))) ||
+       !(skeleton->position = calloc(mmd->num_bones + 1, sizeof(unsigned short))) ||
+       !(skeleton->parent = calloc(mmd->num_bones + 1, sizeof(unsigned short))) ||
+       !(skeleton->levels = calloc(mmd->num_bones + 1, sizeof(unsigned int))) ||
+       !(skeleton->block = calloc(1, skeleton->stride * MMD_SKELETON_ROWS * sizeof(float) + MMD_SKELETON_ALIGN)) ||
+       !(parent = calloc(mmd->num_bones + 1, sizeof(unsigned short))))
+      goto fail;
+
+   if ((levels = mmd_bone_order(mmd, skeleton->order, parent, skeleton->levels)) < 0)
+      goto fail;
+
+   skeleton->num_levels = (unsigned int)levels;
+
+   rows = (float*)(((uintptr_t)skeleton->block + MMD_SKELETON_ALIGN - 1) & ~(uintptr_t)(MMD_SKELETON_ALIGN - 1));
+   skeleton->offset = rows;
+   skeleton->head = skeleton->offset + skeleton->stride * 3;
+   skeleton->lt = skeleton->head + skeleton->stride * 3;
+   skeleton->lq = skeleton->lt + skeleton->stride * 3;
+   skeleton->wp = skeleton->lq + skeleton->stride * 4;
+   skeleton->wq = skeleton->wp + skeleton->stride * 3;
+   skeleton->pp = skeleton->wq + skeleton->stride * 4;
+   skeleton->pq = skeleton->pp + skeleton->stride * 3;
+
+   for (j = 0; j < skeleton->num_bones; ++j)
+      skeleton->position[skeleton->order[j]] = (unsigned short)j;
+
+   /* rest offset from parent head, roots are offset from origin */
+   for (j = 0; j < skeleton->num_bones; ++j) {
+      b = skeleton->order[j];
+      skeleton->parent[j] = (parent[b] != MMD_BONE_NONE ? skeleton->position[parent[b]] : MMD_BONE_NONE);
+
+      for (c = 0; c < 3; ++c) {
+         skeleton->head[c * skeleton->stride + j] = mmd->bones[b].head_pos[c];
+         skeleton->offset[c * skeleton->stride + j] = mmd->bones[b].head_pos[c] -
+            (parent[b] != MMD_BONE_NONE ? mmd->bones[parent[b]].head_pos[c] : 0.0f);
+      }
+   }
+
+   free(parent);
+   return skeleton;
+
+fail:
+   if (parent) free(parent);
+   mmd_skeleton_free(skeleton);
+   return NULL;
+}
+
+/* \brief world transforms of pose */
+void mmd_skeleton_update(mmd_skeleton *skeleton, const mmd_pose *pose)
+{
+   const size_t s = skeleton->stride;
+   unsigned int l, j, c, first, count;
+   assert(skeleton && pose && pose->num_bones == skeleton->num_bones);
+
+   for (j = 0; j < skeleton->num_bones; ++j) {
+      for (c = 0; c < 3; ++c)
+         skeleton->lt[c * s + j] = skeleton->offset[c * s + j] + pose->translations[skeleton->order[j] * 3 + c];
+
+      for (c = 0; c < 4; ++c)
+         skeleton->lq[c * s + j] = pose->rotations[skeleton->order[j] * 4 + c];
+   }
+
+   if (!skeleton->num_levels)
+      return;
+
+   /* first level holds the roots */
+   count = skeleton->levels[1];
+   for (c = 0; c < 3; ++c)
+      memcpy(&skeleton->wp[c * s], &skeleton->lt[c * s], count * sizeof(float));
+
+   for (c = 0; c < 4; ++c)
+      memcpy(&skeleton->wq[c * s], &skeleton->lq[c * s], count * sizeof(float));
+
+   for (l = 1; l < skeleton->num_levels; ++l) {
+      first = skeleton->levels[l];
+      count = skeleton->levels[l + 1] - first;
+
+      for (j = first; j < first + count; ++j) {
+         for (c = 0; c < 3; ++c)
+            skeleton->pp[c * s + j] = skeleton->wp[c * s + skeleton->parent[j]];
+
+         for (c = 0; c < 4; ++c)
+            skeleton->pq[c * s + j] = skeleton->wq[c * s + skeleton->parent[j]];
+      }
+
+      mmd_bone_forward(&skeleton->wq[first], &skeleton->wp[first], &skeleton->lq[first], &skeleton->lt[first],
+                       &skeleton->pq[first], &skeleton->pp[first], s, count);
+   }
+}
+
+/* \brief skinning matrices of last update */
+void mmd_skeleton_palette(const mmd_skeleton *skeleton, float *palette)
+{
+   const size_t s = skeleton->stride;
+   float x, y, z, w, *m, h[3];
+   unsigned int j;
+   assert(skeleton && palette);
+
+   for (j = 0; j < skeleton->num_bones; ++j) {
+      x = skeleton->wq[j];
+      y = skeleton->wq[s + j];
+      z = skeleton->wq[2*s + j];
+      w = skeleton->wq[3*s + j];
+      m = &palette[skeleton->order[j] * 16];
+
+      m[0] = 1.0f - 2.0f * (y * y + z * z);
+      m[1] = 2.0f * (x * y + z * w);
+      m[2] = 2.0f * (x * z - y * w);
+      m[3] = 0.0f;
+      m[4] = 2.0f * (x * y - z * w);
+      m[5] = 1.0f - 2.0f * (x * x + z * z);
+      m[6] = 2.0f * (y * z + x * w);
+      m[7] = 0.0f;
+      m[8] = 2.0f * (x * z + y * w);
+      m[9] = 2.0f * (y * z - x * w);
+      m[10] = 1.0f - 2.0f * (x * x + y * y);
+      m[11] = 0.0f;
+
+      /* vertices are in model space, move them to bone head first */
+      mmd_quat_rotate(x, y, z, w, skeleton->head[j], skeleton->head[s + j], skeleton->head[2*s + j], h);
+      m[12] = skeleton->wp[j] - h[0];
+      m[13] = skeleton->wp[s + j] - h[1];
+      m[14] = skeleton->wp[2*s + j] - h[2];
+      m[15] = 1.0f;
+   }
+}
+
+/* \brief world position and rotation of bone after last update */
+void mmd_skeleton_world(const mmd_skeleton *skeleton, unsigned int bone, float *position, float *rotation)
+{
+   const size_t s = skeleton->stride;
+   unsigned int j, c;
+   assert(skeleton && bone < skeleton->num_bones);
+
+   j = skeleton->position[bone];
+
+   if (position) {
+      for (c = 0; c < 3; ++c)
+         position[c] = skeleton->wp[c * s + j];
+   }
+
+   if (rotation) {
+      for (c = 0; c < 4; ++c)
+         rotation[c] = skeleton->wq[c * s + j];
+   }
+}
+
+/* \brief bones in evaluation order */
+const unsigned short* mmd_skeleton_order(const mmd_skeleton *skeleton)
+{
+   assert(skeleton);
+   return skeleton->order;
+}
+
+/* \brief free skeleton */
+void mmd_skeleton_free(mmd_skeleton *skeleton)
+{
+   assert(skeleton);
+
+   if (skeleton->order) free(skeleton->order);
+   if (skeleton->position) free(skeleton->position);
+   if (skeleton->parent) free(skeleton->parent);
+   if (skeleton->levels) free(skeleton->levels);
+   if (skeleton->block) free(skeleton->block);
+   free(skeleton);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
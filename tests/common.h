@@ -0,0 +1,127 @@
+#ifndef __mmd_tests_common_h__
+#define __mmd_tests_common_h__
+
+#include "../mmd.h"
+#include <stdio.h>
+#include <string.h>
+
+/* helpers shared by the tests */
+
+#define CHECK(x) if (!(x)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #x); return 0; }
+
+/* \brief next pseudo random number */
+static inline unsigned int rnd(unsigned int *seed)
+{
+   *seed ^= *seed << 13;
+   *seed ^= *seed >> 17;
+   *seed ^= *seed << 5;
+   return *seed;
+}
+
+/* \brief random number in [lo, hi] */
+static inline unsigned int rnd_range(unsigned int *seed, unsigned int lo, unsigned int hi)
+{
+   return lo + rnd(seed) % (hi - lo + 1);
+}
+
+/* \brief name of mmd, from its string pool when it has one */
+static inline const char* name_of(const mmd_data *mmd, const char *name, mmd_string id)
+{
+   return (name ? name : mmd_get_string((mmd_data*)mmd, id));
+}
+
+/* \brief are names equal, NULL equals only NULL */
+static inline int same_name(const char *a, const char *b)
+{
+   return (a && b ? !strcmp(a, b) : a == b);
+}
+
+/* \brief are count elements of arrays equal, NULL equals only NULL */
+static inline int same_array(const void *a, const void *b, size_t count, size_t size)
+{
+   if (!a || !b)
+      return a == b;
+
+   return !memcmp(a, b, count * size);
+}
+
+/* \brief are bounds equal */
+static inline int same_bounds(const mmd_bounds *a, const mmd_bounds *b)
+{
+   return !memcmp(a, b, sizeof(mmd_bounds));
+}
+
+/* \brief are models equal in every count, array, name and bounds,
+ * names are compared by text, with or without string pool */
+static inline int same_model(const mmd_data *a, const mmd_data *b)
+{
+   unsigned int i;
+
+   CHECK(same_name(name_of(a, a->header.name, a->header.name_id), name_of(b, b->header.name, b->header.name_id)));
+   CHECK(same_name(name_of(a, a->header.comment, a->header.comment_id), name_of(b, b->header.comment, b->header.comment_id)));
+   CHECK(a->header.version == b->header.version);
+
+   CHECK(a->num_vertices == b->num_vertices);
+   CHECK(a->num_indices == b->num_indices);
+   CHECK(a->num_materials == b->num_materials);
+   CHECK(a->num_bones == b->num_bones);
+   CHECK(a->num_ik == b->num_ik);
+   CHECK(a->num_skins == b->num_skins);
+   CHECK(a->num_skin_displays == b->num_skin_displays);
+   CHECK(a->num_bone_names == b->num_bone_names);
+
+   CHECK(same_array(a->vertices, b->vertices, a->num_vertices, 3 * sizeof(float)));
+   CHECK(same_array(a->normals, b->normals, a->num_vertices, 3 * sizeof(float)));
+   CHECK(same_array(a->coords, b->coords, a->num_vertices, 2 * sizeof(float)));
+   CHECK(same_array(a->weights, b->weights, a->num_vertices, sizeof(mmd_weight)));
+   CHECK(same_array(a->indices, b->indices, a->num_indices, sizeof(unsigned short)));
+   CHECK(same_array(a->indices32, b->indices32, a->num_indices, sizeof(unsigned int)));
+   CHECK(same_array(a->skin_display, b->skin_display, a->num_skin_displays, sizeof(unsigned int)));
+   CHECK(same_bounds(&a->bounds, &b->bounds));
+
+   for (i = 0; i < a->num_materials; ++i) {
+      const mmd_material *ma = &a->materials[i], *mb = &b->materials[i];
+      CHECK(!memcmp(ma->diffuse, mb->diffuse, sizeof(ma->diffuse)));
+      CHECK(!memcmp(ma->specular, mb->specular, sizeof(ma->specular)));
+      CHECK(!memcmp(ma->ambient, mb->ambient, sizeof(ma->ambient)));
+      CHECK(ma->alpha == mb->alpha && ma->power == mb->power);
+      CHECK(ma->toon == mb->toon && ma->edge == mb->edge && ma->face == mb->face);
+      CHECK(same_name(name_of(a, ma->texture, ma->texture_id), name_of(b, mb->texture, mb->texture_id)));
+      CHECK(same_bounds(&ma->bounds, &mb->bounds));
+   }
+
+   for (i = 0; i < a->num_bones; ++i) {
+      const mmd_bone *ba = &a->bones[i], *bb = &b->bones[i];
+      CHECK(same_name(name_of(a, ba->name, ba->name_id), name_of(b, bb->name, bb->name_id)));
+      CHECK(ba->type == bb->type);
+      CHECK(ba->parent_bone_index == bb->parent_bone_index);
+      CHECK(ba->tail_pos_bone_index == bb->tail_pos_bone_index);
+      CHECK(ba->ik_parend_bone_index == bb->ik_parend_bone_index);
+      CHECK(!memcmp(ba->head_pos, bb->head_pos, sizeof(ba->head_pos)));
+      CHECK(same_bounds(&ba->bounds, &bb->bounds));
+   }
+
+   for (i = 0; i < a->num_ik; ++i) {
+      const mmd_ik *ia = &a->ik[i], *ib = &b->ik[i];
+      CHECK(ia->chain_length == ib->chain_length);
+      CHECK(ia->bone_index == ib->bone_index && ia->target_bone_index == ib->target_bone_index);
+      CHECK(ia->iterations == ib->iterations && ia->cotrol_weight == ib->cotrol_weight);
+      CHECK(same_array(ia->child_bone_index, ib->child_bone_index, ia->chain_length, sizeof(unsigned short)));
+   }
+
+   for (i = 0; i < a->num_skins; ++i) {
+      const mmd_skin *sa = &a->skin[i], *sb = &b->skin[i];
+      CHECK(same_name(name_of(a, sa->name, sa->name_id), name_of(b, sb->name, sb->name_id)));
+      CHECK(sa->num_vertices == sb->num_vertices && sa->type == sb->type);
+      CHECK(same_array(sa->vertices, sb->vertices, sa->num_vertices, sizeof(mmd_skin_vertex)));
+   }
+
+   for (i = 0; i < a->num_bone_names; ++i)
+      CHECK(same_name(name_of(a, a->bone_name[i].name, a->bone_name[i].name_id), name_of(b, b->bone_name[i].name, b->bone_name[i].name_id)));
+
+   return 1;
+}
+
+#endif /* __mmd_tests_common_h__ */
+
+/* vim: set ts=8 sw=3 tw=0 :*/
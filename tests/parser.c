@@ -0,0 +1,175 @@
+#include "common.h"
+#include "../bench/pmdgen.h"
+#include <stdlib.h>
+
+/* push parser test. generated models are fed to mmd_parser_feed
+ * in chunks of random size, every chunk in its own buffer freed
+ * right after the call. the result must equal mmd_load of the same
+ * bytes in every count, array, name and bounds. counts past
+ * the limit of mmd_parser_set_limit must fail before allocating.
+ *
+ * usage: mmd_parser_test [rounds=N] [seed=N] */
+
+/* chunk sizes that hit record and count boundaries differently */
+static const size_t fixed_chunks[] = { 1, 7, 100, 1000 };
+
+/* \brief feed model in chunks, fixed is index to fixed_chunks or random sizes past them */
+static int parse_model(const pmdgen_model *model, unsigned int fixed, unsigned int *seed, mmd_data *mmd)
+{
+   mmd_parser *parser;
+   unsigned char *chunk;
+   size_t offset, size;
+   int ret = MMD_PARSER_NEED_MORE;
+
+   CHECK((parser = mmd_parser_new(mmd)));
+
+   for (offset = 0; offset < model->size && ret != MMD_PARSER_DONE; offset += size) {
+      if (fixed < sizeof(fixed_chunks) / sizeof(fixed_chunks[0])) {
+         size = fixed_chunks[fixed];
+      } else {
+         /* mostly short chunks, some spanning many records */
+         size = (rnd(seed) % 4 ? rnd_range(seed, 1, 64) : rnd_range(seed, 65, 8192));
+      }
+
+      size = (size < model->size - offset ? size : model->size - offset);
+
+      if (!(chunk = malloc(size)))
+         break;
+
+      memcpy(chunk, model->data + offset, size);
+      ret = mmd_parser_feed(parser, chunk, size);
+      free(chunk);
+
+      if (ret == MMD_PARSER_ERROR)
+         break;
+   }
+
+   mmd_parser_free(parser);
+   CHECK(ret == MMD_PARSER_DONE);
+   return 1;
+}
+
+/* \brief model fits limit of its own size, huge vertex count fails as format error */
+static int test_limit(const pmdgen_params *params)
+{
+   pmdgen_model model;
+   mmd_data *mmd;
+   mmd_parser *parser;
+   int ret;
+
+   CHECK(pmdgen(params, &model));
+
+   /* exactly the size of the model is enough */
+   CHECK((mmd = mmd_new(NULL)) && (parser = mmd_parser_new(mmd)));
+   mmd_parser_set_limit(parser, model.size);
+   ret = mmd_parser_feed(parser, model.data, model.size);
+   mmd_parser_free(parser);
+   mmd_free(mmd);
+   CHECK(ret == MMD_PARSER_DONE);
+
+   /* uint32_t: vertex count, right after the header */
+   model.data[model.sections[PMDGEN_HEADER] + 0] = 0xf0;
+   model.data[model.sections[PMDGEN_HEADER] + 1] = 0xff;
+   model.data[model.sections[PMDGEN_HEADER] + 2] = 0xff;
+   model.data[model.sections[PMDGEN_HEADER] + 3] = 0x7f;
+
+   CHECK((mmd = mmd_new(NULL)) && (parser = mmd_parser_new(mmd)));
+   ret = mmd_parser_feed(parser, model.data, model.size);
+   mmd_parser_free(parser);
+   CHECK(ret == MMD_PARSER_ERROR);
+   CHECK(mmd_get_error(mmd)->code == MMD_ERROR_FORMAT);
+   CHECK(mmd_get_error(mmd)->section == MMD_SECTION_VERTEX);
+   mmd_free(mmd);
+
+   pmdgen_free(&model);
+   return 1;
+}
+
+/* \brief random parameters of small model */
+static void random_params(unsigned int *seed, pmdgen_params *params)
+{
+   memset(params, 0, sizeof(pmdgen_params));
+   params->vertices = rnd_range(seed, 3, 3000);
+   params->triangles = rnd_range(seed, 1, 4000);
+   params->materials = rnd_range(seed, 1, 12);
+   params->textures = rnd_range(seed, 0, 4);
+   params->bones = rnd_range(seed, 2, 80);
+   params->ik = rnd_range(seed, 0, 6);
+   params->chain = rnd_range(seed, 1, 4);
+   params->morphs = rnd_range(seed, 0, 16);
+   params->morph_vertices = rnd_range(seed, 1, 60);
+   params->names = rnd_range(seed, 0, 8);
+   params->seed = rnd(seed);
+}
+
+/* \brief compare parses of one model in every chunking against mmd_load */
+static int test_model(const pmdgen_params *params, unsigned int *seed)
+{
+   pmdgen_model model;
+   mmd_data *loaded = NULL, *parsed;
+   unsigned int c;
+   int ok = 0;
+
+   /* parameters that do not fit PMD are not an error */
+   if (!pmdgen(params, &model))
+      return 1;
+
+   if (!(loaded = mmd_new_from_memory(model.data, model.size)) || mmd_load(loaded, 0) != 0) {
+      fprintf(stderr, "mmd_load failed\n");
+      goto out;
+   }
+
+   for (c = 0; c <= sizeof(fixed_chunks) / sizeof(fixed_chunks[0]); ++c) {
+      if (!(parsed = mmd_new(NULL)))
+         goto out;
+
+      ok = (parse_model(&model, c, seed, parsed) && same_model(parsed, loaded));
+      mmd_free(parsed);
+
+      if (!ok) {
+         fprintf(stderr, "model seed %u differs, chunks %s\n", params->seed, (c < sizeof(fixed_chunks) / sizeof(fixed_chunks[0]) ? "fixed" : "random"));
+         goto out;
+      }
+   }
+
+out:
+   if (loaded) mmd_free(loaded);
+   pmdgen_free(&model);
+   return ok;
+}
+
+int main(int argc, char **argv)
+{
+   unsigned int rounds = 40, seed = 1, r, i;
+   const char *name;
+   pmdgen_params params;
+
+   for (i = 1; i < (unsigned int)argc; ++i) {
+      if (!strncmp(argv[i], "rounds=", 7)) {
+         rounds = strtoul(argv[i] + 7, NULL, 10);
+      } else if (!strncmp(argv[i], "seed=", 5)) {
+         seed = strtoul(argv[i] + 5, NULL, 10);
+      } else {
+         fprintf(stderr, "unknown argument: %s\n", argv[i]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   /* xorshift never leaves 0 */
+   seed = (seed ? seed : 1);
+
+   /* the small preset once, then random models */
+   if (pmdgen_preset(0, &name, &params) && (!test_model(&params, &seed) || !test_limit(&params)))
+      return EXIT_FAILURE;
+
+   for (r = 0; r < rounds; ++r) {
+      random_params(&seed, &params);
+      if (!test_model(&params, &seed))
+         return EXIT_FAILURE;
+   }
+
+   printf("%u models parsed in every chunking\n", rounds + 1);
+   return EXIT_SUCCESS;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,243 @@
+#include "common.h"
+#include "../bench/pmxgen.h"
+#include <stdlib.h>
+
+/* PMX import test. generated models are loaded from memory,
+ * from FILE into arena, with string pool and with
+ * mmd_load_parallel, and every load must equal the first one
+ * in every count, array, name and bounds. input cut at the
+ * start and middle of every section must fail as truncated
+ * the same way on every path, except cuts in rigid bodies
+ * and joints, which are not read and load the whole model.
+ *
+ * usage: mmd_pmx_test [rounds=N] [seed=N] */
+
+/* ways of loading */
+enum {
+   PATH_MEMORY,
+   PATH_FILE_ARENA,
+   PATH_POOL,
+   PATH_PARALLEL,
+   PATHS
+};
+
+static const char *path_names[PATHS] = { "memory", "FILE and arena", "string pool", "parallel" };
+
+/* MMD_SECTION_* each PMXGEN_* section is read in, MMD_SECTION_LAST when not read */
+static const unsigned int read_in[PMXGEN_SECTIONS] = {
+   MMD_SECTION_HEADER, MMD_SECTION_VERTEX, MMD_SECTION_INDEX, MMD_SECTION_MATERIAL, MMD_SECTION_MATERIAL,
+   MMD_SECTION_BONE, MMD_SECTION_SKIN, MMD_SECTION_SKIN_DISPLAY, MMD_SECTION_LAST, MMD_SECTION_LAST
+};
+
+/* \brief model loaded on one path */
+typedef struct loaded {
+   mmd_data *mmd;
+   FILE *f;
+   int ret;
+} loaded;
+
+/* \brief load size bytes of data on path, out->mmd is kept when load fails */
+static int load(const unsigned char *data, size_t size, unsigned int path, mmd_string_pool *pool, loaded *out)
+{
+   memset(out, 0, sizeof(loaded));
+
+   if (path == PATH_FILE_ARENA) {
+      CHECK((out->f = tmpfile()));
+      CHECK(fwrite(data, 1, size, out->f) == size);
+      rewind(out->f);
+      CHECK((out->mmd = mmd_new(out->f)));
+      out->ret = mmd_load(out->mmd, MMD_LOAD_ARENA);
+      return 1;
+   }
+
+   CHECK((out->mmd = mmd_new_from_memory(data, size)));
+
+   if (path == PATH_POOL)
+      mmd_set_string_pool(out->mmd, pool);
+
+   out->ret = (path == PATH_PARALLEL ? mmd_load_parallel(out->mmd, 0, NULL) : mmd_load(out->mmd, 0));
+   return 1;
+}
+
+/* \brief free loads */
+static void unload(loaded *loads, unsigned int count)
+{
+   unsigned int i;
+
+   for (i = 0; i < count; ++i) {
+      if (loads[i].mmd) mmd_free(loads[i].mmd);
+      if (loads[i].f) fclose(loads[i].f);
+      memset(&loads[i], 0, sizeof(loaded));
+   }
+}
+
+/* \brief does reference load have what the generator wrote */
+static int expected_counts(const pmxgen_params *params, const mmd_data *mmd)
+{
+   CHECK(mmd->num_vertices == params->vertices);
+   CHECK(mmd->num_indices == params->triangles * 3);
+   CHECK(mmd->num_materials == params->materials);
+   CHECK(mmd->num_bones == params->bones);
+   CHECK(mmd->num_ik == params->ik);
+
+   /* vertex morphs and the group of them when it moves any vertex,
+    * bone, uv and material morphs are not skins */
+   CHECK(mmd->num_skins == params->morphs + (params->morphs && params->morph_vertices));
+   CHECK(mmd->num_skin_displays == mmd->num_skins);
+   CHECK(mmd->num_bone_names == params->frames);
+   CHECK((mmd->indices32 != NULL) == (params->vertices > 0x10000));
+   return 1;
+}
+
+/* \brief load cut of model on every path, loads must agree with reference */
+static int test_cut(const pmxgen_model *model, size_t cut, unsigned int section, const mmd_data *reference, mmd_string_pool *pool)
+{
+   loaded loads[PATHS];
+   const mmd_error *error, *first = NULL;
+   unsigned int p;
+   int ok = 1;
+
+   memset(loads, 0, sizeof(loads));
+
+   for (p = 0; ok && p < PATHS; ++p) {
+      if (!(ok = load(model->data, cut, p, pool, &loads[p])))
+         break;
+
+      if (read_in[section] == MMD_SECTION_LAST) {
+         /* physics is not read, what comes before it is whole */
+         ok = (loads[p].ret == 0 && same_model(reference, loads[p].mmd));
+      } else {
+         error = mmd_get_error(loads[p].mmd);
+         first = (first ? first : error);
+         ok = (loads[p].ret != 0 && error->code == MMD_ERROR_TRUNCATED && error->section == read_in[section] &&
+               error->offset <= cut && !memcmp(error, first, sizeof(mmd_error)));
+      }
+
+      if (!ok)
+         fprintf(stderr, "cut at %zu in section %u differs, %s\n", cut, section, path_names[p]);
+   }
+
+   unload(loads, PATHS);
+   return ok;
+}
+
+/* \brief compare loads of model on every path, and of it cut in every section.
+ * random parameters that do not fit PMX are not an error, fixed ones are */
+static int test_model(const pmxgen_params *params, int fixed)
+{
+   mmd_string_pool *pool;
+   pmxgen_model model;
+   loaded loads[PATHS];
+   unsigned int p, s;
+   size_t start, cut;
+   int ok = 0;
+
+   if (!pmxgen(params, &model)) {
+      if (fixed) fprintf(stderr, "model seed %u does not fit PMX\n", params->seed);
+      return !fixed;
+   }
+
+   memset(loads, 0, sizeof(loads));
+
+   if (!(pool = mmd_string_pool_new()))
+      goto out;
+
+   for (p = 0; p < PATHS; ++p) {
+      if (!load(model.data, model.size, p, pool, &loads[p]) || loads[p].ret != 0) {
+         fprintf(stderr, "model seed %u failed to load, %s\n", params->seed, path_names[p]);
+         goto out;
+      }
+
+      if (!same_model(loads[PATH_MEMORY].mmd, loads[p].mmd)) {
+         fprintf(stderr, "model seed %u differs, %s\n", params->seed, path_names[p]);
+         goto out;
+      }
+   }
+
+   if (!expected_counts(params, loads[PATH_MEMORY].mmd))
+      goto out;
+
+   for (s = 0, start = 0; s < PMXGEN_SECTIONS; start += model.sections[s++]) {
+      /* magic has to be there for the input to be PMX */
+      for (cut = (s ? start : 4); cut <= start + model.sections[s] / 2; cut += (model.sections[s] / 2 ? model.sections[s] / 2 : 1)) {
+         if (!test_cut(&model, cut, s, loads[PATH_MEMORY].mmd, pool)) {
+            fprintf(stderr, "model seed %u\n", params->seed);
+            goto out;
+         }
+      }
+   }
+
+   ok = 1;
+
+out:
+   unload(loads, PATHS);
+   if (pool) mmd_string_pool_free(pool);
+   pmxgen_free(&model);
+   return ok;
+}
+
+/* \brief random parameters of small model */
+static void random_params(unsigned int *seed, pmxgen_params *params)
+{
+   static const unsigned int widths[] = { 0, 1, 2, 4 };
+
+   memset(params, 0, sizeof(pmxgen_params));
+   params->vertices = rnd_range(seed, 3, 3000);
+   params->triangles = rnd_range(seed, 1, 4000);
+   params->materials = rnd_range(seed, 1, 12);
+   params->textures = rnd_range(seed, 0, 4);
+   params->bones = rnd_range(seed, 12, 200);
+   params->ik = rnd_range(seed, 0, 6);
+   params->chain = rnd_range(seed, 1, 4);
+   params->morphs = rnd_range(seed, 0, 16);
+   params->morph_vertices = rnd_range(seed, 0, 60);
+   params->frames = rnd_range(seed, 0, 8);
+   params->rigids = rnd_range(seed, 0, 8);
+   params->utf8 = rnd(seed) & 1;
+   params->uvs = rnd_range(seed, 0, 4);
+   params->width = widths[rnd(seed) % 4];
+   params->seed = rnd(seed);
+}
+
+int main(int argc, char **argv)
+{
+   /* UTF16 with narrowest indices, UTF8 with every index 4 bytes,
+    * 32-bit vertex indices, and model with nothing in it */
+   static const pmxgen_params fixed[] = {
+      { 200, 300, 4, 3, 40, 2, 3, 6, 20, 3, 4, 0, 0, 0, 1 },
+      { 500, 700, 6, 2, 60, 3, 2, 8, 30, 4, 6, 1, 4, 4, 2 },
+      { 70000, 3000, 3, 1, 20, 1, 2, 2, 10, 1, 2, 0, 1, 2, 3 },
+      { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 4 }
+   };
+   unsigned int rounds = 20, seed = 1, r, i;
+   pmxgen_params params;
+
+   for (i = 1; i < (unsigned int)argc; ++i) {
+      if (!strncmp(argv[i], "rounds=", 7)) {
+         rounds = strtoul(argv[i] + 7, NULL, 10);
+      } else if (!strncmp(argv[i], "seed=", 5)) {
+         seed = strtoul(argv[i] + 5, NULL, 10);
+      } else {
+         fprintf(stderr, "unknown argument: %s\n", argv[i]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   /* xorshift never leaves 0 */
+   seed = (seed ? seed : 1);
+
+   for (i = 0; i < sizeof(fixed) / sizeof(fixed[0]); ++i)
+      if (!test_model(&fixed[i], 1))
+         return EXIT_FAILURE;
+
+   for (r = 0; r < rounds; ++r) {
+      random_params(&seed, &params);
+      if (!test_model(&params, 0))
+         return EXIT_FAILURE;
+   }
+
+   printf("%u models loaded on every path and cut in every section\n", rounds + (unsigned int)(sizeof(fixed) / sizeof(fixed[0])));
+   return EXIT_SUCCESS;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,185 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <assert.h> /* for assert */
+
+#if defined(_WIN32)
+#  define WIN32_LEAN_AND_MEAN
+#  include <windows.h> /* for CRITICAL_SECTION, CreateThread */
+#else
+#  include <pthread.h>
+#  include <time.h> /* for clock_gettime */
+#endif
+
+struct mmd_mutex {
+#if defined(_WIN32)
+   CRITICAL_SECTION cs;
+#else
+   pthread_mutex_t mutex;
+#endif
+};
+
+/* \brief tasks shared by the workers of mmd_run_tasks */
+typedef struct mmd_task_queue {
+   mmd_mutex *lock;
+   mmd_task_fn fn;
+   void **args;
+   unsigned int count, next;
+} mmd_task_queue;
+
+/* \brief create mutex */
+mmd_mutex* mmd_mutex_new(void)
+{
+   mmd_mutex *mutex;
+
+   if (!(mutex = calloc(1, sizeof(mmd_mutex))))
+      return NULL;
+
+#if defined(_WIN32)
+   InitializeCriticalSection(&mutex->cs);
+#else
+   if (pthread_mutex_init(&mutex->mutex, NULL) != 0) {
+      free(mutex);
+      return NULL;
+   }
+#endif
+
+   return mutex;
+}
+
+/* \brief free mutex */
+void mmd_mutex_free(mmd_mutex *mutex)
+{
+   assert(mutex);
+
+#if defined(_WIN32)
+   DeleteCriticalSection(&mutex->cs);
+#else
+   pthread_mutex_destroy(&mutex->mutex);
+#endif
+
+   free(mutex);
+}
+
+/* \brief lock mutex, NULL mutex is no-op */
+void mmd_mutex_lock(mmd_mutex *mutex)
+{
+   if (!mutex)
+      return;
+
+#if defined(_WIN32)
+   EnterCriticalSection(&mutex->cs);
+#else
+   pthread_mutex_lock(&mutex->mutex);
+#endif
+}
+
+/* \brief unlock mutex, NULL mutex is no-op */
+void mmd_mutex_unlock(mmd_mutex *mutex)
+{
+   if (!mutex)
+      return;
+
+#if defined(_WIN32)
+   LeaveCriticalSection(&mutex->cs);
+#else
+   pthread_mutex_unlock(&mutex->mutex);
+#endif
+}
+
+/* \brief monotonic time in seconds */
+double mmd_time(void)
+{
+#if defined(_WIN32)
+   LARGE_INTEGER count, frequency;
+   QueryPerformanceCounter(&count);
+   QueryPerformanceFrequency(&frequency);
+   return (double)count.QuadPart / (double)frequency.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+   return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/* \brief run tasks from queue until it is empty */
+static void mmd_task_worker(mmd_task_queue *queue)
+{
+   unsigned int i;
+
+   for (;;) {
+      mmd_mutex_lock(queue->lock);
+      i = queue->next++;
+      mmd_mutex_unlock(queue->lock);
+
+      if (i >= queue->count)
+         break;
+
+      queue->fn(queue->args[i]);
+   }
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI mmd_task_thread(LPVOID queue)
+{
+   mmd_task_worker(queue);
+   return 0;
+}
+#else
+static void* mmd_task_thread(void *queue)
+{
+   mmd_task_worker(queue);
+   return NULL;
+}
+#endif
+
+/* \brief run fn for every argument on up to threads threads */
+void mmd_run_tasks(mmd_task_fn fn, void **args, unsigned int count, unsigned int threads)
+{
+   mmd_task_queue queue;
+   unsigned int i, started = 0;
+#if defined(_WIN32)
+   HANDLE handles[MMD_MAX_THREADS];
+#else
+   pthread_t handles[MMD_MAX_THREADS];
+#endif
+   assert(fn && (args || !count));
+
+   memset(&queue, 0, sizeof(queue));
+   queue.fn = fn;
+   queue.args = args;
+   queue.count = count;
+
+   if (threads > count) threads = count;
+   if (threads > MMD_MAX_THREADS) threads = MMD_MAX_THREADS;
+
+   /* without lock the calling thread runs everything */
+   if (threads > 1 && (queue.lock = mmd_mutex_new())) {
+      for (i = 0; i < threads - 1; ++i, ++started) {
+#if defined(_WIN32)
+         if (!(handles[i] = CreateThread(NULL, 0, mmd_task_thread, &queue, 0, NULL)))
+            break;
+#else
+         if (pthread_create(&handles[i], NULL, mmd_task_thread, &queue) != 0)
+            break;
+#endif
+      }
+   }
+
+   /* calling thread works too */
+   mmd_task_worker(&queue);
+
+   for (i = 0; i < started; ++i) {
+#if defined(_WIN32)
+      WaitForSingleObject(handles[i], INFINITE);
+      CloseHandle(handles[i]);
+#else
+      pthread_join(handles[i], NULL);
+#endif
+   }
+
+   if (queue.lock) mmd_mutex_free(queue.lock);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,221 @@
+#include "internal.h"
+#include <assert.h> /* for assert */
+
+#if defined(MMD_HAS_SSE2) || defined(MMD_HAS_AVX2)
+#  include <immintrin.h>
+#endif
+
+#if defined(MMD_HAS_NEON)
+#  include <arm_neon.h>
+#endif
+
+enum {
+   /* vertices decoded before their bounds are taken */
+   MMD_VERTEX_BOUNDS_CHUNK = 512
+};
+
+/* PMD vertex record:
+ * 3xFLOAT position, 3xFLOAT normal, 2xFLOAT coord,
+ * 2xuint16_t bone index, uint8_t weight, uint8_t edge flag */
+enum {
+   MMD_VERTEX_WEIGHT_OFFSET = sizeof(uint32_t) * 8
+};
+
+/* \brief decode weight part of vertex record */
+static inline void mmd_decode_weight(const unsigned char *data, mmd_weight *weight)
+{
+   data += MMD_VERTEX_WEIGHT_OFFSET;
+
+   /* 2xuint16_t: bone indices */
+   weight->bone_index[0] = mmd_u16(data);
+   weight->bone_index[1] = mmd_u16(data + sizeof(uint16_t));
+   data += sizeof(uint16_t) * 2;
+
+   /* uint8_t: vertex weight */
+   weight->weight = data[0];
+
+   /* uint8_t: edge flag */
+   weight->edge_flag = data[1];
+}
+
+/* \brief decode whole vertex record */
+static inline void mmd_decode_vertex(const unsigned char *data, float *vertex, float *normal, float *coord, mmd_weight *weight)
+{
+   /* 3xFLOAT: vertex */
+   mmd_f32v(vertex, data, 3);
+
+   /* 3xFLOAT: normal */
+   mmd_f32v(normal, data + sizeof(uint32_t) * 3, 3);
+
+   /* 2xFLOAT: texture coordinate */
+   mmd_f32v(coord, data + sizeof(uint32_t) * 6, 2);
+
+   mmd_decode_weight(data, weight);
+}
+
+/* \brief portable decoder */
+static void mmd_decode_vertices_scalar(const unsigned char *data, size_t count, float *vertices, float *normals, float *coords, mmd_weight *weights)
+{
+   size_t i;
+
+   for (i = 0; i < count; ++i, data += MMD_VERTEX_SIZE)
+      mmd_decode_vertex(data, &vertices[i*3], &normals[i*3], &coords[i*2], &weights[i]);
+}
+
+#if defined(MMD_HAS_SSE2)
+/* \brief SSE2 decoder
+ * 3 float attributes are written with 4 float stores,
+ * the extra lane is overwritten by the next vertex */
+static void mmd_decode_vertices_sse2(const unsigned char *data, size_t count, float *vertices, float *normals, float *coords, mmd_weight *weights)
+{
+   size_t i;
+   __m128 a, b, n;
+
+   for (i = 0; i + 1 < count; ++i, data += MMD_VERTEX_SIZE) {
+      /* px py pz nx | ny nz u v */
+      a = _mm_loadu_ps((const float*)data);
+      b = _mm_loadu_ps((const float*)(data + 16));
+
+      /* nx nx ny nz -> nx ny nz nz */
+      n = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 3, 3));
+      n = _mm_shuffle_ps(n, n, _MM_SHUFFLE(3, 3, 2, 1));
+
+      _mm_storeu_ps(&vertices[i*3], a);
+      _mm_storeu_ps(&normals[i*3], n);
+      _mm_storeh_pi((__m64*)&coords[i*2], b);
+      mmd_decode_weight(data, &weights[i]);
+   }
+
+   mmd_decode_vertices_scalar(data, count - i, &vertices[i*3], &normals[i*3], &coords[i*2], &weights[i]);
+}
+#endif
+
+#if defined(MMD_HAS_AVX2)
+/* \brief AVX2 decoder, two vertices per iteration
+ * 6 float attributes are written with 8 float stores,
+ * the extra lanes are overwritten by the next pair */
+MMD_TARGET_AVX2 static void mmd_decode_vertices_avx2(const unsigned char *data, size_t count, float *vertices, float *normals, float *coords, mmd_weight *weights)
+{
+   size_t i;
+   __m256 a, b, v, n, c;
+   const __m256i pos_b = _mm256_setr_epi32(0, 0, 0, 0, 1, 2, 0, 0);
+   const __m256i nrm_a = _mm256_setr_epi32(3, 4, 5, 0, 0, 0, 0, 0);
+   const __m256i nrm_b = _mm256_setr_epi32(0, 0, 0, 3, 4, 5, 0, 0);
+   const __m256i crd_a = _mm256_setr_epi32(6, 7, 0, 0, 0, 0, 0, 0);
+   const __m256i crd_b = _mm256_setr_epi32(0, 0, 6, 7, 0, 0, 0, 0);
+
+   for (i = 0; i + 2 < count; i += 2, data += MMD_VERTEX_SIZE * 2) {
+      /* px py pz nx ny nz u v, for both vertices */
+      a = _mm256_loadu_ps((const float*)data);
+      b = _mm256_loadu_ps((const float*)(data + MMD_VERTEX_SIZE));
+
+      v = _mm256_blend_ps(a, _mm256_permutevar8x32_ps(b, pos_b), 0x38);
+      n = _mm256_blend_ps(_mm256_permutevar8x32_ps(a, nrm_a), _mm256_permutevar8x32_ps(b, nrm_b), 0x38);
+      c = _mm256_blend_ps(_mm256_permutevar8x32_ps(a, crd_a), _mm256_permutevar8x32_ps(b, crd_b), 0x0c);
+
+      _mm256_storeu_ps(&vertices[i*3], v);
+      _mm256_storeu_ps(&normals[i*3], n);
+      _mm_storeu_ps(&coords[i*2], _mm256_castps256_ps128(c));
+      mmd_decode_weight(data, &weights[i]);
+      mmd_decode_weight(data + MMD_VERTEX_SIZE, &weights[i + 1]);
+   }
+
+   mmd_decode_vertices_scalar(data, count - i, &vertices[i*3], &normals[i*3], &coords[i*2], &weights[i]);
+}
+#endif
+
+#if defined(MMD_HAS_NEON)
+/* \brief NEON decoder
+ * 3 float attributes are written with 4 float stores,
+ * the extra lane is overwritten by the next vertex */
+static void mmd_decode_vertices_neon(const unsigned char *data, size_t count, float *vertices, float *normals, float *coords, mmd_weight *weights)
+{
+   size_t i;
+   float32x4_t a, b;
+
+   for (i = 0; i + 1 < count; ++i, data += MMD_VERTEX_SIZE) {
+      /* px py pz nx | ny nz u v */
+      a = vreinterpretq_f32_u8(vld1q_u8(data));
+      b = vreinterpretq_f32_u8(vld1q_u8(data + 16));
+
+      vst1q_f32(&vertices[i*3], a);
+      vst1q_f32(&normals[i*3], vextq_f32(a, b, 3));
+      vst1_f32(&coords[i*2], vget_high_f32(b));
+      mmd_decode_weight(data, &weights[i]);
+   }
+
+   mmd_decode_vertices_scalar(data, count - i, &vertices[i*3], &normals[i*3], &coords[i*2], &weights[i]);
+}
+#endif
+
+/* \brief can the SIMD kernels load the floats as they are? */
+static int mmd_vertex_simd_supported(void)
+{
+   return mmd_is_little_endian();
+}
+
+#if defined(MMD_HAS_AVX2)
+/* \brief can we run the AVX2 kernel? */
+static int mmd_vertex_avx2_supported(void)
+{
+   return mmd_is_little_endian() && mmd_cpu_has_avx2();
+}
+#endif
+
+/* \brief scalar kernel runs everywhere */
+static int mmd_vertex_scalar_supported(void)
+{
+   return 1;
+}
+
+/* \brief kernels compiled in, best first */
+const mmd_vertex_kernel* mmd_vertex_kernels(void)
+{
+   static const mmd_vertex_kernel kernels[] = {
+#if defined(MMD_HAS_AVX2)
+      { "avx2", mmd_decode_vertices_avx2, mmd_vertex_avx2_supported },
+#endif
+#if defined(MMD_HAS_SSE2)
+      { "sse2", mmd_decode_vertices_sse2, mmd_vertex_simd_supported },
+#endif
+#if defined(MMD_HAS_NEON)
+      { "neon", mmd_decode_vertices_neon, mmd_vertex_simd_supported },
+#endif
+      { "scalar", mmd_decode_vertices_scalar, mmd_vertex_scalar_supported },
+      { NULL, NULL, NULL }
+   };
+
+   (void)mmd_vertex_simd_supported;
+   return kernels;
+}
+
+/* \brief decode packed vertex records with best kernel */
+void mmd_decode_vertices(const unsigned char *data, size_t count, float *vertices, float *normals, float *coords, mmd_weight *weights)
+{
+   static mmd_vertex_decode_fn best;
+   mmd_vertex_decode_fn decode;
+   assert((data && vertices && normals && coords && weights) || !count);
+
+   if (!(decode = MMD_ATOMIC_LOAD(best))) {
+      const mmd_vertex_kernel *kernel;
+      for (kernel = mmd_vertex_kernels(); !kernel->supported(); ++kernel);
+      MMD_ATOMIC_STORE(best, (decode = kernel->decode));
+   }
+
+   decode(data, count, vertices, normals, coords, weights);
+}
+
+/* \brief decode packed vertex records and grow bounds by them */
+void mmd_decode_vertices_bounded(const unsigned char *data, size_t count, float *vertices, float *normals, float *coords, mmd_weight *weights, mmd_bounds *bounds)
+{
+   size_t i, n;
+   assert(bounds);
+
+   for (i = 0; i < count; i += n) {
+      n = (count - i < MMD_VERTEX_BOUNDS_CHUNK ? count - i : MMD_VERTEX_BOUNDS_CHUNK);
+      mmd_decode_vertices(data + i * MMD_VERTEX_SIZE, n, &vertices[i*3], &normals[i*3], &coords[i*2], &weights[i]);
+      mmd_bounds_add(bounds, &vertices[i*3], n);
+   }
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/